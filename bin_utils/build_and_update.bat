@@ -29,6 +29,10 @@ pushd ..\utils\fltheader\
 call build_vs2012.bat
 popd
 
+pushd ..\utils\fltidx\
+call build_vs2012.bat
+popd
+
 echo == Building latest binaries ==
 msbuild /t:Rebuild /p:Configuration=Release;Platform=Win32 ..\utils\flt2dds\build\flt2dds.sln
 msbuild /t:Rebuild /p:Configuration=Release;Platform=x64 ..\utils\flt2dds\build\flt2dds.sln
@@ -48,6 +52,9 @@ msbuild /t:Rebuild /p:Configuration=Release;Platform=x64 ..\utils\fltfind\buildv
 msbuild /t:Rebuild /p:Configuration=Release;Platform=Win32 ..\utils\fltheader\buildvs2012\fltheader.sln
 msbuild /t:Rebuild /p:Configuration=Release;Platform=x64 ..\utils\fltheader\buildvs2012\fltheader.sln
 
+msbuild /t:Rebuild /p:Configuration=Release;Platform=Win32 ..\utils\fltidx\buildvs2012\fltidx.sln
+msbuild /t:Rebuild /p:Configuration=Release;Platform=x64 ..\utils\fltidx\buildvs2012\fltidx.sln
+
 
 echo == Copying binaries ==
 xcopy ..\utils\flt2dds\build\bin\x32\release\*.exe x86\ /Y
@@ -68,6 +75,9 @@ xcopy ..\utils\fltfind\buildvs2012\bin\x64\release\*.exe x64\ /Y
 xcopy ..\utils\fltheader\buildvs2012\bin\x32\release\*.exe x86\ /Y
 xcopy ..\utils\fltheader\buildvs2012\bin\x64\release\*.exe x64\ /Y 
 
+xcopy ..\utils\fltidx\buildvs2012\bin\x32\release\*.exe x86\ /Y
+xcopy ..\utils\fltidx\buildvs2012\bin\x64\release\*.exe x64\ /Y
+
 xcopy ..\utils\fltview\buildvs2012\bin\x32\release\*.exe x86\ /Y
 xcopy ..\utils\fltview\buildvs2012\bin\x64\release\*.exe x64\ /Y
 
@@ -78,5 +88,6 @@ rmdir /S /Q ..\utils\flt2xml\buildvs2012
 rmdir /S /Q ..\utils\fltextent\buildvs2012
 rmdir /S /Q ..\utils\fltfind\buildvs2012
 rmdir /S /Q ..\utils\fltheader\buildvs2012
+rmdir /S /Q ..\utils\fltidx\buildvs2012
 
 echo.
\ No newline at end of file
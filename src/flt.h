@@ -33,10 +33,16 @@ DOCUMENTATION
 (Multithread)
 - For multithread purposes, a flt_context object is created and passed down during parsing
 - So you might call the public functions from different threads without problems.
-- You might use a callback for external references and then throw a thread task from there
-  with a created new flt* object reusing the flt_context.dict object. 
-- The flt_context.dict object can be shared among threads, it's contained with a critical section, and
-  used to avoid reading same flt ref file twice.
+- FLT_OPT_HIE_EXTREF_RESOLVE with flt_opts.xref_threads>1 loads the whole xref graph in parallel: the calling 
+  thread and xref_threads-1 more load the files, every xref file loaded once. Set flt_opts.cb_exec instead to run
+  the loads in your own thread pool (cb_exec must queue the task and return, task runs later in any thread).
+  The load function returns when the whole graph is resolved.
+- Or you might use a callback for external references and then throw a thread task from there
+  with the pathname returned by flt_extref_prepare (only the thread claiming the xref gets it, the rest reference
+  the same flt). Use flt_wait or flt_then on extref->of when you need its contents before it's loaded.
+- The flt_context.dict object can be shared among threads, and used to avoid reading same flt ref file twice.
+  It's a concurrent dict: lookups don't lock and inserts lock one of FLT_DICT_STRIPES critical sections
+  (the one of the hash entry), so threads resolving different xrefs don't wait for each other.
 
 (Defines)
 - Define flt_malloc/flt_calloc/flt_free/flt_realloc for custom memory management functions
@@ -45,22 +51,104 @@ DOCUMENTATION
 - Define the supported version in FLT_VERSION. Maximum supported version is FLT_GREATER_SUPPORTED_VERSION
 - Define FLT_NO_MEMOUT_CHECK to skip out-of-mem error
 - Define FLT_HASHTABLE_SIZE for a different default hash table size. (http://planetmath.org/goodhashtableprimes)
+- Define FLT_DICT_STRIPES for a different no of critical sections of the shared dict of flt file names
 - Define FLT_STACKARRAY_SIZE for a different default stack array size (when passing flt_opts.stacksize=0)
 - Define FLT_COMPACT_FACES for a smaller footprint version of face record with most important data. see flt_face.
-- Define FLT_DICTFACES_SIZE for a different default hash table size for faces when passing flt_opts.dfaces_size=0.
-- Define FLT_UNIQUE_FACE for an optimized way to store faces (develop more doc about this)
+- Define FLT_DICTFACES_SIZE for a different default initial capacity of the table of unique faces when passing flt_opts.dfaces_size=0.
+- Define FLT_UNIQUE_FACES to store every distinct face once (flt.faces, a hash table that grows as needed) and the
+          triangles as (face id, vertex offset) pairs in flt.indices
 - Define FLT_ALIGNED to use aligned version of malloc/free (when not implementing custom flt_malloc/...)
 - Define FLT_INDICES_SIZE for a default initial capacity of the global indices array (when using FLT_UNIQUE_FACES only)
           and flt_opts.indices_size=0.
+- Define FLT_BLOCK_SIZE for a different default size of the blocks read from file (when flt_opts.block_size=0)
+- Define FLT_ARENA_CHUNK_SIZE for a different size of the arena chunks (FLT_OPT_LOAD_ARENA)
 - Define FLT_TEXTURE_ATTRIBS_IN_NODE to keep width/height/depth attributes in each flt_text_pal node
+- Define FLT_CACHE_EXT for a different extension of the cache files of FLT_OPT_LOAD_CACHE (".fltc" appended)
+- Define FLT_RECIDX_EXT for a different extension of the sidecar record index files (".fltx" appended)
+- Define FLT_NO_SIMD to convert the vertex palette with portable code instead of the SSE2 kernels (x86/x64)
+
+(Input)
+- flt_load_from_filename reads the file in large blocks (flt_opts.block_size, FLT_BLOCK_SIZE) and records are
+  sliced out of them, skipping records is a pointer bump. FLT_OPT_LOAD_READAHEAD reads the next block in a
+  background thread while the current one is parsed (one extra thread per load, think of it with thread pools).
+- Set FLT_OPT_LOAD_MMAP in flt_opts.lflags to map the file instead, the record loop then walks the mapped view
+  and the readers decode fields in place.
+- flt_load_from_memory parses a file already in memory the same way (no copies of the records).
+- flt_parse_from_filename/flt_parse_from_memory stream the records to a callback instead (SAX like): nothing is
+  built, the callback gets each record (flt_record: opcode, depth, file offset and its big endian data, read it
+  with flt_record_u16/u32/flo/dbl/str) and returns FLT_SAX_CONTINUE, FLT_SAX_SKIP (children of the record) or 
+  FLT_SAX_STOP. Records are in place in the window, memory doesn't grow with the file.
+- flt_save_cache writes a loaded flt into a binary cache (offsets instead of pointers) flt_load_cache maps back
+  without parsing. Vertex palette, indices and unique faces are used in place from the mapped view (read-only),
+  nodes and texture entries are rebuilt in the arena pointing to their names and arrays in the view.
+  A cache is valid for the same source (size, mtime and a hash of the whole file, only read when both match), pflags/hflags
+  and build (byte order, FLT_UNIQUE_FACES...). Set FLT_OPT_LOAD_CACHE to do it transparently on every file loaded.
+- flt_recidx_build writes a sidecar index of a file (file+FLT_RECIDX_EXT, see utils/fltidx) in one streaming pass:
+  offset, length, depth, parent, name and end of the subtree of every node (not faces/meshes) and the records 
+  before the hierarchy (header and palettes). flt_load_subtree seeks with it to read the header and palettes only
+  and, if given, the subtree of a node by name (a child of the root then). The index is built when not valid.
+
+(Memory)
+- Set FLT_OPT_LOAD_ARENA in flt_opts.lflags to allocate nodes, names, texture palette entries, unique faces and 
+  indices of the flt from an arena of large chunks. flt_release then frees the chunks instead of walking the
+  hierarchy node by node. Nodes of such a hierarchy can't be freed or renamed one by one with flt_free.
 
 (Additional info)
 - Calls to load functions are thread safe
 - For the vertex palette (FLT_OPT_PAL_VERTEX) the whole vertex palete is stored directly into the buffer in memory
+- With vertex components in pflags (FLT_OPT_PAL_VTX_*) the whole palette is converted in one pass when read, 
+  vtx_array keeps all its vertices in file order and the indices (FLT_UNIQUE_FACES) are vertex numbers in it.
+  With FLT_OPT_PAL_VTX_WELD a vertex equal to one already converted (positions within flt_opts.weld_pos, normal 
+  and uv components within weld_normal/weld_uv, same color) isn't added again, its references use the first one. 
+  Positions are hashed in cells of weld_pos, so tolerances are meant to be small (welding, not simplification).
+- Mesh nodes (FLT_OPT_HIE_MESH) get their local vertex pool in mesh->vb (same vertex layout as vtx_array) and 
+  their primitives (strips, fans, quad strips, polygons) as index ranges of mesh->indices, not triangulated.
+- With FLT_UNIQUE_FACES, FLT_OPT_LOAD_BATCHES (or flt_batches_build after loading) groups the triangles by the face 
+  state to bind (textures, material, shader, draw type) in of->batches: one 16/32 bits index buffer with a range per 
+  state, so there's a draw call per state instead of per node. Mesh primitives are not in it.
+  flt_batches_optimize reorders them for the vertex cache and vtx_array for fetching (bake time, reports ACMR).
+- With FLT_UNIQUE_FACES, flt_bvh_build makes of->bvh from a loaded flt (no reading again) over the triangles in the 
+  ndx_pairs of a node and its children: binned SAH, the subtrees split by several threads, 32 bytes nodes and the 
+  triangle corners copied as floats relative to the center (precision kept in large coordinates). flt_bvh_raycast 
+  takes a batch of rays (line of sight, sensors) and gives the closest (or any) hit with distance, triangle, face 
+  id and its smc_id/feat_id. External references are not in it, every flt builds its own.
+- With FLT_UNIQUE_FACES, flt_terrain_build makes of->terrain, a 2.5D grid: the triangles (optionally only the ones 
+  of faces with FLT_FACE_TERRAIN) bucketed in xy cells, with their plane and barycentric setup precomputed. 
+  flt_query_height gives the height and normal at a batch of xy points, a few triangles tested per point. It's read 
+  only, threads can query at the same time (a batch each).
+- With FLT_UNIQUE_FACES, FLT_OPT_LOAD_INDEX_STREAMS keeps the triangles in of->tris instead of of->indices: the 
+  vertex no of every corner in a 16 bits stream (32 bits once any is over 0xffff) and the face id once per triangle, 
+  10 or 16 bytes per triangle instead of 24. ndx_pairs are positions in the same way, flt_index_vertex/flt_index_face
+  read either layout.
+- FLT_OPT_LOAD_BOUNDS gives every node with geometry below it an AABB and a bounding sphere (node->bounds, null 
+  otherwise), grown while the vertex lists and mesh pools are read and merged into the parent when the node is 
+  complete (next sibling or pop), so there's no pass over vtx_array after loading. Needs FLT_OPT_PAL_VTX_POSITION. 
+  The root has the bounds of the file, external references are not included (their root has theirs).
+- FLT_OPT_HIE_LOD_RANGE/FINEST/COARSEST keep only some LOD nodes: the ones whose switch out..in distances overlap 
+  flt_opts.lod_range, and/or the finest/coarsest of every set of sibling LODs. A LOD not kept is not allocated and its 
+  ancillary records and children are skipped following their push/pop levels (no nodes, indices nor bounds for 
+  them). Finest/coarsest look ahead over the siblings, the file is mapped for it (all kept if it can't be). The 
+  vertex palette comes before the hierarchy, so it's converted whole.
+- FLT_OPT_LOAD_NAMES interns the node names, long ids and face names of a flt in of->names: an open addressing 
+  table of every distinct name, its bytes packed in chunks, so the many nodes named "g1", "o1"... share one string, 
+  names are compared by pointer (flt_name_find) and all are freed at once. Strings of a cache are interned in place.
+  Every flt has its own (xrefs load in other threads).
+- flt_flat_build copies the hierarchy of a loaded flt to of->flat: the nodes in preorder as parallel arrays (size of 
+  the subtree, parent, type, name) addressed by 32 bits indices, so children and siblings are implicit and a 
+  subtree walk is a linear scan, and a hash of the names for flt_flat_find instead of a search of the tree. The 
+  nodes themselves are copied to one contiguous array per type (lods, switches, meshes...) in the same order. With 
+  FLT_UNIQUE_FACES the ndx_pairs are copied in the same order, the triangles of a subtree are one range of pairs.
+- flt_load_async loads a file in its own thread: the record loop publishes the bytes read (flt_async_progress) and 
+  checks flt_async_cancel every FLT_ASYNC_RECORDS records, a canceled load ends released with FLT_ERR_CANCELED. The 
+  completion is the one of the extrefs (flt_wait/flt_then on of), and flt_async_join ends the thread.
+- FLT_OPT_LOAD_STATS fills of->stats while loading: records, bytes and reader time per opcode, faces, unique faces, 
+  indices, vertices, allocations (flt_of_*) and wall time. Every flt is loaded by one thread, so counters are plain 
+  adds in its own struct (no contention). flt_stats_total sums the stats of a file and its external references.
+- Records longer than 64K continued with continuation records (vertex lists, local vertex pools, mesh 
+  primitives, switch masks) are read as one record. flt_parse_* report the continuation records as they are.
 
 (Important ToDo)
-- Parsing into callbacks, no memory allocated. Parsing from memory or specific reader.
-- Add memory pools for nodes, perhaps the client code can save stats after a first read and use that data for next reads.
+- Arena chunk size from stats of a first read, so next reads do one allocation.
 - Callbacks for nodes before to get added to graph.
 - 
 */
@@ -83,6 +171,9 @@ DOCUMENTATION
 #define FLT_ERR_MEMOUT 4
 #define FLT_ERR_READBEYOND_REC 5
 #define FLT_ERR_ALREADY 6
+#define FLT_ERR_CACHE 7
+#define FLT_ERR_RECIDX 8
+#define FLT_ERR_CANCELED 9
 
 // Versioning
 #define FLT_GREATER_SUPPORTED_VERSION 1640
@@ -120,6 +211,7 @@ DOCUMENTATION
 #define FLT_OPT_PAL_VTX_UV        (1<<18)
 #define FLT_OPT_PAL_VTX_COLOR     (1<<19)
 #define FLT_OPT_PAL_VTX_POSITION_SINGLE (1<<20)
+#define FLT_OPT_PAL_VTX_WELD      (1<<21) // duplicated palette vertices converted once (flt_opts.weld_*)
 #define FLT_OPT_PAL_VTX_MASK      (FLT_OPT_PAL_VTX_POSITION|FLT_OPT_PAL_VTX_NORMAL|FLT_OPT_PAL_VTX_UV|FLT_OPT_PAL_VTX_COLOR)
 
 //hierarchy/node flags (filter parsing of nodes and type of hierarchy)
@@ -149,10 +241,44 @@ DOCUMENTATION
 #define FLT_OPT_HIE_EXTREF_RESOLVE  (1<<21) // xrefs aren't resolved by default, set this bit to make it
 #define FLT_OPT_HIE_COMMENTS        (1<<22) // include comments 
 #define FLT_OPT_HIE_GO_THROUGH      (1<<23)
+#define FLT_OPT_HIE_LOD_RANGE       (1<<24) // only LODs visible in flt_opts.lod_range, the others skipped with their children
+#define FLT_OPT_HIE_LOD_FINEST      (1<<25) // only the LOD with the smallest switch out of every set of sibling LODs
+#define FLT_OPT_HIE_LOD_COARSEST    (1<<26) // only the LOD with the largest switch in of every set of sibling LODs
+#define FLT_OPT_HIE_LOD_SELECT      (FLT_OPT_HIE_LOD_RANGE|FLT_OPT_HIE_LOD_FINEST|FLT_OPT_HIE_LOD_COARSEST)
 
 #define FLT_OPT_HIE_RESERVED1       (1<<30) // not used
 #define FLT_OPT_HIE_RESERVED2       (1<<31)
 
+//load flags (how the input is read)
+#define FLT_OPT_LOAD_MMAP           (1<<0) // maps the file in memory and parses records in place (falls back to file reading)
+#define FLT_OPT_LOAD_READAHEAD      (1<<1) // reads next file block in a background thread while parsing the current one
+#define FLT_OPT_LOAD_ARENA          (1<<2) // nodes, names and palette entries allocated in large chunks owned by the flt
+#define FLT_OPT_LOAD_CACHE          (1<<3) // flt_load_from_filename uses file+FLT_CACHE_EXT if valid, otherwise parses and writes it
+#define FLT_OPT_LOAD_BATCHES        (1<<4) // builds of->batches when loaded, triangles grouped by face state (FLT_UNIQUE_FACES)
+#define FLT_OPT_LOAD_INDEX_STREAMS  (1<<5) // triangles in of->tris (16/32 bits vertex stream, face id per triangle) instead of of->indices
+#define FLT_OPT_LOAD_STATS          (1<<6) // fills of->stats (counters and timing of the load, see flt_stats_total)
+#define FLT_OPT_LOAD_BOUNDS         (1<<7) // node->bounds while loading (needs FLT_OPT_PAL_VTX_POSITION)
+#define FLT_OPT_LOAD_NAMES          (1<<8) // names interned in of->names, every distinct name stored once
+
+#define FLT_BVH_NO_HIT 0xffffffff   // flt_hit.tri of a ray not hitting
+
+// flt_face.flags
+#define FLT_FACE_TERRAIN            (1<<15)
+#define FLT_FACE_NO_COLOR           (1<<14)
+#define FLT_FACE_NO_ALT_COLOR       (1<<13)
+#define FLT_FACE_PACKED_COLOR       (1<<12)
+#define FLT_FACE_TERRAIN_CUTOUT     (1<<11)
+#define FLT_FACE_HIDDEN             (1<<10)
+#define FLT_FACE_ROOFLINE           (1<<9)
+
+// return values of the record callback (flt_parse_from_*)
+#define FLT_SAX_CONTINUE 0 // next record
+#define FLT_SAX_SKIP     1 // skips the children of the record (push..pop level following it), or the rest of a level on a push
+#define FLT_SAX_STOP     2 // stops parsing (FLT_OK returned)
+
+#define FLT_RECIDX_NONE 0xffffffff // no entry (flt_recidx_entry.parent, flt_recidx_find) or no name
+#define FLT_FLAT_NONE 0xffffffff   // no node (flt_flat_find, flt_flat.parent of the root, end of flt_flat.name_next)
+
 //////////////////////////////////////////////////////////////////////////
 #define FLT_NOTLOADED 0
 #define FLT_LOADING 1
@@ -203,6 +329,20 @@ DOCUMENTATION
 #define FLT_NODE_SWITCH 9 // FLT_OP_SWITCH
 #define FLT_NODE_MAX    10
 
+// Mesh primitive types (flt_mesh_prim.type)
+#define FLT_MESH_PRIM_TRI_STRIP   1
+#define FLT_MESH_PRIM_TRI_FAN     2
+#define FLT_MESH_PRIM_QUAD_STRIP  3
+#define FLT_MESH_PRIM_POLYGON     4 // indexed polygon
+
+// Attribute mask of a local vertex pool (flt_mesh_vb.semantic)
+#define FLT_VTXPOOL_POSITION      (1u<<31)
+#define FLT_VTXPOOL_COLOR_INDEX   (1u<<30)
+#define FLT_VTXPOOL_COLOR_RGBA    (1u<<29)
+#define FLT_VTXPOOL_NORMAL        (1u<<28)
+#define FLT_VTXPOOL_UV0           (1u<<27)
+#define FLT_VTXPOOL_UV1           (1u<<26) // ...up to UV7 (1<<20)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -230,16 +370,108 @@ extern "C" {
   typedef struct flt_node_face;
   typedef struct flt_face;
   typedef struct flt_array;
+  typedef struct flt_arena;
+  typedef struct flt_names;
+  typedef struct flt_flat;
+  typedef struct flt_async;
+  typedef struct flt_record;
+  typedef struct flt_batches;
+  typedef struct flt_tris;
+  typedef struct flt_recidx;
+  typedef struct flt_stats;
+  typedef struct flt_bounds;
+  typedef struct flt_bvh;
+  typedef struct flt_ray;
+  typedef struct flt_hit;
+  typedef struct flt_terrain;
   typedef int (*flt_callback_texture)(struct flt_pal_tex* texpal, struct flt* of, void* user_data);
   typedef int (*flt_callback_extref)(struct flt_node_extref* extref, struct flt* of, void* user_data);
+  typedef void (*flt_task_func)(void* task);
+  typedef void (*flt_callback_exec)(flt_task_func func, void* task, void* user_data);
+  typedef void (*flt_callback_loaded)(struct flt* of, void* user_data);
+  typedef int (*flt_callback_record)(const struct flt_record* rec, void* user_data);
   
     // Load openflight information into of with given options
   int flt_load_from_filename(const char* filename, struct flt* of, struct flt_opts* opts);
 
-    // If the extref is already loaded, references it (inc ref count) and returns NULL. 
-    // Otherwise, extref not loaded yet, creates a new flt for it and returns the pathname for the extref.
+    // Load openflight information from a memory buffer holding the whole file. The buffer is only read during the call.
+    // Set of->filename (flt_strdup) before calling to resolve external references relative to it.
+  int flt_load_from_memory(const void* data, fltu64 size, struct flt* of, struct flt_opts* opts);
+
+    // Streams the records of the file to cb, without building anything (see FLT_SAX_*). Only lflags (MMAP/READAHEAD), 
+    // block_size and search_paths of opts are used, opts can be null. Returns FLT_OK when all read or stopped.
+  int flt_parse_from_filename(const char* filename, struct flt_opts* opts, flt_callback_record cb, void* user_data);
+
+    // Same streaming the records of a whole file in memory
+  int flt_parse_from_memory(const void* data, fltu64 size, flt_callback_record cb, void* user_data);
+
+    // Field of a record passed to flt_callback_record, byte swapped. offs is from the start of rec->data (after the 
+    // opcode and length). 0 if the field is beyond the record
+  fltu16 flt_record_u16(const struct flt_record* rec, fltu32 offs);
+  fltu32 flt_record_u32(const struct flt_record* rec, fltu32 offs);
+  float  flt_record_flo(const struct flt_record* rec, fltu32 offs);
+  double flt_record_dbl(const struct flt_record* rec, fltu32 offs);
+
+    // Copies a string field of at most maxlen chars into dst (zero terminated, at most dstsize-1 chars). Returns its length
+  fltu32 flt_record_str(const struct flt_record* rec, fltu32 offs, fltu32 maxlen, char* dst, fltu32 dstsize);
+
+    // Writes the loaded flt into a cache file flt_load_cache maps back without parsing. srcfile (of->filename if null)
+    // is the source file the cache is validated against.
+  int flt_save_cache(struct flt* of, const char* cachefile, const char* srcfile);
+
+    // Loads of from a cache file written by flt_save_cache. FLT_ERR_CACHE if it's not valid for srcfile (not checked
+    // if null) and opts. Arrays are used in place from the mapped file and must not be modified.
+  int flt_load_cache(const char* cachefile, const char* srcfile, struct flt* of, struct flt_opts* opts);
+
+    // Builds the sidecar record index of a file in one streaming pass (see flt_recidx) and writes it to indexfile 
+    // (filename+FLT_RECIDX_EXT if null). Only lflags, block_size and search_paths of opts are used, opts can be null.
+  int flt_recidx_build(const char* filename, const char* indexfile, struct flt_opts* opts);
+
+    // Reads a sidecar record index (flt_recidx_free it). FLT_ERR_RECIDX if not valid for srcfile (not checked if null)
+  int flt_recidx_load(const char* indexfile, const char* srcfile, struct flt_recidx** idx);
+  void flt_recidx_free(struct flt_recidx** idx);
+
+    // First entry of a node with the given name, FLT_RECIDX_NONE if there's none
+  fltu32 flt_recidx_find(const struct flt_recidx* idx, const char* name);
+
+    // Loads the header and palettes of a file and, if nodename isn't null, the subtree of the first node with that name 
+    // (as a child of the root), seeking to them with the sidecar index of the file (built and written if not valid).
+    // FLT_ERR_RECIDX if the node isn't there. The cache (FLT_OPT_LOAD_CACHE) isn't used.
+  int flt_load_subtree(const char* filename, const char* nodename, struct flt* of, struct flt_opts* opts);
+
+    // If the extref is already loaded (or being loaded by another thread), references it (inc ref count) and returns NULL. 
+    // Otherwise, extref not loaded yet, creates a new flt for it and returns the pathname for the extref (flt_free it).
+    // Only one thread gets the pathname of an extref, the one which has to load it.
   char* flt_extref_prepare(struct flt_node_extref* extref, struct flt* of);
 
+    // Waits until the file of a flt returned by flt_extref_prepare is loaded (FLT_LOADED or error). Returns its errcode.
+    // Its own extrefs might be still loading with parallel resolve, wait on them the same way.
+  int flt_wait(struct flt* of);
+
+    // Calls cb when the file of a flt returned by flt_extref_prepare is loaded (in the loading thread, before 
+    // flt_wait returns), or now if it's loaded already. cb must not release of. Returns FLT_FALSE if out of memory.
+  int flt_then(struct flt* of, flt_callback_loaded cb, void* user_data);
+
+    // Loads a file as flt_load_from_filename in a new thread and returns its handle (null if out of memory). of, 
+    // opts and callbacks in opts must be valid until flt_async_join. flt_wait/flt_then on of tell when it's loaded.
+  struct flt_async* flt_load_async(const char* filename, struct flt* of, struct flt_opts* opts);
+
+    // Fraction [0,1] of the bytes of the file read so far, 1 only when the load finished
+  float flt_async_progress(const struct flt_async* job);
+
+    // Asks the load to stop. The record loop checks it every FLT_ASYNC_RECORDS records, and then of finishes released 
+    // with FLT_ERR_CANCELED. The external references already being loaded when resolving them are finished anyway
+  void flt_async_cancel(struct flt_async* job);
+
+    // Waits for the load thread and releases the handle (not of). Returns of->errcode
+  int flt_async_join(struct flt_async** job);
+
+    // Adds the stats (FLT_OPT_LOAD_STATS) of a file and all its loaded external references (once each) to total
+  void flt_stats_total(const struct flt* of, struct flt_stats* total);
+
+    // Adds the stats of src to dst
+  void flt_stats_merge(struct flt_stats* dst, const struct flt_stats* src);
+
     // Deallocates all memory
   void flt_release(struct flt* of);
 
@@ -250,8 +482,55 @@ extern "C" {
 
   flt_node* flt_node_find_by_name(flt_node* node_parent, const char* node_name );
 
+    // Interned name of a flt loaded with FLT_OPT_LOAD_NAMES, null if none has it. Node and face names are the 
+    // same pointers, so they're compared by pointer against it.
+  const char* flt_name_find(const struct flt* of, const char* name);
+
+    // Builds of->flat from the loaded hierarchy: its nodes in preorder as parallel arrays and a hash of their names
+    // (see flt_flat). It's a copy, built again after changing the nodes. Returns FLT_OK or FLT_ERR_MEMOUT
+  int flt_flat_build(struct flt* of);
+
+    // First node of of->flat named name (the others with it follow name_next), FLT_FLAT_NONE if none
+  fltu32 flt_flat_find(const struct flt_flat* fl, const char* name);
+
   void flt_count_indices(flt_node* node_parent, fltu32* inds, int recursive);
 
+#ifdef FLT_UNIQUE_FACES
+    // No of indices of the triangles (3 per triangle), vertex no and face id of index i. Same for both layouts, 
+    // of->indices or of->tris (FLT_OPT_LOAD_INDEX_STREAMS). No bounds checked.
+  fltu32 flt_index_count(const struct flt* of);
+  fltu32 flt_index_vertex(const struct flt* of, fltu32 i);
+  fltu32 flt_index_face(const struct flt* of, fltu32 i);
+
+    // Groups the triangles of of->indices by face state into of->batches, one index buffer with a range per state 
+    // (built again if already there). Done when loading with FLT_OPT_LOAD_BATCHES. Returns FLT_OK or FLT_ERR_MEMOUT
+  int flt_batches_build(struct flt* of);
+
+    // Reorders the triangles of every batch for the post transform vertex cache (Forsyth) and then pal->vtx_array 
+    // in the order the batches use the vertices, renumbering of->batches and of->indices. For bake time, it's slow.
+    // acmr_before/acmr_after (optional) get the average cache misses per triangle with a FIFO cache of cache_size 
+    // entries (0 for FLT_VCACHE_SIZE, at most FLT_VCACHE_MAX). Returns FLT_OK or FLT_ERR_MEMOUT
+  int flt_batches_optimize(struct flt* of, fltu32 cache_size, float* acmr_before, float* acmr_after);
+
+    // Builds of->bvh over the triangles in ndx_pairs of node and its children (null for the root) from vtx_array,
+    // so FLT_OPT_PAL_VTX_POSITION is needed. The top levels are split in this thread and the subtrees by nthreads
+    // threads (0/1 all in this one). Built again if already there. Returns FLT_OK or FLT_ERR_MEMOUT
+  int flt_bvh_build(struct flt* of, struct flt_node* node, fltu16 nthreads);
+
+    // Casts count rays against of->bvh, hits[i] the closest hit of rays[i] or any hit if anyhit (line of sight, 
+    // stops at the first one found). Returns the no of rays hitting (0 if out of memory)
+  fltu32 flt_bvh_raycast(const struct flt* of, const struct flt_ray* rays, struct flt_hit* hits, fltu32 count, int anyhit);
+
+    // Builds of->terrain, a grid of xy cells of cell_size (0 picks one) with the triangles in ndx_pairs of node and 
+    // its children (null for the root), only the ones of faces with FLT_FACE_TERRAIN if terrain_only. Needs 
+    // FLT_OPT_PAL_VTX_POSITION. Built again if already there. Returns FLT_OK or FLT_ERR_MEMOUT
+  int flt_terrain_build(struct flt* of, struct flt_node* node, float cell_size, int terrain_only);
+
+    // Height of of->terrain at the n points xs[i],ys[i] in out_z (the highest triangle there, -DBL_MAX if none) and 
+    // its normal in out_normal (optional, 3 floats per point). Returns the no of points on the terrain
+  fltu32 flt_query_height(const struct flt* of, const double* xs, const double* ys, fltu32 n, double* out_z, float* out_normal);
+#endif
+
 #ifdef FLT_WRITER
   int flt_write_to_filename(struct flt* of);
 #endif
@@ -261,14 +540,21 @@ extern "C" {
   {
     fltu32 pflags;                          // palette flags        (FLT_OPT_PAL_*)
     fltu32 hflags;                          // hierarchy/node flags (FLT_OPT_HIE_*)
+    fltu32 lflags;                          // load flags           (FLT_OPT_LOAD_*)
     fltu16 stacksize;                         // optional stack size (no of elements). 0 to use FLT_STACKARRAY_SIZE    
-    fltu32 dfaces_size;                       // optional dict faces hash table size. 0 to use FLT_DICTFACES_SIZE
+    fltu32 dfaces_size;                       // optional initial capacity of unique faces table (grows). 0 to use FLT_DICTFACES_SIZE
     fltu32 indices_size;                      // optional array initial capacity for indices. 0 to use FLT_INDICES_SIZE
+    fltu32 block_size;                        // optional size of the blocks read from file. 0 to use FLT_BLOCK_SIZE
+    fltu16 xref_threads;                      // optional no of threads loading xrefs with FLT_OPT_HIE_EXTREF_RESOLVE. 0/1 sequential
+    float weld_pos;                           // optional tolerance of positions welding vertices (FLT_OPT_PAL_VTX_WELD). 0 exact
+    float weld_normal;                        // optional tolerance of normal components welding vertices. 0 exact
+    float weld_uv;                            // optional tolerance of uv components welding vertices. 0 exact
+    double lod_range[2];                      // optional distances [min,max] the LODs kept are visible in (FLT_OPT_HIE_LOD_RANGE)
 
     const char** search_paths;                // optional custom array of search paths ordered. last element should be null.
     flt_callback_extref   cb_extref;          // optional callback when an external ref is found
     flt_callback_texture  cb_texture;         // optional callback when a texture entry is found
-    fltatom32* countable;                        // optional to get back counters for opcodes
+    flt_callback_exec     cb_exec;            // optional executor of xref loads with FLT_OPT_HIE_EXTREF_RESOLVE (instead of xref_threads)
     void* cb_user_data;                       // optional data to pass to callbacks
   }flt_opts;
 
@@ -299,8 +585,20 @@ extern "C" {
     fltu32 loaded;                            // 0:not loaded 1:loading 2:loaded
     fltatom32 ref;
 #ifdef FLT_UNIQUE_FACES
-    flt_array* indices;
+    flt_array* indices;                       // (face id, vertex offset) for every vertex of triangles
+    struct flt_tris* tris;                    // same as separate streams instead of indices (FLT_OPT_LOAD_INDEX_STREAMS)
+    struct flt_facetable* faces;              // unique faces
+    struct flt_batches* batches;              // triangles by face state (FLT_OPT_LOAD_BATCHES, flt_batches_build)
+    struct flt_bvh* bvh;                      // triangles for ray casts (flt_bvh_build)
+    struct flt_terrain* terrain;              // triangles for height queries (flt_terrain_build)
 #endif
+    struct flt_arena* arena;                  // memory of nodes, names and palette entries (FLT_OPT_LOAD_ARENA)
+    struct flt_names* names;                  // interned node, long id and face names (FLT_OPT_LOAD_NAMES)
+    struct flt_flat* flat;                    // hierarchy as arrays indexed by node (flt_flat_build)
+    struct flt_future* future;                // completion of an extref load (see flt_wait/flt_then)
+    struct flt_async* async;                  // progress and cancel of flt_load_async (set null)
+    struct flt_cache* cache;                  // mapped cache file when loaded from it (see flt_load_cache)
+    struct flt_stats* stats;                  // counters and timing of the load (FLT_OPT_LOAD_STATS)
 
     int errcode;                              // error code (see flt_get_err_reason)
     struct flt_context* ctx;                  // internal parsing context data (set null)
@@ -312,6 +610,58 @@ extern "C" {
     fltu16 length; 
   }flt_op;
 
+  // record as seen by flt_callback_record. data is only valid during the callback
+  typedef struct flt_record
+  {
+    fltu16 op;                    // opcode (FLT_OP_*)
+    fltu16 length;                // record length, with the 4 bytes of opcode and length
+    fltu32 depth;                 // push level the record is in. push reported at the outer level, pop too (after it)
+    fltu64 offset;                // offset of the record in the file
+    const fltu8* data;            // record contents after opcode and length, big endian (see flt_record_u16...)
+    fltu32 size;                  // no of bytes in data (length-4, less if the file is truncated)
+  }flt_record;
+
+  // Counters and timing of a load (FLT_OPT_LOAD_STATS). Records of a cache load aren't counted
+  typedef struct flt_stats
+  {
+    fltu32 rec_count[FLT_OP_MAX];   // records read per opcode
+    fltu64 rec_bytes[FLT_OP_MAX];   // bytes of the records per opcode
+    double rec_time[FLT_OP_MAX];    // seconds reading (or skipping) the records per opcode
+    fltu32 faces;                   // face records
+    fltu32 unique_faces;            // faces in the table (FLT_UNIQUE_FACES) or face nodes
+    fltu64 indices;                 // vertex indices of vertex lists and mesh primitives
+    fltu64 vertices;                // vertices converted (vtx_array, after welding, and mesh pools)
+    fltu32 allocs;                  // allocations of nodes, names, palette entries... (arena ones too)
+    fltu64 alloc_bytes;
+    fltu32 lods_skipped;            // LOD nodes not loaded (FLT_OPT_HIE_LOD_*)
+    fltu64 skipped_bytes;           // bytes of their records and children, not read
+    double load_time;               // seconds from the start of the load to its end (xrefs resolution not included)
+    fltu32 files;                   // 1, more when merged
+  }flt_stats;
+
+  // Record of the sidecar index (flt_recidx_build)
+  typedef struct flt_recidx_entry
+  {
+    fltu64 offset;                // of the record in the file
+    fltu64 end;                   // end of the node: its ancillary records and children (its pop included)
+    fltu32 parent;                // entry of the closest parent indexed, FLT_RECIDX_NONE at the top
+    fltu32 name;                  // offset of the name in flt_recidx.names (long id if any), FLT_RECIDX_NONE if none
+    fltu16 op;
+    fltu16 length;                // of the record
+    fltu16 depth;                 // as flt_record.depth
+    fltu16 reserved;
+  }flt_recidx_entry;
+
+  // Sidecar index of the nodes of a file (not faces/meshes) and the records before the hierarchy (header, palettes)
+  typedef struct flt_recidx
+  {
+    flt_recidx_entry* entries;    // in file order
+    char* names;                  // zero terminated names one after the other
+    fltu64 hie;                   // offset of the first push of the hierarchy (end of the header and palettes)
+    fltu32 count;
+    fltu32 names_size;
+  }flt_recidx;
+
   typedef struct flt_pal_tex
   {
     char* name;
@@ -335,10 +685,20 @@ extern "C" {
     fltu64* ndx_pairs;
     fltu32 ndx_pairs_count;
 #endif
+    struct flt_bounds* bounds;    // of its geometry and children (FLT_OPT_LOAD_BOUNDS), null if none
     fltu16 type;                  // one of FLT_NODE_*
     fltu16 child_count;           // number of children
   }flt_node;
 
+  // Bounding volumes of a node (FLT_OPT_LOAD_BOUNDS)
+  typedef struct flt_bounds
+  {
+    double min[3];                // aabb
+    double max[3];
+    double center[3];             // sphere grown with every vertex (not minimal, close)
+    double radius;
+  }flt_bounds;
+
   typedef struct flt_face
   {
 #ifndef FLT_LEAN_FACES
@@ -355,7 +715,7 @@ extern "C" {
     fltu16 cnamealt_ndx;          // color secondary index
     fltu16 texmapp_ndx;           // texture mapping index
     fltu16 shader_ndx;            // shader index
-    fltu16 flags;                 // terrain/no color/no altcolor/pck color/terrain cutout/hidden/roofline
+    fltu16 flags;                 // FLT_FACE_* (high 16 bits of the record flags)
     fltu8 draw_type;              // 0..10
     fltu8 billb;                  //
     fltu8 light_mode;
@@ -379,6 +739,115 @@ extern "C" {
 # define FLT_FACESIZE_HASH sizeof(flt_face)
 #endif
 
+#ifdef FLT_UNIQUE_FACES
+  // Table of unique faces. The face id is the index in faces array, high 32 bits of flt.indices entries
+  typedef struct flt_facetable
+  {
+    flt_face* faces;              // unique faces by id
+    fltu64* hashes;               // hash of every face by id
+    fltu64* slots;                // open addressing slots: high 32 bits of hash | face id+1. 0 is empty
+    fltu32 count;                 // no of unique faces
+    fltu32 capacity;              // capacity of faces/hashes
+    fltu32 nslots;                // power of 2
+  }flt_facetable;
+
+  // Triangles with the same state to bind for them (textures, material, shader, draw type), one draw call
+  typedef struct flt_batch
+  {
+    flti16 texbase_pat;
+    flti16 texdetail_pat;
+    flti16 mat_pat;
+    fltu16 shader_ndx;
+    fltu8 draw_type;              // 0 with FLT_LEAN_FACES
+    fltu32 face;                  // first unique face id with this state
+    fltu32 start;                 // first index in flt_batches.indices
+    fltu32 count;                 // no of indices, 3 per triangle
+  }flt_batch;
+
+  // Triangles of the vertex lists as streams (FLT_OPT_LOAD_INDEX_STREAMS), flt_node.ndx_pairs are positions in vtx
+  typedef struct flt_tris
+  {
+    void* vtx;                    // vertex no (offset), fltu16 or fltu32 as index_size
+    fltu32* face;                 // unique face id of every triangle (index i is in triangle i/3)
+    fltu32 count;                 // no of indices, 3 per triangle
+    fltu32 capacity;              // no of triangles
+    fltu32 index_size;            // 2 while all vertex no fit in 16 bits, 4 otherwise
+  }flt_tris;
+
+  // Index buffer of all the triangles in flt.indices, contiguous by batch
+  typedef struct flt_batches
+  {
+    void* indices;                // vertex no (low 32 bits of flt.indices), fltu16 or fltu32 as index_size
+    struct flt_batch* batches;    // sorted by state
+    fltu32 index_count;
+    fltu32 batch_count;
+    fltu32 index_size;            // 2 if all vertex no fit in 16 bits (0xffff free as restart index), 4 otherwise
+  }flt_batches;
+
+  // Node of flt_bvh, 32 bytes. Inner ones (count=0) have their two children at first and first+1, leaves the 
+  // triangles first..first+count-1 of flt_bvh.tris. Bounds relative to flt_bvh.origin
+  typedef struct flt_bvh_node
+  {
+    float min[3];
+    fltu32 first;
+    float max[3];
+    fltu32 count;
+  }flt_bvh_node;
+
+  // Bounding volume hierarchy of triangles (flt_bvh_build), root at nodes[0]
+  typedef struct flt_bvh
+  {
+    flt_bvh_node* nodes;
+    fltu32* tris;                 // triangle no (indices 3*no..3*no+2 of the flt) in leaf order
+    float* verts;                 // the 3 corners of every triangle in tris, relative to origin
+    double origin[3];             // center of the triangles
+    fltu32 node_count;
+    fltu32 tri_count;
+    fltu32 depth;                 // levels under the root
+  }flt_bvh;
+
+  // Ray of flt_bvh_raycast, points origin+t*dir with t in [0,tmax]
+  typedef struct flt_ray
+  {
+    double origin[3];
+    float dir[3];
+    float tmax;
+  }flt_ray;
+
+  // Hit of a ray
+  typedef struct flt_hit
+  {
+    float t;                      // tmax of the ray if no hit
+    float u, v;                   // barycentric coordinates in the triangle (corners 1 and 2)
+    fltu32 tri;                   // triangle no, FLT_BVH_NO_HIT if no hit
+    fltu32 face;                  // unique face id of the triangle
+    flti16 smc_id;                // surface material code of the face (0 with FLT_LEAN_FACES)
+    flti16 feat_id;               // feature id of the face (0 with FLT_LEAN_FACES)
+  }flt_hit;
+
+  // Triangle of flt_terrain, relative to flt_terrain.origin
+  typedef struct flt_terrain_tri
+  {
+    float x0, y0, z0;             // first corner
+    float a1, b1, a2, b2;         // barycentric coordinates of corners 1 and 2 are a*(x-x0)+b*(y-y0)
+    float dzdx, dzdy;             // slope of its plane
+  }flt_terrain_tri;
+
+  // 2.5D grid of triangles (flt_terrain_build). Cell x,y has the triangles refs[cells[y*nx+x]] to 
+  // refs[cells[y*nx+x+1]-1]
+  typedef struct flt_terrain
+  {
+    flt_terrain_tri* tris;
+    fltu32* cells;                // nx*ny+1 starts in refs
+    fltu32* refs;                 // triangles of every cell
+    double origin[3];             // min x,y of the grid and center z
+    float cell_size;
+    fltu32 nx;
+    fltu32 ny;
+    fltu32 tri_count;
+  }flt_terrain;
+#endif
+
   typedef struct flt_node_extref
   {
     struct flt_node base;
@@ -408,16 +877,28 @@ extern "C" {
 
   typedef struct flt_mesh_vb
   {
-    fltu32 semantic;
+    fltu32 semantic;              // attribute mask of the local vertex pool (FLT_VTXPOOL_*)
     fltu32 count;
-    fltu8* vertices;
+    fltu8* vertices;              // same layout as pal->vtx_array (FLT_OPT_PAL_VTX_*), null if no vertex components
   }flt_mesh_vb;
 
+  // primitive of a mesh, as in the file (strips and fans not triangulated)
+  typedef struct flt_mesh_prim
+  {
+    fltu32 type;                  // FLT_MESH_PRIM_*
+    fltu32 start;                 // first index in flt_node_mesh.indices
+    fltu32 count;                 // no of indices
+  }flt_mesh_prim;
+
   typedef struct flt_node_mesh
   {
     struct flt_node base;
     struct flt_face attribs;
     struct flt_mesh_vb* vb;
+    fltu32* indices;              // of all the primitives, vertex no in vb
+    struct flt_mesh_prim* prims;
+    fltu32 index_count;
+    fltu32 prim_count;
   }flt_node_mesh;
 
   typedef struct flt_node_lod
@@ -455,6 +936,38 @@ extern "C" {
     fltu32 count;
   }flt_node_vlist;
 
+  // Hierarchy in preorder (flt_flat_build), one entry per node in every array, the root at 0. The subtree of 
+  // node i is i..i+size[i]-1: its first child is i+1 and every child c is followed by its sibling at c+size[c].
+  // The data of every type is copied to an array of that type: lod i is fl->lods[fl->data[i]] and so on
+  typedef struct flt_flat
+  {
+    fltu32* size;                 // nodes of the subtree, itself included
+    fltu32* parent;               // FLT_FLAT_NONE for the root
+    fltu8* type;                  // FLT_NODE_*
+    const char** name;            // null if none
+    fltu32* data;                 // entry in the array of its type, FLT_FLAT_NONE for the root
+    struct flt_node** node;       // the node in the tree
+    struct flt_node_extref* extrefs; // copies of the nodes by type in preorder (base links are the tree ones)
+    struct flt_node_group* groups;
+    struct flt_node_object* objects;
+    struct flt_node_mesh* meshes;
+    struct flt_node_lod* lods;
+#ifndef FLT_UNIQUE_FACES
+    struct flt_node_face* faces;
+#endif
+    struct flt_node_vlist* vlists;
+    struct flt_node_switch* switches;
+    fltu32* name_next;            // next node with the same name, FLT_FLAT_NONE if last
+    fltu32* name_slots;           // hash of names (open addressing): first node with every name, FLT_FLAT_NONE if empty
+#ifdef FLT_UNIQUE_FACES
+    fltu64* pairs;                // ndx_pairs of the nodes in preorder, a subtree's are contiguous
+    fltu32* pair_first;           // pairs of node i are pair_first[i]..pair_first[i+1]-1 (node_count+1 entries)
+#endif
+    fltu32 name_mask;             // slots-1
+    fltu32 node_count;
+    fltu32 type_count[FLT_NODE_MAX]; // entries of the array of every type
+  }flt_flat;
+
   typedef struct flt_header
   {
     flti8    ascii[8];
@@ -521,6 +1034,20 @@ extern "C" {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
 #ifdef FLT_IMPLEMENTATION
+#include <math.h>     // sqrtf of the vertex cache scores
+#include <float.h>    // DBL_MAX of empty bounds
+#ifdef _MSC_VER
+#include <io.h>       // _get_osfhandle for file mapping
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h> // mmap for file mapping
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>     // clock_gettime of the stats
+#include <unistd.h>   // getpid of temporary names
+#endif
+
 #if defined(__x86_64__) || defined(_M_X64)  ||  defined(__aarch64__)   || defined(__64BIT__) || \
   defined(__mips64)     || defined(__powerpc64__) || defined(__ppc64__)
 #	define FLT_PLATFORM_64
@@ -618,6 +1145,10 @@ extern "C" {
 #define FLT_HASHTABLE_SIZE 3079       // this size is for the *shared* dict of flt file names
 #endif
 
+#ifndef FLT_DICT_STRIPES
+#define FLT_DICT_STRIPES 16           // no of critical sections of a concurrent dict (power of 2)
+#endif
+
 #ifndef FLT_STACKARRAY_SIZE           // fixed stack size, 32 is a good maximum stack depth
 #define FLT_STACKARRAY_SIZE 32
 #endif
@@ -639,6 +1170,57 @@ extern "C" {
 #define FLT_INDICES_SIZE 4096       // this is the default initial capacity of the indices array for *every* flt
 #endif                              // only used with FLT_UNIQUE_FACES and when flt_opts.indices_size=0
 
+#ifndef FLT_CACHE_EXT
+#define FLT_CACHE_EXT ".fltc"          // appended to the file name for its cache (FLT_OPT_LOAD_CACHE)
+#endif
+#ifndef FLT_RECIDX_EXT
+#define FLT_RECIDX_EXT ".fltx"         // appended to the file name for its sidecar record index (flt_recidx_build)
+#endif
+#ifndef FLT_BLOCK_SIZE
+#define FLT_BLOCK_SIZE (1<<20)      // size of the blocks read from file when flt_opts.block_size=0 (two per load)
+#endif
+
+#ifndef FLT_VCACHE_SIZE
+#define FLT_VCACHE_SIZE 32          // vertex cache entries modeled by flt_batches_optimize when cache_size=0
+#endif
+#define FLT_VCACHE_MAX 64
+
+#ifndef FLT_BVH_LEAF_SIZE
+#define FLT_BVH_LEAF_SIZE 4         // triangles in a bvh leaf with no split tried
+#endif
+#ifndef FLT_BVH_LEAF_MAX
+#define FLT_BVH_LEAF_MAX 32         // leaves with more triangles are split even if SAH says not (unless can't)
+#endif
+#ifndef FLT_BVH_TASK_MIN
+#define FLT_BVH_TASK_MIN 1024       // smaller subtrees are not given to other threads by flt_bvh_build
+#endif
+#define FLT_BVH_BINS 16
+
+#ifndef FLT_TERRAIN_MAX_CELLS
+#define FLT_TERRAIN_MAX_CELLS 4096  // cells of the terrain grid in x and y at most (larger ones if needed)
+#endif
+#define FLT_TERRAIN_EPS 1e-5f       // barycentric tolerance, no cracks in shared edges
+
+#ifndef FLT_ARENA_CHUNK_SIZE
+#define FLT_ARENA_CHUNK_SIZE (64<<10) // size of every chunk of the arena. larger allocations get their own chunk
+#endif
+#ifndef FLT_ASYNC_RECORDS
+#define FLT_ASYNC_RECORDS 256       // records read between progress updates and cancel checks of flt_load_async
+#endif
+#ifndef FLT_NAMES_SIZE
+#define FLT_NAMES_SIZE 256          // initial slots of the interned names (FLT_OPT_LOAD_NAMES), grows at 3/4
+#endif
+#ifndef FLT_NAMES_CHUNK_SIZE
+#define FLT_NAMES_CHUNK_SIZE (16<<10) // chunks of the bytes of the interned names
+#endif
+#define FLT_ARENA_ALIGN 16
+
+#ifdef _MSC_VER
+#define flt_fseek64(f,offs) _fseeki64(f,(__int64)(offs),SEEK_CUR)
+#else
+#define flt_fseek64(f,offs) fseeko(f,(off_t)(offs),SEEK_CUR)
+#endif
+
 
 #if defined(WIN32) || defined(_WIN32) || (defined(sgi) && defined(unix) && defined(_MIPSEL)) || (defined(sun) && defined(unix) && !defined(_BIG_ENDIAN)) || (defined(__BYTE_ORDER) && (__BYTE_ORDER == __LITTLE_ENDIAN)) || (defined(__APPLE__) && defined(__LITTLE_ENDIAN__)) || (defined( _PowerMAXOS ) && (BYTE_ORDER == LITTLE_ENDIAN ))
 #define FLT_LITTLE_ENDIAN
@@ -648,6 +1230,12 @@ extern "C" {
 #  error unknown endian type
 #endif
 
+// SSE2 kernels for the vertex palette conversion (baseline of x64, no dispatch needed)
+#if !defined(FLT_NO_SIMD) && defined(FLT_LITTLE_ENDIAN) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2))
+#define FLT_SSE2
+#include <emmintrin.h>
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 #ifdef FLT_LITTLE_ENDIAN
 void flt_swap16(void* d)
@@ -686,12 +1274,15 @@ void flt_swap64(void* d)
 
 #define flt_offsetto(n,t)  ( (fltu8*)&((t*)(0))->n - (fltu8*)(0) )
 #define FLT_RECORD_READER(name) flti32 name(flt_op* oh, flt* of)
-#define flt_getswapu32(dst,offs) { u32=(fltu32*)(ctx->tmpbuff+offs); flt_swap32(u32); (dst)=*u32; }
-#define flt_getswapi32(dst,offs) { i32=(flti32*)(ctx->tmpbuff+offs); flt_swap32(i32); (dst)=*i32; }
-#define flt_getswapu16(dst,offs) { u16=(fltu16*)(ctx->tmpbuff+offs); flt_swap16(u16); (dst)=*u16; }
-#define flt_getswapi16(dst,offs) { i16=(flti16*)(ctx->tmpbuff+offs); flt_swap16(i16); (dst)=*i16; }
-#define flt_getswapflo(dst,offs) { flo=(float*)(ctx->tmpbuff+offs); flt_swap32(flo); (dst)=*flo; }
-#define flt_getswapdbl(dst,offs) { dbl=(double*)(ctx->tmpbuff+offs); flt_swap64(dbl); (dst)=*dbl; }
+// record fields are read from ctx->rec (never swapped in place, it might point to a read-only mapping)
+#define flt_getswapu32(dst,offs) { (dst)=flt_get32(ctx->rec+(offs)); }
+#define flt_getswapi32(dst,offs) { (dst)=(flti32)flt_get32(ctx->rec+(offs)); }
+#define flt_getswapu16(dst,offs) { (dst)=flt_get16(ctx->rec+(offs)); }
+#define flt_getswapi16(dst,offs) { (dst)=(flti16)flt_get16(ctx->rec+(offs)); }
+#define flt_getswapflo(dst,offs) { (dst)=flt_getflo(ctx->rec+(offs)); }
+#define flt_getswapdbl(dst,offs) { (dst)=flt_getdbl(ctx->rec+(offs)); }
+#define FLT_VTX_NONE 0xffffffff // offset of a vertex component not in the input (flt_vertex_decode)
+#define FLT_SCRATCH_MIN 1024    // fixed size records read in the scratch never read beyond it
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // Internal structures
@@ -707,22 +1298,79 @@ typedef struct flt_end_desc
 // context data used while parsing
 typedef struct flt_context
 {
-  char tmpbuff[512];
+  char strbuff[512];     // zero terminated copy of last string field read (flt_rec_str)
   FILE* f;
+  struct flt_blockreader* br; // blocks read from f (when there's no mapping)
+  const fltu8* mem;      // memory window: the whole file (flt_load_from_memory/FLT_OPT_LOAD_MMAP) or current block of br
+  fltu64 memsize;        // size of the memory window
+  fltu64 mempos;         // read position in the memory window
+  fltu64 memoffs;        // file offset of the memory window
+  fltu64 ranges[4];      // start/end offsets of the parts of the file loaded (flt_load_subtree), whole file if none
+  fltu32 nranges;
+  void* mapview;         // file mapping owned by the context (FLT_OPT_LOAD_MMAP)
+  fltu64 mapsize;
+  const fltu8* rec;      // current record data read (scratch or directly in the memory view)
+  fltu32 reclen;         // no of bytes available in rec
+  fltu8* scratch;        // copy of records crossing blocks or continued, grows as needed
+  fltu32 scratchsize;
+  flt_op ophead_next;    // header read after a record looking for continuations (flt_rec_read_all)
+  fltu8 ophead_pending;
   struct flt_pal_tex* pal_tex_last;
   struct flt_node_extref* node_extref_last;
-  struct flt_opts* opts;
+  struct flt_opts* opts;  // the caller's, only alive while loading
+  fltu32 pflags;         // flags of opts kept for the passes after the load (flt_bvh_build...)
+  fltu32 hflags;
+  fltu32 lflags;
+  float weld[3];         // welding and LOD range of opts the data was loaded with (flt_save_cache)
+  double lod_range[2];
   struct flt_dict* dict;
-#ifdef FLT_UNIQUE_FACES
-  struct flt_dict* dictfaces;
-#endif
   struct flt_stack* stack;
+  struct flt_xrefjob* xrefjob; // parallel resolve of xrefs this load belongs to
   char* basepath;
+  char* cachefile;       // cache to use or write (FLT_OPT_LOAD_CACHE)
+  fltu32 vtx_mapbytes;   // bytes of pal->vtx_buff converted, each vertex offset keeps its vertex no in vtx_array
+  fltu8* vtx_starts;     // bit per byte of pal->vtx_buff, set at the offset of every vertex converted
   fltu32 rec_count;
   fltu32 cur_depth;
-  fltu16 op_last;        // immediate last  
+  fltu64* lod_sets;      // per level, LOD picked and end of the siblings looked ahead (FLT_OPT_HIE_LOD_FINEST/COARSEST)
+  int lod_levels;
+  int lod_skip;          // skipping a LOD not kept: 1 its ancillary records, >1 its levels (+1)
 }flt_context;
 
+#ifdef FLT_UNIQUE_FACES
+// working arrays of the vertex cache optimization of a batch, sized for the largest one. ids are local to the batch
+typedef struct flt_vcache
+{
+  fltu32* local;         // local id of every vertex no, 0xffffffff if not in the batch
+  fltu32* verts;         // vertex no of every local id
+  fltu32* corners;       // local ids of the corners of the triangles
+  fltu32* live;          // triangles not emitted yet using every vertex
+  fltu32* adjofs;        // triangles of vertex v are adj[adjofs[v]] until adj[adjofs[v+1]]
+  fltu32* adj;
+  fltu32* out;           // reordered indices
+  flti32* pos;           // position of every vertex in the cache, -1 if not in it
+  float* vscore;
+  float* tscore;         // -1 once emitted
+  fltu32 cache[FLT_VCACHE_MAX+3];
+  fltu32 size;           // entries of the cache
+}flt_vcache;
+#endif
+
+// spatial hash of the vertices converted so far welding the vertex palette (FLT_OPT_PAL_VTX_WELD)
+typedef struct flt_weld
+{
+  fltu32* head;          // first vertex of every bucket, 0xffffffff if empty
+  fltu32* next;          // next vertex in the same bucket
+  fltu32 mask;           // buckets-1
+  fltu32 flags;          // pflags
+  fltu32 psize;          // bytes of the position, offsets of the other components (FLT_VTX_NONE if not there)
+  fltu32 nofs;
+  fltu32 uvofs;
+  fltu32 cofs;
+  fltu32 vsize;
+  float eps[3];          // position, normal and uv tolerances
+}flt_weld;
+
 ////////////////////////////////////////////////
 // Critical section / Atomic operations
 ////////////////////////////////////////////////
@@ -734,6 +1382,293 @@ void flt_critsec_leave(struct flt_critsec* cs);
 flti32 flt_atomic_dec(fltatom32* c);
 flti32 flt_atomic_inc(fltatom32* c);
 void flt_atomic_add(fltatom32* c, fltu32 val);
+void* flt_atomic_loadptr(void** p);           // acquire
+void flt_atomic_storeptr(void** p, void* val); // release
+fltu64 flt_atomic_load64(fltu64* p);           // acquire, whole also in 32 bits
+void flt_atomic_store64(fltu64* p, fltu64 val); // release
+
+////////////////////////////////////////////////
+// Threads / Events
+////////////////////////////////////////////////
+typedef void (*flt_thread_func)(void* arg);
+struct flt_thread;
+struct flt_event; // auto-reset
+struct flt_thread* flt_thread_create(flt_thread_func func, void* arg);
+void flt_thread_join(struct flt_thread* t); // waits for the thread and releases it
+struct flt_event* flt_event_create();
+void flt_event_destroy(struct flt_event* ev);
+void flt_event_signal(struct flt_event* ev);
+void flt_event_wait(struct flt_event* ev);
+
+////////////////////////////////////////////////
+// Block reader (double buffered file input)
+////////////////////////////////////////////////
+typedef struct flt_blockreader
+{
+  FILE* f;
+  fltu8* blocks[2];             // one block being parsed while the other is read
+  fltu32 sizes[2];              // bytes read in every block (0 is end of file)
+  fltu32 blocksize;
+  fltu64 seek;                  // bytes to skip in file before reading the requested block
+  int fill;                     // block requested/last read
+  int pending;                  // there's a block requested not consumed yet
+  int quit;
+  struct flt_thread* thread;    // read-ahead thread (FLT_OPT_LOAD_READAHEAD)
+  struct flt_event* ev_request;
+  struct flt_event* ev_ready;
+}flt_blockreader;
+
+int flt_blockreader_create(flt_blockreader** br, FILE* f, fltu32 blocksize, int readahead);
+void flt_blockreader_destroy(flt_blockreader** br);
+void flt_blockreader_request(flt_blockreader* br, fltu64 seek);
+const fltu8* flt_blockreader_wait(flt_blockreader* br, fltu32* size);
+void flt_blockreader_fill(flt_blockreader* br);
+void flt_blockreader_thread(void* arg);
+
+////////////////////////////////////////////////
+// Xref job (parallel resolve of xrefs)
+////////////////////////////////////////////////
+typedef struct flt_xreftask
+{
+  struct flt_xrefjob* job;
+  flt_node_extref* extref;
+  char* filename;
+  struct flt_xreftask* next;
+}flt_xreftask;
+
+typedef struct flt_xrefjob
+{
+  flt_opts* opts;
+  fltatom32 pending;            // tasks submitted and not finished (+1 while the owner is submitting)
+  struct flt_critsec* cs;       // guards the queue
+  flt_xreftask* head;           // queue of tasks (not used with flt_opts.cb_exec)
+  flt_xreftask* tail;
+  struct flt_event* ev_work;    // there are tasks in queue or quit
+  struct flt_event* ev_done;    // pending reached 0
+  struct flt_thread** threads;
+  int nthreads;
+  int quit;
+}flt_xrefjob;
+
+////////////////////////////////////////////////
+// Load future (of a flt referenced by extrefs)
+////////////////////////////////////////////////
+typedef struct flt_future_cont
+{
+  flt_callback_loaded cb;
+  void* user_data;
+  struct flt_future_cont* next;
+}flt_future_cont;
+
+typedef struct flt_future
+{
+  struct flt_critsec* cs;
+  struct flt_event* ev;         // signaled when done and there are waiters
+  flt_future_cont* conts;       // continuations to call when done
+  int waiters;
+  int done;
+}flt_future;
+
+flt_future* flt_future_create();
+void flt_future_destroy(flt_future** fu);
+void flt_future_complete(flt* of);
+
+////////////////////////////////////////////////
+// Asynchronous load (flt_load_async)
+////////////////////////////////////////////////
+typedef struct flt_async
+{
+  flt* of;
+  flt_opts* opts;
+  char* filename;
+  struct flt_thread* thread;
+  fltu64 pos;                   // bytes read, published by the record loop (flt_atomic_store64)
+  fltu64 size;                  // bytes of the input, 0 until it's opened
+  volatile fltatom32 cancel;
+  volatile fltatom32 done;
+  int own_future;               // of->future created for this load
+}flt_async;
+
+void flt_async_thread(void* arg);
+int flt_async_poll(flt* of);
+
+int flt_xrefjob_create(flt_xrefjob** job, flt_opts* opts);
+void flt_xrefjob_destroy(flt_xrefjob** job);
+void flt_xrefjob_submit(flt_xrefjob* job, flt_node_extref* extref, char* filename);
+flt_xreftask* flt_xrefjob_pop(flt_xrefjob* job);
+void flt_xrefjob_run(void* task);
+void flt_xrefjob_worker(void* arg);
+void flt_xrefjob_wait(flt_xrefjob* job);
+
+////////////////////////////////////////////////
+// Cache of a parsed flt. All offsets from the start of the file
+////////////////////////////////////////////////
+#define FLT_CACHE_MAGIC 0x43544c46 // 'FLTC' read in the byte order it was written
+#define FLT_CACHE_VERSION 8
+#define FLT_CACHE_NONE 0           // offset of nothing (head is at 0)
+#define FLT_CACHE_HASH_SIZE (64*1024) // blocks the source is hashed in
+#define FLT_CACHE_HAS_PAL (1<<0)
+#define FLT_CACHE_HAS_HIE (1<<1)
+#define FLT_CACHE_HAS_BOUNDS (1<<2) // node bounds (FLT_OPT_LOAD_BOUNDS)
+#define FLT_CACHE_HFLAGS_IGNORED FLT_OPT_HIE_EXTREF_RESOLVE // options not changing the cached data
+#define flt_cache_owns(c,p) ( (c) && (const fltu8*)(p)>=(const fltu8*)(c)->view && (const fltu8*)(p)<(const fltu8*)(c)->view+(c)->size )
+
+typedef struct flt_cache
+{
+  void* view;
+  fltu64 size;
+}flt_cache;
+
+typedef struct flt_cache_head
+{
+  fltu32 magic;
+  fltu32 version;
+  fltu32 abi;                   // struct sizes and build options (flt_cache_abi)
+  fltu32 pflags;                // options the source was parsed with
+  fltu32 hflags;
+  fltu32 has;                   // FLT_CACHE_HAS_*
+  fltu64 src_size;              // source file when written
+  fltu64 src_mtime;
+  fltu64 src_hash;
+  fltu64 size;                  // size of the cache file
+  fltu64 header;                // flt_header
+  fltu64 tex;                   // flt_cache_tex array
+  fltu64 vtx;                   // vtx_array
+  fltu64 nodes;                 // flt_cache_node array in preorder
+  fltu64 indices;               // indices data (FLT_UNIQUE_FACES)
+  fltu64 faces;                 // unique faces, hashes, slots and offsets of names (FLT_UNIQUE_FACES)
+  fltu64 face_hashes;
+  fltu64 face_slots;
+  fltu64 face_names;
+  fltu64 tri_faces;             // face ids of of->tris, indices is its vertex stream (FLT_OPT_LOAD_INDEX_STREAMS)
+  fltu32 vtx_size;
+  fltu32 vtx_count;
+  fltu32 tex_count;
+  fltu32 node_count;
+  fltu32 hie_node_count;        // flt_hie.node_count
+  fltu32 indices_count;
+  fltu32 index_size;            // of the vertex stream of of->tris, 0 with of->indices
+  fltu32 face_count;
+  fltu32 face_nslots;
+  float weld[3];                // tolerances the vertex palette was welded with (FLT_OPT_PAL_VTX_WELD)
+  double lod_range[2];          // LODs kept (FLT_OPT_HIE_LOD_RANGE)
+}flt_cache_head;
+
+typedef struct flt_cache_node
+{
+  fltu64 name;
+  fltu64 data;                  // node struct after flt_node (pointers are null)
+  fltu64 array;                 // maskwords of switch, indices of vlist, flt_cache_mesh of mesh
+  fltu64 facename;              // name of face of mesh/face nodes
+  fltu64 pairs;                 // ndx_pairs (FLT_UNIQUE_FACES)
+  fltu64 bounds;                // flt_bounds if any
+  fltu32 pairs_count;
+  fltu32 child_count;           // children follow the node
+  fltu32 type;
+  fltu32 pad;
+}flt_cache_node;
+
+typedef struct flt_cache_mesh
+{
+  fltu64 vertices;              // vb->vertices
+  fltu64 indices;
+  fltu64 prims;
+  fltu32 has_vb;
+  fltu32 semantic;              // vb
+  fltu32 vtx_count;
+  fltu32 vtx_size;
+}flt_cache_mesh;
+
+typedef struct flt_cache_tex
+{
+  fltu64 name;
+  flti32 patt_ndx;
+  flti32 xy_loc[2];
+  fltu16 whd[3];
+  fltu16 pad;
+}flt_cache_tex;
+
+typedef union flt_cache_anynode
+{
+  flt_node base;
+  flt_node_extref extref;
+  flt_node_group group;
+  flt_node_object object;
+  flt_node_mesh mesh;
+  flt_node_lod lod;
+  flt_node_switch swi;
+  flt_node_vlist vlist;
+#ifndef FLT_UNIQUE_FACES
+  flt_node_face face;
+#endif
+}flt_cache_anynode;
+
+typedef struct flt_cachew
+{
+  FILE* f;
+  fltu64 pos;
+  flt_cache_node* nodes;        // node records, written at the end
+  fltu32 node_count;
+  fltu32 node_cap;
+  fltu32 vtx_size;              // of vertex palette and mesh vertices
+  int err;
+}flt_cachew;
+
+fltu32 flt_cache_abi();
+int flt_cache_source(const char* srcfile, fltu64* size, fltu64* mtime, fltu64* hash);
+int flt_cache_source_valid(const char* srcfile, fltu64 size, fltu64 mtime, fltu64 hash);
+fltu64 flt_file_hash(const char* filename);
+fltu64 flt_cachew_put(flt_cachew* w, const void* data, fltu64 size);
+fltu64 flt_cachew_str(flt_cachew* w, const char* str);
+int flt_cachew_node(flt_cachew* w, flt_node* n);
+const void* flt_cache_ptr(const flt_cache* c, fltu64 offs, fltu64 size);
+char* flt_cache_str(const flt_cache* c, fltu64 offs);
+int flt_cache_check_nodes(const flt_cache* c, const flt_cache_head* head);
+flt_node* flt_cache_read_node(flt* of, fltu32* ndx);
+int flt_cache_read_mesh(flt* of, flt_node_mesh* mesh, const flt_cache_node* rec);
+int flt_cache_read(flt* of, const char* cachefile, const char* srcfile);
+void flt_cache_detach(flt* of);
+
+////////////////////////////////////////////////
+// Sidecar record index
+////////////////////////////////////////////////
+#define FLT_RECIDX_MAGIC 0x58544c46 // 'FLTX' read in the byte order it was written
+#define FLT_RECIDX_VERSION 2
+
+typedef struct flt_recidx_head
+{
+  fltu32 magic;
+  fltu32 version;
+  fltu32 count;                 // entries after the head, names after them
+  fltu32 names_size;
+  fltu64 hie;
+  fltu64 src_size;              // source file when written (see flt_cache_source)
+  fltu64 src_mtime;
+  fltu64 src_hash;
+}flt_recidx_head;
+
+// state of the streaming pass building an index
+typedef struct flt_recidx_scan
+{
+  flt_recidx* idx;
+  fltu32* last;                 // entry of the last node at every depth, FLT_RECIDX_NONE if not indexed
+  fltu32* open;                 // entry at every depth whose end isn't known yet
+  fltu32 depths;                // capacity of last/open
+  fltu32 cap;                   // capacity of idx->entries
+  fltu32 names_cap;
+  fltu32 prelude;               // last entry before the hierarchy, its end isn't known yet
+  fltu64 end;                   // end of the last record
+  int err;
+}flt_recidx_scan;
+
+int flt_recidx_scan_file(const char* filename, flt_opts* opts, flt_recidx** idx);
+int flt_recidx_scan_record(const flt_record* rec, void* user_data);
+int flt_recidx_node(fltu16 op);
+fltu32 flt_recidx_add(flt_recidx_scan* s, const flt_record* rec, fltu32 parent);
+int flt_recidx_name(flt_recidx_scan* s, const flt_record* rec, fltu32 maxlen);
+void flt_recidx_close(flt_recidx_scan* s, fltu32 depth, fltu64 end);
+int flt_recidx_write(const flt_recidx* idx, const char* indexfile, const char* srcfile);
+int flt_recidx_ranges(flt* of, const char* nodename);
 
 
 ////////////////////////////////////////////////
@@ -753,26 +1688,35 @@ typedef struct flt_dict_node
 typedef struct flt_dict
 {
   struct flt_dict_node** hasht;
-  struct flt_critsec* cs;
+  struct flt_critsec** cs;  // critical sections (entry of hash table locks cs[entry%ncs]) or null
+  int ncs;                  // 1 locks all operations, FLT_DICT_CONCURRENT only locks inserts of same stripe
   flt_dict_hash hashf;
   flt_dict_keycomp keycomp;
   fltatom32 ref;
   int capacity; // no of entries in hash table
-  int count; // no of actual elements
+  fltatom32 count; // no of actual elements
 }flt_dict;
 
+#define FLT_DICT_CONCURRENT FLT_DICT_STRIPES  // create_cs value for striped locks and lock-free lookups
+#define flt_dict_lock(d,entry)    { if ((d)->cs) flt_critsec_enter((d)->cs[(entry)&((d)->ncs-1)]); }
+#define flt_dict_unlock(d,entry)  { if ((d)->cs) flt_critsec_leave((d)->cs[(entry)&((d)->ncs-1)]); }
+#define flt_dict_lock_read(d,entry)   { if ((d)->cs && (d)->ncs==1) flt_critsec_enter((d)->cs[0]); }
+#define flt_dict_unlock_read(d,entry) { if ((d)->cs && (d)->ncs==1) flt_critsec_leave((d)->cs[0]); }
+
 
 fltu32 flt_dict_hash_djb2(const unsigned char* str, int extra);
-fltu32 flt_dict_hash_face_djb2(const unsigned char* str, int size);
 int flt_dict_keycomp_string(const char* a, const char* b, int extra);
-int flt_dict_keycomp_face(const char* a, const char* b, int size);
 void flt_dict_create(int capacity, int create_cs, flt_dict** dict, flt_dict_hash hashf, flt_dict_keycomp kcomp);
+void flt_dict_lock_all(flt_dict* dict);
+void flt_dict_unlock_all(flt_dict* dict);
 void flt_dict_destroy(flt_dict** dict, int free_elms, flt_dict_visitor destructor);
 void* flt_dict_gethe(flt_dict* dict, fltu32 hashe, fltu32* hashkey); // returns given entry+offset in hash
 void* flt_dict_geth(flt_dict* dict, const char* key, fltopt int size, fltu32 hash, fltu32* hashe); // returns given a hash
 void* flt_dict_get(flt_dict* dict, const char* key, fltopt int size);
 flt_dict_node* flt_dict_create_node(const char* key, fltu32 keyhash, void* value, int size);
 int flt_dict_insert(flt_dict* dict, const char* key, void* value, fltopt int size, fltopt fltu32 hash, fltopt fltu32* hashentry);
+void* flt_dict_insert_unique(flt_dict* dict, const char* key, void* value, fltopt int size); // returns the value in dict
+void* flt_dict_insert_ex(flt_dict* dict, const char* key, void* value, int size, fltu32 hash, fltu32* hashentry, int replace);
 void flt_dict_visit(flt_dict*dict, flt_dict_visitor visitor, void* userdata);
 
 ////////////////////////////////////////////////
@@ -827,8 +1771,72 @@ flt_array_type flt_array_at(flt_array* arr, fltu32 index);
 void flt_array_clear(flt_array* arr);
 void flt_array_grow_double(flt_array* arr);
 void flt_array_ensure(flt_array* arr, fltu32 count_new_elements); // makes sure there's room for new elements
+
+int flt_tris_create(flt_tris** t, fltu32 capacity);
+void flt_tris_destroy(flt_tris** t);
+int flt_tris_reserve(flt_tris* t, fltu32 ntris);
+int flt_tris_widen(flt_tris* t, int keep);
+int flt_tris_push(flt_tris* t, fltu32 face, const fltu32* vtx);
+void flt_index_set_vertex(flt* of, fltu32 i, fltu32 v);
 #endif
 
+////////////////////////////////////////////////
+// Arena (bump allocator, freed at once)
+////////////////////////////////////////////////
+typedef struct flt_arena_chunk
+{
+  struct flt_arena_chunk* next;
+  fltu32 size;                  // bytes of data after the header
+  fltu32 used;
+}flt_arena_chunk;
+
+typedef struct flt_arena
+{
+  flt_arena_chunk* head;        // current chunk, where allocations are bumped
+  fltu32 chunksize;
+  fltu32 last;                  // offset of last allocation in head (to grow it in place)
+  fltu64 total;                 // total bytes allocated
+}flt_arena;
+
+int flt_arena_create(flt_arena** a, fltu32 chunksize);
+void flt_arena_destroy(flt_arena** a);
+void* flt_arena_alloc(flt_arena* a, fltu32 size);
+void* flt_arena_calloc(flt_arena* a, fltu32 size);
+void* flt_arena_realloc(flt_arena* a, void* p, fltu32 oldsize, fltu32 newsize);
+char* flt_arena_strdup(flt_arena* a, const char* str);
+
+////////////////////////////////////////////////
+// Interned names (FLT_OPT_LOAD_NAMES)
+////////////////////////////////////////////////
+typedef struct flt_names
+{
+  char** slots;                 // open addressing (linear probing), null if empty
+  fltu32* hashes;               // of the name in every slot
+  fltu32 mask;                  // no of slots-1 (power of 2)
+  fltu32 count;                 // distinct names
+  flt_arena* strs;              // bytes of the names copied
+}flt_names;
+
+void flt_flat_destroy(flt_flat** fl);
+void flt_flat_count(const flt_node* n, fltu32* count, fltu32* npairs);
+void** flt_flat_typed(flt_flat* fl, int type);
+void flt_flat_types(flt_flat* fl, const flt_node* n);
+void flt_flat_fill(flt_flat* fl, flt_node* n, fltu32 parent, fltu32* npairs);
+fltu32 flt_flat_slot(const flt_flat* fl, const char* name);
+int flt_flat_grow(flt_flat* fl);
+int flt_names_create(flt_names** ns, fltu32 capacity);
+void flt_names_destroy(flt_names** ns);
+fltu32 flt_names_hash(const char* str, fltu32 len);
+fltu32 flt_names_slot(const flt_names* ns, const char* str, fltu32 len, fltu32 hash);
+int flt_names_grow(flt_names* ns);
+char* flt_names_intern(flt* of, const char* str, fltu32 len, int copy);
+
+// allocations of the flt contents, from its arena if any
+void* flt_of_calloc(flt* of, fltu32 size);
+void* flt_of_realloc(flt* of, void* p, fltu32 oldsize, fltu32 newsize);
+char* flt_of_strdup(flt* of, const char* str);
+void flt_of_free(flt* of, void* p);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // Forward declarations of functions
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -837,7 +1845,42 @@ char* flt_strdup_internal(const char* str);
 void* flt_aligned_calloc(size_t nelem, size_t elsize, size_t alignment);
 #endif
 int flt_err(int err, flt* of);
-int flt_read_ophead(fltu16 op, flt_op* data, FILE* f);
+double flt_time();
+void flt_stats_total_rec(const flt* of, flt_stats* total, const flt*** visited, fltu32* count);
+flt_context* flt_load_begin(flt* of, flt_opts* opts);
+int flt_load_records(flt* of);
+int flt_load_end(flt* of);
+int flt_read_ophead(fltu16 op, flt_op* data, flt_context* ctx);
+int flt_input_next(flt_context* ctx, fltu64 skip);
+int flt_input_seek(flt_context* ctx, fltu64 offset);
+fltu64 flt_input_tell(flt_context* ctx);
+int flt_load_file(const char* filename, flt* of, flt_opts* opts, const char* nodename, int part);
+int flt_input_copy(flt_context* ctx, void* dst, int bytes);
+int flt_rec_read(flt_context* ctx, int bytes);
+int flt_rec_read_all(flt_context* ctx, int bytes);
+fltu8* flt_rec_scratch(flt_context* ctx, fltu32 size);
+int flt_rec_keep(flt_context* ctx, fltu32 extra);
+const fltu8* flt_rec_pad(flt_context* ctx, fltu32 size);
+void flt_input_close(flt_context* ctx);
+int flt_parse_records(flt_context* ctx, flt_callback_record cb, void* user_data);
+int flt_parse_skips_to(fltu16 op);
+int flt_lod_keep(flt_context* ctx, fltu64 offs, double sin, double sout);
+int flt_lod_in_range(const flt_opts* opts, double sin, double sout);
+void flt_lod_range(const flt_opts* opts, double* range);
+fltu64 flt_lod_pick(flt_context* ctx, fltu64 offs, fltu64* end);
+int flt_lod_skip(flt_context* ctx, fltu16 op);
+int flt_rec_copy(flt_context* ctx, void* dst, int bytes);
+void flt_rec_skip(flt_context* ctx, int bytes);
+const char* flt_rec_str(flt_context* ctx, fltu32 offs, fltu32 maxlen);
+fltu16 flt_get16(const void* d);
+fltu32 flt_get32(const void* d);
+float flt_getflo(const void* d);
+double flt_getdbl(const void* d);
+void* flt_mmap_file(FILE* f, fltu64* size);
+void flt_munmap_file(void* view, fltu64 size);
+int flt_file_stat(const char* filename, fltu64* size, fltu64* mtime);
+char* flt_file_tmpname(const char* filename);
+fltu64 flt_hash_bytes(const void* data, fltu32 size);
 void flt_swap_desc(void* data, flt_end_desc* desc);
 void flt_node_add(flt* of, flt_node* node);
 void flt_node_add_child(flt_node* parent, flt_node* node);
@@ -846,13 +1889,76 @@ char* flt_path_base(const char* filaname);
 char* flt_path_basefile(const char* filename);
 int flt_path_endsok(const char* filename);
 flt_node* flt_node_create(fltu32 hieflags, int nodetype, const char* name);
-void flt_release_node(flt_node* n);
+flt_node* flt_node_alloc(flt* of, int nodetype, const char* name);
+void flt_release_node(flt_node* n, int free_names);
+void flt_release_extrefs(flt* of);
+void flt_release_extref_of(flt* of);
 void flt_resolve_all_extref(flt* of);
+void flt_extref_load(flt_node_extref* extref, char* basefile, flt_opts* opts);
 #ifdef FLT_UNIQUE_FACES
-void flt_face_destroy_name(char* key, void* faceptr, void* userdata);
+int flt_facetable_create(flt_facetable** ft, fltu32 capacity);
+void flt_facetable_destroy(flt_facetable** ft, int free_names);
+fltu32 flt_facetable_insert(flt_facetable* ft, const flt_face* face, fltu64 hash, int* isnew);
+int flt_facetable_grow(flt_facetable* ft);
+void flt_batches_destroy(flt_batches** bs);
+void flt_vcache_batch(flt_vcache* vc, fltu32* inds, fltu32 ntris);
+float flt_vcache_score(const flt_vcache* vc, fltu32 v);
+float flt_vcache_acmr(const flt_batches* bs, const fltu32* inds, fltu32 size);
+int flt_vfetch_reorder(flt* of, fltu32* inds, fltu32 count);
+int flt_batch_state_cmp(const flt_batch* a, const flt_batch* b);
+int flt_batch_cmp(const void* a, const void* b);
+fltu32 flt_batch_index(const flt_batches* bs, fltu32 i);
+void flt_batch_set_index(flt_batches* bs, fltu32 i, fltu32 v);
+
+// subtree of the bvh left to the threads
+typedef struct flt_bvh_task
+{
+  flt_bvh_node* nodes;          // root at 0
+  fltu32 node_count;
+  fltu32 node;                  // node of the top it's built for
+  fltu32 depth;                 // of the node, then the deepest of the subtree
+}flt_bvh_task;
+
+typedef struct flt_bvh_builder
+{
+  const float* box;             // min and max of every triangle (6 floats)
+  fltu32* ref;                  // triangles, partitioned in place by the nodes
+  flt_bvh_node* nodes;          // top of the tree, the subtrees are appended
+  flt_bvh_task* tasks;          // subtrees left to the threads
+  fltu32 task_count;
+  fltu32 task_cap;
+  fltu32 defer;                 // subtrees of up to defer triangles are tasks (0 none)
+  fltatom32 next;               // tasks taken
+  int err;                      // FLT_ERR_MEMOUT in any thread
+}flt_bvh_builder;
+
+void flt_bvh_destroy(flt_bvh** bvh);
+void flt_collect_tris(const flt_node* n, fltu32* tris, fltu32* count, fltu32 cap);
+float flt_bvh_area(const float* mn, const float* mx);
+void flt_bvh_bounds(const flt_bvh_builder* b, flt_bvh_node* node);
+int flt_bvh_split(flt_bvh_builder* b, flt_bvh_node* nodes, fltu32* node_count, fltu32 root, fltu32 depth, fltu32* maxdepth, int top);
+void flt_bvh_worker(void* arg);
+int flt_bvh_slab(const flt_bvh_node* n, const float* o, const float* inv, float tmax, float* tentry);
+int flt_bvh_tri(const float* vtx, const float* o, const float* d, float tmax, float* t, float* u, float* v);
+void flt_terrain_destroy(flt_terrain** t);
 #endif
-void flt_vertex_write(flt* of, fltu32 vtxoffset);
+void flt_vertex_convert(flt* of, fltu32 palbytes);
+int flt_weld_create(flt_weld* w, const flt_opts* opts, fltu32 maxverts);
+void flt_weld_destroy(flt_weld* w);
+fltu32 flt_weld_insert(flt_weld* w, const fltu8* vtxs, fltu32 v);
+int flt_weld_equal(const flt_weld* w, const fltu8* a, const fltu8* b);
+fltu32 flt_weld_bucket(const flt_weld* w, const fltu8* vtx, int dx, int dy, int dz);
+void flt_weld_eps(const flt_opts* opts, float* eps);
+void flt_vertex_decode(const fltu8* invtx, fltu8* outvtx, fltu32 flags, fltu32 pofs, fltu32 nofs, fltu32 uvofs, fltu32 cofs);
+fltu32 flt_vtxpool_size(fltu32 mask);
+fltu32 flt_mesh_cap(fltu64 count, fltu32 size);
 fltu32 flt_compute_vertex_size(fltu32 palopts);
+void flt_vertex_position(const fltu8* vtx, fltu32 pflags, double* p);
+flt_bounds* flt_node_bounds(flt* of, flt_node* n);
+void flt_bounds_point(flt_bounds* b, const double* p);
+void flt_bounds_merge(flt_bounds* dst, const flt_bounds* src);
+void flt_bounds_up(flt* of, flt_node* child, flt_node* parent);
+fltu32 flt_vtx_number(flt* of, fltu32 vtxoffset);
 
 
 FLT_RECORD_READER(flt_reader_header);                 // FLT_OP_HEADER
@@ -871,8 +1977,6 @@ FLT_RECORD_READER(flt_reader_extref);                 // FLT_OP_EXTREF
 FLT_RECORD_READER(flt_reader_pal_vertex);             // FLT_OP_PAL_VERTEX
 FLT_RECORD_READER(flt_reader_vertex_list);            // FLT_OP_VERTEX_LIST
 FLT_RECORD_READER(flt_reader_switch);                 // FLT_OP_SWITCH
-FLT_RECORD_READER(flt_reader_continuation);           // FLT_OP_CONTINUATION
-static float flt_zerovec[4]={0};
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
 int flt_err(int err, flt* of)
@@ -880,2191 +1984,6936 @@ int flt_err(int err, flt* of)
   flt_context* ctx = of->ctx;
 
   of->errcode = err;
-  if ( ctx ) 
-  { 
-    if ( ctx->f ) fclose(ctx->f); ctx->f=0;
-  }
+  if ( ctx ) flt_input_close(ctx);
   if ( err != FLT_OK ) flt_release(of);
+  flt_future_complete(of); // load finished, for others waiting on this extref
   return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// Record input. Records are sliced out of the memory window (the whole mapped file or the 
+// current block read from file), only the ones spanning two blocks or continued are copied.
 ////////////////////////////////////////////////////////////////////////////////////////////////
-int flt_read_ophead(fltu16 op, flt_op* data, FILE* f)
+int flt_read_ophead(fltu16 op, flt_op* data, flt_context* ctx)
 {
-  if ( fread(data,1,sizeof(flt_op),f) != sizeof(flt_op) )
+  fltu8 head[sizeof(flt_op)];
+  const fltu8* ptr=head;
+
+  if ( ctx->ophead_pending )
+  {
+    // already read by the last record looking for continuations
+    ctx->ophead_pending = FLT_FALSE;
+    *data = ctx->ophead_next;
+    return op==FLT_OP_DONTCARE || data->op == op;
+  }
+  if ( ctx->mempos >= ctx->memsize ) flt_input_next(ctx,0);
+  if ( ctx->mempos+sizeof(flt_op) <= ctx->memsize )
+  {
+    ptr = ctx->mem+ctx->mempos;
+    ctx->mempos += sizeof(flt_op);
+  }
+  else if ( flt_input_copy(ctx,head,sizeof(flt_op)) != sizeof(flt_op) )
     return 0;
-  flt_swap16(&data->op); flt_swap16(&data->length);
+  data->op = flt_get16(ptr);
+  data->length = flt_get16(ptr+2);
   return op==FLT_OP_DONTCARE || data->op == op;
 }
 
-fltatom32 TOTALNFACES=0;
-fltatom32 TOTALUNIQUEFACES=0; 
-fltatom32 TOTALINDICES=0;
-
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-int flt_load_from_filename(const char* filename, flt* of, flt_opts* opts)
+// moves the window to the next block of the file skipping some bytes. returns 0 when no more input
+int flt_input_next(flt_context* ctx, fltu64 skip)
 {
-  flt_op oh;
-  flti32 skipbytes;  
-  flt_rec_reader readtab[FLT_OP_MAX]={0};  
-  flt_context* ctx;
-  char use_pal=0, use_node=0;  
+  flt_blockreader* br=ctx->br;
+  fltu64 offs=ctx->memoffs+ctx->memsize; // of the next block
+  const fltu8* block;
+  fltu32 size;
 
-  of->loaded = FLT_LOADING;
-  // preparing internal obj (references and shared dict)
-  ctx = (flt_context*)flt_calloc(1,sizeof(flt_context));
-  ctx->opts = opts;  
-  if (of->ctx ) // reuse some stuff from input of->context
+  if ( !br ) return 0; // the window is the whole input
+  for (;;)
   {
-    if ( of->ctx->dict )
-    {
-      ctx->dict = of->ctx->dict;
-      flt_atomic_inc(&of->ctx->dict->ref);
-    }
-    ctx->cur_depth = of->ctx->cur_depth;
+    block = flt_blockreader_wait(br,&size);
+    if ( !size || skip < size ) break;
+    skip -= size; // whole block skipped, the reader seeks the rest
+    offs += size+skip;
+    flt_blockreader_request(br,skip);
+    skip = 0;
   }
-  of->ctx = ctx;
-  if ( !ctx->dict ) // if not sharing dict
-    flt_dict_create(FLT_HASHTABLE_SIZE,1,&ctx->dict, flt_dict_hash_djb2, flt_dict_keycomp_string);
-  flt_atomic_inc(&of->ref); // increments this of reference
-  flt_stack_create(&ctx->stack,ctx->opts->stacksize); // creates nodes stack
-#ifdef FLT_UNIQUE_FACES
-  flt_dict_create(opts->dfaces_size ? opts->dfaces_size: FLT_DICTFACES_SIZE,0,&ctx->dictfaces,flt_dict_hash_face_djb2, flt_dict_keycomp_face);
-  flt_array_create(&of->indices, opts->indices_size ? opts->indices_size : FLT_INDICES_SIZE, flt_array_grow_double);
-#endif
-  // opening file
-  ctx->f = flt_fopen(filename, of);
-  if ( !ctx->f ) return flt_err(FLT_ERR_FOPEN, of);
+  ctx->memoffs = offs;
+  ctx->mem = block;
+  ctx->memsize = size;
+  ctx->mempos = flt_min(skip,size);
+  if ( size ) flt_blockreader_request(br,0); // next block while this one is parsed
+  return size!=0;
+}
 
-  // configuring reading
-  readtab[FLT_OP_HEADER] = flt_reader_header;         // always read header
-  readtab[FLT_OP_PAL_VERTEX] = flt_reader_pal_vertex; // always read vertex palette header for skipping at least
-  readtab[FLT_OP_CONTINUATION] = flt_reader_continuation; // always prepared to continue
-  if ( opts->pflags & FLT_OPT_PAL_VERTEX )  { use_pal = FLT_TRUE; }
-  if ( opts->pflags & FLT_OPT_PAL_TEXTURE ) { readtab[FLT_OP_PAL_TEXTURE] = flt_reader_pal_tex; use_pal=FLT_TRUE; }  
-  if ( opts->hflags & FLT_OPT_HIE_EXTREF )  { readtab[FLT_OP_EXTREF] = flt_reader_extref; use_node=FLT_TRUE; }
-  if ( opts->hflags & FLT_OPT_HIE_OBJECT )  { readtab[FLT_OP_OBJECT] = flt_reader_object; use_node=FLT_TRUE; }
-  if ( opts->hflags & FLT_OPT_HIE_GROUP )   { readtab[FLT_OP_GROUP] = flt_reader_group; use_node=FLT_TRUE; }
-  if ( opts->hflags & FLT_OPT_HIE_LOD )     { readtab[FLT_OP_LOD] = flt_reader_lod; use_node=FLT_TRUE; }
-  if ( opts->hflags & FLT_OPT_HIE_FACE )    { readtab[FLT_OP_FACE] = flt_reader_face; readtab[FLT_OP_VERTEX_LIST]= flt_reader_vertex_list; use_node=FLT_TRUE;}  
-  if (opts->hflags & FLT_OPT_HIE_SWITCH)    { readtab[FLT_OP_SWITCH] = flt_reader_switch; use_node = FLT_TRUE; }
-  if ( opts->hflags & FLT_OPT_HIE_MESH )    
-  { 
-    readtab[FLT_OP_MESH] = flt_reader_mesh; 
-    readtab[FLT_OP_LOCAL_VERTEX_POOL] = flt_reader_local_vertex_pool;
-    readtab[FLT_OP_MESH_PRIMITIVE] = flt_reader_mesh_primitive;
-    use_node=FLT_TRUE; 
-  }  
-  if (use_pal)
+// file offset of the next record header
+fltu64 flt_input_tell(flt_context* ctx)
+{
+  return ctx->memoffs+ctx->mempos-(ctx->ophead_pending ? sizeof(flt_op) : 0);
+}
+
+// moves to a file offset. reading blocks only forward or inside the window. returns 0 if not possible
+int flt_input_seek(flt_context* ctx, fltu64 offset)
+{
+  const fltu64 winend = ctx->memoffs+ctx->memsize;
+
+  if ( offset == flt_input_tell(ctx) ) return 1;
+  ctx->ophead_pending = FLT_FALSE;
+  if ( offset >= ctx->memoffs && offset <= winend ) 
   {
-    of->pal = (flt_palettes*)flt_calloc(1,sizeof(flt_palettes));
-    flt_mem_check2(of->pal,of);
+    ctx->mempos = offset-ctx->memoffs;
+    return 1;
   }
+  if ( !ctx->br || offset < winend ) return 0;
+  return flt_input_next(ctx, offset-winend);
+}
 
-  if (use_node)
-  {
-    if (!(ctx->opts->hflags & FLT_OPT_HIE_NO_NAMES))
-      readtab[FLT_OP_LONGID] = flt_reader_longid;
-    readtab[FLT_OP_PUSHLEVEL] = flt_reader_pushlv;
-    readtab[FLT_OP_POPLEVEL] = flt_reader_poplv;
+// copies the next bytes of the input to dst, crossing blocks if needed. returns the no of bytes copied
+int flt_input_copy(flt_context* ctx, void* dst, int bytes)
+{
+  int n, got=0;
 
-    // hierarchy (root should be always)
-    of->hie = (flt_hie*)flt_calloc(1,sizeof(flt_hie));
-    flt_mem_check2(of->hie, of);
-    of->hie->node_root = flt_node_create(of->ctx->opts->hflags, FLT_NODE_BASE, "root");
-    flt_mem_check2(of->hie->node_root, of);
-    flt_stack_pushn(ctx->stack, of->hie->node_root);
+  while ( got < bytes )
+  {
+    if ( ctx->mempos >= ctx->memsize && !flt_input_next(ctx,0) ) break;
+    n = (int)flt_min((fltu64)(bytes-got), ctx->memsize-ctx->mempos);
+    memcpy((fltu8*)dst+got, ctx->mem+ctx->mempos, n);
+    ctx->mempos += n; 
+    got += n;
   }
+  return got;
+}
 
-  // Reading Loop!
-  while ( flt_read_ophead(FLT_OP_DONTCARE, &oh, ctx->f) )
+// makes available the next bytes in ctx->rec. returns the no of bytes read (rec null if out of memory)
+int flt_rec_read(flt_context* ctx, int bytes)
+{
+  if ( bytes <= 0 ) { ctx->rec=ctx->mem+ctx->mempos; ctx->reclen=0; return 0; }
+  if ( ctx->mempos >= ctx->memsize ) flt_input_next(ctx,0);
+  if ( ctx->mempos+bytes <= ctx->memsize )
+  {
+    // in place
+    ctx->rec = ctx->mem+ctx->mempos;
+    ctx->mempos += bytes;
+  }
+  else
   {
-    ++ctx->rec_count;
-    // if reader function available, use it
-    skipbytes = ( readtab[oh.op] && !(opts->hflags&FLT_OPT_HIE_GO_THROUGH) ) ? readtab[oh.op](&oh, of) : oh.length-sizeof(flt_op);    
-    ctx->op_last = oh.op;
+    // crossing blocks (or end of input)
+    ctx->rec = flt_rec_scratch(ctx,bytes);
+    bytes = ctx->rec ? flt_input_copy(ctx, ctx->scratch, bytes) : 0;
+  }
+  ctx->reclen = (fltu32)bytes;
+  return bytes;
+}
 
-    if ( opts->countable )
-      flt_atomic_inc(opts->countable+oh.op);
+// the next bytes of the record and the data of the continuation records after it, one after
+// the other in ctx->rec. the header following them is kept for the next flt_read_ophead.
+// returns the no of bytes of the record read (rec null if out of memory)
+int flt_rec_read_all(flt_context* ctx, int bytes)
+{
+  flt_op oh;
+  fltu32 len;
+
+  bytes = flt_rec_read(ctx,bytes);
+  while ( ctx->rec )
+  {
+    // a record in place can't be in a block given back to the reader while reading the header
+    if ( ctx->br && ctx->mempos+sizeof(flt_op) > ctx->memsize && !flt_rec_keep(ctx,0) ) break;
+    if ( !flt_read_ophead(FLT_OP_DONTCARE,&oh,ctx) ) break;
+    if ( oh.op != FLT_OP_CONTINUATION || oh.length < sizeof(flt_op) )
+    {
+      ctx->ophead_next = oh;
+      ctx->ophead_pending = FLT_TRUE;
+      break;
+    }
 
-    // if returned negative, it's an error, if positive, we skip until next record
-    if ( skipbytes < 0 )        return flt_err(FLT_ERR_READBEYOND_REC,of);
-    else if ( skipbytes > 0 )   fseek(ctx->f,skipbytes,SEEK_CUR); 
+    // continuation data appended
+    len = oh.length-sizeof(flt_op);
+    if ( !flt_rec_keep(ctx,len) ) break;
+    ctx->reclen += (fltu32)flt_input_copy(ctx, ctx->scratch+ctx->reclen, len);
   }
+  return bytes;
+}
 
-  if (opts->hflags & FLT_OPT_HIE_EXTREF_RESOLVE && of->hie)
-    flt_resolve_all_extref(of);  
-
-  flt_stack_popn(ctx->stack); // root
-  flt_stack_destroy(&ctx->stack); // no needed anymore (also released in flt_release)
-  if (of->pal && of->pal->vtx_array) 
-    flt_safefree(of->pal->vtx_buff); // not needed the buffer anymore if we go the array
-
-  of->loaded = FLT_LOADED;
-  return flt_err(FLT_OK,of);
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-char* flt_extref_prepare(struct flt_node_extref* extref, struct flt* of)
+// scratch of at least size bytes (the contents are kept when growing). null if out of memory
+fltu8* flt_rec_scratch(flt_context* ctx, fltu32 size)
 {
-  char* basefile=FLT_NULL;
-  flt_context* oldctx = of->ctx;
+  fltu8* scratch;
+  fltu32 cap;
 
-  if ( !extref || !of ) 
-    return FLT_NULL;
-
-  // check if reference has been loaded already
-  extref->of = (struct flt*)flt_dict_get(of->ctx->dict, extref->base.name, 0);
-  if ( !extref->of ) // does not exist, creates one, register in dict and passes dict
-  {
-    extref->of = (flt*)flt_calloc(1,sizeof(flt));
-    extref->of->ctx = of->ctx; 
-    flt_dict_insert(of->ctx->dict, extref->base.name, extref->of, FLT_NULL, FLT_NULL, FLT_NULL);
-
-    // Creates the full path for the external reference (uses same base path as parent)
-    if (oldctx->basepath)
-    {
-      *oldctx->tmpbuff=0; 
-      strcat(oldctx->tmpbuff, oldctx->basepath);
-      if ( !flt_path_endsok(oldctx->basepath) ) strcat(oldctx->tmpbuff, "/");
-      strcat(oldctx->tmpbuff, extref->base.name);
-      basefile = flt_strdup(oldctx->tmpbuff);    
-    }
-  }
-  else 
+  if ( size > ctx->scratchsize )
   {
-    // file already loaded. uses and inc reference count
-    flt_atomic_inc(&extref->of->ref);
+    cap = flt_max(flt_max(size, ctx->scratchsize*2), FLT_SCRATCH_MIN);
+    scratch = (fltu8*)flt_realloc(ctx->scratch, cap);
+    if ( !scratch ) return FLT_NULL;
+    ctx->scratch = scratch;
+    ctx->scratchsize = cap;
   }
+  return ctx->scratch;
+}
 
-  
-  return basefile;
+// moves the current record to the scratch with room for extra bytes after it. 0 if out of memory
+int flt_rec_keep(flt_context* ctx, fltu32 extra)
+{
+  const fltu8* rec = ctx->rec;
+  const int inscratch = rec == ctx->scratch;
+  fltu8* scratch = flt_rec_scratch(ctx, ctx->reclen+extra);
+
+  if ( scratch && !inscratch && ctx->reclen ) 
+    memcpy(scratch, rec, ctx->reclen);
+  ctx->rec = scratch;
+  return scratch != FLT_NULL;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_resolve_all_extref(flt* of)
+// a short record (last of the input, or shorter than its layout) is copied to the scratch zeroed up to 
+// size bytes, so the fixed offsets of a reader are inside it. reclen is kept. returns ctx->rec (null if out of memory)
+const fltu8* flt_rec_pad(flt_context* ctx, fltu32 size)
 {
-  flt_context* ctx=of->ctx;
-  flt_opts* opts=ctx->opts;
-  char* basefile;
-  flt_node_extref* extref=of->hie->extref_head;
+  if ( !ctx->rec || ctx->reclen >= size ) return ctx->rec;
+  if ( !flt_rec_keep(ctx, size-ctx->reclen) ) return FLT_NULL;
+  memset(ctx->scratch+ctx->reclen, 0, size-ctx->reclen);
+  return ctx->rec;
+}
 
-  while(extref)
-  {
-    basefile = flt_extref_prepare(extref,of);
-    if ( basefile )
-    {
-      if ( flt_load_from_filename( basefile, extref->of, opts) != FLT_OK )
-        flt_safefree(extref->of);
-      flt_safefree(basefile);
-    }
-    extref=(flt_node_extref*)extref->next_extref;
-  }
+// copies the next bytes to dst. returns the no of bytes read
+int flt_rec_copy(flt_context* ctx, void* dst, int bytes)
+{
+  return bytes > 0 ? flt_input_copy(ctx,dst,bytes) : 0;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_header)
+// skipping is a pointer bump unless it goes beyond the window
+void flt_rec_skip(flt_context* ctx, int bytes)
 {
-  flt_end_desc  desc[]={ 
-    {32, 2, flt_offsetto(format_rev,flt_header)},
-    {16, 5, flt_offsetto(n_group_nid,flt_header)},
-    {32,15, flt_offsetto(flags,flt_header)},
-    {16, 2, flt_offsetto(n_dof_nid,flt_header)},
-    {32, 1, flt_offsetto(db_orig,flt_header)},
-    {64, 4, flt_offsetto(sw_db_x,flt_header)},
-    {16, 2, flt_offsetto(n_sound_nid,flt_header)},
-    {16, 4, flt_offsetto(n_clip_nid,flt_header)},
-    {64, 8, flt_offsetto(sw_corner_lat,flt_header)},
-    {16, 5, flt_offsetto(n_lightsrc_nid,flt_header)},
-    {32, 1, flt_offsetto(earth_ellip_model,flt_header)},
-    {16, 3, flt_offsetto(n_adapt_nid,flt_header)},
-    {64, 2, flt_offsetto(d_db_z,flt_header)},
-    {16, 2, flt_offsetto(n_mesh_nid,flt_header)},
-    {64, 2, flt_offsetto(earth_major_axis,flt_header)},
-    {0,0,0}
-  };
-  flt_context* ctx=of->ctx;
-  int leftbytes=oh->length-sizeof(flt_op);
-  flti32 format_rev=0;
-  int i;
+  const fltu64 avail = ctx->memsize-ctx->mempos;
+  if ( (fltu64)bytes <= avail )
+    ctx->mempos += bytes;
+  else if ( !flt_input_next(ctx,bytes-avail) )
+    ctx->mempos = ctx->memsize;
+}
 
-  if ( ctx->opts->hflags & FLT_OPT_HIE_HEADER ) 
-  {
-    // if storing header, read it entirely
-    of->header = (flt_header*)flt_malloc(sizeof(flt_header));
-    flt_mem_check(of->header, of->errcode);
-    leftbytes -= (int)fread(of->header, 1, flt_min(leftbytes,sizeof(flt_header)), ctx->f);  
-    flt_swap_desc(of->header,desc); // endianess
-    format_rev = of->header->format_rev;
-    // remove dtime line breaks
-    for (i=0;i<32;++i) if (of->header->dtime[i]=='\n' || of->header->dtime[i]=='\r') of->header->dtime[i]=' ';
-  }
-  else
-  {
-    // if no header needed, just read the version
-    fseek(ctx->f,8,SEEK_CUR); leftbytes-=8;
-    leftbytes -= (int)fread(&format_rev,1,4,ctx->f);
-    flt_swap32(&format_rev);
-  }
+// releases the input (block reader, file, mapping) of the context
+void flt_input_close(flt_context* ctx)
+{
+  if ( ctx->br ) flt_blockreader_destroy(&ctx->br);
+  if ( ctx->f ) { fclose(ctx->f); ctx->f=0; }
+  if ( ctx->mapview ) { flt_munmap_file(ctx->mapview, ctx->mapsize); ctx->mapview=0; }
+  flt_safefree(ctx->scratch); ctx->scratchsize=0;
+  ctx->mem=0; ctx->rec=0; ctx->reclen=0; ctx->ophead_pending=0;
+}
 
-  // checking version
-  if ( format_rev > FLT_VERSION ) 
-  { 
-    leftbytes = -1; 
-    of->errcode=FLT_ERR_VERSION; 
+// zero terminated copy of a string field in the current record (at most maxlen chars)
+const char* flt_rec_str(flt_context* ctx, fltu32 offs, fltu32 maxlen)
+{
+  fltu32 len=0;
+  if ( offs < ctx->reclen )
+  {
+    maxlen = flt_min(flt_min(maxlen, ctx->reclen-offs), (fltu32)sizeof(ctx->strbuff)-1);
+    while ( len < maxlen && ctx->rec[offs+len] ) ++len;
+    memcpy(ctx->strbuff, ctx->rec+offs, len);
   }
+  ctx->strbuff[len]=0;
+  return ctx->strbuff;
+}
 
-  return leftbytes;
+fltu16 flt_get16(const void* d)
+{
+  fltu16 v;
+  memcpy(&v,d,sizeof(v)); flt_swap16(&v);
+  return v;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_pushlv)
+fltu32 flt_get32(const void* d)
 {
-  flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
+  fltu32 v;
+  memcpy(&v,d,sizeof(v)); flt_swap32(&v);
+  return v;
+}
 
-  flt_stack_pushn(ctx->stack,FLT_NULL);
+float flt_getflo(const void* d)
+{
+  float v;
+  memcpy(&v,d,sizeof(v)); flt_swap32(&v);
+  return v;
+}
 
-  return leftbytes;
+double flt_getdbl(const void* d)
+{
+  double v;
+  memcpy(&v,d,sizeof(v)); flt_swap64(&v);
+  return v;
 }
 
+// counters of the load if FLT_OPT_LOAD_STATS
+#define flt_stat_add(of,field,n) { if ( (of)->stats ) (of)->stats->field += (n); }
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_poplv)
+int flt_load_from_filename(const char* filename, flt* of, flt_opts* opts)
 {
-  flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);  
-  flt_stack_popn(ctx->stack);
-
-  return leftbytes;
+  return flt_load_file(filename, of, opts, FLT_NULL, FLT_FALSE);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_pal_tex)
+int flt_load_subtree(const char* filename, const char* nodename, flt* of, flt_opts* opts)
 {
-  int leftbytes=oh->length-sizeof(flt_op);
-  flt_context* ctx = of->ctx;
-  flt_opts* opts=ctx->opts;
-  flti32* i32;
-
-  flt_pal_tex* newpt = (flt_pal_tex*)flt_calloc(1,sizeof(flt_pal_tex));
-  flt_mem_check(newpt, of->errcode);
-
-  leftbytes -= (int)fread(ctx->tmpbuff, 1, flt_min(leftbytes,220), ctx->f);
-  newpt->name = flt_strdup(ctx->tmpbuff);
-  flt_getswapi32(newpt->patt_ndx, 200);
-  flt_getswapi32(newpt->xy_loc[0], 204);
-  flt_getswapi32(newpt->xy_loc[1], 208);
-
-  if ( opts->cb_texture ) 
-    opts->cb_texture(newpt,of,opts->cb_user_data); // callback?
-
-  // adding node to list (use last if defined, or the beginning)
-  if ( ctx->pal_tex_last )
-    ctx->pal_tex_last->next = newpt;
-  else
-    of->pal->tex_head = newpt;
-
-  ctx->pal_tex_last = newpt;
-  ++of->pal->tex_count;
-  return leftbytes;
+  return flt_load_file(filename, of, opts, nodename, FLT_TRUE);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// whole file, or only the header/palettes and a subtree (part) seeking with the record index
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_extref)
+int flt_load_file(const char* filename, flt* of, flt_opts* opts, const char* nodename, int part)
 {
-  flt_context* ctx = of->ctx;
-  flt_opts* opts=ctx->opts;
-  flt_node_extref* newextref=0;
-  int leftbytes = oh->length-sizeof(flt_op);
-  flti32* i32;
-  fltu16* u16;
-  
-  leftbytes -= (int)fread(ctx->tmpbuff,1,flt_min(leftbytes,210),ctx->f);
-  {
-    // creates
-    newextref = (flt_node_extref*)flt_node_create(of->ctx->opts->hflags, FLT_NODE_EXTREF, ctx->tmpbuff);
-    flt_mem_check(newextref, of->errcode);    
-    
-    // set values
-    flt_getswapi32(newextref->flags,204);
-    flt_getswapu16(newextref->view_asbb, 208);
+  flt_context* ctx = flt_load_begin(of,opts);
+  int err;
+  if ( !ctx ) { of->errcode=FLT_ERR_MEMOUT; flt_future_complete(of); return of->errcode; }
 
-    // add to hierarchy
-    flt_node_add(of,(flt_node*)newextref);
+  // opening file
+  ctx->f = flt_fopen(filename, of);
+  if ( !ctx->f ) return flt_err(FLT_ERR_FOPEN, of);
 
-    // callback?
-    if ( opts->cb_extref ) 
-      opts->cb_extref(newextref, of, opts->cb_user_data);
+  // parts of the file from its index
+  if ( part )
+  {
+    err = flt_recidx_ranges(of, nodename);
+    if ( err != FLT_OK ) return flt_err(err, of);
   }
 
-  return leftbytes;
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_object)
-{
-  flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
-  flt_node_object* newobj;
-  fltu32* u32;
-  flti16* i16;
+  // cache of the file if valid, otherwise written after parsing
+  else if ( opts->lflags & FLT_OPT_LOAD_CACHE )
+  {
+    ctx->cachefile = (char*)flt_malloc(strlen(of->filename)+strlen(FLT_CACHE_EXT)+1);
+    if ( ctx->cachefile )
+    {
+      strcpy(ctx->cachefile,of->filename);
+      strcat(ctx->cachefile,FLT_CACHE_EXT);
+      err = flt_cache_read(of,ctx->cachefile,of->filename);
+      if ( err == FLT_OK ) 
+      {
+        flt_safefree(ctx->cachefile);
+        return flt_load_end(of);
+      }
+      if ( of->cache ) return flt_err(err, of); // broken when already filling of
+    }
+  }
 
-  // read and create node
-  leftbytes -= (int)fread(ctx->tmpbuff,1,flt_min(leftbytes,24),ctx->f);
+  // mapping it if possible (also to look ahead choosing LODs)
+  if ( (opts->lflags & FLT_OPT_LOAD_MMAP) || (opts->hflags & (FLT_OPT_HIE_LOD_FINEST|FLT_OPT_HIE_LOD_COARSEST)) )
   {
-    newobj = (flt_node_object*)flt_node_create(of->ctx->opts->hflags, FLT_NODE_OBJECT, ctx->tmpbuff);
-    flt_mem_check(newobj, of->errcode);
+    ctx->mapview = flt_mmap_file(ctx->f, &ctx->mapsize);
+    if ( ctx->mapview )
+    {
+      ctx->mem = (const fltu8*)ctx->mapview;
+      ctx->memsize = ctx->mapsize;
+      fclose(ctx->f); ctx->f=0;
+    }
+  }
 
-    // set values
-    flt_getswapu32(newobj->flags, 8);
-    flt_getswapi16(newobj->priority,12);
-    flt_getswapi16(newobj->transp,14);
+  // otherwise reading blocks 
+  if ( !ctx->mem && !flt_blockreader_create(&ctx->br, ctx->f, opts->block_size ? opts->block_size : FLT_BLOCK_SIZE, 
+    (opts->lflags & FLT_OPT_LOAD_READAHEAD)!=0) )
+    return flt_err(FLT_ERR_MEMOUT, of);
 
-    // add to hierarchy
-    flt_node_add(of,(flt_node*)newobj);
-  }
-  
-  return leftbytes;
+  return flt_load_records(of);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_group)
+int flt_load_from_memory(const void* data, fltu64 size, flt* of, flt_opts* opts)
 {
-  flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
-  flt_node_group* group;
-  fltu32* u32;
-  fltu16* u16;
-  float* flo;
-
-  leftbytes -= (int)fread(ctx->tmpbuff,1,flt_min(leftbytes,40),ctx->f);
-  {
-    group = (flt_node_group*)flt_node_create(of->ctx->opts->hflags,FLT_NODE_GROUP,ctx->tmpbuff);
-    flt_mem_check(group,of->errcode);
+  flt_context* ctx = flt_load_begin(of,opts);
+  if ( !ctx ) { of->errcode=FLT_ERR_MEMOUT; flt_future_complete(of); return of->errcode; }
+  if ( !data ) return flt_err(FLT_ERR_FOPEN, of);
 
-    flt_getswapu16(group->priority,8);
-    flt_getswapu32(group->flags,12);
-    flt_getswapu32(group->loop_count,28);
-    flt_getswapflo(group->loop_dur,32);
-    flt_getswapflo(group->last_fr_dur,36);
+  ctx->mem = (const fltu8*)data;
+  ctx->memsize = size;
+  if ( of->filename ) 
+    ctx->basepath = flt_path_base(of->filename); // for the external references
 
-    flt_node_add(of,(flt_node*)group);
-  }
-  return leftbytes;
+  return flt_load_records(of);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// preparing internal obj (references and shared dict)
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_lod)
+flt_context* flt_load_begin(flt* of, flt_opts* opts)
 {
-  flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
-  flt_node_lod* lod;
-  fltu32* u32;
-  double *dbl, *tgdbl;
-  int i;
+  flt_context* ctx;
 
-  leftbytes -= (int)fread(ctx->tmpbuff,1,flt_min(leftbytes,76),ctx->f);
+  of->loaded = FLT_LOADING;
+  ctx = (flt_context*)flt_calloc(1,sizeof(flt_context));
+  if ( !ctx ) return FLT_NULL;
+  ctx->opts = opts;  
+  ctx->pflags = opts->pflags;
+  ctx->hflags = opts->hflags;
+  ctx->lflags = opts->lflags;
+  flt_weld_eps(opts, ctx->weld);
+  flt_lod_range(opts, ctx->lod_range);
+
+  // storage of the load first: on failure there's no context attached to release (of's own is freed by flt_release)
+  if ( ((opts->lflags & FLT_OPT_LOAD_ARENA) && !of->arena && !flt_arena_create(&of->arena, FLT_ARENA_CHUNK_SIZE))
+    || ((opts->lflags & FLT_OPT_LOAD_NAMES) && !of->names && !flt_names_create(&of->names, FLT_NAMES_SIZE))
+    || ((opts->lflags & FLT_OPT_LOAD_STATS) && !of->stats && !(of->stats = (flt_stats*)flt_calloc(1,sizeof(flt_stats))))
+#ifdef FLT_UNIQUE_FACES
+    || !flt_facetable_create(&of->faces, opts->dfaces_size ? opts->dfaces_size: FLT_DICTFACES_SIZE)
+    || ((opts->lflags & FLT_OPT_LOAD_INDEX_STREAMS) 
+      ? !flt_tris_create(&of->tris, (opts->indices_size ? opts->indices_size : FLT_INDICES_SIZE)/3)
+      : !flt_array_create(&of->indices, opts->indices_size ? opts->indices_size : FLT_INDICES_SIZE, flt_array_grow_double))
+#endif
+    || !flt_stack_create(&ctx->stack,opts->stacksize) ) // nodes stack, last (nothing of ctx to release before it)
   {
-    lod = (flt_node_lod*)flt_node_create(of->ctx->opts->hflags,FLT_NODE_LOD,ctx->tmpbuff);
-    flt_mem_check(lod,of->errcode);
+    flt_free(ctx);
+    return FLT_NULL;
+  }
+  if ( opts->lflags & FLT_OPT_LOAD_STATS )
+  {
+    of->stats->files = 1;
+    of->stats->load_time = flt_time(); // start, elapsed at the end
+  }
 
-    flt_getswapdbl(lod->switch_in,12);
-    flt_getswapdbl(lod->switch_out,20);    
-    flt_getswapu32(lod->flags,32);
-    dbl+=2; tgdbl=lod->cnt_coords;
-    for (i=0;i<5;++i,++dbl){ flt_swap64(dbl); tgdbl[i]=*dbl; }
-    
-    flt_node_add(of,(flt_node*)lod);
+  if (of->ctx ) // reuse some stuff from input of->context
+  {
+    if ( of->ctx->dict )
+    {
+      ctx->dict = of->ctx->dict;
+      flt_atomic_inc(&of->ctx->dict->ref);
+    }
+    ctx->cur_depth = of->ctx->cur_depth;
+    ctx->xrefjob = of->ctx->xrefjob;
   }
-  return leftbytes;
+  of->ctx = ctx;
+  if ( !ctx->dict ) // if not sharing dict
+    flt_dict_create(FLT_HASHTABLE_SIZE,FLT_DICT_CONCURRENT,&ctx->dict, flt_dict_hash_djb2, flt_dict_keycomp_string);
+  flt_atomic_inc(&of->ref); // increments this of reference
+  return ctx;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// reads all the records from the input (file or memory) already opened in of->ctx
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_mesh)
+int flt_load_records(flt* of)
 {
+  flt_op oh;
+  flti32 skipbytes;  
+  flt_rec_reader readtab[FLT_OP_MAX]={0};  
   flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
-  fltu32* u32; flti32* i32; fltu16* u16; flti16* i16;
-  flt_face* attr;
-
-  leftbytes -= (int)fread(ctx->tmpbuff,1,leftbytes,ctx->f);
-  flt_node_mesh* mesh = (flt_node_mesh*)flt_node_create(ctx->opts->hflags, FLT_NODE_MESH, ctx->tmpbuff);
-  flt_mem_check(mesh,of->errcode);
-  attr=&mesh->attribs;
+  flt_opts* opts=ctx->opts;
+  flt_stats* stats=of->stats;
+  double t0=0.0;
+  fltu64 end;
+  fltu32 r;
+  char use_pal=0, use_node=0;  
 
-  // same as face record but different offsets
-  attr->billb = (fltu8)*(ctx->tmpbuff+25);
-  flt_getswapi16(attr->texbase_pat, 28);
-  flt_getswapi16(attr->texdetail_pat, 26);
-  flt_getswapi16(attr->mat_pat, 30);
-  flt_getswapi32(attr->flags,44);
-  flt_getswapu32(attr->abgr,52);
-  flt_getswapu16(attr->shader_ndx,78);
-#ifndef FLT_LEAN_FACES  
-  flt_getswapi32(attr->ir_color,12);
-  flt_getswapi32(attr->ir_mat,36);
-  flt_getswapi16(attr->smc_id,32);
-  flt_getswapi16(attr->feat_id,34);
-  flt_getswapi16(attr->transp, 40);
-  flt_getswapu16(attr->cname_ndx,20);
-  flt_getswapu16(attr->cnamealt_ndx,22);
-  flt_getswapu16(attr->texmapp_ndx,64);
-  attr->draw_type = *(fltu8*)(ctx->tmpbuff+18);
-  attr->light_mode = *(fltu8*)(ctx->tmpbuff+48);
-  attr->lod_gen = *(fltu8*)(ctx->tmpbuff+42);
-  attr->linestyle_ndx = *(fltu8*)(ctx->tmpbuff+43);
-#endif
+  // configuring reading
+  readtab[FLT_OP_HEADER] = flt_reader_header;         // always read header
+  readtab[FLT_OP_PAL_VERTEX] = flt_reader_pal_vertex; // always read vertex palette header for skipping at least
+  if ( opts->pflags & FLT_OPT_PAL_VERTEX )  { use_pal = FLT_TRUE; }
+  if ( opts->pflags & FLT_OPT_PAL_TEXTURE ) { readtab[FLT_OP_PAL_TEXTURE] = flt_reader_pal_tex; use_pal=FLT_TRUE; }  
+  if ( opts->hflags & FLT_OPT_HIE_EXTREF )  { readtab[FLT_OP_EXTREF] = flt_reader_extref; use_node=FLT_TRUE; }
+  if ( opts->hflags & FLT_OPT_HIE_OBJECT )  { readtab[FLT_OP_OBJECT] = flt_reader_object; use_node=FLT_TRUE; }
+  if ( opts->hflags & FLT_OPT_HIE_GROUP )   { readtab[FLT_OP_GROUP] = flt_reader_group; use_node=FLT_TRUE; }
+  if ( opts->hflags & FLT_OPT_HIE_LOD )     { readtab[FLT_OP_LOD] = flt_reader_lod; use_node=FLT_TRUE; }
+  if ( opts->hflags & FLT_OPT_HIE_FACE )    { readtab[FLT_OP_FACE] = flt_reader_face; readtab[FLT_OP_VERTEX_LIST]= flt_reader_vertex_list; use_node=FLT_TRUE;}  
+  if (opts->hflags & FLT_OPT_HIE_SWITCH)    { readtab[FLT_OP_SWITCH] = flt_reader_switch; use_node = FLT_TRUE; }
+  if ( opts->hflags & FLT_OPT_HIE_MESH )    
+  { 
+    readtab[FLT_OP_MESH] = flt_reader_mesh; 
+    readtab[FLT_OP_LOCAL_VERTEX_POOL] = flt_reader_local_vertex_pool;
+    readtab[FLT_OP_MESH_PRIMITIVE] = flt_reader_mesh_primitive;
+    use_node=FLT_TRUE; 
+  }  
+  if (use_pal)
+  {
+    of->pal = (flt_palettes*)flt_calloc(1,sizeof(flt_palettes));
+    flt_mem_check2(of->pal,of);
+  }
 
-  flt_node_add(of, (flt_node*)mesh);
+  if (use_node)
+  {
+    if (!(ctx->opts->hflags & FLT_OPT_HIE_NO_NAMES))
+      readtab[FLT_OP_LONGID] = flt_reader_longid;
+    readtab[FLT_OP_PUSHLEVEL] = flt_reader_pushlv;
+    readtab[FLT_OP_POPLEVEL] = flt_reader_poplv;
 
-  return leftbytes;
-}
+    // hierarchy (root should be always)
+    of->hie = (flt_hie*)flt_calloc(1,sizeof(flt_hie));
+    flt_mem_check2(of->hie, of);
+    of->hie->node_root = flt_node_alloc(of, FLT_NODE_BASE, "root");
+    flt_mem_check2(of->hie->node_root, of);
+    flt_stack_pushn(ctx->stack, of->hie->node_root);
+  }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_local_vertex_pool)
-{
-  flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
-  fltu32* u32;
+  // Reading Loop! (only the ranges of the file if loading a part)
+  for ( r=0; r<flt_max(ctx->nranges,1); ++r )
+  {
+    end = (fltu64)-1;
+    if ( ctx->nranges )
+    {
+      if ( !flt_input_seek(ctx, ctx->ranges[r*2]) ) return flt_err(FLT_ERR_RECIDX,of);
+      end = ctx->ranges[r*2+1];
+      if ( r && use_node ) flt_stack_pushn(ctx->stack,FLT_NULL); // subtree as a child of the root
+    }
 
-  FLT_ASSERT(leftbytes != 0xffff); // there'll be a continuation record, do something!
-  flt_node_mesh* mesh = (flt_node_mesh*)flt_stack_topn_not_null(ctx->stack);
-  FLT_ASSERT(mesh->base.type==FLT_NODE_MESH);
-  if ( mesh->base.type==FLT_NODE_MESH )
+    while ( flt_input_tell(ctx) < end && flt_read_ophead(FLT_OP_DONTCARE, &oh, ctx) )
+    {
+      if ( !(++ctx->rec_count % FLT_ASYNC_RECORDS) && of->async && flt_async_poll(of) ) // progress, canceled?
+        return flt_err(FLT_ERR_CANCELED,of);
+      if ( ctx->lod_skip && flt_lod_skip(ctx, oh.op) ) // below a LOD not kept
+      {
+        flt_rec_skip(ctx, oh.length-sizeof(flt_op));
+        if ( stats ) stats->skipped_bytes += oh.length;
+        continue;
+      }
+      if ( stats ) t0 = flt_time();
+
+      // if reader function available, use it
+      skipbytes = ( readtab[oh.op] && !(opts->hflags&FLT_OPT_HIE_GO_THROUGH) ) ? readtab[oh.op](&oh, of) : oh.length-sizeof(flt_op);    
+
+      // if returned negative, it's an error, if positive, we skip until next record
+      if ( skipbytes < 0 )        return flt_err(FLT_ERR_READBEYOND_REC,of);
+      else if ( skipbytes > 0 )   flt_rec_skip(ctx,skipbytes);
+
+      if ( stats )
+      {
+        ++stats->rec_count[oh.op];
+        stats->rec_bytes[oh.op] += oh.length;
+        stats->rec_time[oh.op] += flt_time()-t0;
+      }
+    }
+  }
+
+  if ( use_node && (opts->lflags & FLT_OPT_LOAD_BOUNDS) )
   {
-    mesh->vb = (flt_mesh_vb*)flt_malloc(sizeof(flt_mesh_vb));
-    flt_mem_check(mesh->vb,of->errcode);
-    leftbytes -= (int)fread(ctx->tmpbuff,1,sizeof(fltu32)*2,ctx->f);
-    flt_getswapu32(mesh->vb->count,0);
-    flt_getswapu32(mesh->vb->semantic,4);
+    while ( ctx->stack->count>1 ) // levels not popped (truncated file)
+      flt_bounds_up(of, flt_stack_popn(ctx->stack), flt_stack_topn_not_null(ctx->stack));
   }
-  fprintf( stderr, "LOCAL VERTEX POOL NOT SUPPORTED\n" );
-  return leftbytes;
+  flt_stack_popn(ctx->stack); // root
+  flt_stack_destroy(&ctx->stack); // no needed anymore (also released in flt_release)
+  flt_safefree(ctx->lod_sets); ctx->lod_levels=0;
+  flt_safefree(ctx->vtx_starts);
+  if (of->pal && of->pal->vtx_array) 
+    flt_safefree(of->pal->vtx_buff); // not needed the buffer anymore if we go the array
+
+  // writing the cache for next loads (failing to write it doesn't fail the load)
+  if ( ctx->cachefile )
+  {
+    flt_save_cache(of,ctx->cachefile,of->filename);
+    flt_safefree(ctx->cachefile);
+  }
+  return flt_load_end(of);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// of is filled (from records or cache). resolves the xrefs
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_mesh_primitive)
+int flt_load_end(flt* of)
 {
-  //flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
-  //fltu32* u32; flti32* i32; fltu16* u16; flti16* i16;
-  fprintf( stderr, "MESH PRIMITIVE NOT SUPPORTED\n" );
+  if ( of->async && of->async->cancel ) 
+    return flt_err(FLT_ERR_CANCELED,of);
+#ifdef FLT_UNIQUE_FACES
+  if ( (of->ctx->opts->lflags & FLT_OPT_LOAD_BATCHES) && flt_batches_build(of)!=FLT_OK )
+    return flt_err(FLT_ERR_MEMOUT,of);
+#endif
+  if ( of->stats ) of->stats->load_time = flt_time()-of->stats->load_time;
+  if (of->ctx->opts->hflags & FLT_OPT_HIE_EXTREF_RESOLVE && of->hie)
+    flt_resolve_all_extref(of);  
 
-  return leftbytes;
+  of->loaded = FLT_LOADED;
+  return flt_err(FLT_OK,of);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// Streaming parse. Records go to the callback as they're read, no hierarchy, palettes or dict.
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_longid)
+int flt_parse_from_filename(const char* filename, flt_opts* opts, flt_callback_record cb, void* user_data)
 {
-  flt_context* ctx=of->ctx;
-  int leftbytes = oh->length-sizeof(flt_op);
+  flt of;
+  flt_opts defopts;
+  flt_context* ctx;
+  int err=FLT_ERR_FOPEN;
 
-  flt_node* top = flt_stack_topn(ctx->stack);
-  if ( top )
+  if ( !opts ) { memset(&defopts,0,sizeof(defopts)); opts=&defopts; }
+  memset(&of,0,sizeof(of));
+  ctx = (flt_context*)flt_calloc(1,sizeof(flt_context));
+  if ( !ctx ) return FLT_ERR_MEMOUT;
+  ctx->opts = opts;
+  of.ctx = ctx; // flt_fopen resolves the search paths with it
+
+  if ( flt_fopen(filename, &of) )
   {
-    leftbytes -= (int)fread(ctx->tmpbuff, 1, flt_min(leftbytes,512),ctx->f);
-    top->name = (char*)flt_realloc(top->name,strlen(ctx->tmpbuff)+1);
-    flt_mem_check(top->name,of->errcode);
-    strcpy(top->name,ctx->tmpbuff);
+    if ( opts->lflags & FLT_OPT_LOAD_MMAP )
+    {
+      ctx->mapview = flt_mmap_file(ctx->f, &ctx->mapsize);
+      if ( ctx->mapview )
+      {
+        ctx->mem = (const fltu8*)ctx->mapview;
+        ctx->memsize = ctx->mapsize;
+      }
+    }
+    if ( !ctx->mem && !flt_blockreader_create(&ctx->br, ctx->f, opts->block_size ? opts->block_size : FLT_BLOCK_SIZE, 
+      (opts->lflags & FLT_OPT_LOAD_READAHEAD)!=0) )
+      err = FLT_ERR_MEMOUT;
+    else
+      err = flt_parse_records(ctx, cb, user_data);
   }
-  
-  return leftbytes;
+  flt_input_close(ctx);
+  flt_safefree(ctx->basepath);
+  flt_safefree(of.filename);
+  flt_free(ctx);
+  return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_pal_vertex)
+int flt_parse_from_memory(const void* data, fltu64 size, flt_callback_record cb, void* user_data)
 {
-  flt_context* ctx=of->ctx;
-  flt_opts* opts=ctx->opts;
-  int leftbytes, palbytes;
-  fltu32 vsize = 0;
+  flt_context* ctx;
+  int err;
 
-  // record header
-  leftbytes = oh->length - sizeof(flt_op);
-  leftbytes -= (int)fread(&palbytes,1,flt_min(leftbytes,4),ctx->f);
-  flt_swap32(&palbytes); 
-  palbytes -= sizeof(flt_op) + 4;
-  leftbytes = palbytes; // size of palette minus header and marker
-  
-  // read vertices from palette?
-  if ( palbytes && opts->pflags & FLT_OPT_PAL_VERTEX )
+  if ( !data ) return FLT_ERR_FOPEN;
+  ctx = (flt_context*)flt_calloc(1,sizeof(flt_context));
+  if ( !ctx ) return FLT_ERR_MEMOUT;
+  ctx->mem = (const fltu8*)data;
+  ctx->memsize = size;
+  err = flt_parse_records(ctx, cb, user_data);
+  flt_input_close(ctx);
+  flt_free(ctx);
+  return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// the record loop of the streaming parse. records crossing two blocks are copied into the scratch.
+// skipping a level counts the push/pop inside it without calling back.
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_parse_records(flt_context* ctx, flt_callback_record cb, void* user_data)
+{
+  flt_op oh;
+  flt_record rec;
+  fltu64 offset=0;
+  fltu32 depth=0, skiplevels=0;
+  int ret, err=FLT_OK;
+  char skipnext=FLT_FALSE, popnext=FLT_FALSE; // pending skip of the next level / report the pop of a skipped level
+  char report;
+
+  while ( flt_read_ophead(FLT_OP_DONTCARE, &oh, ctx) )
   {
-    // saves the whole vertex
-    of->pal->vtx_buff = (fltu8*)flt_malloc( palbytes ); 
-    flt_mem_check(of->pal->vtx_buff, of->errcode);
-    leftbytes -= (int)fread(of->pal->vtx_buff, 1, palbytes, ctx->f);
+    if ( oh.length < sizeof(flt_op) ) { err=FLT_ERR_OPREAD; break; }
+    rec.op = oh.op;
+    rec.length = oh.length;
+    rec.offset = offset;
+    rec.size = oh.length-sizeof(flt_op);
+    offset += oh.length;
+
+    // in a skipped level (only its outer push/pop move the depth)
+    if ( skiplevels || (skipnext && oh.op==FLT_OP_PUSHLEVEL) )
+    {
+      report = FLT_FALSE;
+      skipnext = FLT_FALSE;
+      if ( oh.op==FLT_OP_PUSHLEVEL && ++skiplevels==1 ) ++depth;
+      else if ( oh.op==FLT_OP_POPLEVEL && --skiplevels==0 ) { --depth; report=popnext; popnext=FLT_FALSE; }
+      if ( !report ) { flt_rec_skip(ctx,rec.size); continue; }
+    }
+    else
+    {
+      if ( skipnext && flt_parse_skips_to(oh.op) ) skipnext=FLT_FALSE; // the node skipped had no children
+      if ( oh.op==FLT_OP_POPLEVEL && depth ) --depth;
+    }
 
-    vsize = flt_compute_vertex_size(opts->pflags);
-    if (vsize)
+    // record data, in place or in the scratch if crossing blocks
+    rec.size = (fltu32)flt_rec_read(ctx, rec.size);
+    if ( !ctx->rec ) { err=FLT_ERR_MEMOUT; break; }
+    rec.data = ctx->rec;
+    rec.depth = depth;
+    ret = cb(&rec, user_data);
+    if ( oh.op==FLT_OP_PUSHLEVEL ) ++depth;
+
+    if ( ret == FLT_SAX_STOP ) break;
+    if ( ret == FLT_SAX_SKIP )
     {
-      palbytes /= 40; // upper bound of vertices
-      of->pal->vtx_array = (fltu8*)flt_malloc(palbytes*vsize);
-      flt_mem_check(of->pal->vtx_array, of->errcode);
-      of->pal->vtx_count = 0;
+      if ( oh.op==FLT_OP_PUSHLEVEL ) { skiplevels=1; popnext=FLT_TRUE; } // rest of this level, its pop reported
+      else if ( oh.op!=FLT_OP_POPLEVEL ) skipnext=FLT_TRUE;
     }
   }
-
-  return leftbytes;
+  return err;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma warning(disable:4101 4189) // use under gcc: #pragma GCC diagnostic
-FLT_RECORD_READER(flt_reader_face)
+// records ending a pending skip: the skipped record was a leaf and this one starts another node
+int flt_parse_skips_to(fltu16 op)
 {
-  flt_context* ctx=of->ctx;
-  flt_node *parent, *sibling;
-  int leftbytes = oh->length-sizeof(flt_op);
-  flti32* i32; flti16* i16; fltu16* u16; fltu32* u32;
-#ifdef FLT_UNIQUE_FACES
-  fltu32 facehash;
-  fltu32 hashentry;
-  flt_face *lface, *lfacelast;
-#else
-  flt_node_face* nodeface;
-#endif
-  flt_face tmpf={0};
-  flt_face* face=&tmpf;
-  flt_atomic_inc(&TOTALNFACES);
+  switch ( op )
+  {
+  case FLT_OP_HEADER: case FLT_OP_GROUP: case FLT_OP_OBJECT: case FLT_OP_FACE: case FLT_OP_LOD: 
+  case FLT_OP_MESH: case FLT_OP_EXTREF: case FLT_OP_SWITCH: case FLT_OP_POPLEVEL: 
+    return FLT_TRUE;
+  }
+  return FLT_FALSE;
+}
 
-  leftbytes -= (int)fread(ctx->tmpbuff,1,flt_min(leftbytes,76),ctx->f);
+fltu16 flt_record_u16(const flt_record* rec, fltu32 offs)
+{
+  return offs+2 <= rec->size ? flt_get16(rec->data+offs) : 0;
+}
 
-  face->billb = (fltu8)*(ctx->tmpbuff+21);
-  flt_getswapi16(face->texbase_pat, 22);
-  flt_getswapi16(face->texdetail_pat, 24);
-  flt_getswapi16(face->mat_pat, 26);
-  flt_getswapi32(face->flags,40);
-  flt_getswapu32(face->abgr,52);
-  flt_getswapu16(face->shader_ndx,74);
-#ifndef FLT_LEAN_FACES  
-  flt_getswapi32(face->ir_color,8);
-  flt_getswapi32(face->ir_mat,32);
-  flt_getswapi16(face->smc_id,28);
-  flt_getswapi16(face->feat_id,30);
-  flt_getswapi16(face->transp, 36);
-  flt_getswapu16(face->cname_ndx,16);
-  flt_getswapu16(face->cnamealt_ndx,18);
-  flt_getswapu16(face->texmapp_ndx,60);
-  face->draw_type = *(fltu8*)(ctx->tmpbuff+14);
-  face->light_mode = *(fltu8*)(ctx->tmpbuff+44);
-  face->lod_gen = *(fltu8*)(ctx->tmpbuff+38);
-  face->linestyle_ndx = *(fltu8*)(ctx->tmpbuff+39);
-#endif
+fltu32 flt_record_u32(const flt_record* rec, fltu32 offs)
+{
+  return offs+4 <= rec->size ? flt_get32(rec->data+offs) : 0;
+}
 
-#ifdef FLT_UNIQUE_FACES
-  // if we compiled for face palettes, let's do the hash thing 
-  // we store the face hash in every face node
-  facehash=flt_dict_hash_face_djb2((const unsigned char*)face, FLT_FACESIZE_HASH);
-  // any face with same hash exists?
-  face=(flt_face*)flt_dict_geth(ctx->dictfaces, (const char*) face, FLT_FACESIZE_HASH, facehash, &hashentry);
-  if ( !face )
-  {
-    flt_atomic_inc(&TOTALUNIQUEFACES);
-    // if it's unique, add it to dictionary of faces. 
-    face = (flt_face*)flt_malloc(sizeof(flt_face));
-    flt_mem_check(face,of->errcode);    
-    *face = tmpf;
-#ifndef FLT_LEAN_FACES
-    if ( !(ctx->opts->hflags & FLT_OPT_HIE_NO_NAMES) && *ctx->tmpbuff )
-      face->name = flt_strdup(ctx->tmpbuff);
-#endif
-    flt_dict_insert(ctx->dictfaces, (const char*)face, face, FLT_FACESIZE_HASH, facehash, &hashentry);
-  }  
+float flt_record_flo(const flt_record* rec, fltu32 offs)
+{
+  return offs+4 <= rec->size ? flt_getflo(rec->data+offs) : 0.0f;
+}
 
-  flt_stack_popn(ctx->stack);
-  flt_stack_push32(ctx->stack, hashentry);
-#else
-  // creating node for every face
-  nodeface = (flt_node_face*)flt_node_create(of->ctx->opts->hflags, FLT_NODE_FACE,ctx->tmpbuff);
-  flt_mem_check(nodeface,of->errcode);
-  // whole face info in node
-  nodeface->face = tmpf;
-  flt_node_add(of, (flt_node*)nodeface);
-  flt_atomic_inc(&TOTALUNIQUEFACES);
-#endif
-  
+double flt_record_dbl(const flt_record* rec, fltu32 offs)
+{
+  return offs+8 <= rec->size ? flt_getdbl(rec->data+offs) : 0.0;
+}
 
-  return leftbytes;
+fltu32 flt_record_str(const flt_record* rec, fltu32 offs, fltu32 maxlen, char* dst, fltu32 dstsize)
+{
+  fltu32 len=0;
+  if ( !dstsize ) return 0;
+  if ( offs < rec->size )
+  {
+    maxlen = flt_min(flt_min(maxlen, rec->size-offs), dstsize-1);
+    while ( len < maxlen && rec->data[offs+len] ) ++len;
+    memcpy(dst, rec->data+offs, len);
+  }
+  dst[len]=0;
+  return len;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_vertex_list)
+char* flt_extref_prepare(struct flt_node_extref* extref, struct flt* of)
 {
-  flt_context* ctx=of->ctx;
-#ifndef FLT_UNIQUE_FACES
-  flt_node_vlist* vlistnode;
-#endif
-  int leftbytes = oh->length-sizeof(flt_op);
-  fltu32 n_inds=(oh->length-4)>>2;
-  fltu32 i,k;
-  fltu32 tarr[3];
-#ifdef FLT_UNIQUE_FACES
-  const fltu32 max_ninds_read = sizeof(ctx->tmpbuff)/4; // max no of indices can be read at once
-  fltu32* inds=(fltu32*)ctx->tmpbuff; // indices array
-  fltu32 vtxoffset;
-  fltu64* pair;
-  fltu32 thisndxstart,thisndxend,ndxstart,ndxend;
-  flt_node* parentn;
+  char* basefile=FLT_NULL;
+  flt_context* oldctx = of->ctx;
+  flt* newof=FLT_NULL;
+  size_t len;
 
-  if ( !n_inds || !leftbytes ) return 0;
+  if ( !extref || !of ) 
+    return FLT_NULL;
 
-  // we get the top not null, which is my hash entry number for the unique face in the dict
-  FLT_ASSERT(n_inds<max_ninds_read);
-  fltu32 hashe = flt_stack_top32_not_null(ctx->stack);
-  if ( hashe != 0xffffffff )
+  // check if reference has been loaded already
+  extref->of = (struct flt*)flt_dict_get(of->ctx->dict, extref->base.name, 0);
+  if ( !extref->of ) // does not exist, creates one, register in dict and passes dict
   {
-    // get the parent node from stack
-    parentn=flt_stack_topn_not_null(ctx->stack);
-    FLT_ASSERT(parentn && "Vertex list with no parent node, skipping");
-    if ( parentn )
+    newof = (flt*)flt_calloc(1,sizeof(flt));
+    if ( !newof ) return FLT_NULL;
+    newof->future = flt_future_create(); // before publishing it, others might wait on it
+    if ( !newof->future ) { flt_free(newof); return FLT_NULL; }
+
+    // another thread might have registered it meanwhile, only one of them loads it
+    extref->of = (flt*)flt_dict_insert_unique(of->ctx->dict, extref->base.name, newof, 0);
+    if ( extref->of != newof ) 
     {
-      thisndxstart=of->indices->size;
+      flt_future_destroy(&newof->future);
+      flt_safefree(newof);
+    }
+  }
 
-      // make sure indices array has enough memory for new indices
-      flt_array_ensure(of->indices, n_inds); 
+  if ( newof )
+  {
+    newof->ctx = of->ctx; 
 
-      // only read the capacity of our temporary buffer
-      FLT_ASSERT(n_inds <= max_ninds_read); // increase tmpbuff or ignore other indices      
-      n_inds = flt_min(n_inds,max_ninds_read);
-      leftbytes -= (int)fread(ctx->tmpbuff, 1, n_inds<<2,ctx->f);
+    // Creates the full path for the external reference (uses same base path as parent)
+    if (oldctx->basepath)
+    {
+      len = strlen(oldctx->basepath);
+      basefile = (char*)flt_malloc(len+strlen(extref->base.name)+2);
+      if ( basefile )
+      {
+        strcpy(basefile, oldctx->basepath);
+        if ( !flt_path_endsok(oldctx->basepath) ) basefile[len++]='/';
+        strcpy(basefile+len, extref->base.name);
+      }
+    }
+    else
+      basefile = flt_strdup(extref->base.name);
 
-      // this loop is to triangulate like a fan (convex) polygon when n_inds > 3. Also work with n_inds==3
-      if ( n_inds >= 3 )
-      { 
-        // we got this batch of indices, let's swap it and encode it with the hash entry code
-        for (i=0;i<n_inds;++i) flt_swap32(inds+i);
-        tarr[0]=0;
-        for (k=2;k<n_inds;++k)
-        {
-          tarr[1]=k-1;
-          tarr[2]=k;
-          for (i=0;i<3;++i)
-          {
-            vtxoffset = inds[tarr[i]];            
-            vtxoffset -= sizeof(flt_op) + 4; // correct offset
+    // no path, nobody would complete it
+    if ( !basefile ) { newof->errcode=FLT_ERR_MEMOUT; flt_future_complete(newof); }
+  }
+  else if ( extref->of )
+  {
+    // file already loaded (or being loaded). uses and inc reference count
+    flt_atomic_inc(&extref->of->ref);
+  }
 
-            // if there's an array, then the vertices have to be compressed (remove boilerplate opcode data)
-            if (of->pal->vtx_array)
-            {
-              // get the opcode in vertex opcodes buffer
-              if (*(fltu16*)(of->pal->vtx_buff + vtxoffset) != 0)
-              {
-                flt_vertex_write(of, vtxoffset);
-              }
-              vtxoffset = *(fltu32*)(of->pal->vtx_buff + vtxoffset + 2);
-            }
-            flt_array_push_back(of->indices, FLTMAKE64(hashe,vtxoffset));
-          }
-        }
-      }
+  
+  return basefile;
+}
 
-      thisndxend = of->indices->size-1; // last index
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_resolve_all_extref(flt* of)
+{
+  flt_context* ctx=of->ctx;
+  flt_opts* opts=ctx->opts;
+  char* basefile;
+  flt_node_extref* extref=of->hie->extref_head;
+  flt_xrefjob* job=ctx->xrefjob;
+  int owner=FLT_FALSE;
 
-      // if no pairs (start/end) creates one
-      if (!parentn->ndx_pairs)
-      {
-        pair = parentn->ndx_pairs = (fltu64*)flt_malloc(sizeof(fltu64));        
-        parentn->ndx_pairs_count=1;
-      }
-      else
-      {
-        // there are pairs, check if we need to add one more or concat to last one
-        pair = parentn->ndx_pairs + (parentn->ndx_pairs_count-1);
-        FLTGET32(*pair, ndxstart, ndxend);
-        if ( ndxend+1 == thisndxstart )
-        {
-          // reuse last pair, same start, new end
-          thisndxstart=ndxstart;
-        }
-        else
-        {
-          // add new pair (regrow array with one more element) (should i double capacity?)
-          i=parentn->ndx_pairs_count;
-          parentn->ndx_pairs = (fltu64*)flt_realloc(parentn->ndx_pairs, sizeof(fltu64)*(i+1));
-          pair += i; // set the last pair
-          parentn->ndx_pairs_count= i+1;
-        }
-      }
+  // parallel: this file starts the job or is already a task of one (then its xrefs go to the same job)
+  if ( !job && (opts->xref_threads>1 || opts->cb_exec) && flt_xrefjob_create(&job,opts) )
+  {
+    ctx->xrefjob = job;
+    owner = FLT_TRUE;
+  }
 
-      *pair = FLTMAKE64(thisndxstart,thisndxend);
-    }
-  }  
-#else
-  // using normal vertex list node, create the node, create the indices array and add the node
-  if ( n_inds )
+  while(extref)
   {
-    vlistnode = (flt_node_vlist*)flt_node_create(of->ctx->opts->hflags, FLT_NODE_VLIST, FLT_NULL);
-    vlistnode->count = n_inds;
-    vlistnode->indices = (fltu32*)flt_malloc(sizeof(fltu32)*n_inds);
-    flt_mem_check(vlistnode->indices,of->errcode);
-    leftbytes -= (int)fread(vlistnode->indices,1,sizeof(fltu32)*n_inds,ctx->f);
-    for (i=0;i<n_inds;++i) { flt_swap32(vlistnode->indices+i); }    
-    flt_node_add(of, (flt_node*)vlistnode);
+    basefile = flt_extref_prepare(extref,of);
+    if ( basefile )
+    {
+      if ( job )
+        flt_xrefjob_submit(job,extref,basefile); // job frees basefile
+      else
+        flt_extref_load(extref,basefile,opts);
+    }
+    extref=(flt_node_extref*)extref->next_extref;
   }
-#endif
 
-  flt_atomic_add(&TOTALINDICES, n_inds);
-  return leftbytes;
+  // whole graph resolved
+  if ( owner )
+  {
+    flt_xrefjob_wait(job);
+    flt_xrefjob_destroy(&job);
+    ctx->xrefjob = FLT_NULL;
+  }
 }
-#pragma warning(default:4101 4189)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// loads the flt of a prepared extref. on error, the flt stays referenced with its errcode
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_switch)
+void flt_extref_load(flt_node_extref* extref, char* basefile, flt_opts* opts)
 {
-  flt_context* ctx = of->ctx;
-  flt_node_switch* switchnode;
-  int leftbytes = oh->length - sizeof(flt_op);
-  fltu32* u32;
-  fltu32 i,end;
+  flt_load_from_filename(basefile, extref->of, opts);
+  flt_safefree(basefile);
+}
 
-  leftbytes -= (int)fread(ctx->tmpbuff,1,leftbytes,ctx->f);  
-  switchnode = (flt_node_switch*)flt_node_create(ctx->opts->hflags, FLT_NODE_SWITCH, ctx->tmpbuff);
-  flt_mem_check(switchnode,of->errcode);
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+FLT_RECORD_READER(flt_reader_header)
+{
+  flt_end_desc  desc[]={ 
+    {32, 2, flt_offsetto(format_rev,flt_header)},
+    {16, 5, flt_offsetto(n_group_nid,flt_header)},
+    {32,15, flt_offsetto(flags,flt_header)},
+    {16, 2, flt_offsetto(n_dof_nid,flt_header)},
+    {32, 1, flt_offsetto(db_orig,flt_header)},
+    {64, 4, flt_offsetto(sw_db_x,flt_header)},
+    {16, 2, flt_offsetto(n_sound_nid,flt_header)},
+    {16, 4, flt_offsetto(n_clip_nid,flt_header)},
+    {64, 8, flt_offsetto(sw_corner_lat,flt_header)},
+    {16, 5, flt_offsetto(n_lightsrc_nid,flt_header)},
+    {32, 1, flt_offsetto(earth_ellip_model,flt_header)},
+    {16, 3, flt_offsetto(n_adapt_nid,flt_header)},
+    {64, 2, flt_offsetto(d_db_z,flt_header)},
+    {16, 2, flt_offsetto(n_mesh_nid,flt_header)},
+    {64, 2, flt_offsetto(earth_major_axis,flt_header)},
+    {0,0,0}
+  };
+  flt_context* ctx=of->ctx;
+  int leftbytes=oh->length-sizeof(flt_op);
+  flti32 format_rev=0;
+  int i;
 
-  flt_getswapu32(switchnode->cur_mask,12);
-  flt_getswapu32(switchnode->mask_count,16);
-  flt_getswapu32(switchnode->wpm,20);
-    
-  end = switchnode->mask_count * switchnode->wpm;
-  switchnode->maskwords = (fltu32*)flt_calloc(1,sizeof(fltu32)*end);
-  flt_mem_check(switchnode->maskwords,of->errcode);
-  u32 = (fltu32*)(ctx->tmpbuff+24);
-  for (i=0;i<end;++i,++u32)
+  if ( ctx->opts->hflags & FLT_OPT_HIE_HEADER ) 
+  {
+    // if storing header, read it entirely (zeros beyond a short record)
+    of->header = (flt_header*)flt_calloc(1,sizeof(flt_header));
+    flt_mem_check(of->header, of->errcode);
+    leftbytes -= flt_rec_copy(ctx, of->header, flt_min(leftbytes,sizeof(flt_header)));  
+    flt_swap_desc(of->header,desc); // endianess
+    format_rev = of->header->format_rev;
+    // remove dtime line breaks
+    for (i=0;i<32;++i) if (of->header->dtime[i]=='\n' || of->header->dtime[i]=='\r') of->header->dtime[i]=' ';
+  }
+  else
   {
-    flt_swap32(u32);
-    switchnode->maskwords[i]=*u32;
+    // if no header needed, just read the version
+    flt_rec_skip(ctx,8); leftbytes-=8;
+    leftbytes -= flt_rec_read(ctx,4);
+    flt_mem_check(flt_rec_pad(ctx,4),of->errcode);
+    flt_getswapi32(format_rev,0);
+  }
+
+  // checking version
+  if ( format_rev > FLT_VERSION ) 
+  { 
+    leftbytes = -1; 
+    of->errcode=FLT_ERR_VERSION; 
   }
-  flt_node_add(of,(flt_node*)switchnode);
 
   return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FLT_RECORD_READER(flt_reader_continuation)
+FLT_RECORD_READER(flt_reader_pushlv)
 {
   flt_context* ctx=of->ctx;
   int leftbytes = oh->length-sizeof(flt_op);
-  
-  fltu8* contdata = (fltu8*)flt_malloc(leftbytes);
-  leftbytes -= (int)fread(contdata,1,leftbytes,ctx->f);
 
-  FLT_BREAK_ALWAYS; // !! NOT IMPLEMENTED YET !! 
-  
-  // it will depend on the last record
-  switch ( ctx->op_last )
-  {
-  case FLT_OP_LOCAL_VERTEX_POOL: break;
-  case FLT_OP_MESH_PRIMITIVE: break;
-  case FLT_OP_VERTEX_LIST: break;
-  }
-  
-  flt_free(contdata);
+  flt_stack_pushn(ctx->stack,FLT_NULL);
+
   return leftbytes;
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-fltu32 flt_compute_vertex_size(fltu32 palopts)
+FLT_RECORD_READER(flt_reader_poplv)
 {
-  fltu32 size = 0;
-
-  if (palopts & FLT_OPT_PAL_VTX_POSITION)
-  {
-    if (palopts & FLT_OPT_PAL_VTX_POSITION_SINGLE)
-      size += sizeof(float) * 3;
-    else
-      size += sizeof(double) * 3;
-  }
-
-  if (palopts & FLT_OPT_PAL_VTX_NORMAL) size += sizeof(float) * 3;
-  if (palopts & FLT_OPT_PAL_VTX_UV)     size += sizeof(float) * 2;
-  if (palopts & FLT_OPT_PAL_VTX_COLOR)  size += sizeof(fltu32);
+  flt_context* ctx=of->ctx;
+  int leftbytes = oh->length-sizeof(flt_op);  
+  flt_node* last = flt_stack_popn(ctx->stack);
 
-  return size;
+  // last node of the level complete, bounds to the parent
+  if ( last && last->bounds ) 
+    flt_bounds_up(of, last, flt_stack_topn_not_null(ctx->stack));
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_vertex_write(flt* of, fltu32 vtxoffset)
+FLT_RECORD_READER(flt_reader_pal_tex)
 {
-  const fltu32 vsize = flt_compute_vertex_size(of->ctx->opts->pflags);
-  const fltu8* invtx = of->pal->vtx_buff + vtxoffset;
-  fltu16 op = *(fltu16*)(invtx);
-  fltu8* outvtx = of->pal->vtx_array + vsize*of->pal->vtx_count;
-  const fltu32 flags = of->ctx->opts->pflags;
-  double *xyz = FLT_NULL;
-  float *normal = FLT_NULL;
-  float *uv = FLT_NULL;
-  fltu32 *abgr = FLT_NULL;
-  double *outd;
-  float *outf;
-  fltu32 *outc;
-  fltu32 offs;
-
-  flt_swap16(&op);
-  // getting input data
-  switch (op)
-  {
-  case FLT_OP_VERTEX_COLOR:
-    xyz = (double*)(invtx + 8);
-    abgr = (fltu32*)(invtx + 32);
-    break;
-  case FLT_OP_VERTEX_COLOR_NORMAL:
-    xyz = (double*)(invtx + 8);
-    normal = (float*)(invtx + 32);
-    abgr = (fltu32*)(invtx + 44);
-    break;
-  case FLT_OP_VERTEX_COLOR_UV:
-    xyz = (double*)(invtx + 8);
-    uv = (float*)(invtx + 32);
-    abgr = (fltu32*)(invtx + 40);
-    break;
-  case FLT_OP_VERTEX_COLOR_NORMAL_UV:
-    xyz = (double*)(invtx + 8);
-    normal = (float*)(invtx + 32);
-    uv = (float*)(invtx + 44);
-    abgr = (fltu32*)(invtx + 52);
-    break;
-  }
-
-  // swaping byte ordering
-  flt_swap64(xyz + 0); flt_swap64(xyz + 1); flt_swap64(xyz + 2);
-  flt_swap32(abgr);
-  if (normal) { flt_swap32(normal); flt_swap32(normal + 1); }
-  else { normal = flt_zerovec; }
-  if (uv) { flt_swap32(uv); flt_swap32(uv + 1); }
-  else { uv = flt_zerovec; }
+  int leftbytes=oh->length-sizeof(flt_op);
+  flt_context* ctx = of->ctx;
+  flt_opts* opts=ctx->opts;
 
-  // outputting data
-  offs = 0;
-  if (flags & FLT_OPT_PAL_VTX_POSITION)
-  {
-    if (flags & FLT_OPT_PAL_VTX_POSITION_SINGLE)
-    {
-      outf = (float*)(outvtx + offs);
-      outf[0] = (float)xyz[0]; outf[1] = (float)xyz[1]; outf[2] = (float)xyz[2];
-      offs += sizeof(float) * 3;
-    }
-    else
-    {
-      outd = (double*)(outvtx + offs);
-      outd[0] = xyz[0]; outd[1] = xyz[1]; outd[2] = xyz[2];
-      offs += sizeof(double) * 3;
-    }
-  }
+  flt_pal_tex* newpt;
 
-  if (flags & FLT_OPT_PAL_VTX_NORMAL)
-  {
-    outf = (float*)(outvtx + offs);
-    outf[0] = normal[0]; outf[1] = normal[1]; outf[2] = normal[2];
-    offs += sizeof(float) * 3;
-  }
+  leftbytes -= flt_rec_read(ctx, flt_min(leftbytes,220));
+  flt_mem_check(flt_rec_pad(ctx,212), of->errcode);
+  newpt = (flt_pal_tex*)flt_of_calloc(of,sizeof(flt_pal_tex));
+  flt_mem_check(newpt, of->errcode);
+  newpt->name = flt_of_strdup(of,flt_rec_str(ctx,0,200));
+  flt_getswapi32(newpt->patt_ndx, 200);
+  flt_getswapi32(newpt->xy_loc[0], 204);
+  flt_getswapi32(newpt->xy_loc[1], 208);
 
-  if (flags & FLT_OPT_PAL_VTX_UV)
-  {
-    outf = (float*)(outvtx + offs);
-    outf[0] = uv[0]; outf[1] = uv[1];
-    offs += sizeof(float) * 2;
-  }
+  if ( opts->cb_texture ) 
+    opts->cb_texture(newpt,of,opts->cb_user_data); // callback?
 
-  if (flags & FLT_OPT_PAL_VTX_COLOR)
-  {
-    outc = (fltu32*)(outvtx + offs);
-    *outc = *abgr;
-  }
+  // adding node to list (use last if defined, or the beginning)
+  if ( ctx->pal_tex_last )
+    ctx->pal_tex_last->next = newpt;
+  else
+    of->pal->tex_head = newpt;
 
-  *(fltu16*)(invtx) = 0;
-  *(fltu32*)(invtx + sizeof(fltu16)) = of->pal->vtx_count;
-  ++of->pal->vtx_count;
+  ctx->pal_tex_last = newpt;
+  ++of->pal->tex_count;
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_release(flt* of)
+FLT_RECORD_READER(flt_reader_extref)
 {
-  flt_pal_tex* pt, *pn;
+  flt_context* ctx = of->ctx;
+  flt_opts* opts=ctx->opts;
+  flt_node_extref* newextref=0;
+  int leftbytes = oh->length-sizeof(flt_op);
   
-  if ( !of ) return;
-  // header
-  flt_safefree(of->filename);
-  flt_safefree(of->header);
-#ifdef FLT_UNIQUE_FACES
-  flt_array_destroy(&of->indices);
-#endif
-
-  // palette list
-  if ( of->pal )
+  leftbytes -= flt_rec_read(ctx,flt_min(leftbytes,210));
+  flt_mem_check(flt_rec_pad(ctx,210),of->errcode);
   {
-    // texture pal
-    pt=of->pal->tex_head; 
-    while (pt)
-    { 
-      pn=pt->next; 
-      flt_safefree(pt->name);
-      flt_free(pt); 
-      pt=pn; 
-    } 
-
-    // vertex palette
-    flt_safefree(of->pal->vtx_buff);    
-    flt_safefree(of->pal->vtx_array);
+    // creates
+    newextref = (flt_node_extref*)flt_node_alloc(of, FLT_NODE_EXTREF, flt_rec_str(ctx,0,200));
+    flt_mem_check(newextref, of->errcode);    
+    
+    // set values
+    flt_getswapi32(newextref->flags,204);
+    flt_getswapu16(newextref->view_asbb, 208);
 
-    flt_safefree(of->pal);
-  }
+    // add to hierarchy
+    flt_node_add(of,(flt_node*)newextref);
 
-  // nodes
-  if ( of->hie )
-  {
-    // releasing node hierarchy
-    flt_release_node(of->hie->node_root);
-    flt_safefree(of->hie->node_root);
-    flt_safefree(of->hie);
+    // callback?
+    if ( opts->cb_extref ) 
+      opts->cb_extref(newextref, of, opts->cb_user_data);
   }
 
-  // context
-  if ( of->ctx )
-  {
-#ifdef FLT_UNIQUE_FACES
-    // dict of faces
-    if ( of->ctx->dictfaces )
-      flt_dict_destroy(&of->ctx->dictfaces, FLT_TRUE, flt_face_destroy_name);
-#endif
-    // stack
-    if ( of->ctx->stack )
-      flt_stack_destroy(&of->ctx->stack);
-
-    // dict
-    if ( of->ctx->dict && flt_atomic_dec(&of->ctx->dict->ref)<=0 )
-      flt_dict_destroy(&of->ctx->dict, FLT_FALSE, FLT_NULL);
-
-    // finally context
-    flt_safefree(of->ctx->basepath);
-    flt_safefree(of->ctx);
-  }
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_release_node(flt_node* n)
+FLT_RECORD_READER(flt_reader_object)
 {
-  flt_node *next, *cur;
-  flt_node_extref* eref;
-  flt_node_switch* swi;
-  flt_node_mesh* mesh;
+  flt_context* ctx=of->ctx;
+  int leftbytes = oh->length-sizeof(flt_op);
+  flt_node_object* newobj;
 
-#if !defined(FLT_UNIQUE_FACES) && !defined(FLT_LEAN_FACES)
-  flt_node_face* nodeface;
-#endif
-#ifndef FLT_UNIQUE_FACES
-  flt_node_vlist* vlist;
-#endif
+  // read and create node
+  leftbytes -= flt_rec_read(ctx,flt_min(leftbytes,24));
+  flt_mem_check(flt_rec_pad(ctx,16),of->errcode);
+  {
+    newobj = (flt_node_object*)flt_node_alloc(of, FLT_NODE_OBJECT, flt_rec_str(ctx,0,8));
+    flt_mem_check(newobj, of->errcode);
 
-  if (!n) return;
+    // set values
+    flt_getswapu32(newobj->flags, 8);
+    flt_getswapi16(newobj->priority,12);
+    flt_getswapi16(newobj->transp,14);
+
+    // add to hierarchy
+    flt_node_add(of,(flt_node*)newobj);
+  }
   
-  flt_safefree(n->name);  
+  return leftbytes;
+}
 
-#ifdef FLT_UNIQUE_FACES
-  flt_safefree(n->ndx_pairs);
-#endif
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+FLT_RECORD_READER(flt_reader_group)
+{
+  flt_context* ctx=of->ctx;
+  int leftbytes = oh->length-sizeof(flt_op);
+  flt_node_group* group;
 
-  // children
-  cur=next=n->child_head;
-  while (cur)
+  leftbytes -= flt_rec_read(ctx,flt_min(leftbytes,40));
+  flt_mem_check(flt_rec_pad(ctx,40),of->errcode);
   {
-    next=cur->next;
-    flt_release_node(cur);
-    flt_free(cur);
-    cur=next;
-  }
+    group = (flt_node_group*)flt_node_alloc(of, FLT_NODE_GROUP,flt_rec_str(ctx,0,8));
+    flt_mem_check(group,of->errcode);
 
-  // external ref node to consider to release a flt* reference
-  switch ( n->type )
-  {
-    case FLT_NODE_EXTREF:
-    {
-      eref=(flt_node_extref*)n;
-      if ( eref->of && flt_atomic_dec(&eref->of->ref)<=0 )
-      {
-        flt_release(eref->of);
-        flt_free(eref->of);        
-      }
-      eref=FLT_NULL;
-    }break;
-    case FLT_NODE_MESH:
-    {
-      mesh = (flt_node_mesh*)n;
-      if ( mesh->vb )
-      {
-        flt_safefree(mesh->vb->vertices);
-        flt_safefree(mesh->vb);
-      }
-    }break;
-    case FLT_NODE_SWITCH:
-    {
-      swi = (flt_node_switch*)n;
-      flt_safefree(swi->maskwords);
-    }break;
-#if !defined(FLT_UNIQUE_FACES) && !defined(FLT_LEAN_FACES) // if there are node of large faces, release name
-    case FLT_NODE_FACE:
-      {
-        nodeface = (flt_node_face*)n;        
-        flt_safefree(nodeface->face.name);
-      }break;
-#endif
-#ifndef FLT_UNIQUE_FACES
-    case FLT_NODE_VLIST:
-    {
-      vlist=(flt_node_vlist*)n;
-      flt_safefree(vlist->indices);
-    }break;
-#endif
+    flt_getswapu16(group->priority,8);
+    flt_getswapu32(group->flags,12);
+    flt_getswapu32(group->loop_count,28);
+    flt_getswapflo(group->loop_dur,32);
+    flt_getswapflo(group->last_fr_dur,36);
+
+    flt_node_add(of,(flt_node*)group);
   }
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// LOD selection (FLT_OPT_HIE_LOD_*). A LOD is visible from its switch out distance (included) to 
+// its switch in, so one of a chain of LODs is visible at a given distance.
 ////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef FLT_UNIQUE_FACES
-void flt_face_destroy_name(char* key, void* faceptr, void* userdata)
+int flt_lod_in_range(const flt_opts* opts, double sin, double sout)
 {
-  key=key;//unused
-  userdata=userdata;
-#ifndef FLT_LEAN_FACES
-  flt_face* f = (flt_face*)faceptr;
-  flt_safefree(f->name);
-#endif
+  return sout <= opts->lod_range[1] && sin > opts->lod_range[0];
 }
-#endif
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_node_add_child(flt_node* parent, flt_node* node)
+// range LODs are selected with, zeros if none (cache validation)
+void flt_lod_range(const flt_opts* opts, double* range)
 {
-  FLT_ASSERT(parent && "There should be at least a node-root. some unwanted pop was done");
+  range[0] = range[1] = 0.0;
+  if ( !(opts->hflags & FLT_OPT_HIE_LOD_RANGE) ) return;
+  range[0] = opts->lod_range[0];
+  range[1] = opts->lod_range[1];
+}
 
-  if ( !parent->child_head )
+// LOD record at offs kept: in range and, choosing the finest/coarsest, the one picked of its siblings. 
+// The siblings are looked ahead once per set (the first LOD), all kept if the file isn't whole in memory
+int flt_lod_keep(flt_context* ctx, fltu64 offs, double sin, double sout)
+{
+  const flt_opts* opts=ctx->opts;
+  const int level=ctx->stack->count;
+  fltu64* sets;
+  fltu64* set;
+
+  if ( (opts->hflags & FLT_OPT_HIE_LOD_RANGE) && !flt_lod_in_range(opts,sin,sout) ) return FLT_FALSE;
+  if ( !(opts->hflags & (FLT_OPT_HIE_LOD_FINEST|FLT_OPT_HIE_LOD_COARSEST)) || ctx->br ) return FLT_TRUE;
+  if ( level >= ctx->lod_levels )
   {
-    parent->child_tail = parent->child_head = node;
+    sets = (fltu64*)flt_realloc(ctx->lod_sets, sizeof(fltu64)*2*(level+8));
+    if ( !sets ) return FLT_TRUE;
+    memset(sets+ctx->lod_levels*2, 0, sizeof(fltu64)*2*(level+8-ctx->lod_levels));
+    ctx->lod_sets = sets;
+    ctx->lod_levels = level+8;
   }
-  else 
+  set = ctx->lod_sets+level*2;
+  if ( offs >= set[1] ) // first of a new set of siblings
+    set[0] = flt_lod_pick(ctx, offs, set+1);
+  return offs == set[0];
+}
+
+// offset of the finest (smallest switch out) or coarsest (largest switch in) LOD of the siblings from the 
+// one at offs to the pop of their level, first one on ties. end is set to the end of the level
+fltu64 flt_lod_pick(flt_context* ctx, fltu64 offs, fltu64* end)
+{
+  const flt_opts* opts=ctx->opts;
+  const int coarsest=(opts->hflags & FLT_OPT_HIE_LOD_COARSEST)!=0;
+  fltu64 limit=ctx->memoffs+ctx->memsize, pick=offs;
+  double best=0.0, sin, sout, d;
+  const fltu8* p;
+  fltu16 op, len;
+  int depth=0, found=FLT_FALSE;
+  fltu32 r;
+
+  for ( r=0; r<ctx->nranges; ++r ) // not beyond the part of the file loaded
   {
-    parent->child_tail->next = node;
-    parent->child_tail = node;
+    if ( offs>=ctx->ranges[r*2] && offs<ctx->ranges[r*2+1] ) limit = ctx->ranges[r*2+1];
+  }
+  while ( offs+sizeof(flt_op) <= limit )
+  {
+    p = ctx->mem+(offs-ctx->memoffs);
+    op = flt_get16(p);
+    len = flt_get16(p+2);
+    if ( len<sizeof(flt_op) || offs+len>limit ) break;
+    if ( op == FLT_OP_PUSHLEVEL ) ++depth;
+    else if ( op == FLT_OP_POPLEVEL && --depth<0 ) break;
+    else if ( op == FLT_OP_LOD && !depth && len>=32 ) // switch in and out distances at 16 and 24
+    {
+      sin = flt_getdbl(p+16);
+      sout = flt_getdbl(p+24);
+      d = coarsest ? -sin : sout; // smaller is better
+      if ( (!(opts->hflags & FLT_OPT_HIE_LOD_RANGE) || flt_lod_in_range(opts,sin,sout)) && (!found || d<best) )
+      {
+        best = d;
+        pick = offs;
+        found = FLT_TRUE;
+      }
+    }
+    offs += len;
   }
+  *end = offs;
+  return pick;
+}
 
-  ++parent->child_count;  
+// record below a LOD not kept: its ancillary records, then its push..pop levels. 0 for the first record after it
+int flt_lod_skip(flt_context* ctx, fltu16 op)
+{
+  if ( ctx->lod_skip == 1 )
+  {
+    if ( op == FLT_OP_PUSHLEVEL ) { ctx->lod_skip=2; return FLT_TRUE; }
+    if ( flt_parse_skips_to(op) ) { ctx->lod_skip=0; return FLT_FALSE; } // no children
+    return FLT_TRUE;
+  }
+  if ( op == FLT_OP_PUSHLEVEL ) ++ctx->lod_skip;
+  else if ( op == FLT_OP_POPLEVEL && --ctx->lod_skip==1 ) ctx->lod_skip=0;
+  return FLT_TRUE;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_node_add(flt* of, flt_node* node)
+FLT_RECORD_READER(flt_reader_lod)
 {
-  flt_context* ctx = of->ctx;
-  flt_node *parent=0;
-  flt_node_extref* er;
-
-  if (ctx->stack->count)
-  {
-    // pop and then look for parent
-    flt_stack_popn(ctx->stack);
-    parent = flt_stack_topn_not_null(ctx->stack);      
+  flt_context* ctx=of->ctx;
+  int leftbytes = oh->length-sizeof(flt_op);
+  const fltu64 offs = flt_input_tell(ctx)-sizeof(flt_op);
+  flt_node_lod* lod;
+  double *tgdbl;
+  int i;
 
-    // add to parent
-    flt_node_add_child(parent,node);
+  leftbytes -= flt_rec_read(ctx,flt_min(leftbytes,76));
+  flt_mem_check(flt_rec_pad(ctx,76),of->errcode);
 
-    // restore stack
-    flt_stack_pushn(ctx->stack, node );
+  // not kept, skipped until the end of its children (no node)
+  if ( (ctx->opts->hflags & FLT_OPT_HIE_LOD_SELECT) && ctx->reclen>=28 
+    && !flt_lod_keep(ctx, offs, flt_getdbl(ctx->rec+12), flt_getdbl(ctx->rec+20)) )
+  {
+    ctx->lod_skip = 1;
+    if ( of->stats ) { ++of->stats->lods_skipped; of->stats->skipped_bytes += oh->length; }
+    return leftbytes;
   }
-  else
-    FLT_BREAK;// "shouldn't be here as there's always the node_root"
-
-  if ( of->hie ) 
   {
-    ++of->hie->node_count;
+    lod = (flt_node_lod*)flt_node_alloc(of, FLT_NODE_LOD,flt_rec_str(ctx,0,8));
+    flt_mem_check(lod,of->errcode);
 
-    // check if it's a extref node, then we maintain an additional flat list structure
-    if ( node->type==FLT_NODE_EXTREF )
-    {
-      er = (flt_node_extref*)node;
-      if ( ctx->node_extref_last )
-        ctx->node_extref_last->next_extref = er; // if shortcut to last one
-      else
-        of->hie->extref_head = er; // if starting list
-      ++of->hie->extref_count;
-      ctx->node_extref_last = er;
-    }
+    flt_getswapdbl(lod->switch_in,12);
+    flt_getswapdbl(lod->switch_out,20);    
+    flt_getswapu32(lod->flags,32);
+    tgdbl=lod->cnt_coords; // center, transition range and significant size
+    for (i=0;i<5;++i){ flt_getswapdbl(tgdbl[i],36+i*8); }
+    
+    flt_node_add(of,(flt_node*)lod);
   }
-
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-flt_node* flt_node_create(fltu32 hieflags, int nodetype, const char* name)
+FLT_RECORD_READER(flt_reader_mesh)
 {
-  flt_node* n=0;
-  static int nodefacesize = 
-#ifdef FLT_UNIQUE_FACES
-    0;
-#else
-    sizeof(flt_node_face);
+  flt_context* ctx=of->ctx;
+  int leftbytes = oh->length-sizeof(flt_op);
+  flt_face* attr;
+
+  leftbytes -= flt_rec_read(ctx,leftbytes);
+  flt_mem_check(flt_rec_pad(ctx,80),of->errcode);
+  flt_node_mesh* mesh = (flt_node_mesh*)flt_node_alloc(of, FLT_NODE_MESH, flt_rec_str(ctx,0,8));
+  flt_mem_check(mesh,of->errcode);
+  attr=&mesh->attribs;
+
+  // same as face record but different offsets
+  attr->billb = *(ctx->rec+25);
+  flt_getswapi16(attr->texbase_pat, 28);
+  flt_getswapi16(attr->texdetail_pat, 26);
+  flt_getswapi16(attr->mat_pat, 30);
+  attr->flags = (fltu16)(flt_get32(ctx->rec+44)>>16);
+  flt_getswapu32(attr->abgr,52);
+  flt_getswapu16(attr->shader_ndx,78);
+#ifndef FLT_LEAN_FACES  
+  flt_getswapi32(attr->ir_color,12);
+  flt_getswapi32(attr->ir_mat,36);
+  flt_getswapi16(attr->smc_id,32);
+  flt_getswapi16(attr->feat_id,34);
+  flt_getswapi16(attr->transp, 40);
+  flt_getswapu16(attr->cname_ndx,20);
+  flt_getswapu16(attr->cnamealt_ndx,22);
+  flt_getswapu16(attr->texmapp_ndx,64);
+  attr->draw_type = *(ctx->rec+18);
+  attr->light_mode = *(ctx->rec+48);
+  attr->lod_gen = *(ctx->rec+42);
+  attr->linestyle_ndx = *(ctx->rec+43);
 #endif
-  static int nodesizes[FLT_NODE_MAX]={0,sizeof(flt_node), sizeof(flt_node_extref), sizeof(flt_node_group),
-    sizeof(flt_node_object), sizeof(flt_node_mesh), sizeof(flt_node_lod), nodefacesize, sizeof(flt_node_vlist), sizeof(flt_node_switch)};
-  int size=nodesizes[nodetype];
 
-  n=(flt_node*)flt_calloc(1,size);
-  if (n)
-  {
-    n->type = nodetype;
-    if ( (!(hieflags & FLT_OPT_HIE_NO_NAMES) || nodetype==FLT_NODE_EXTREF) && name && *name )
-      n->name = flt_strdup(name);
-  }
-  return n;
+  flt_node_add(of, (flt_node*)mesh);
+
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_swap_desc(void* data, flt_end_desc* desc)
+FLT_RECORD_READER(flt_reader_local_vertex_pool)
 {
-  unsigned char* _data = (unsigned char*)data;
-  int i;
-  unsigned int offs;
+  flt_context* ctx=of->ctx;
+  flt_opts* opts=ctx->opts;
+  int leftbytes = oh->length-sizeof(flt_op);
+  const fltu32 vsize = flt_compute_vertex_size(opts->pflags);
+  fltu32 i, count, mask, insize, pofs, cofs, nofs, uvofs, offs=0;
+  const fltu8* invtx;
+  flt_mesh_vb* vb;
+  flt_bounds* bounds;
+  double p[3];
 
-  while (desc->bits)
+  flt_node_mesh* mesh = (flt_node_mesh*)flt_stack_topn_not_null(ctx->stack);
+  FLT_ASSERT(mesh && mesh->base.type==FLT_NODE_MESH);
+  if ( !mesh || mesh->base.type!=FLT_NODE_MESH || mesh->vb || leftbytes < 8 ) 
+    return leftbytes;
+  leftbytes -= flt_rec_read_all(ctx,leftbytes); // with the vertices in continuation records
+  flt_mem_check(ctx->rec,of->errcode);
+  if ( ctx->reclen < 8 ) return leftbytes; // truncated input
+  flt_getswapu32(count,0);
+  flt_getswapu32(mask,4);
+
+  vb = mesh->vb = (flt_mesh_vb*)flt_of_calloc(of,sizeof(flt_mesh_vb));
+  flt_mem_check(vb,of->errcode);
+  vb->semantic = mask;
+
+  // vertices as many as in the record
+  insize = flt_vtxpool_size(mask);
+  count = insize ? flt_min(count, (ctx->reclen-8)/insize) : 0;
+  if ( !count ) return leftbytes;
+  vb->count = count;
+  if ( !vsize ) return leftbytes; // no vertex components, just the count
+  flt_stat_add(of, vertices, count);
+
+  // offsets of the components in a pool vertex
+  pofs = (mask & FLT_VTXPOOL_POSITION) ? offs : FLT_VTX_NONE; if ( mask & FLT_VTXPOOL_POSITION ) offs += sizeof(double)*3;
+  cofs = (mask & FLT_VTXPOOL_COLOR_RGBA) ? offs : FLT_VTX_NONE; if ( mask & (FLT_VTXPOOL_COLOR_INDEX|FLT_VTXPOOL_COLOR_RGBA) ) offs += sizeof(fltu32);
+  nofs = (mask & FLT_VTXPOOL_NORMAL) ? offs : FLT_VTX_NONE; if ( mask & FLT_VTXPOOL_NORMAL ) offs += sizeof(float)*3;
+  uvofs = (mask & FLT_VTXPOOL_UV0) ? offs : FLT_VTX_NONE;
+
+  invtx = ctx->rec+8;
+  vb->vertices = (fltu8*)flt_of_calloc(of, count*vsize);
+  flt_mem_check(vb->vertices,of->errcode);
+  for ( i=0; i<count; ++i )
+    flt_vertex_decode(invtx+i*insize, vb->vertices+i*vsize, opts->pflags, pofs, nofs, uvofs, cofs);
+
+  // the whole pool in the bounds of the mesh
+  if ( (opts->lflags & FLT_OPT_LOAD_BOUNDS) && (opts->pflags & FLT_OPT_PAL_VTX_POSITION) )
   {
-    offs = desc->offs;
-    for (i=0;i<desc->count;++i, offs+=desc->bits>>3)
+    bounds = flt_node_bounds(of, (flt_node*)mesh);
+    flt_mem_check(bounds, of->errcode);
+    for ( i=0; i<count; ++i )
     {
-      switch(desc->bits)
-      {
-      case 16: flt_swap16( _data+offs ); break;
-      case 32: flt_swap32( _data+offs ); break;
-      case 64: flt_swap64( _data+offs ); break;
-      }
+      flt_vertex_position(vb->vertices+i*vsize, opts->pflags, p);
+      flt_bounds_point(bounds, p);
     }
-    desc++;
   }
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// indices of the primitive appended to the mesh ones, widened to 32 bits
 ////////////////////////////////////////////////////////////////////////////////////////////////
-flt_node* flt_node_find_by_name(flt_node* node_parent, const char* node_name )
+FLT_RECORD_READER(flt_reader_mesh_primitive)
 {
-  flt_node *c, *found;
-  if ( !node_parent || !node_name ) return FLT_NULL;
-  if ( node_parent->name && strcmp(node_parent->name, node_name) == 0 )
-    return node_parent;
+  flt_context* ctx=of->ctx;
+  int leftbytes = oh->length-sizeof(flt_op);
+  fltu32 i, type, ndxsize, count, ndx, cap, newcap;
+  const fltu8* data;
+  fltu32* indices;
+  flt_mesh_prim* prim;
 
-  c = node_parent->child_head;
-  found = FLT_NULL;
-  while ( c )
+  flt_node_mesh* mesh = (flt_node_mesh*)flt_stack_topn_not_null(ctx->stack);
+  FLT_ASSERT(mesh && mesh->base.type==FLT_NODE_MESH);
+  if ( !mesh || mesh->base.type!=FLT_NODE_MESH || leftbytes < 8 ) 
+    return leftbytes;
+  leftbytes -= flt_rec_read_all(ctx,leftbytes); // with the indices in continuation records
+  flt_mem_check(ctx->rec,of->errcode);
+  if ( ctx->reclen < 8 ) return leftbytes; // truncated input
+  flt_getswapu16(type,0);
+  flt_getswapu16(ndxsize,2);
+  flt_getswapu32(count,4);
+  if ( ndxsize!=1 && ndxsize!=2 && ndxsize!=4 ) return leftbytes;
+  count = flt_min(count, (ctx->reclen-8)/ndxsize);
+  if ( !count ) return leftbytes;
+
+  // room for the primitive and its indices (capacities doubled)
+  cap = flt_mesh_cap(mesh->prim_count, sizeof(flt_mesh_prim));
+  if ( !mesh->prims || mesh->prim_count==cap )
   {
-    found = flt_node_find_by_name(c, node_name);
-    if ( found )
-      break;
-    c = c->next;
+    newcap = flt_mesh_cap((fltu64)mesh->prim_count+1, sizeof(flt_mesh_prim));
+    flt_mem_check(newcap,of->errcode);
+    prim = (flt_mesh_prim*)flt_of_realloc(of, mesh->prims, sizeof(flt_mesh_prim)*(mesh->prims?cap:0), sizeof(flt_mesh_prim)*newcap);
+    flt_mem_check(prim,of->errcode);
+    mesh->prims = prim;
   }
-  return found;
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-void flt_count_indices(flt_node* node_parent, fltu32* inds, int recursive)
-{
-#ifdef FLT_UNIQUE_FACES
-  fltu32 b, batchStart, batchEnd;
-  flt_node* c;
-
-  if ( !node_parent ) return;
-  for ( b = 0; b < node_parent->ndx_pairs_count; ++b )
+  cap = flt_mesh_cap(mesh->index_count, sizeof(fltu32));
+  if ( !mesh->indices || (fltu64)mesh->index_count+count > cap )
   {
-    FLTGET32(node_parent->ndx_pairs[b], batchStart, batchEnd);
-    *inds += batchEnd-batchStart+1;
+    newcap = flt_mesh_cap((fltu64)mesh->index_count+count, sizeof(fltu32));
+    flt_mem_check(newcap,of->errcode);
+    indices = (fltu32*)flt_of_realloc(of, mesh->indices, sizeof(fltu32)*(mesh->indices?cap:0), sizeof(fltu32)*newcap);
+    flt_mem_check(indices,of->errcode);
+    mesh->indices = indices;
   }
 
-  if ( recursive )
+  data = ctx->rec+8;
+  indices = mesh->indices+mesh->index_count;
+  for ( i=0; i<count; ++i )
   {
-    c = node_parent->child_head;
-    while ( c )
+    switch ( ndxsize )
     {
-      flt_count_indices(c, inds, recursive);
-      c = c->next;
+    case 1: ndx = data[i]; break;
+    case 2: ndx = flt_get16(data+i*2); break;
+    default: ndx = flt_get32(data+i*4);
     }
+    indices[i] = ( mesh->vb && ndx >= mesh->vb->count ) ? 0 : ndx; // out of the pool
   }
-#else
-  FLT_BREAK; // NOT IMPLEMENTED
-  *inds = 0;
-#endif
-}
 
-
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_op_name(fltu16 opcode)
-{
-#ifndef FLT_NO_OPNAMES
-  static const char* names[FLT_OP_MAX] = {
-    "",                                                                   // 0
-    "Header",                                                             // 1
-    "Group",                                                              // 2
-    "Level of Detail",                                                    // 3 (obsolete)
-    "Object",                                                             // 4
-    "Face",                                                               // 5
-    "Vertex with ID",                                                     // 6 (obsolete)
-    "Short Vertex w/o ID",                                                // 7 (obsolete) 
-    "Vertex with Color",                                                  // 8 (obsolete)
-    "Vertex with Color and Normal",                                       // 9 (obsolete)
-    "Push Level",                                                         // 10
-    "Pop Level",                                                          // 11
-    "Translate",                                                          // 12 (obsolete)
-    "Degree of Freedom",                                                  // 13 (obsolete)
-    "Degree of Freedom",                                                  // 14
-    "",                                                                   // 15
-    "Instance Reference",                                                 // 16 (obsolete)  
-    "Instance Definition",                                                // 17 (obsolete)
-    "",                                                                   // 18
-    "Push Subface",                                                       // 19
-    "Pop Subface",                                                        // 20
-    "Push Extension",                                                     // 21
-    "Pop Extension",                                                      // 22
-    "Continuation",                                                       // 23
-    "", "", "", "", "", "", "",                                           // 24-30
-    "Comment",                                                            // 31 
-    "Color Palette",                                                      // 32
-    "Long ID",                                                            // 33
-    "", "", "", "", "", "",                                               // 34-39
-    "Translate",                                                          // 40 (obsolete)
-    "Rotate about Point",                                                 // 41 (obsolete)
-    "Rotate about Edge",                                                  // 42 (obsolete)
-    "Scale",                                                              // 43 (obsolete)
-    "Translate",                                                          // 44 (obsolete)
-    "Scale nonuniform",                                                   // 45 (obsolete)
-    "Rotate about Point",                                                 // 46 (obsolete)
-    "Rotate and/or Scale to Point",                                       // 47 (obsolete)
-    "Put",                                                                // 48 (obsolete)
-    "Matrix",                                                             // 49
-    "Vector",                                                             // 50
-    "Bounding Box",                                                       // 51 (obsolete)
-    "Multitexture",                                                       // 52
-    "UV List",                                                            // 53
-    "",                                                                   // 54
-    "Binary Separating Plane",                                            // 55
-    "", "", "", "",                                                       // 56-59
-    "Replicate",                                                          // 60
-    "Instance Reference",                                                 // 61
-    "Instance Definition",                                                // 62
-    "External Reference",                                                 // 63
-    "Texture Palette",                                                    // 64
-    "Eyepoint Palete",                                                    // 65 (obsolete)
-    "Material Palette",                                                   // 66 (obsolete)
-    "Vertex Palette",                                                     // 67
-    "Vertex with Color",                                                  // 68
-    "Vertex with Color and Normal",                                       // 69
-    "Vertex with Color, Normal and UV",                                   // 70
-    "Vertex with Color and UV",                                           // 71
-    "Vertex List",                                                        // 72
-    "Level of Detail",                                                    // 73
-    "Bounding Box",                                                       // 74
-    "",                                                                   // 75
-    "Rotate About Edge",                                                  // 76
-    "Scale",                                                              // 77 (obsolete)
-    "Translate",                                                          // 78
-    "Scale",                                                              // 79
-    "Rotate About Point",                                                 // 80
-    "Rotate and/or Scale to Point",                                       // 81
-    "Put",                                                                // 82
-    "Eyepoint and Trackplane Palette",                                    // 83
-    "Mesh",                                                               // 84
-    "Local Vertex Pool",                                                  // 85
-    "Mesh Primitive",                                                     // 86
-    "Road Segment",                                                       // 87
-    "Road Zone",                                                          // 88
-    "Morph Vertex List",                                                  // 89
-    "Linkage Palette",                                                    // 90
-    "Sound",                                                              // 91
-    "Road Path",                                                          // 92
-    "Sound Palette",                                                      // 93
-    "General Matrix",                                                     // 94
-    "Text",                                                               // 95
-    "Switch",                                                             // 96
-    "Line Style Palette",                                                 // 97
-    "Clip Region",                                                        // 98
-    "",                                                                   // 99
-    "Extension",                                                          // 100
-    "Light Source",                                                       // 101
-    "Light Source Palette",                                               // 102
-    "Reserved",                                                           // 103
-    "Reserved",                                                           // 104
-    "Bounding Sphere",                                                    // 105
-    "Bounding Cylinder",                                                  // 106
-    "Bounding Convex Hull",                                               // 107
-    "Bounding Volume Center",                                             // 108
-    "Bounding Volume Orientation",                                        // 109
-    "Reserved",                                                           // 110
-    "Light Point",                                                        // 111
-    "Texture Mapping Palette",                                            // 112
-    "Material Palette",                                                   // 113
-    "Name Table",                                                         // 114
-    "Continuously Adaptive Terrain (CAT)",                                // 115
-    "CAT Data",                                                           // 116
-    "Reserved",                                                           // 117
-    "Reserved",                                                           // 118
-    "Bounding Histogram",                                                 // 119
-    "Reserved",                                                           // 120
-    "Reserved",                                                           // 121
-    "Push Attribute",                                                     // 123
-    "Pop Attribute",                                                      // 124
-    "Reserved",                                                           // 125
-    "Curve",                                                              // 126
-    "Road Construction",                                                  // 127
-    "Light Point Appearance Palette",                                     // 128
-    "Light Point Animation Palette",                                      // 129
-    "Indexed Light Point",                                                // 130
-    "Light Point System",                                                 // 131
-    "Indexed String",                                                     // 132
-    "Shader Palette",                                                     // 133
-    "Reserved",                                                           // 134
-    "Extended Material Header",                                           // 135
-    "Extended Material Ambient",                                          // 136
-    "Extended Material Diffuse",                                          // 137
-    "Extended Material Specular",                                         // 138
-    "Extended Material Emissive",                                         // 139
-    "Extended Material Alpha",                                            // 140
-    "Extended Material Light Map",                                        // 141
-    "Extended Material Normal Map",                                       // 142
-    "Extended Material Bump Map",                                         // 143
-    "Reserved",                                                           // 144
-    "Extended Material Shadow Map",                                       // 145
-    "Reserved",                                                           // 146
-    "Extended Material Reflection Map",                                   // 147
-    "Extension GUID Palette",                                             // 148
-    "Extension Field Boolean",                                            // 149
-    "Extension Field Integer",                                            // 150
-    "Extension Field Float",                                              // 151
-    "Extension Field Double",                                             // 152
-    "Extension Field String",                                             // 153
-    "Extension Field XML String",                                         // 154
-  };
-  return (opcode<=FLT_OP_MAX) ? names[opcode] : "Unknown";
-#else
-return "";
-#endif
+  prim = mesh->prims+mesh->prim_count++;
+  prim->type = type;
+  prim->start = mesh->index_count;
+  prim->count = count;
+  mesh->index_count += count;
+  flt_stat_add(of, indices, count);
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_proj_name(fltu32 proj)
+FLT_RECORD_READER(flt_reader_longid)
 {
-  static char tmp[16];
-#ifndef FLT_NO_OPNAMES
-  const char* names[]={"Flat Earth", "Trapezoidal", "Round Earth", "Lambert", "UTM", "Geodetic", "Geocentric"};
-  return proj<7?names[proj]:itoa(proj,tmp,10);
-#else
-  return itoa(proj,tmp,10);
-#endif
+  flt_context* ctx=of->ctx;
+  int leftbytes = oh->length-sizeof(flt_op);
+
+  fltu32 len=0;
+  char* name;
+
+  flt_node* top = flt_stack_topn(ctx->stack);
+  if ( top )
+  {
+    leftbytes -= flt_rec_read(ctx,leftbytes);
+    flt_mem_check(ctx->rec,of->errcode);
+    while ( len < ctx->reclen && ctx->rec[len] ) ++len;
+    if ( of->names ) 
+    {
+      name = flt_names_intern(of,(const char*)ctx->rec,len,FLT_TRUE);
+      flt_mem_check(name,of->errcode);
+    }
+    else
+    {
+      name = (char*)flt_of_calloc(of,len+1);
+      flt_mem_check(name,of->errcode);
+      memcpy(name,ctx->rec,len);
+      flt_of_free(of,top->name);
+    }
+    top->name = name;
+  }
+  
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_db_origin_name(fltu32 db_orig)
+FLT_RECORD_READER(flt_reader_pal_vertex)
 {
-  static char tmp[16];
-#ifndef FLT_NO_OPNAMES
-  switch(db_orig)
+  flt_context* ctx=of->ctx;
+  flt_opts* opts=ctx->opts;
+  int leftbytes, palbytes;
+  fltu32 vsize = 0;
+
+  // record header
+  leftbytes = oh->length - sizeof(flt_op);
+  leftbytes -= flt_rec_read(ctx,flt_min(leftbytes,4));
+  flt_mem_check(flt_rec_pad(ctx,4),of->errcode);
+  flt_getswapi32(palbytes,0);
+  palbytes -= sizeof(flt_op) + 4;
+  if ( palbytes < 0 ) palbytes = 0; // truncated or bogus palette size
+  leftbytes = palbytes; // size of palette minus header and marker
+  
+  // read vertices from palette?
+  if ( palbytes && opts->pflags & FLT_OPT_PAL_VERTEX )
   {
-  case 100: return "OpenFlight";
-  case 200: return "DIG I/II";
-  case 300: return "Evans and Sutherland CT5A/CT6";
-  case 400: return "PSP DIG";
-  case 600: return "General Electric CIV/CV/PT2000";
-  case 700: return "Evans and Sutherland GDF";
-  default: return itoa(db_orig,tmp,10);
+    // saves the whole vertex
+    of->pal->vtx_buff = (fltu8*)flt_malloc( palbytes ); 
+    flt_mem_check(of->pal->vtx_buff, of->errcode);
+    leftbytes -= flt_rec_copy(ctx, of->pal->vtx_buff, palbytes); // writable copy, vertices are converted in place
+
+    vsize = flt_compute_vertex_size(opts->pflags);
+    if (vsize)
+    {
+      of->pal->vtx_array = (fltu8*)flt_malloc((palbytes/40)*vsize); // upper bound of vertices
+      flt_mem_check(of->pal->vtx_array, of->errcode);
+      ctx->vtx_starts = (fltu8*)flt_calloc(1,(palbytes+7)/8);
+      flt_mem_check(ctx->vtx_starts, of->errcode);
+      flt_vertex_convert(of, palbytes);
+      flt_stat_add(of, vertices, of->pal->vtx_count);
+
+      // shrinks to the vertices converted (smaller records, welded ones)
+      if ( of->pal->vtx_count && of->pal->vtx_count < (fltu32)(palbytes/40) )
+      {
+        fltu8* vtxs = (fltu8*)flt_realloc(of->pal->vtx_array, of->pal->vtx_count*vsize);
+        if ( vtxs ) of->pal->vtx_array = vtxs;
+      }
+    }
   }
-#else
-  return itoa(db_orig,tmp,10);
-#endif
+
+  return leftbytes;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_vcoords_units_name(fltu8 vcu)
+#pragma warning(disable:4101 4189) // use under gcc: #pragma GCC diagnostic
+FLT_RECORD_READER(flt_reader_face)
 {
-  static char tmp[16];
-#ifndef FLT_NO_OPNAMES
-  static const char* names[]={"Meters", "Kilometers", "", "", "Feet", "Inches", "", "", "Nautical miles"};
-  return vcu<9?names[vcu]:itoa(vcu,tmp,10);
+  flt_context* ctx=of->ctx;
+  flt_node *parent, *sibling;
+  int leftbytes = oh->length-sizeof(flt_op);
+  const char* name;
+#ifdef FLT_UNIQUE_FACES
+  fltu32 faceid;
+  int isnew;
 #else
-  return itoa(vcu,tmp,10);
+  flt_node_face* nodeface;
+#endif
+  flt_face tmpf;
+  flt_face* face=&tmpf;
+  flt_stat_add(of, faces, 1);
+  memset(&tmpf,0,sizeof(tmpf)); // padding too, faces are hashed as bytes
+
+  leftbytes -= flt_rec_read(ctx,flt_min(leftbytes,76));
+  flt_mem_check(flt_rec_pad(ctx,76),of->errcode);
+  name = flt_rec_str(ctx,0,8);
+
+  face->billb = *(ctx->rec+21);
+  flt_getswapi16(face->texbase_pat, 22);
+  flt_getswapi16(face->texdetail_pat, 24);
+  flt_getswapi16(face->mat_pat, 26);
+  face->flags = (fltu16)(flt_get32(ctx->rec+40)>>16); // defined ones are the high bits (FLT_FACE_*)
+  flt_getswapu32(face->abgr,52);
+  flt_getswapu16(face->shader_ndx,74);
+#ifndef FLT_LEAN_FACES  
+  flt_getswapi32(face->ir_color,8);
+  flt_getswapi32(face->ir_mat,32);
+  flt_getswapi16(face->smc_id,28);
+  flt_getswapi16(face->feat_id,30);
+  flt_getswapi16(face->transp, 36);
+  flt_getswapu16(face->cname_ndx,16);
+  flt_getswapu16(face->cnamealt_ndx,18);
+  flt_getswapu16(face->texmapp_ndx,60);
+  face->draw_type = *(ctx->rec+14);
+  face->light_mode = *(ctx->rec+44);
+  face->lod_gen = *(ctx->rec+38);
+  face->linestyle_ndx = *(ctx->rec+39);
 #endif
+
+#ifdef FLT_UNIQUE_FACES
+  // if we compiled for face palettes, look up the face in the table of unique faces.
+  // the vertex lists below take the face id from the stack (id+1, as 0 is no value)
+  faceid = flt_facetable_insert(of->faces, face, flt_hash_bytes(face,FLT_FACESIZE_HASH), &isnew);
+  if ( faceid == 0xffffffff ) { of->errcode=FLT_ERR_MEMOUT; return -1; }
+  if ( isnew )
+  {
+    flt_stat_add(of, unique_faces, 1);
+#ifndef FLT_LEAN_FACES
+    if ( !(ctx->opts->hflags & FLT_OPT_HIE_NO_NAMES) && *name )
+      of->faces->faces[faceid].name = of->names ? flt_names_intern(of,name,(fltu32)strlen(name),FLT_TRUE) : flt_of_strdup(of,name);
+#endif
+  }  
+
+  flt_stack_popn(ctx->stack);
+  flt_stack_push32(ctx->stack, faceid+1);
+#else
+  // creating node for every face
+  nodeface = (flt_node_face*)flt_node_alloc(of, FLT_NODE_FACE,name);
+  flt_mem_check(nodeface,of->errcode);
+  // whole face info in node
+  nodeface->face = tmpf;
+  flt_node_add(of, (flt_node*)nodeface);
+  flt_stat_add(of, unique_faces, 1);
+#endif
+  
+
+  return leftbytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+FLT_RECORD_READER(flt_reader_vertex_list)
+{
+  flt_context* ctx=of->ctx;
+#ifndef FLT_UNIQUE_FACES
+  flt_node_vlist* vlistnode;
+#endif
+  int leftbytes = oh->length-sizeof(flt_op);
+  fltu32 n_inds=(oh->length-4)>>2;
+  fltu32 i,k;
+  fltu32 tarr[3];
+  const fltu32 pflags = ctx->opts->pflags;
+  const fltu32 vsize = flt_compute_vertex_size(pflags);
+  flt_bounds* bounds=FLT_NULL;
+  double p[3];
+#ifdef FLT_UNIQUE_FACES
+  fltu32 vtxoffset, tvtx[3];
+  fltu64* pair;
+  fltu32 thisndxstart,thisndxend,ndxstart,ndxend;
+  flt_node* parentn;
+
+  if ( !n_inds ) return leftbytes;
+
+  // we get the top not null, which is my hash entry number for the unique face in the dict
+  fltu32 faceid = flt_stack_top32_not_null(ctx->stack);
+  if ( faceid != 0xffffffff )
+  {
+    --faceid; // stack keeps id+1
+    // get the parent node from stack
+    parentn=flt_stack_topn_not_null(ctx->stack);
+    FLT_ASSERT(parentn && "Vertex list with no parent node, skipping");
+    if ( parentn )
+    {
+      thisndxstart=flt_index_count(of);
+      if ( (ctx->opts->lflags & FLT_OPT_LOAD_BOUNDS) && (pflags & FLT_OPT_PAL_VTX_POSITION) && of->pal->vtx_count )
+      {
+        bounds = flt_node_bounds(of, parentn);
+        flt_mem_check(bounds, of->errcode);
+      }
+
+      // all the indices, also the ones in continuation records
+      leftbytes -= flt_rec_read_all(ctx, leftbytes);
+      flt_mem_check(ctx->rec,of->errcode);
+      n_inds = ctx->reclen>>2;
+
+      // make sure indices array has enough memory for new indices
+      if ( of->tris ) { flt_mem_check(flt_tris_reserve(of->tris, n_inds>=3 ? n_inds-2 : 0), of->errcode); }
+      else flt_array_ensure(of->indices, n_inds); 
+
+      // this loop is to triangulate like a fan (convex) polygon when n_inds > 3. Also work with n_inds==3
+      if ( n_inds >= 3 )
+      { 
+        // we got this batch of indices, let's encode it with the hash entry code
+        tarr[0]=0;
+        for (k=2;k<n_inds;++k)
+        {
+          tarr[1]=k-1;
+          tarr[2]=k;
+          for (i=0;i<3;++i)
+          {
+            vtxoffset = flt_get32(ctx->rec+(tarr[i]<<2));
+            vtxoffset -= sizeof(flt_op) + 4; // correct offset
+
+            // if there's an array, the palette is converted already, offset to vertex no
+            if (of->pal->vtx_array)
+              vtxoffset = flt_vtx_number(of, vtxoffset);
+            tvtx[i] = vtxoffset;
+
+            // every vertex of the fan once
+            if ( bounds && (k==2 || i==2) )
+            {
+              flt_vertex_position(of->pal->vtx_array+(fltu64)vtxoffset*vsize, pflags, p);
+              flt_bounds_point(bounds, p);
+            }
+          }
+          if ( of->tris ) 
+          {
+            flt_mem_check(flt_tris_push(of->tris, faceid, tvtx), of->errcode);
+          }
+          else
+          {
+            for (i=0;i<3;++i)
+              flt_array_push_back(of->indices, FLTMAKE64(faceid,tvtx[i]));
+          }
+        }
+      }
+
+      thisndxend = flt_index_count(of)-1; // last index
+
+      // if no pairs (start/end) creates one
+      if (!parentn->ndx_pairs)
+      {
+        pair = parentn->ndx_pairs = (fltu64*)flt_of_calloc(of,sizeof(fltu64));
+        flt_mem_check(pair,of->errcode);
+        parentn->ndx_pairs_count=1;
+      }
+      else
+      {
+        // there are pairs, check if we need to add one more or concat to last one
+        pair = parentn->ndx_pairs + (parentn->ndx_pairs_count-1);
+        FLTGET32(*pair, ndxstart, ndxend);
+        if ( ndxend+1 == thisndxstart )
+        {
+          // reuse last pair, same start, new end
+          thisndxstart=ndxstart;
+        }
+        else
+        {
+          // add new pair (regrow array with one more element) (should i double capacity?)
+          i=parentn->ndx_pairs_count;
+          parentn->ndx_pairs = (fltu64*)flt_of_realloc(of, parentn->ndx_pairs, sizeof(fltu64)*i, sizeof(fltu64)*(i+1));
+          flt_mem_check(parentn->ndx_pairs,of->errcode);
+          pair = parentn->ndx_pairs;
+          pair += i; // set the last pair
+          parentn->ndx_pairs_count= i+1;
+        }
+      }
+
+      *pair = FLTMAKE64(thisndxstart,thisndxend);
+    }
+  }  
+#else
+  // using normal vertex list node, create the node, create the indices array and add the node
+  if ( n_inds )
+  {
+    // all the indices, also the ones in continuation records
+    leftbytes -= flt_rec_read_all(ctx, leftbytes);
+    flt_mem_check(ctx->rec,of->errcode);
+    n_inds = ctx->reclen>>2;
+    vlistnode = (flt_node_vlist*)flt_node_alloc(of, FLT_NODE_VLIST, FLT_NULL);
+    flt_mem_check(vlistnode,of->errcode);
+    vlistnode->count = n_inds;
+    vlistnode->indices = (fltu32*)flt_of_calloc(of,sizeof(fltu32)*flt_max(n_inds,1));
+    flt_mem_check(vlistnode->indices,of->errcode);
+    for (i=0;i<n_inds;++i) { vlistnode->indices[i]=flt_get32(ctx->rec+i*4); }
+
+    // vertices in the bounds of the face
+    if ( (ctx->opts->lflags & FLT_OPT_LOAD_BOUNDS) && (pflags & FLT_OPT_PAL_VTX_POSITION) && of->pal->vtx_count 
+      && flt_stack_topn_not_null(ctx->stack) )
+    {
+      bounds = flt_node_bounds(of, flt_stack_topn_not_null(ctx->stack));
+      flt_mem_check(bounds, of->errcode);
+      for (i=0;i<n_inds;++i) 
+      {
+        k = flt_vtx_number(of, vlistnode->indices[i]-sizeof(flt_op)-4);
+        flt_vertex_position(of->pal->vtx_array+(fltu64)k*vsize, pflags, p);
+        flt_bounds_point(bounds, p);
+      }
+    }
+    flt_node_add(of, (flt_node*)vlistnode);
+  }
+#endif
+
+  flt_stat_add(of, indices, n_inds);
+  return leftbytes;
+}
+#pragma warning(default:4101 4189)
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+FLT_RECORD_READER(flt_reader_switch)
+{
+  flt_context* ctx = of->ctx;
+  flt_node_switch* switchnode;
+  int leftbytes = oh->length - sizeof(flt_op);
+  fltu32 i,end;
+
+  leftbytes -= flt_rec_read_all(ctx,leftbytes); // masks can go on in continuation records
+  flt_mem_check(flt_rec_pad(ctx,24),of->errcode);
+  switchnode = (flt_node_switch*)flt_node_alloc(of, FLT_NODE_SWITCH, flt_rec_str(ctx,0,8));
+  flt_mem_check(switchnode,of->errcode);
+
+  flt_getswapu32(switchnode->cur_mask,12);
+  flt_getswapu32(switchnode->mask_count,16);
+  flt_getswapu32(switchnode->wpm,20);
+    
+  end = switchnode->mask_count * switchnode->wpm;
+  switchnode->maskwords = (fltu32*)flt_of_calloc(of,sizeof(fltu32)*end);
+  flt_mem_check(switchnode->maskwords,of->errcode);
+  for (i=0;i<end && 24+(i+1)*4<=ctx->reclen;++i)
+    flt_getswapu32(switchnode->maskwords[i],24+i*4);
+  flt_node_add(of,(flt_node*)switchnode);
+
+  return leftbytes;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+// position of a converted vertex (first component) as doubles
+void flt_vertex_position(const fltu8* vtx, fltu32 pflags, double* p)
+{
+  float pf[3];
+  if ( pflags & FLT_OPT_PAL_VTX_POSITION_SINGLE )
+  {
+    memcpy(pf,vtx,sizeof(pf));
+    p[0]=pf[0]; p[1]=pf[1]; p[2]=pf[2];
+  }
+  else
+    memcpy(p,vtx,sizeof(double)*3);
+}
+
+// vertex no in vtx_array of a palette offset (0 if it's not the offset of a vertex converted)
+fltu32 flt_vtx_number(flt* of, fltu32 vtxoffset)
+{
+  const flt_context* ctx=of->ctx;
+  fltu32 n=0;
+  if ( vtxoffset < ctx->vtx_mapbytes && ctx->vtx_starts && (ctx->vtx_starts[vtxoffset>>3] & (1<<(vtxoffset&7))) )
+  {
+    memcpy(&n, of->pal->vtx_buff + vtxoffset, sizeof(fltu32));
+    if ( n >= of->pal->vtx_count ) n=0;
+  }
+  return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// bounds of the node, empty ones created the first time. null if out of memory
+////////////////////////////////////////////////////////////////////////////////////////////////
+flt_bounds* flt_node_bounds(flt* of, flt_node* n)
+{
+  flt_bounds* b=n->bounds;
+  int i;
+
+  if ( b ) return b;
+  b = n->bounds = (flt_bounds*)flt_of_calloc(of,sizeof(flt_bounds));
+  if ( !b ) return FLT_NULL;
+  for ( i=0; i<3; ++i ) { b->min[i]=DBL_MAX; b->max[i]=-DBL_MAX; }
+  b->radius = -1.0; // empty
+  return b;
+}
+
+// the sphere grows half way to a point out of it (moving its center), as in Ritter's
+void flt_bounds_point(flt_bounds* b, const double* p)
+{
+  double d[3], dist, r;
+  int i;
+
+  for ( i=0; i<3; ++i )
+  {
+    if ( p[i]<b->min[i] ) b->min[i]=p[i];
+    if ( p[i]>b->max[i] ) b->max[i]=p[i];
+    d[i] = p[i]-b->center[i];
+  }
+  if ( b->radius < 0.0 )
+  {
+    memcpy(b->center,p,sizeof(b->center));
+    b->radius = 0.0;
+    return;
+  }
+  dist = d[0]*d[0]+d[1]*d[1]+d[2]*d[2];
+  if ( dist <= b->radius*b->radius ) return;
+  dist = sqrt(dist);
+  r = (b->radius+dist)*0.5;
+  for ( i=0; i<3; ++i ) b->center[i] += d[i]*(r-b->radius)/dist;
+  b->radius = r;
+}
+
+// dst encloses src too
+void flt_bounds_merge(flt_bounds* dst, const flt_bounds* src)
+{
+  double d[3], dist, r;
+  int i;
+
+  if ( src->radius < 0.0 ) return;
+  for ( i=0; i<3; ++i )
+  {
+    if ( src->min[i]<dst->min[i] ) dst->min[i]=src->min[i];
+    if ( src->max[i]>dst->max[i] ) dst->max[i]=src->max[i];
+    d[i] = src->center[i]-dst->center[i];
+  }
+  dist = sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+  if ( dst->radius < 0.0 || dist+dst->radius <= src->radius ) // src encloses dst
+  {
+    memcpy(dst->center,src->center,sizeof(dst->center));
+    dst->radius = src->radius;
+  }
+  else if ( dist+src->radius > dst->radius )
+  {
+    r = (dist+dst->radius+src->radius)*0.5;
+    for ( i=0; i<3; ++i ) dst->center[i] += d[i]*(r-dst->radius)/dist;
+    dst->radius = r;
+  }
+}
+
+// a complete node adds its bounds to the parent (out of memory leaves the parent without them)
+void flt_bounds_up(flt* of, flt_node* child, flt_node* parent)
+{
+  flt_bounds* b;
+  if ( !child || !child->bounds || !parent ) return;
+  b = flt_node_bounds(of, parent);
+  if ( b ) flt_bounds_merge(b, child->bounds);
+}
+
+fltu32 flt_compute_vertex_size(fltu32 palopts)
+{
+  fltu32 size = 0;
+
+  if (palopts & FLT_OPT_PAL_VTX_POSITION)
+  {
+    if (palopts & FLT_OPT_PAL_VTX_POSITION_SINGLE)
+      size += sizeof(float) * 3;
+    else
+      size += sizeof(double) * 3;
+  }
+
+  if (palopts & FLT_OPT_PAL_VTX_NORMAL) size += sizeof(float) * 3;
+  if (palopts & FLT_OPT_PAL_VTX_UV)     size += sizeof(float) * 2;
+  if (palopts & FLT_OPT_PAL_VTX_COLOR)  size += sizeof(fltu32);
+
+  return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// converts the whole vertex palette in vtx_buff to vtx_array (layout of pflags) in one pass.
+// the first 4 bytes of every vertex in vtx_buff are replaced by its no in vtx_array (vertex lists).
+// welding, a duplicated vertex gets the no of the first one and its conversion is overwritten.
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_vertex_convert(flt* of, fltu32 palbytes)
+{
+  const fltu32 flags = of->ctx->opts->pflags;
+  const fltu32 vsize = flt_compute_vertex_size(flags);
+  fltu8* invtx = of->pal->vtx_buff;
+  fltu8* end = invtx+palbytes;
+  fltu8* outvtx = of->pal->vtx_array;
+  flt_weld weld, *w=FLT_NULL;
+  fltu32 n = 0, id;
+  fltu16 op, len;
+
+  // not welded if the hash doesn't fit in memory
+  if ( (flags & FLT_OPT_PAL_VTX_WELD) && flt_weld_create(&weld, of->ctx->opts, palbytes/40) )
+    w = &weld;
+
+  while ( invtx+sizeof(flt_op) <= end )
+  {
+    op = flt_get16(invtx);
+    len = flt_get16(invtx+2);
+    if ( invtx+len > end ) break;
+
+    // offsets of position, normal, uv and packed color by vertex type
+    switch ( op )
+    {
+    case FLT_OP_VERTEX_COLOR:           if ( len < 40 ) len=0; else flt_vertex_decode(invtx, outvtx, flags, 8, FLT_VTX_NONE, FLT_VTX_NONE, 32); break;
+    case FLT_OP_VERTEX_COLOR_NORMAL:    if ( len < 56 ) len=0; else flt_vertex_decode(invtx, outvtx, flags, 8, 32, FLT_VTX_NONE, 44); break;
+    case FLT_OP_VERTEX_COLOR_UV:        if ( len < 48 ) len=0; else flt_vertex_decode(invtx, outvtx, flags, 8, FLT_VTX_NONE, 32, 40); break;
+    case FLT_OP_VERTEX_COLOR_NORMAL_UV: if ( len < 64 ) len=0; else flt_vertex_decode(invtx, outvtx, flags, 8, 32, 44, 52); break;
+    default: 
+      if ( len >= sizeof(flt_op) ) { invtx += len; continue; } // not a vertex
+      len = 0;
+    }
+    if ( !len ) break; // broken palette, the rest not converted
+
+    id = w ? flt_weld_insert(w, of->pal->vtx_array, n) : n;
+    memcpy(invtx, &id, sizeof(fltu32));
+    of->ctx->vtx_starts[(invtx-of->pal->vtx_buff)>>3] |= 1<<((invtx-of->pal->vtx_buff)&7);
+    invtx += len;
+    if ( id == n )
+    {
+      outvtx += vsize;
+      ++n;
+    }
+  }
+
+  if ( w ) flt_weld_destroy(w);
+  of->pal->vtx_count = n;
+  of->ctx->vtx_mapbytes = (fltu32)(invtx-of->pal->vtx_buff);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// tolerances of the options, zeros if not welding
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_weld_eps(const flt_opts* opts, float* eps)
+{
+  eps[0] = eps[1] = eps[2] = 0.0f;
+  if ( !(opts->pflags & FLT_OPT_PAL_VTX_WELD) ) return;
+  if ( opts->weld_pos > 0.0f )    eps[0] = opts->weld_pos;
+  if ( opts->weld_normal > 0.0f ) eps[1] = opts->weld_normal;
+  if ( opts->weld_uv > 0.0f )     eps[2] = opts->weld_uv;
+}
+
+int flt_weld_create(flt_weld* w, const flt_opts* opts, fltu32 maxverts)
+{
+  fltu32 nbuckets = 64;
+  const fltu32 flags = opts->pflags;
+
+  memset(w, 0, sizeof(flt_weld));
+  while ( nbuckets < maxverts*2 && nbuckets < 0x80000000 ) nbuckets <<= 1;
+  w->head = (fltu32*)flt_malloc(nbuckets*sizeof(fltu32));
+  w->next = (fltu32*)flt_malloc((maxverts+1)*sizeof(fltu32));
+  if ( !w->head || !w->next )
+  {
+    flt_weld_destroy(w);
+    return FLT_FALSE;
+  }
+  memset(w->head, 0xff, nbuckets*sizeof(fltu32));
+  w->mask = nbuckets-1;
+  w->flags = flags;
+  flt_weld_eps(opts, w->eps);
+
+  // offsets of the components in the output layout (flt_compute_vertex_size)
+  if ( flags & FLT_OPT_PAL_VTX_POSITION )
+    w->psize = (flags & FLT_OPT_PAL_VTX_POSITION_SINGLE) ? sizeof(float)*3 : sizeof(double)*3;
+  w->vsize = w->psize;
+  w->nofs = w->uvofs = w->cofs = FLT_VTX_NONE;
+  if ( flags & FLT_OPT_PAL_VTX_NORMAL ) { w->nofs = w->vsize;  w->vsize += sizeof(float)*3; }
+  if ( flags & FLT_OPT_PAL_VTX_UV )     { w->uvofs = w->vsize; w->vsize += sizeof(float)*2; }
+  if ( flags & FLT_OPT_PAL_VTX_COLOR )  { w->cofs = w->vsize;  w->vsize += sizeof(fltu32); }
+  return FLT_TRUE;
+}
+
+void flt_weld_destroy(flt_weld* w)
+{
+  flt_safefree(w->head);
+  flt_safefree(w->next);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// bucket of the cell of a vertex position displaced dx,dy,dz cells. with no position tolerance
+// the exact position (or the whole vertex with no position) is hashed.
+////////////////////////////////////////////////////////////////////////////////////////////////
+fltu32 flt_weld_bucket(const flt_weld* w, const fltu8* vtx, int dx, int dy, int dz)
+{
+  fltu64 h = 14695981039346656037ULL;
+  flti64 cell[3];
+  double p[3];
+  fltu32 i, size;
+
+  if ( w->psize && w->eps[0] > 0.0f )
+  {
+    if ( w->flags & FLT_OPT_PAL_VTX_POSITION_SINGLE )
+    {
+      const float* pf = (const float*)vtx;
+      p[0]=pf[0]; p[1]=pf[1]; p[2]=pf[2];
+    }
+    else
+      memcpy(p, vtx, sizeof(double)*3);
+    cell[0] = (flti64)floor(p[0]/w->eps[0])+dx;
+    cell[1] = (flti64)floor(p[1]/w->eps[0])+dy;
+    cell[2] = (flti64)floor(p[2]/w->eps[0])+dz;
+    vtx = (const fltu8*)cell;
+    size = sizeof(cell);
+  }
+  else
+    size = w->psize ? w->psize : w->vsize;
+
+  // FNV-1a
+  for ( i = 0; i < size; ++i )
+    h = (h ^ vtx[i]) * 1099511628211ULL;
+  return (fltu32)(h ^ (h>>32)) & w->mask;
+}
+
+int flt_weld_equal(const flt_weld* w, const fltu8* a, const fltu8* b)
+{
+  const float* fa, *fb;
+  double pa[3], pb[3];
+  int i;
+
+  if ( w->psize )
+  {
+    if ( w->eps[0] <= 0.0f )
+    {
+      if ( memcmp(a, b, w->psize) ) return FLT_FALSE;
+    }
+    else
+    {
+      if ( w->flags & FLT_OPT_PAL_VTX_POSITION_SINGLE )
+      {
+        fa = (const float*)a; fb = (const float*)b;
+        for ( i = 0; i < 3; ++i ) { pa[i] = fa[i]; pb[i] = fb[i]; }
+      }
+      else
+      {
+        memcpy(pa, a, sizeof(pa)); memcpy(pb, b, sizeof(pb));
+      }
+      for ( i = 0; i < 3; ++i )
+        if ( fabs(pa[i]-pb[i]) > w->eps[0] ) return FLT_FALSE;
+    }
+  }
+  if ( w->nofs != FLT_VTX_NONE )
+  {
+    fa = (const float*)(a+w->nofs); fb = (const float*)(b+w->nofs);
+    for ( i = 0; i < 3; ++i )
+      if ( w->eps[1] > 0.0f ? fabs(fa[i]-fb[i]) > w->eps[1] : fa[i]!=fb[i] ) return FLT_FALSE;
+  }
+  if ( w->uvofs != FLT_VTX_NONE )
+  {
+    fa = (const float*)(a+w->uvofs); fb = (const float*)(b+w->uvofs);
+    for ( i = 0; i < 2; ++i )
+      if ( w->eps[2] > 0.0f ? fabs(fa[i]-fb[i]) > w->eps[2] : fa[i]!=fb[i] ) return FLT_FALSE;
+  }
+  if ( w->cofs != FLT_VTX_NONE && memcmp(a+w->cofs, b+w->cofs, sizeof(fltu32)) ) 
+    return FLT_FALSE;
+  return FLT_TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// returns the no of a vertex in vtxs equal to vertex v, or v (added to the hash) if there's none.
+// with a position tolerance the neighbor cells are looked up too.
+////////////////////////////////////////////////////////////////////////////////////////////////
+fltu32 flt_weld_insert(flt_weld* w, const fltu8* vtxs, fltu32 v)
+{
+  const fltu8* vtx = vtxs+v*w->vsize;
+  const int r = (w->psize && w->eps[0] > 0.0f) ? 1 : 0;
+  fltu32 b, i;
+  int dx, dy, dz;
+
+  for ( dx = -r; dx <= r; ++dx )
+  {
+    for ( dy = -r; dy <= r; ++dy )
+    {
+      for ( dz = -r; dz <= r; ++dz )
+      {
+        b = flt_weld_bucket(w, vtx, dx, dy, dz);
+        for ( i = w->head[b]; i != 0xffffffff; i = w->next[i] )
+        {
+          if ( flt_weld_equal(w, vtxs+i*w->vsize, vtx) )
+            return i;
+        }
+      }
+    }
+  }
+
+  b = flt_weld_bucket(w, vtx, 0, 0, 0);
+  w->next[v] = w->head[b];
+  w->head[b] = v;
+  return v;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// one vertex (big endian, palette record or local pool entry) to the output layout. components
+// at the given offsets of invtx, zeros written for the ones not there (FLT_VTX_NONE).
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_vertex_decode(const fltu8* invtx, fltu8* outvtx, fltu32 flags, fltu32 pofs, fltu32 nofs, fltu32 uvofs, fltu32 cofs)
+{
+  float* outf;
+  fltu32 c;
+#ifdef FLT_SSE2
+  const __m128i m8 = _mm_set1_epi16(0x00ff);
+  __m128i v, xy, z;
+  __m128 f;
+#else
+  double* outd;
+#endif
+
+  if ((flags & FLT_OPT_PAL_VTX_POSITION) && pofs==FLT_VTX_NONE)
+  {
+    c = (flags & FLT_OPT_PAL_VTX_POSITION_SINGLE) ? sizeof(float)*3 : sizeof(double)*3;
+    memset(outvtx, 0, c);
+    outvtx += c;
+  }
+  else if (flags & FLT_OPT_PAL_VTX_POSITION)
+  {
+    invtx += pofs;
+#ifdef FLT_SSE2
+    // byte swap of each double: bytes in each 16 bits word, then words reversed
+    xy = _mm_loadu_si128((const __m128i*)(invtx));
+    z = _mm_loadl_epi64((const __m128i*)(invtx+16));
+    xy = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(xy,8),m8), _mm_slli_epi16(xy,8));
+    z = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(z,8),m8), _mm_slli_epi16(z,8));
+    xy = _mm_shufflehi_epi16(_mm_shufflelo_epi16(xy,_MM_SHUFFLE(0,1,2,3)),_MM_SHUFFLE(0,1,2,3));
+    z = _mm_shufflelo_epi16(z,_MM_SHUFFLE(0,1,2,3));
+    if (flags & FLT_OPT_PAL_VTX_POSITION_SINGLE)
+    {
+      f = _mm_movelh_ps(_mm_cvtpd_ps(_mm_castsi128_pd(xy)), _mm_cvtpd_ps(_mm_castsi128_pd(z)));
+      _mm_storel_pi((__m64*)outvtx, f);
+      _mm_store_ss((float*)outvtx+2, _mm_movehl_ps(f,f));
+      outvtx += sizeof(float)*3;
+    }
+    else
+    {
+      _mm_storeu_pd((double*)outvtx, _mm_castsi128_pd(xy));
+      _mm_store_sd((double*)outvtx+2, _mm_castsi128_pd(z));
+      outvtx += sizeof(double)*3;
+    }
+#else
+    if (flags & FLT_OPT_PAL_VTX_POSITION_SINGLE)
+    {
+      outf = (float*)outvtx;
+      outf[0] = (float)flt_getdbl(invtx); outf[1] = (float)flt_getdbl(invtx+8); outf[2] = (float)flt_getdbl(invtx+16);
+      outvtx += sizeof(float)*3;
+    }
+    else
+    {
+      outd = (double*)outvtx;
+      outd[0] = flt_getdbl(invtx); outd[1] = flt_getdbl(invtx+8); outd[2] = flt_getdbl(invtx+16);
+      outvtx += sizeof(double)*3;
+    }
+#endif
+    invtx -= pofs;
+  }
+
+  if (flags & FLT_OPT_PAL_VTX_NORMAL)
+  {
+    outf = (float*)outvtx;
+    if ( nofs != FLT_VTX_NONE )
+    {
+#ifdef FLT_SSE2
+      // 3 floats loaded (the 4th zero), byte swapped as above
+      memcpy(&c, invtx+nofs+8, sizeof(fltu32));
+      v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(invtx+nofs)), _mm_cvtsi32_si128((int)c));
+      v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v,8),m8), _mm_slli_epi16(v,8));
+      f = _mm_castsi128_ps(_mm_shufflehi_epi16(_mm_shufflelo_epi16(v,_MM_SHUFFLE(2,3,0,1)),_MM_SHUFFLE(2,3,0,1)));
+      _mm_storel_pi((__m64*)outf, f);
+      _mm_store_ss(outf+2, _mm_movehl_ps(f,f));
+#else
+      outf[0] = flt_getflo(invtx+nofs); outf[1] = flt_getflo(invtx+nofs+4); outf[2] = flt_getflo(invtx+nofs+8);
+#endif
+    }
+    else
+      outf[0] = outf[1] = outf[2] = 0.0f;
+    outvtx += sizeof(float)*3;
+  }
+
+  if (flags & FLT_OPT_PAL_VTX_UV)
+  {
+    outf = (float*)outvtx;
+    outf[0] = uvofs != FLT_VTX_NONE ? flt_getflo(invtx+uvofs) : 0.0f;
+    outf[1] = uvofs != FLT_VTX_NONE ? flt_getflo(invtx+uvofs+4) : 0.0f;
+    outvtx += sizeof(float)*2;
+  }
+
+  if (flags & FLT_OPT_PAL_VTX_COLOR)
+  {
+    c = cofs != FLT_VTX_NONE ? flt_get32(invtx+cofs) : 0;
+    memcpy(outvtx, &c, sizeof(fltu32));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// bytes of a vertex in a local vertex pool with the given attribute mask
+////////////////////////////////////////////////////////////////////////////////////////////////
+fltu32 flt_vtxpool_size(fltu32 mask)
+{
+  fltu32 size = 0, uv;
+  if ( mask & FLT_VTXPOOL_POSITION ) size += sizeof(double)*3;
+  if ( mask & (FLT_VTXPOOL_COLOR_INDEX|FLT_VTXPOOL_COLOR_RGBA) ) size += sizeof(fltu32);
+  if ( mask & FLT_VTXPOOL_NORMAL ) size += sizeof(float)*3;
+  for ( uv=FLT_VTXPOOL_UV0; uv>=(1u<<20); uv>>=1 )
+  {
+    if ( mask & uv ) size += sizeof(float)*2;
+  }
+  return size;
+}
+
+// capacity of the mesh arrays for count elements of size bytes (doubling), 0 if its bytes don't fit in 32 bits
+fltu32 flt_mesh_cap(fltu64 count, fltu32 size)
+{
+  fltu64 cap = 16;
+  while ( cap < count ) cap <<= 1;
+  return cap*size <= 0xffffffff ? (fltu32)cap : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_release(flt* of)
+{
+  flt_pal_tex* pt, *pn;
+  
+  if ( !of ) return;
+  if ( of->cache ) 
+    flt_cache_detach(of); // in place arrays
+
+  // header
+  flt_safefree(of->filename);
+  flt_safefree(of->header);
+  flt_safefree(of->stats);
+#ifdef FLT_UNIQUE_FACES
+  flt_array_destroy(&of->indices);
+  flt_tris_destroy(&of->tris);
+  flt_facetable_destroy(&of->faces, !of->arena && !of->names); // names in arena or interned if any
+  flt_batches_destroy(&of->batches);
+  flt_bvh_destroy(&of->bvh);
+  flt_terrain_destroy(&of->terrain);
+#endif
+
+  // palette list
+  if ( of->pal )
+  {
+    // texture pal (in arena if any)
+    pt=of->arena ? FLT_NULL : of->pal->tex_head; 
+    while (pt)
+    { 
+      pn=pt->next; 
+      flt_safefree(pt->name);
+      flt_free(pt); 
+      pt=pn; 
+    } 
+
+    // vertex palette
+    flt_safefree(of->pal->vtx_buff);    
+    flt_safefree(of->pal->vtx_array);
+
+    flt_safefree(of->pal);
+  }
+
+  // nodes
+  if ( of->hie )
+  {
+    // releasing node hierarchy (only the references to other flt when in arena)
+    if ( of->arena )
+      flt_release_extrefs(of);
+    else
+    {
+      flt_release_node(of->hie->node_root, !of->names);
+      flt_safefree(of->hie->node_root);
+    }
+    flt_safefree(of->hie);
+  }
+
+  // context
+  if ( of->ctx )
+  {
+    // stack
+    if ( of->ctx->stack )
+      flt_stack_destroy(&of->ctx->stack);
+
+    // dict
+    if ( of->ctx->dict && flt_atomic_dec(&of->ctx->dict->ref)<=0 )
+      flt_dict_destroy(&of->ctx->dict, FLT_FALSE, FLT_NULL);
+
+    // finally context
+    flt_safefree(of->ctx->lod_sets);
+    flt_safefree(of->ctx->vtx_starts);
+    flt_safefree(of->ctx->basepath);
+    flt_safefree(of->ctx->cachefile);
+    flt_safefree(of->ctx);
+  }
+
+  flt_flat_destroy(&of->flat);
+
+  // all memory of nodes, names and palette entries
+  flt_arena_destroy(&of->arena);
+  flt_names_destroy(&of->names);
+
+  // cache file mapped (after the nodes pointing to it)
+  if ( of->cache )
+  {
+    flt_munmap_file(of->cache->view, of->cache->size);
+    flt_safefree(of->cache);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// releases the flt referenced by extref nodes, without freeing the nodes (the arena does)
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_release_extrefs(flt* of)
+{
+  flt_node_extref* eref=of->hie->extref_head;
+  while (eref)
+  {
+    flt_release_extref_of(eref->of);
+    eref->of=FLT_NULL;
+    eref=eref->next_extref;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// unreferences the flt of an extref, releasing it when last
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_release_extref_of(flt* of)
+{
+  if ( of && flt_atomic_dec(&of->ref)<=0 )
+  {
+    flt_release(of);
+    flt_future_destroy(&of->future);
+    flt_free(of);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_release_node(flt_node* n, int free_names)
+{
+  flt_node *next, *cur;
+  flt_node_extref* eref;
+  flt_node_switch* swi;
+  flt_node_mesh* mesh;
+
+#if !defined(FLT_UNIQUE_FACES) && !defined(FLT_LEAN_FACES)
+  flt_node_face* nodeface;
+#endif
+#ifndef FLT_UNIQUE_FACES
+  flt_node_vlist* vlist;
+#endif
+
+  if (!n) return;
+  
+  if ( free_names ) flt_safefree(n->name);  
+  flt_safefree(n->bounds);
+
+#ifdef FLT_UNIQUE_FACES
+  flt_safefree(n->ndx_pairs);
+#endif
+
+  // children
+  cur=next=n->child_head;
+  while (cur)
+  {
+    next=cur->next;
+    flt_release_node(cur, free_names);
+    flt_free(cur);
+    cur=next;
+  }
+
+  // external ref node to consider to release a flt* reference
+  switch ( n->type )
+  {
+    case FLT_NODE_EXTREF:
+    {
+      eref=(flt_node_extref*)n;
+      flt_release_extref_of(eref->of);
+      eref=FLT_NULL;
+    }break;
+    case FLT_NODE_MESH:
+    {
+      mesh = (flt_node_mesh*)n;
+      if ( mesh->vb )
+      {
+        flt_safefree(mesh->vb->vertices);
+        flt_safefree(mesh->vb);
+      }
+      flt_safefree(mesh->indices);
+      flt_safefree(mesh->prims);
+    }break;
+    case FLT_NODE_SWITCH:
+    {
+      swi = (flt_node_switch*)n;
+      flt_safefree(swi->maskwords);
+    }break;
+#if !defined(FLT_UNIQUE_FACES) && !defined(FLT_LEAN_FACES) // if there are node of large faces, release name
+    case FLT_NODE_FACE:
+      {
+        nodeface = (flt_node_face*)n;        
+        flt_safefree(nodeface->face.name);
+      }break;
+#endif
+#ifndef FLT_UNIQUE_FACES
+    case FLT_NODE_VLIST:
+    {
+      vlist=(flt_node_vlist*)n;
+      flt_safefree(vlist->indices);
+    }break;
+#endif
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_node_add_child(flt_node* parent, flt_node* node)
+{
+  FLT_ASSERT(parent && "There should be at least a node-root. some unwanted pop was done");
+
+  if ( !parent->child_head )
+  {
+    parent->child_tail = parent->child_head = node;
+  }
+  else 
+  {
+    parent->child_tail->next = node;
+    parent->child_tail = node;
+  }
+
+  ++parent->child_count;  
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_node_add(flt* of, flt_node* node)
+{
+  flt_context* ctx = of->ctx;
+  flt_node *parent=0, *prev;
+  flt_node_extref* er;
+
+  if (ctx->stack->count)
+  {
+    // pop and then look for parent
+    prev = flt_stack_popn(ctx->stack);
+    parent = flt_stack_topn_not_null(ctx->stack);      
+    if ( prev && prev->bounds ) flt_bounds_up(of, prev, parent); // previous sibling complete
+
+    // add to parent
+    flt_node_add_child(parent,node);
+
+    // restore stack
+    flt_stack_pushn(ctx->stack, node );
+  }
+  else
+    FLT_BREAK;// "shouldn't be here as there's always the node_root"
+
+  if ( of->hie ) 
+  {
+    ++of->hie->node_count;
+
+    // check if it's a extref node, then we maintain an additional flat list structure
+    if ( node->type==FLT_NODE_EXTREF )
+    {
+      er = (flt_node_extref*)node;
+      if ( ctx->node_extref_last )
+        ctx->node_extref_last->next_extref = er; // if shortcut to last one
+      else
+        of->hie->extref_head = er; // if starting list
+      ++of->hie->extref_count;
+      ctx->node_extref_last = er;
+    }
+  }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+static int flt_node_sizes[FLT_NODE_MAX]={0,sizeof(flt_node), sizeof(flt_node_extref), sizeof(flt_node_group),
+  sizeof(flt_node_object), sizeof(flt_node_mesh), sizeof(flt_node_lod), 
+#ifdef FLT_UNIQUE_FACES
+  0,
+#else
+  sizeof(flt_node_face),
+#endif
+  sizeof(flt_node_vlist), sizeof(flt_node_switch)};
+#define flt_node_keeps_name(hieflags,nodetype,name) ( (!((hieflags) & FLT_OPT_HIE_NO_NAMES) || (nodetype)==FLT_NODE_EXTREF) && (name) && *(name) )
+
+flt_node* flt_node_create(fltu32 hieflags, int nodetype, const char* name)
+{
+  flt_node* n=0;
+
+  n=(flt_node*)flt_calloc(1,flt_node_sizes[nodetype]);
+  if (n)
+  {
+    n->type = nodetype;
+    if ( flt_node_keeps_name(hieflags,nodetype,name) )
+      n->name = flt_strdup(name);
+  }
+  return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// node of a flt being loaded, from its arena if any
+////////////////////////////////////////////////////////////////////////////////////////////////
+flt_node* flt_node_alloc(flt* of, int nodetype, const char* name)
+{
+  flt_node* n=0;
+
+  flt_stat_add(of, allocs, 1);
+  flt_stat_add(of, alloc_bytes, flt_node_sizes[nodetype]);
+  if ( !of->arena && !of->names ) 
+    return flt_node_create(of->ctx->opts->hflags, nodetype, name);
+
+  n=(flt_node*)(of->arena ? flt_arena_calloc(of->arena,flt_node_sizes[nodetype]) : flt_calloc(1,flt_node_sizes[nodetype]));
+  if (n)
+  {
+    n->type = nodetype;
+    if ( flt_node_keeps_name(of->ctx->opts->hflags,nodetype,name) )
+      n->name = of->names ? flt_names_intern(of,name,(fltu32)strlen(name),FLT_TRUE) : flt_arena_strdup(of->arena,name);
+  }
+  return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_swap_desc(void* data, flt_end_desc* desc)
+{
+  unsigned char* _data = (unsigned char*)data;
+  int i;
+  unsigned int offs;
+
+  while (desc->bits)
+  {
+    offs = desc->offs;
+    for (i=0;i<desc->count;++i, offs+=desc->bits>>3)
+    {
+      switch(desc->bits)
+      {
+      case 16: flt_swap16( _data+offs ); break;
+      case 32: flt_swap32( _data+offs ); break;
+      case 64: flt_swap64( _data+offs ); break;
+      }
+    }
+    desc++;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+flt_node* flt_node_find_by_name(flt_node* node_parent, const char* node_name )
+{
+  flt_node *c, *found;
+  if ( !node_parent || !node_name ) return FLT_NULL;
+  if ( node_parent->name && strcmp(node_parent->name, node_name) == 0 )
+    return node_parent;
+
+  c = node_parent->child_head;
+  found = FLT_NULL;
+  while ( c )
+  {
+    found = flt_node_find_by_name(c, node_name);
+    if ( found )
+      break;
+    c = c->next;
+  }
+  return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_count_indices(flt_node* node_parent, fltu32* inds, int recursive)
+{
+#ifdef FLT_UNIQUE_FACES
+  fltu32 b, batchStart, batchEnd;
+  flt_node* c;
+
+  if ( !node_parent ) return;
+  for ( b = 0; b < node_parent->ndx_pairs_count; ++b )
+  {
+    FLTGET32(node_parent->ndx_pairs[b], batchStart, batchEnd);
+    *inds += batchEnd-batchStart+1;
+  }
+
+  if ( recursive )
+  {
+    c = node_parent->child_head;
+    while ( c )
+    {
+      flt_count_indices(c, inds, recursive);
+      c = c->next;
+    }
+  }
+#else
+  FLT_BREAK; // NOT IMPLEMENTED
+  *inds = 0;
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_op_name(fltu16 opcode)
+{
+#ifndef FLT_NO_OPNAMES
+  static const char* names[FLT_OP_MAX] = {
+    "",                                                                   // 0
+    "Header",                                                             // 1
+    "Group",                                                              // 2
+    "Level of Detail",                                                    // 3 (obsolete)
+    "Object",                                                             // 4
+    "Face",                                                               // 5
+    "Vertex with ID",                                                     // 6 (obsolete)
+    "Short Vertex w/o ID",                                                // 7 (obsolete) 
+    "Vertex with Color",                                                  // 8 (obsolete)
+    "Vertex with Color and Normal",                                       // 9 (obsolete)
+    "Push Level",                                                         // 10
+    "Pop Level",                                                          // 11
+    "Translate",                                                          // 12 (obsolete)
+    "Degree of Freedom",                                                  // 13 (obsolete)
+    "Degree of Freedom",                                                  // 14
+    "",                                                                   // 15
+    "Instance Reference",                                                 // 16 (obsolete)  
+    "Instance Definition",                                                // 17 (obsolete)
+    "",                                                                   // 18
+    "Push Subface",                                                       // 19
+    "Pop Subface",                                                        // 20
+    "Push Extension",                                                     // 21
+    "Pop Extension",                                                      // 22
+    "Continuation",                                                       // 23
+    "", "", "", "", "", "", "",                                           // 24-30
+    "Comment",                                                            // 31 
+    "Color Palette",                                                      // 32
+    "Long ID",                                                            // 33
+    "", "", "", "", "", "",                                               // 34-39
+    "Translate",                                                          // 40 (obsolete)
+    "Rotate about Point",                                                 // 41 (obsolete)
+    "Rotate about Edge",                                                  // 42 (obsolete)
+    "Scale",                                                              // 43 (obsolete)
+    "Translate",                                                          // 44 (obsolete)
+    "Scale nonuniform",                                                   // 45 (obsolete)
+    "Rotate about Point",                                                 // 46 (obsolete)
+    "Rotate and/or Scale to Point",                                       // 47 (obsolete)
+    "Put",                                                                // 48 (obsolete)
+    "Matrix",                                                             // 49
+    "Vector",                                                             // 50
+    "Bounding Box",                                                       // 51 (obsolete)
+    "Multitexture",                                                       // 52
+    "UV List",                                                            // 53
+    "",                                                                   // 54
+    "Binary Separating Plane",                                            // 55
+    "", "", "", "",                                                       // 56-59
+    "Replicate",                                                          // 60
+    "Instance Reference",                                                 // 61
+    "Instance Definition",                                                // 62
+    "External Reference",                                                 // 63
+    "Texture Palette",                                                    // 64
+    "Eyepoint Palete",                                                    // 65 (obsolete)
+    "Material Palette",                                                   // 66 (obsolete)
+    "Vertex Palette",                                                     // 67
+    "Vertex with Color",                                                  // 68
+    "Vertex with Color and Normal",                                       // 69
+    "Vertex with Color, Normal and UV",                                   // 70
+    "Vertex with Color and UV",                                           // 71
+    "Vertex List",                                                        // 72
+    "Level of Detail",                                                    // 73
+    "Bounding Box",                                                       // 74
+    "",                                                                   // 75
+    "Rotate About Edge",                                                  // 76
+    "Scale",                                                              // 77 (obsolete)
+    "Translate",                                                          // 78
+    "Scale",                                                              // 79
+    "Rotate About Point",                                                 // 80
+    "Rotate and/or Scale to Point",                                       // 81
+    "Put",                                                                // 82
+    "Eyepoint and Trackplane Palette",                                    // 83
+    "Mesh",                                                               // 84
+    "Local Vertex Pool",                                                  // 85
+    "Mesh Primitive",                                                     // 86
+    "Road Segment",                                                       // 87
+    "Road Zone",                                                          // 88
+    "Morph Vertex List",                                                  // 89
+    "Linkage Palette",                                                    // 90
+    "Sound",                                                              // 91
+    "Road Path",                                                          // 92
+    "Sound Palette",                                                      // 93
+    "General Matrix",                                                     // 94
+    "Text",                                                               // 95
+    "Switch",                                                             // 96
+    "Line Style Palette",                                                 // 97
+    "Clip Region",                                                        // 98
+    "",                                                                   // 99
+    "Extension",                                                          // 100
+    "Light Source",                                                       // 101
+    "Light Source Palette",                                               // 102
+    "Reserved",                                                           // 103
+    "Reserved",                                                           // 104
+    "Bounding Sphere",                                                    // 105
+    "Bounding Cylinder",                                                  // 106
+    "Bounding Convex Hull",                                               // 107
+    "Bounding Volume Center",                                             // 108
+    "Bounding Volume Orientation",                                        // 109
+    "Reserved",                                                           // 110
+    "Light Point",                                                        // 111
+    "Texture Mapping Palette",                                            // 112
+    "Material Palette",                                                   // 113
+    "Name Table",                                                         // 114
+    "Continuously Adaptive Terrain (CAT)",                                // 115
+    "CAT Data",                                                           // 116
+    "Reserved",                                                           // 117
+    "Reserved",                                                           // 118
+    "Bounding Histogram",                                                 // 119
+    "Reserved",                                                           // 120
+    "Reserved",                                                           // 121
+    "Push Attribute",                                                     // 123
+    "Pop Attribute",                                                      // 124
+    "Reserved",                                                           // 125
+    "Curve",                                                              // 126
+    "Road Construction",                                                  // 127
+    "Light Point Appearance Palette",                                     // 128
+    "Light Point Animation Palette",                                      // 129
+    "Indexed Light Point",                                                // 130
+    "Light Point System",                                                 // 131
+    "Indexed String",                                                     // 132
+    "Shader Palette",                                                     // 133
+    "Reserved",                                                           // 134
+    "Extended Material Header",                                           // 135
+    "Extended Material Ambient",                                          // 136
+    "Extended Material Diffuse",                                          // 137
+    "Extended Material Specular",                                         // 138
+    "Extended Material Emissive",                                         // 139
+    "Extended Material Alpha",                                            // 140
+    "Extended Material Light Map",                                        // 141
+    "Extended Material Normal Map",                                       // 142
+    "Extended Material Bump Map",                                         // 143
+    "Reserved",                                                           // 144
+    "Extended Material Shadow Map",                                       // 145
+    "Reserved",                                                           // 146
+    "Extended Material Reflection Map",                                   // 147
+    "Extension GUID Palette",                                             // 148
+    "Extension Field Boolean",                                            // 149
+    "Extension Field Integer",                                            // 150
+    "Extension Field Float",                                              // 151
+    "Extension Field Double",                                             // 152
+    "Extension Field String",                                             // 153
+    "Extension Field XML String",                                         // 154
+  };
+  return (opcode<=FLT_OP_MAX) ? names[opcode] : "Unknown";
+#else
+return "";
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_proj_name(fltu32 proj)
+{
+  static char tmp[16];
+#ifndef FLT_NO_OPNAMES
+  const char* names[]={"Flat Earth", "Trapezoidal", "Round Earth", "Lambert", "UTM", "Geodetic", "Geocentric"};
+  return proj<7?names[proj]:itoa(proj,tmp,10);
+#else
+  return itoa(proj,tmp,10);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_db_origin_name(fltu32 db_orig)
+{
+  static char tmp[16];
+#ifndef FLT_NO_OPNAMES
+  switch(db_orig)
+  {
+  case 100: return "OpenFlight";
+  case 200: return "DIG I/II";
+  case 300: return "Evans and Sutherland CT5A/CT6";
+  case 400: return "PSP DIG";
+  case 600: return "General Electric CIV/CV/PT2000";
+  case 700: return "Evans and Sutherland GDF";
+  default: return itoa(db_orig,tmp,10);
+  }
+#else
+  return itoa(db_orig,tmp,10);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_vcoords_units_name(fltu8 vcu)
+{
+  static char tmp[16];
+#ifndef FLT_NO_OPNAMES
+  static const char* names[]={"Meters", "Kilometers", "", "", "Feet", "Inches", "", "", "Nautical miles"};
+  return vcu<9?names[vcu]:itoa(vcu,tmp,10);
+#else
+  return itoa(vcu,tmp,10);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_earth_ellip_name(int eem)
+{
+  static char tmp[16];
+#ifndef FLT_NO_OPNAMES
+  if ( eem==-1 ) return "User Defined";
+  static const char* names[]={"WGS 1984", "WGS 1972", "Bessel", "Clarke 1866", "NAD1927"};
+  return eem>=0 && eem<5?names[eem]:itoa(eem,tmp,10);
+#else
+  return itoa(eem,tmp,10);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_face_drawtype(fltu16 drawtype)
+{
+  static char tmp[16];
+#ifndef FLT_NO_OPNAMES
+  static const char* names[]={"Draw Solid Culling", "Draw Solid DSided", "Draw Wireframe Close", 
+    "Draw Wireframe", "Sorround WF AltColor","", "", "",  "Omni light", "Unidir light", "Bidir light"};
+  return drawtype<11?names[drawtype]:itoa(drawtype,tmp,10);
+#else
+  return itoa(drawtype,tmp,10);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_face_lightmode(fltu16 lm)
+{
+  static char tmp[16];
+#ifndef FLT_NO_OPNAMES
+  static const char* names[]={"Flat", "Gouraud", "Lit", "Lit-Gouraud"};
+  return lm<4?names[lm]:itoa(lm,tmp,10);
+#else
+  return itoa(lm,tmp,10);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_header_flags_name(flti32 flags)
+{
+  static char tmp[64];
+#ifndef FLT_NO_OPNAMES
+  *tmp='['; *(tmp+1)=0;  
+  if ( flags & (1<<31) )  sprintf(tmp, "%s%s", tmp, "0" );
+  if ( flags & (1<<30) )  sprintf(tmp, "%s | %s", tmp, "1");
+  if ( flags & (1<<29) )  sprintf(tmp, "%s | %s", tmp, "2" );
+  sprintf(tmp, "%s]", tmp );
+  return tmp;
+#else
+  return itoa(flags,tmp,16);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+const char* flt_get_err_reason(int errcode)
+{
+#ifdef FLT_LONG_ERR_MESSAGES
+  switch ( errcode )
+  {
+  case FLT_OK         : return "Ok"; 
+  case FLT_ERR_FOPEN  : return "IO Error opening/reading file or not found"; 
+  case FLT_ERR_VERSION: return "Version error. Max. supported version FLT_GREATER_SUPPORTED_VERSION";
+  case FLT_ERR_MEMOUT : return "Running out of memory. Malloc returns null";
+  case FLT_ERR_READBEYOND_REC: return "Read beyond record. Skip bytes is negative. Version error?";
+  case FLT_ERR_ALREADY: return "Already parsed and registered in the context dictionary";
+  case FLT_ERR_CACHE  : return "Cache file missing, broken, stale or written with other options/build";
+  case FLT_ERR_RECIDX : return "Record index missing, broken or stale, or node not found in it";
+  case FLT_ERR_CANCELED: return "Load canceled with flt_async_cancel";
+  }
+#else
+  switch ( errcode )
+  {
+  case FLT_OK         : return "Ok"; 
+  case FLT_ERR_FOPEN  : return "File error"; 
+  case FLT_ERR_VERSION: return "Version unsupported";
+  case FLT_ERR_MEMOUT : return "Out of mem";
+  case FLT_ERR_READBEYOND_REC: return "Read beyond record"; 
+  case FLT_ERR_ALREADY: return "Already parsed";
+  case FLT_ERR_CACHE  : return "Cache not valid";
+  case FLT_ERR_RECIDX : return "Record index not valid";
+  case FLT_ERR_CANCELED: return "Canceled";
+  }
+#endif
+  return "Unknown";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_get_op_from_node_type(int nodetype)
+{
+  int ops[FLT_NODE_MAX]={0,0,FLT_OP_EXTREF, FLT_OP_GROUP, FLT_OP_OBJECT, FLT_OP_MESH, 
+    FLT_OP_LOD, FLT_OP_FACE, FLT_OP_VERTEX_LIST, FLT_OP_SWITCH};
+  
+  return (nodetype >=0 && nodetype < FLT_NODE_MAX) ? ops[nodetype] : 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Encodes/decodes a vertex stream semantic word with the semantic, size and offset
+// 4 msb for semantic, and 6 bits for size and 6 for offset
+////////////////////////////////////////////////////////////////////////////////////////////////
+fltu16 flt_vtx_stream_enc(fltu8 semantic, fltu8 offset, fltu8 size)
+{
+  return (fltu16)( (fltu16)(semantic<<12) | (fltu16)((size<<6)&0x0fc0) | (fltu16)(offset&0x003f) );
+}
+
+void flt_vtx_stream_dec(fltu16 sem, fltu8* semantic, fltu8* offset, fltu8* size)
+{
+  *semantic = (fltu8)(sem>>12);
+  *size = (fltu8)( (sem&0x0fc0)>>6 );
+  *offset=(fltu8)( sem&0x003f );
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// extract base path from filename (caller should free the returned pointer)
+////////////////////////////////////////////////////////////////////////////////////////////////
+char* flt_path_base(const char* filename)
+{
+  char *ret, *ptr;
+  size_t len;
+  if ( !filename) return FLT_NULL;
+
+  len = strlen(filename);
+  ret=flt_strdup(filename);
+  ptr=ret+len;
+  while (ptr!=ret)
+  {
+    if ( *ptr=='\\' || *ptr=='/' )
+    {
+      // weren't not last
+      if ( ptr+1 != ret+len ) *(ptr+1)='\0';
+      return ret;
+    }
+    --ptr;
+  }
+  flt_safefree(ret);
+  return FLT_NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// try to open the filename, and if couldn't then uses the search paths...
+////////////////////////////////////////////////////////////////////////////////////////////////
+FILE* flt_fopen(const char* filename, flt* of)
+{
+  flt_context* ctx=of->ctx;  
+  flt_opts* opts=ctx->opts;
+  fltu32 i=0;  
+  char* basefile;
+  char* path;
+  const char* spath;
+
+  path = flt_strdup(filename);
+  ctx->f = path ? fopen(path,"rb") : FLT_NULL;
+  if( !ctx->f && path && opts->search_paths ) // failed original, use search paths if valid
+  {
+    // get the base file name
+    basefile = flt_path_basefile(filename);
+    while ( basefile ) // infinite if base file, but breaking in
+    {
+      spath = opts->search_paths[i];
+      if ( !spath ) break;
+      flt_free(path);
+      path = (char*)flt_malloc(strlen(spath)+strlen(basefile)+2);
+      if ( !path ) break;
+      strcpy(path, spath);
+      if ( !flt_path_endsok(spath) ) strcat(path, "/" );      
+      strcat(path, basefile);
+      ctx->f = fopen(path,"rb");
+      if (ctx->f) break;
+      ++i;
+    }
+    flt_safefree(basefile);
+  }
+
+  // if open ok, saves correct filename and base path
+  if ( ctx->f )
+  {
+    ctx->basepath = flt_path_base(path);
+    if ( !of->filename ) { of->filename = path; path = FLT_NULL; }
+  }
+  flt_safefree(path);
+  return ctx->f;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// extract the filename from a path
+////////////////////////////////////////////////////////////////////////////////////////////////
+char* flt_path_basefile(const char* filename)
+{
+  const char *ptr;
+  size_t len;
+
+  if ( !filename ) return FLT_NULL;
+  len = strlen(filename);
+  ptr = filename + len;
+  while ( ptr != filename )
+  {
+    if ( *ptr=='\\' || *ptr=='/' )
+    {
+      ++ptr;
+      break;
+    }
+    --ptr;
+  }
+
+  if ( ptr==filename+len ) return FLT_NULL;
+  return flt_strdup(ptr);  
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// returns 1 if path ends with / or \
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_path_endsok(const char* filename)
+{
+  size_t len;
+  const char* ptr;
+
+  if ( !filename || !*filename ) return FLT_FALSE;
+  len = strlen(filename);
+  ptr = filename+len-1;
+  while (ptr!=filename && (*ptr==' ' || *ptr=='\t') )
+    --ptr;
+  return (*ptr=='\\' || *ptr=='/') ? FLT_TRUE : FLT_FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// custom strdup implementation making use of optionally user defined malloc
+////////////////////////////////////////////////////////////////////////////////////////////////
+char* flt_strdup_internal(const char* str)
+{
+  const int len=(int)strlen(str);
+  char* outstr=(char*)flt_malloc(len+1);
+  memcpy(outstr, str, len+1);
+  return outstr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef FLT_ALIGNED
+void* flt_aligned_calloc(size_t nelem, size_t elsize, size_t alignment)
+{
+  void* mem;
+  elsize *= nelem;
+  mem=_aligned_malloc(elsize,alignment);
+  if (mem)
+    memset(mem,0,elsize);
+  return mem;
+}
+#endif
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                DICTIONARY
+////////////////////////////////////////////////////////////////////////////////////////////////
+// djb2
+fltu32 flt_dict_hash_djb2(const unsigned char* str, int unused) 
+{
+  unused;
+  fltu32 hash = 5381;
+  int c;
+  while (c = *str++) hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+  return hash;
+}
+
+int flt_dict_keycomp_string(const char* a, const char* b, int extra)
+{
+  return strcmp(a,b);
+}
+
+// create_cs==1 to create a critical section object, FLT_DICT_CONCURRENT to use several ones for concurrent access:
+// lookups don't lock (nodes are only appended and published complete) and inserts lock the stripe of their entry
+void flt_dict_create(int capacity, int create_cs, flt_dict** dict, flt_dict_hash hashf, flt_dict_keycomp keycomp)
+{
+  int i;
+  flt_dict* d = (flt_dict*)flt_malloc(sizeof(flt_dict));
+  d->ncs = create_cs > 1 ? create_cs : 1;
+  FLT_ASSERT( (d->ncs & (d->ncs-1))==0 && "number of critical sections must be a power of 2" );
+  d->cs = FLT_NULL;
+  if ( create_cs )
+  {
+    d->cs = (flt_critsec**)flt_malloc(sizeof(flt_critsec*)*d->ncs);
+    for (i=0;i<d->ncs;++i)
+      d->cs[i] = flt_critsec_create();
+  }
+  d->hasht = (flt_dict_node**)flt_calloc(capacity,sizeof(flt_dict_node*));
+  d->capacity = capacity;
+  d->count = 0;
+  d->hashf = hashf;
+  d->keycomp = keycomp;
+  d->ref = 1;
+  *dict = d;
+}
+
+// stripes always locked in the same order
+void flt_dict_lock_all(flt_dict* dict)
+{
+  int i;
+  if ( !dict->cs ) return;
+  for (i=0;i<dict->ncs;++i)
+    flt_critsec_enter(dict->cs[i]);
+}
+
+void flt_dict_unlock_all(flt_dict* dict)
+{
+  int i;
+  if ( !dict->cs ) return;
+  for (i=dict->ncs-1;i>=0;--i)
+    flt_critsec_leave(dict->cs[i]);
+}
+
+void flt_dict_visit(flt_dict*dict, flt_dict_visitor visitor, void* userdata)
+{
+  int i;
+  flt_dict_node *n;
+
+  flt_dict_lock_all(dict);
+  i=dict->capacity;
+  while(i--)
+  {
+    n=dict->hasht[i];
+    while (n)
+    {
+      visitor(n->key, n->value, userdata);
+      n=n->next;
+    }
+  }
+  flt_dict_unlock_all(dict);
+}
+
+void flt_dict_destroy(flt_dict** dict, int free_elms, flt_dict_visitor destructor)
+{
+  int i;
+  flt_dict_node *n, *nn;
+
+  flt_dict_lock_all(*dict);
+  
+  // entries and their lists
+  for (i=0;i<(*dict)->capacity;++i)
+  {
+    n=(*dict)->hasht[i];
+    while (n)
+    {
+      nn=n->next;
+      if ( destructor )
+        destructor(n->key, n->value, FLT_NULL);
+      if ( free_elms )
+        flt_safefree(n->value);
+      flt_free(n->key);
+      flt_free(n);
+      n=nn;
+    }
+  }
+  flt_safefree((*dict)->hasht);
+  flt_dict_unlock_all(*dict);
+  if ( (*dict)->cs ) 
+  {
+    for (i=0;i<(*dict)->ncs;++i)
+      flt_critsec_destroy((*dict)->cs[i]);
+    flt_safefree((*dict)->cs);
+  }
+  flt_safefree(*dict);
+}
+
+// caller saves hash computation and possible comparison in flat list
+void* flt_dict_gethe(flt_dict* dict, fltu32 hashe, fltu32* hashkey)
+{
+  flt_dict_node *n;
+  fltu16 entry, entryoff;
+  FLTGET16(hashe,entryoff,entry);
+  flt_dict_lock_read(dict,entry);
+  n = (flt_dict_node*)flt_atomic_loadptr((void**)&dict->hasht[entry]);
+  while(entryoff--)
+    n = (flt_dict_node*)flt_atomic_loadptr((void**)&n->next);
+  flt_dict_unlock_read(dict,entry);
+  if(hashkey) *hashkey=n->keyhash;
+  return flt_atomic_loadptr(&n->value);
+}
+
+// caller can save hash computation
+void* flt_dict_geth(flt_dict* dict, const char* key, int size, fltu32 hash, fltu32* hashe)
+{
+  flt_dict_node *n;
+  const int entry = hash % dict->capacity;
+  fltu16 hoff=0;
+
+  flt_dict_lock_read(dict,entry);
+  n = (flt_dict_node*)flt_atomic_loadptr((void**)&dict->hasht[entry]);
+  while(n)
+  {
+    if ( n->keyhash == hash && dict->keycomp(n->key,key,size)==0 ){ break; }
+    ++hoff;
+    n = (flt_dict_node*)flt_atomic_loadptr((void**)&n->next);
+  }
+  flt_dict_unlock_read(dict,entry);
+  *hashe = FLTMAKE32(hoff,(fltu16)entry);
+  return n ? flt_atomic_loadptr(&n->value) : FLT_NULL;
+}
+
+// this perform hash computation
+void* flt_dict_get(flt_dict* dict, const char* key, int size)
+{
+  fltu32 he;
+  return flt_dict_geth(dict,key,size,dict->hashf((const unsigned char*)key,size),&he);
+}
+
+flt_dict_node* flt_dict_create_node(const char* key, fltu32 keyhash, void* value, int size)
+{
+  flt_dict_node *n = (flt_dict_node*)flt_malloc(sizeof(flt_dict_node));
+  if ( size ) // we got size, just alloc+memcpy the key
+  {
+    n->key = (char*)flt_malloc(size);
+    memcpy(n->key,key,size);
+  }
+  else
+  {
+    n->key = flt_strdup(key); // 0 size is for strings
+  }
+  n->keyhash = keyhash;
+  n->value = value;
+  n->next = FLT_NULL;
+  return n;
+}
+
+int flt_dict_insert(flt_dict* dict, const char* key, void* value, fltopt int size, fltopt fltu32 hash, fltopt fltu32* hashentry)
+{
+  return flt_dict_insert_ex(dict,key,value,size,hash,hashentry,FLT_TRUE) != FLT_NULL;
+}
+
+// inserts only if key doesn't exist, all in same lock
+void* flt_dict_insert_unique(flt_dict* dict, const char* key, void* value, fltopt int size)
+{
+  return flt_dict_insert_ex(dict,key,value,size,0,FLT_NULL,FLT_FALSE);
+}
+
+// replace=0 keeps the value of an existing key. returns the value for key in dict
+void* flt_dict_insert_ex(flt_dict* dict, const char* key, void* value, int size, fltu32 hash, fltu32* hashentry, int replace)
+{
+  flt_dict_node *n, *ln;
+  fltu32 hashk;
+  int entry;
+  fltu16 hoff=0;
+
+  if ( !value || !dict ) 
+    return FLT_NULL; // must insert non-null value.  
+  hashk = !hash ? dict->hashf((const unsigned char*)key, size) : hash;
+  entry = hashk % dict->capacity;
+  flt_dict_lock(dict,entry); // acquire
+  n=dict->hasht[entry];
+  if ( !n )
+  {
+    n=flt_dict_create_node(key,hashk,value,size); // not found in entry, add it
+    flt_atomic_storeptr((void**)&dict->hasht[entry], n); // published complete to lookups
+    flt_atomic_inc(&dict->count);
+  }
+  else
+  {
+    ln=n;
+    // entry collision: append to the end of list: new entry, just hash collision || or already exists element
+    while (n)
+    {
+      // same keyhash and same keyname (exists)
+      if ( n->keyhash == hashk && dict->keycomp(n->key,key,size)==0 ) 
+      { 
+        if ( replace ) flt_atomic_storeptr(&n->value,value); 
+        else value = n->value;
+        ln=0; 
+        break; 
+      }
+      ++hoff;
+      ln=n;
+      n=n->next;
+    }    
+    if (ln) 
+    {
+      n=flt_dict_create_node(key,hashk,value,size);
+      flt_atomic_storeptr((void**)&ln->next, n);
+      flt_atomic_inc(&dict->count);
+    }
+  }
+
+  if ( hashentry )
+    *hashentry = FLTMAKE32( hoff, (fltu16)entry ) ;
+
+  flt_dict_unlock(dict,entry);
+  return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                            CRITICAL SECTION / ATOMIC
+////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+typedef struct flt_critsec
+{
+  CRITICAL_SECTION cs;
+}flt_critsec;
+
+flt_critsec* flt_critsec_create()
+{
+  flt_critsec* cs=(flt_critsec*)flt_malloc(sizeof(flt_critsec));
+  InitializeCriticalSection(&cs->cs);
+  return cs;
+}
+
+void flt_critsec_destroy(flt_critsec* cs)
+{
+  DeleteCriticalSection(&cs->cs);
+  flt_free(cs);
+}
+
+void flt_critsec_enter(flt_critsec* cs)
+{
+  EnterCriticalSection(&cs->cs);
+}
+
+void flt_critsec_leave(flt_critsec* cs)
+{
+  LeaveCriticalSection(&cs->cs);
+}
+
+flti32 flt_atomic_dec(fltatom32* c)
+{
+  return InterlockedDecrement(c);
+}
+
+flti32 flt_atomic_inc(fltatom32* c)
+{
+  return InterlockedIncrement(c);
+}
+
+void flt_atomic_add(fltatom32* c, fltu32 val)
+{
+  InterlockedExchangeAdd(c,(LONG)val);
+}
+
+void* flt_atomic_loadptr(void** p)
+{
+  void* val = *(void* volatile*)p;
+  _ReadWriteBarrier();
+  return val;
+}
+
+void flt_atomic_storeptr(void** p, void* val)
+{
+  InterlockedExchangePointer(p,val);
+}
+
+fltu64 flt_atomic_load64(fltu64* p)
+{
+  return (fltu64)InterlockedCompareExchange64((volatile LONGLONG*)p,0,0);
+}
+
+void flt_atomic_store64(fltu64* p, fltu64 val)
+{
+  InterlockedExchange64((volatile LONGLONG*)p,(LONGLONG)val);
+}
+
+typedef struct flt_thread
+{
+  HANDLE h;
+  flt_thread_func func;
+  void* arg;
+}flt_thread;
+
+DWORD WINAPI flt_thread_proc(LPVOID t)
+{
+  ((flt_thread*)t)->func( ((flt_thread*)t)->arg );
+  return 0;
+}
+
+flt_thread* flt_thread_create(flt_thread_func func, void* arg)
+{
+  flt_thread* t=(flt_thread*)flt_malloc(sizeof(flt_thread));
+  if ( !t ) return FLT_NULL;
+  t->func = func;
+  t->arg = arg;
+  t->h = CreateThread(FLT_NULL, 0, flt_thread_proc, t, 0, FLT_NULL);
+  if ( !t->h ) flt_safefree(t);
+  return t;
+}
+
+void flt_thread_join(flt_thread* t)
+{
+  WaitForSingleObject(t->h, INFINITE);
+  CloseHandle(t->h);
+  flt_free(t);
+}
+
+typedef struct flt_event
+{
+  HANDLE h;
+}flt_event;
+
+flt_event* flt_event_create()
+{
+  flt_event* ev=(flt_event*)flt_malloc(sizeof(flt_event));
+  if ( !ev ) return FLT_NULL;
+  ev->h = CreateEvent(FLT_NULL, FALSE, FALSE, FLT_NULL);
+  if ( !ev->h ) flt_safefree(ev);
+  return ev;
+}
+
+void flt_event_destroy(flt_event* ev)
+{
+  CloseHandle(ev->h);
+  flt_free(ev);
+}
+
+void flt_event_signal(flt_event* ev)
+{
+  SetEvent(ev->h);
+}
+
+void flt_event_wait(flt_event* ev)
+{
+  WaitForSingleObject(ev->h, INFINITE);
+}
+
+#else // perhaps pthread/gcc builtings ? // add other platforms here
+
+typedef struct flt_critsec
+{
+  pthread_mutex_t mtx;
+}flt_critsec;
+
+flt_critsec* flt_critsec_create()
+{
+  flt_critsec* cs;
+  cs=(flt_critsec*)flt_malloc(sizeof(flt_critsec));
+  pthread_mutex_init(&cs->mtx, FLT_NULL);
+  return cs;
+}
+
+void flt_critsec_destroy(flt_critsec* cs)
+{
+  pthread_mutex_destroy(&cs->mtx);
+  flt_free(cs);
+}
+
+void flt_critsec_enter(flt_critsec* cs)
+{
+  pthread_mutex_lock(&cs->mtx);
+}
+
+void flt_critsec_leave(flt_critsec* cs)
+{
+  pthread_mutex_unlock(&cs->mtx);
+}
+
+flti32 flt_atomic_dec(fltatom32* c)
+{
+  return __sync_sub_and_fetch(c,1);
+}
+
+flti32 flt_atomic_inc(fltatom32* c)
+{
+  return __sync_add_and_fetch(c,1);
+}
+
+void flt_atomic_add(fltatom32* c, fltu32 val)
+{
+  __sync_add_and_fetch(c,val);
+}
+
+void* flt_atomic_loadptr(void** p)
+{
+  return __atomic_load_n(p,__ATOMIC_ACQUIRE);
+}
+
+void flt_atomic_storeptr(void** p, void* val)
+{
+  __atomic_store_n(p,val,__ATOMIC_RELEASE);
+}
+
+fltu64 flt_atomic_load64(fltu64* p)
+{
+  return __atomic_load_n(p,__ATOMIC_ACQUIRE);
+}
+
+void flt_atomic_store64(fltu64* p, fltu64 val)
+{
+  __atomic_store_n(p,val,__ATOMIC_RELEASE);
+}
+
+typedef struct flt_thread
+{
+  pthread_t th;
+  flt_thread_func func;
+  void* arg;
+}flt_thread;
+
+void* flt_thread_proc(void* t)
+{
+  ((flt_thread*)t)->func( ((flt_thread*)t)->arg );
+  return FLT_NULL;
+}
+
+flt_thread* flt_thread_create(flt_thread_func func, void* arg)
+{
+  flt_thread* t=(flt_thread*)flt_malloc(sizeof(flt_thread));
+  if ( !t ) return FLT_NULL;
+  t->func = func;
+  t->arg = arg;
+  if ( pthread_create(&t->th, FLT_NULL, flt_thread_proc, t) != 0 ) flt_safefree(t);
+  return t;
+}
+
+void flt_thread_join(flt_thread* t)
+{
+  pthread_join(t->th, FLT_NULL);
+  flt_free(t);
+}
+
+typedef struct flt_event
+{
+  pthread_mutex_t mtx;
+  pthread_cond_t cond;
+  int signaled;
+}flt_event;
+
+flt_event* flt_event_create()
+{
+  flt_event* ev=(flt_event*)flt_malloc(sizeof(flt_event));
+  if ( !ev ) return FLT_NULL;
+  pthread_mutex_init(&ev->mtx, FLT_NULL);
+  pthread_cond_init(&ev->cond, FLT_NULL);
+  ev->signaled = 0;
+  return ev;
+}
+
+void flt_event_destroy(flt_event* ev)
+{
+  pthread_cond_destroy(&ev->cond);
+  pthread_mutex_destroy(&ev->mtx);
+  flt_free(ev);
+}
+
+void flt_event_signal(flt_event* ev)
+{
+  pthread_mutex_lock(&ev->mtx);
+  ev->signaled = 1;
+  pthread_cond_signal(&ev->cond);
+  pthread_mutex_unlock(&ev->mtx);
+}
+
+void flt_event_wait(flt_event* ev)
+{
+  pthread_mutex_lock(&ev->mtx);
+  while ( !ev->signaled ) 
+    pthread_cond_wait(&ev->cond, &ev->mtx);
+  ev->signaled = 0;
+  pthread_mutex_unlock(&ev->mtx);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                FILE MAPPING
+////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+// maps the whole opened file read-only. returns null if it can't be mapped (empty, pipe, no address space...)
+void* flt_mmap_file(FILE* f, fltu64* size)
+{
+  HANDLE hfile = (HANDLE)_get_osfhandle(_fileno(f));
+  HANDLE hmap;
+  LARGE_INTEGER fsize;
+  void* view;
+
+  if ( hfile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hfile,&fsize) || !fsize.QuadPart ) 
+    return FLT_NULL;
+  hmap = CreateFileMappingA(hfile, FLT_NULL, PAGE_READONLY, 0, 0, FLT_NULL);
+  if ( !hmap ) return FLT_NULL;
+  view = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(hmap); // the view keeps the mapping alive
+  if ( view ) *size = (fltu64)fsize.QuadPart;
+  return view;
+}
+
+void flt_munmap_file(void* view, fltu64 size)
+{
+  UnmapViewOfFile(view);
+}
+
+int flt_file_stat(const char* filename, fltu64* size, fltu64* mtime)
+{
+  struct __stat64 st;
+  if ( _stat64(filename,&st) != 0 ) return FLT_FALSE;
+  *size = (fltu64)st.st_size;
+  *mtime = (fltu64)st.st_mtime;
+  return FLT_TRUE;
+}
+
+// seconds of a monotonic clock (FLT_OPT_LOAD_STATS)
+double flt_time()
+{
+  static double freqinv=0.0;
+  LARGE_INTEGER t;
+  if ( freqinv == 0.0 )
+  {
+    QueryPerformanceFrequency(&t);
+    freqinv = 1.0/(double)t.QuadPart;
+  }
+  QueryPerformanceCounter(&t);
+  return (double)t.QuadPart*freqinv;
+}
+
+#else
+
+void* flt_mmap_file(FILE* f, fltu64* size)
+{
+  struct stat st;
+  void* view;
+
+  if ( fstat(fileno(f),&st) != 0 || !S_ISREG(st.st_mode) || !st.st_size || (fltu64)st.st_size != (size_t)st.st_size )
+    return FLT_NULL;
+  view = mmap(FLT_NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if ( view == MAP_FAILED ) return FLT_NULL;
+  madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL); // records are walked once from start to end
+  *size = (fltu64)st.st_size;
+  return view;
+}
+
+void flt_munmap_file(void* view, fltu64 size)
+{
+  munmap(view, (size_t)size);
+}
+
+int flt_file_stat(const char* filename, fltu64* size, fltu64* mtime)
+{
+  struct stat st;
+  if ( stat(filename,&st) != 0 ) return FLT_FALSE;
+  *size = (fltu64)st.st_size;
+  *mtime = (fltu64)st.st_mtime;
+  return FLT_TRUE;
+}
+
+double flt_time()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return (double)t.tv_sec+(double)t.tv_nsec*1e-9;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                BLOCK READER
+////////////////////////////////////////////////////////////////////////////////////////////////
+// readahead=1 to read the blocks in a background thread. The first block is requested already.
+int flt_blockreader_create(flt_blockreader** br, FILE* f, fltu32 blocksize, int readahead)
+{
+  flt_blockreader* _br = (flt_blockreader*)flt_calloc(1,sizeof(flt_blockreader));
+  if ( !_br ) return FLT_FALSE;
+  *br = _br;
+  _br->f = f;
+  _br->blocksize = blocksize;
+  _br->blocks[0] = (fltu8*)flt_malloc(blocksize);
+  _br->blocks[1] = (fltu8*)flt_malloc(blocksize);
+  _br->fill = 1;
+  if ( !_br->blocks[0] || !_br->blocks[1] ) { flt_blockreader_destroy(br); return FLT_FALSE; }
+
+  if ( readahead )
+  {
+    _br->ev_request = flt_event_create();
+    _br->ev_ready = flt_event_create();
+    if ( _br->ev_request && _br->ev_ready )
+      _br->thread = flt_thread_create(flt_blockreader_thread, _br);
+    // if the thread couldn't be created, blocks are read in place
+  }
+
+  flt_blockreader_request(_br,0);
+  return FLT_TRUE;
+}
+
+void flt_blockreader_destroy(flt_blockreader** br)
+{
+  flt_blockreader* _br;
+  if ( !br || !*br ) return;
+  _br = *br;
+
+  if ( _br->thread )
+  {
+    if ( _br->pending ) flt_event_wait(_br->ev_ready); // in flight read
+    _br->quit = 1;
+    flt_event_signal(_br->ev_request);
+    flt_thread_join(_br->thread);
+  }
+  if ( _br->ev_request ) flt_event_destroy(_br->ev_request);
+  if ( _br->ev_ready ) flt_event_destroy(_br->ev_ready);
+  flt_safefree(_br->blocks[0]);
+  flt_safefree(_br->blocks[1]);
+  flt_safefree(*br);
+}
+
+// requests the next block (into the one not being parsed), skipping seek bytes in file first
+void flt_blockreader_request(flt_blockreader* br, fltu64 seek)
+{
+  br->seek = seek;
+  br->fill ^= 1;
+  br->pending = 1;
+  if ( br->thread )
+    flt_event_signal(br->ev_request);
+  else
+    flt_blockreader_fill(br);
+}
+
+// waits for the requested block. returns it and its size (0 at end of file)
+const fltu8* flt_blockreader_wait(flt_blockreader* br, fltu32* size)
+{
+  *size = 0;
+  if ( !br->pending ) return FLT_NULL;
+  if ( br->thread ) flt_event_wait(br->ev_ready);
+  br->pending = 0;
+  *size = br->sizes[br->fill];
+  return br->blocks[br->fill];
+}
+
+void flt_blockreader_fill(flt_blockreader* br)
+{
+  if ( br->seek ) flt_fseek64(br->f, br->seek);
+  br->sizes[br->fill] = (fltu32)fread(br->blocks[br->fill], 1, br->blocksize, br->f);
+}
+
+void flt_blockreader_thread(void* arg)
+{
+  flt_blockreader* br=(flt_blockreader*)arg;
+  for (;;)
+  {
+    flt_event_wait(br->ev_request);
+    if ( br->quit ) break;
+    flt_blockreader_fill(br);
+    flt_event_signal(br->ev_ready);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                    CACHE
+////////////////////////////////////////////////////////////////////////////////////////////////
+// build options and struct sizes changing the layout of the cached data
+fltu32 flt_cache_abi()
+{
+  fltu32 abi = (fltu32)sizeof(flt_face) | ((fltu32)sizeof(flt_node)<<8) | ((fltu32)sizeof(void*)<<16);
+#ifdef FLT_UNIQUE_FACES
+  abi |= 1<<24;
+#endif
+#ifdef FLT_LEAN_FACES
+  abi |= 1<<25;
+#endif
+#ifdef FLT_TEXTURE_ATTRIBS_IN_NODE
+  abi |= 1<<26;
+#endif
+  return abi;
+}
+
+// hash of the whole file, streamed in blocks of FLT_CACHE_HASH_SIZE (chained, order matters). 0 if not read
+fltu64 flt_file_hash(const char* filename)
+{
+  FILE* f;
+  fltu8* buff;
+  size_t n;
+  fltu64 hash=0;
+
+  f = fopen(filename,"rb");
+  if ( !f ) return 0;
+  buff = (fltu8*)flt_malloc(FLT_CACHE_HASH_SIZE);
+  if ( buff )
+  {
+    while ( (n=fread(buff,1,FLT_CACHE_HASH_SIZE,f)) > 0 )
+      hash = flt_hash_bytes(buff,(fltu32)n) ^ (hash*0x9e3779b97f4a7c15ULL);
+    if ( ferror(f) ) hash=0;
+  }
+  fclose(f);
+  flt_safefree(buff);
+  return hash;
+}
+
+// size, modification time and hash of the whole source file
+int flt_cache_source(const char* srcfile, fltu64* size, fltu64* mtime, fltu64* hash)
+{
+  if ( !flt_file_stat(srcfile,size,mtime) ) return FLT_FALSE;
+  *hash = flt_file_hash(srcfile);
+  return *hash != 0;
+}
+
+// the source is the one written: size and mtime first, the file is only hashed when they match
+int flt_cache_source_valid(const char* srcfile, fltu64 size, fltu64 mtime, fltu64 hash)
+{
+  fltu64 cursize, curmtime;
+  return flt_file_stat(srcfile,&cursize,&curmtime) && cursize==size && curmtime==mtime && flt_file_hash(srcfile)==hash;
+}
+
+// appends data aligned to 16 bytes, returns its offset in file (FLT_CACHE_NONE if nothing)
+fltu64 flt_cachew_put(flt_cachew* w, const void* data, fltu64 size)
+{
+  static const fltu8 zeros[16]={0};
+  fltu64 offs;
+  fltu32 pad = (fltu32)((16-(w->pos&15))&15);
+
+  if ( !data || !size || w->err ) return FLT_CACHE_NONE;
+  if ( pad && fwrite(zeros,1,pad,w->f)!=pad ) { w->err=FLT_ERR_FOPEN; return FLT_CACHE_NONE; }
+  offs = w->pos+pad;
+  if ( fwrite(data,1,(size_t)size,w->f)!=(size_t)size ) { w->err=FLT_ERR_FOPEN; return FLT_CACHE_NONE; }
+  w->pos = offs+size;
+  return offs;
+}
+
+fltu64 flt_cachew_str(flt_cachew* w, const char* str)
+{
+  return str ? flt_cachew_put(w,str,strlen(str)+1) : FLT_CACHE_NONE;
+}
+
+// node and its children in preorder. the node struct is written with its pointers as offsets in the record
+int flt_cachew_node(flt_cachew* w, flt_node* n)
+{
+  flt_cache_anynode tmp;
+  flt_cache_node* rec;
+  flt_cache_mesh cm;
+  flt_node* child;
+  fltu32 ndx, size;
+  fltu64 name, data, array=FLT_CACHE_NONE, facename=FLT_CACHE_NONE, pairs=FLT_CACHE_NONE, bounds=FLT_CACHE_NONE;
+
+  if ( w->node_count>=w->node_cap )
+  {
+    w->node_cap = w->node_cap ? w->node_cap*2 : 256;
+    w->nodes = (flt_cache_node*)flt_realloc(w->nodes, w->node_cap*sizeof(flt_cache_node));
+    if ( !w->nodes ) return w->err=FLT_ERR_MEMOUT;
+  }
+  ndx = w->node_count++;
+
+  size = (fltu32)flt_node_sizes[n->type];
+  memset(&tmp,0,sizeof(tmp));
+  memcpy(&tmp,n,size);
+  switch ( n->type )
+  {
+  case FLT_NODE_EXTREF: tmp.extref.next_extref=FLT_NULL; tmp.extref.of=FLT_NULL; break;
+  case FLT_NODE_SWITCH: 
+    array = flt_cachew_put(w,tmp.swi.maskwords,(fltu64)tmp.swi.mask_count*tmp.swi.wpm*sizeof(fltu32)); 
+    tmp.swi.maskwords=FLT_NULL; 
+    break;
+  case FLT_NODE_VLIST: 
+    array = flt_cachew_put(w,tmp.vlist.indices,(fltu64)tmp.vlist.count*sizeof(fltu32)); 
+    tmp.vlist.indices=FLT_NULL; 
+    break;
+  case FLT_NODE_MESH: 
+#ifndef FLT_LEAN_FACES
+    facename = flt_cachew_str(w,tmp.mesh.attribs.name); 
+    tmp.mesh.attribs.name=FLT_NULL; 
+#endif
+    memset(&cm,0,sizeof(cm));
+    if ( tmp.mesh.vb )
+    {
+      cm.has_vb = FLT_TRUE;
+      cm.semantic = tmp.mesh.vb->semantic;
+      cm.vtx_count = tmp.mesh.vb->count;
+      cm.vtx_size = w->vtx_size;
+      cm.vertices = flt_cachew_put(w,tmp.mesh.vb->vertices,(fltu64)cm.vtx_count*cm.vtx_size);
+    }
+    cm.indices = flt_cachew_put(w,tmp.mesh.indices,(fltu64)tmp.mesh.index_count*sizeof(fltu32));
+    cm.prims = flt_cachew_put(w,tmp.mesh.prims,(fltu64)tmp.mesh.prim_count*sizeof(flt_mesh_prim));
+    array = flt_cachew_put(w,&cm,sizeof(cm));
+    tmp.mesh.vb=FLT_NULL; 
+    tmp.mesh.indices=FLT_NULL;
+    tmp.mesh.prims=FLT_NULL;
+    break;
+#if !defined(FLT_UNIQUE_FACES) && !defined(FLT_LEAN_FACES)
+  case FLT_NODE_FACE: facename = flt_cachew_str(w,tmp.face.face.name); tmp.face.face.name=FLT_NULL; break;
+#endif
+  }
+#ifdef FLT_UNIQUE_FACES
+  pairs = flt_cachew_put(w,n->ndx_pairs,(fltu64)n->ndx_pairs_count*sizeof(fltu64));
+#endif
+  if ( n->bounds ) bounds = flt_cachew_put(w,n->bounds,sizeof(flt_bounds));
+  name = flt_cachew_str(w,n->name);
+  data = flt_cachew_put(w,(fltu8*)&tmp+sizeof(flt_node),size-sizeof(flt_node));
+
+  rec = w->nodes+ndx;
+  memset(rec,0,sizeof(flt_cache_node));
+  rec->name = name;
+  rec->data = data;
+  rec->array = array;
+  rec->facename = facename;
+  rec->pairs = pairs;
+  rec->bounds = bounds;
+#ifdef FLT_UNIQUE_FACES
+  rec->pairs_count = n->ndx_pairs_count;
+#endif
+  rec->type = n->type;
+
+  for ( child=n->child_head; child && !w->err; child=child->next )
+  {
+    flt_cachew_node(w,child);
+    ++w->nodes[ndx].child_count; // nodes might have been reallocated
+  }
+  return w->err;
+}
+
+int flt_save_cache(flt* of, const char* cachefile, const char* srcfile)
+{
+  flt_cachew w;
+  flt_cache_head head;
+  flt_pal_tex* pt;
+  flt_cache_tex* texs=FLT_NULL;
+  char* tmpname;
+  fltu32 i;
+  int err;
+
+  if ( !of || !cachefile || !of->ctx ) return FLT_ERR_CACHE;
+  if ( of->pal && of->pal->vtx_buff ) return FLT_ERR_CACHE; // raw vertex palette (no vertex components in opts) not cached
+  if ( !srcfile ) srcfile = of->filename;
+
+  memset(&head,0,sizeof(head));
+  head.magic = FLT_CACHE_MAGIC;
+  head.version = FLT_CACHE_VERSION;
+  head.abi = flt_cache_abi();
+  head.pflags = of->ctx->pflags;
+  head.hflags = of->ctx->hflags & ~FLT_CACHE_HFLAGS_IGNORED;
+  memcpy(head.weld, of->ctx->weld, sizeof(head.weld));
+  memcpy(head.lod_range, of->ctx->lod_range, sizeof(head.lod_range));
+  if ( srcfile && !flt_cache_source(srcfile, &head.src_size, &head.src_mtime, &head.src_hash) ) return FLT_ERR_FOPEN;
+
+  // written to a temporary file and renamed, readers never see a half written cache. every writer has its own one
+  tmpname = flt_file_tmpname(cachefile);
+  if ( !tmpname ) return FLT_ERR_MEMOUT;
+  memset(&w,0,sizeof(w));
+  w.vtx_size = flt_compute_vertex_size(head.pflags);
+  w.f = fopen(tmpname,"wb");
+  if ( !w.f ) { flt_free(tmpname); return FLT_ERR_FOPEN; }
+  w.pos = sizeof(head);
+  if ( fwrite(&head,1,sizeof(head),w.f)!=sizeof(head) ) w.err=FLT_ERR_FOPEN;
+
+  if ( of->header )
+    head.header = flt_cachew_put(&w,of->header,sizeof(flt_header));
+  if ( of->pal )
+  {
+    head.has |= FLT_CACHE_HAS_PAL;
+    head.vtx_count = of->pal->vtx_count;
+    head.vtx_size = flt_compute_vertex_size(head.pflags);
+    head.vtx = flt_cachew_put(&w,of->pal->vtx_array,(fltu64)head.vtx_count*head.vtx_size);
+    head.tex_count = of->pal->tex_count;
+    texs = head.tex_count ? (flt_cache_tex*)flt_calloc(head.tex_count,sizeof(flt_cache_tex)) : FLT_NULL;
+    if ( head.tex_count && !texs ) w.err=FLT_ERR_MEMOUT;
+    for ( pt=of->pal->tex_head, i=0; texs && pt && i<head.tex_count; pt=pt->next, ++i )
+    {
+      texs[i].name = flt_cachew_str(&w,pt->name);
+      texs[i].patt_ndx = pt->patt_ndx;
+      texs[i].xy_loc[0] = pt->xy_loc[0];
+      texs[i].xy_loc[1] = pt->xy_loc[1];
+#ifdef FLT_TEXTURE_ATTRIBS_IN_NODE
+      texs[i].whd[0] = pt->width; texs[i].whd[1] = pt->height; texs[i].whd[2] = pt->depth;
+#endif
+    }
+    head.tex_count = i;
+    head.tex = flt_cachew_put(&w,texs,(fltu64)head.tex_count*sizeof(flt_cache_tex));
+    flt_safefree(texs);
+  }
+#ifdef FLT_UNIQUE_FACES
+  if ( of->indices )
+  {
+    head.indices_count = of->indices->size;
+    head.indices = flt_cachew_put(&w,of->indices->data,(fltu64)head.indices_count*sizeof(flt_array_type));
+  }
+  else if ( of->tris )
+  {
+    head.indices_count = of->tris->count;
+    head.index_size = of->tris->index_size;
+    head.indices = flt_cachew_put(&w,of->tris->vtx,(fltu64)head.indices_count*head.index_size);
+    head.tri_faces = flt_cachew_put(&w,of->tris->face,(fltu64)(head.indices_count/3)*sizeof(fltu32));
+  }
+  if ( of->faces && of->faces->count )
+  {
+    head.face_count = of->faces->count;
+    head.face_nslots = of->faces->nslots;
+    head.faces = flt_cachew_put(&w,of->faces->faces,(fltu64)head.face_count*sizeof(flt_face));
+    head.face_hashes = flt_cachew_put(&w,of->faces->hashes,(fltu64)head.face_count*sizeof(fltu64));
+    head.face_slots = flt_cachew_put(&w,of->faces->slots,(fltu64)head.face_nslots*sizeof(fltu64));
+#ifndef FLT_LEAN_FACES
+    {
+      fltu64* names = (fltu64*)flt_calloc(head.face_count,sizeof(fltu64));
+      if ( !names ) w.err=FLT_ERR_MEMOUT;
+      for ( i=0; names && i<head.face_count; ++i )
+        names[i] = flt_cachew_str(&w,of->faces->faces[i].name);
+      head.face_names = flt_cachew_put(&w,names,(fltu64)head.face_count*sizeof(fltu64));
+      flt_safefree(names);
+    }
+#endif
+  }
+#endif
+  if ( of->hie )
+  {
+    head.has |= FLT_CACHE_HAS_HIE;
+    if ( of->ctx->lflags & FLT_OPT_LOAD_BOUNDS ) head.has |= FLT_CACHE_HAS_BOUNDS;
+    head.hie_node_count = of->hie->node_count;
+    if ( of->hie->node_root ) flt_cachew_node(&w,of->hie->node_root);
+    head.node_count = w.node_count;
+    head.nodes = flt_cachew_put(&w,w.nodes,(fltu64)w.node_count*sizeof(flt_cache_node));
+    flt_safefree(w.nodes);
+  }
+
+  // head with the offsets
+  head.size = w.pos;
+  if ( !w.err && (fseek(w.f,0,SEEK_SET)!=0 || fwrite(&head,1,sizeof(head),w.f)!=sizeof(head)) ) w.err=FLT_ERR_FOPEN;
+  if ( fclose(w.f)!=0 && !w.err ) w.err=FLT_ERR_FOPEN;
+  err = w.err;
+  if ( !err )
+  {
+#ifdef _MSC_VER
+    remove(cachefile); // rename doesn't replace
+#endif
+    if ( rename(tmpname,cachefile)!=0 ) err=FLT_ERR_FOPEN;
+  }
+  if ( err ) remove(tmpname);
+  flt_free(tmpname);
+  return err;
+}
+
+// pointer to bytes of the cache, null if out of it
+const void* flt_cache_ptr(const flt_cache* c, fltu64 offs, fltu64 size)
+{
+  if ( offs==FLT_CACHE_NONE || offs>c->size || size>c->size-offs ) return FLT_NULL;
+  return (const fltu8*)c->view+offs;
+}
+
+// string of the cache (null terminated within the cache)
+char* flt_cache_str(const flt_cache* c, fltu64 offs)
+{
+  const char* s = (const char*)flt_cache_ptr(c,offs,1);
+  return s && memchr(s,0,(size_t)(c->size-offs)) ? (char*)s : FLT_NULL;
+}
+
+// node records form a tree in preorder and their data is in the cache
+int flt_cache_check_nodes(const flt_cache* c, const flt_cache_head* head)
+{
+  const flt_cache_node* recs;
+  fltu64 need=1;
+  fltu32 i, size;
+
+  if ( !head->node_count ) return FLT_TRUE;
+  recs = (const flt_cache_node*)flt_cache_ptr(c,head->nodes,(fltu64)head->node_count*sizeof(flt_cache_node));
+  if ( !recs ) return FLT_FALSE;
+  for ( i=0; i<head->node_count; ++i )
+  {
+    if ( !need || recs[i].type>=FLT_NODE_MAX || !flt_node_sizes[recs[i].type] ) return FLT_FALSE;
+    size = (fltu32)flt_node_sizes[recs[i].type];
+    if ( size>sizeof(flt_node) && !flt_cache_ptr(c,recs[i].data,size-sizeof(flt_node)) ) return FLT_FALSE;
+    if ( recs[i].type==FLT_NODE_EXTREF && !flt_cache_str(c,recs[i].name) ) return FLT_FALSE;
+    need = need-1+recs[i].child_count;
+  }
+  return need==0;
+}
+
+// rebuilds node (and its children) from the record ndx (checked). returns null if out of memory
+flt_node* flt_cache_read_node(flt* of, fltu32* ndx)
+{
+  const flt_cache* c = of->cache;
+  const flt_cache_head* head = (const flt_cache_head*)c->view;
+  const flt_cache_node* rec;
+  flt_node *n, *child;
+  flt_node_extref* er;
+  const void* data;
+  fltu32 size, i;
+  flt_context* ctx=of->ctx;
+
+  if ( *ndx>=head->node_count ) return FLT_NULL;
+  rec = (const flt_cache_node*)flt_cache_ptr(c,head->nodes,(fltu64)head->node_count*sizeof(flt_cache_node)) + (*ndx)++;
+  if ( rec->type>=FLT_NODE_MAX || !flt_node_sizes[rec->type] ) return FLT_NULL;
+  size = (fltu32)flt_node_sizes[rec->type];
+  data = flt_cache_ptr(c,rec->data,size-sizeof(flt_node));
+  n = (flt_node*)flt_arena_calloc(of->arena,size);
+  if ( !n || (size>sizeof(flt_node) && !data) ) return FLT_NULL;
+  if ( data ) memcpy((fltu8*)n+sizeof(flt_node),data,size-sizeof(flt_node));
+  n->type = rec->type;
+  n->name = flt_cache_str(c,rec->name);
+  if ( n->name && of->names ) n->name = flt_names_intern(of,n->name,(fltu32)strlen(n->name),FLT_FALSE);
+
+  // pointers of the node into the cache
+  switch ( n->type )
+  {
+  case FLT_NODE_SWITCH: 
+    {
+      flt_node_switch* swi = (flt_node_switch*)n;
+      swi->maskwords = (fltu32*)flt_cache_ptr(c,rec->array,(fltu64)swi->mask_count*swi->wpm*sizeof(fltu32));
+      if ( !swi->maskwords ) swi->mask_count=0;
+    }
+    break;
+  case FLT_NODE_VLIST: 
+    {
+      flt_node_vlist* vl = (flt_node_vlist*)n;
+      vl->indices = (fltu32*)flt_cache_ptr(c,rec->array,(fltu64)vl->count*sizeof(fltu32));
+      if ( !vl->indices ) vl->count=0;
+    }
+    break;
+  case FLT_NODE_MESH: 
+    if ( !flt_cache_read_mesh(of,(flt_node_mesh*)n,rec) ) return FLT_NULL; 
+    break;
+#ifndef FLT_LEAN_FACES
+#ifndef FLT_UNIQUE_FACES
+  case FLT_NODE_FACE: ((flt_node_face*)n)->face.name = flt_cache_str(c,rec->facename); break;
+#endif
+#endif
+  case FLT_NODE_EXTREF:
+    er = (flt_node_extref*)n;
+    if ( !n->name ) return FLT_NULL;
+    if ( ctx->node_extref_last ) ctx->node_extref_last->next_extref = er;
+    else of->hie->extref_head = er;
+    ctx->node_extref_last = er;
+    ++of->hie->extref_count;
+    if ( ctx->opts->cb_extref ) 
+      ctx->opts->cb_extref(er, of, ctx->opts->cb_user_data);
+    break;
+  }
+  n->bounds = (flt_bounds*)flt_cache_ptr(c,rec->bounds,sizeof(flt_bounds));
+#ifdef FLT_UNIQUE_FACES
+  n->ndx_pairs = (fltu64*)flt_cache_ptr(c,rec->pairs,(fltu64)rec->pairs_count*sizeof(fltu64));
+  n->ndx_pairs_count = n->ndx_pairs ? rec->pairs_count : 0;
+#endif
+
+  for ( i=0; i<rec->child_count; ++i )
+  {
+    child = flt_cache_read_node(of,ndx);
+    if ( !child ) return FLT_NULL;
+    flt_node_add_child(n,child);
+  }
+  return n;
+}
+
+// vertices, indices and primitives of a mesh in place. FLT_FALSE if out of memory
+int flt_cache_read_mesh(flt* of, flt_node_mesh* mesh, const flt_cache_node* rec)
+{
+  const flt_cache* c = of->cache;
+  const flt_cache_mesh* cm = (const flt_cache_mesh*)flt_cache_ptr(c,rec->array,sizeof(flt_cache_mesh));
+  fltu32 i;
+
+#ifndef FLT_LEAN_FACES
+  mesh->attribs.name = flt_cache_str(c,rec->facename);
+#endif
+  mesh->indices = cm ? (fltu32*)flt_cache_ptr(c,cm->indices,(fltu64)mesh->index_count*sizeof(fltu32)) : FLT_NULL;
+  mesh->prims = cm ? (flt_mesh_prim*)flt_cache_ptr(c,cm->prims,(fltu64)mesh->prim_count*sizeof(flt_mesh_prim)) : FLT_NULL;
+  for ( i=0; mesh->prims && i<mesh->prim_count; ++i )
+  {
+    if ( mesh->prims[i].start > mesh->index_count || mesh->prims[i].count > mesh->index_count-mesh->prims[i].start ) 
+      mesh->prims = FLT_NULL;
+  }
+  if ( !mesh->indices || !mesh->prims )
+  {
+    mesh->indices = FLT_NULL; mesh->index_count = 0;
+    mesh->prims = FLT_NULL; mesh->prim_count = 0;
+  }
+  if ( cm && cm->has_vb )
+  {
+    mesh->vb = (flt_mesh_vb*)flt_arena_calloc(of->arena,sizeof(flt_mesh_vb));
+    if ( !mesh->vb ) return FLT_FALSE;
+    mesh->vb->semantic = cm->semantic;
+    mesh->vb->count = cm->vtx_count;
+    if ( cm->vtx_size == flt_compute_vertex_size(of->ctx->opts->pflags) )
+      mesh->vb->vertices = (fltu8*)flt_cache_ptr(c,cm->vertices,(fltu64)cm->vtx_count*cm->vtx_size);
+  }
+  return FLT_TRUE;
+}
+
+// maps the cache and fills of from it. no changes in of if the cache is not valid (FLT_ERR_CACHE)
+int flt_cache_read(flt* of, const char* cachefile, const char* srcfile)
+{
+  flt_context* ctx=of->ctx;
+  flt_opts* opts=ctx->opts;
+  flt_cache c;
+  const flt_cache_head* head;
+  const flt_cache_tex* texs;
+  flt_pal_tex* pt, *last=FLT_NULL;
+  fltu32 i, ndx=0, vsize;
+  float weld[3];
+  double lodrange[2];
+  FILE* f;
+
+  // mapping and validating
+  f = fopen(cachefile,"rb");
+  if ( !f ) return FLT_ERR_CACHE;
+  c.view = flt_mmap_file(f,&c.size);
+  fclose(f);
+  if ( !c.view ) return FLT_ERR_CACHE;
+  head = (const flt_cache_head*)c.view;
+  vsize = flt_compute_vertex_size(opts->pflags);
+  flt_weld_eps(opts, weld);
+  flt_lod_range(opts, lodrange);
+  if ( c.size<sizeof(flt_cache_head) || head->magic!=FLT_CACHE_MAGIC || head->version!=FLT_CACHE_VERSION 
+    || head->abi!=flt_cache_abi() || head->size!=c.size || head->pflags!=opts->pflags 
+    || head->hflags!=(opts->hflags & ~FLT_CACHE_HFLAGS_IGNORED) || head->vtx_size!=vsize || memcmp(head->weld,weld,sizeof(weld))
+    || memcmp(head->lod_range,lodrange,sizeof(lodrange))
+    || ((head->has & FLT_CACHE_HAS_BOUNDS)!=0) != ((opts->lflags & FLT_OPT_LOAD_BOUNDS) && (head->has & FLT_CACHE_HAS_HIE))
+    || (srcfile && !flt_cache_source_valid(srcfile,head->src_size,head->src_mtime,head->src_hash))
+    || !flt_cache_check_nodes(&c,head)
+    || (head->tex_count && !flt_cache_ptr(&c,head->tex,(fltu64)head->tex_count*sizeof(flt_cache_tex)))
+    || (head->vtx_count && !flt_cache_ptr(&c,head->vtx,(fltu64)head->vtx_count*vsize))
+    || (head->header && !flt_cache_ptr(&c,head->header,sizeof(flt_header)))
+#ifdef FLT_UNIQUE_FACES
+    || (head->index_size!=0) != ((opts->lflags & FLT_OPT_LOAD_INDEX_STREAMS)!=0)
+    || (head->index_size && (head->indices_count%3 || (head->index_size!=sizeof(fltu16) && head->index_size!=sizeof(fltu32))))
+    || (head->indices_count && !flt_cache_ptr(&c,head->indices,(fltu64)head->indices_count*(head->index_size ? head->index_size : sizeof(flt_array_type))))
+    || (head->indices_count && head->index_size && !flt_cache_ptr(&c,head->tri_faces,(fltu64)(head->indices_count/3)*sizeof(fltu32)))
+    || (head->face_count && (!flt_cache_ptr(&c,head->faces,(fltu64)head->face_count*sizeof(flt_face)) 
+        || !flt_cache_ptr(&c,head->face_hashes,(fltu64)head->face_count*sizeof(fltu64))
+        || !flt_cache_ptr(&c,head->face_slots,(fltu64)head->face_nslots*sizeof(fltu64))
+        || (head->face_nslots & (head->face_nslots-1))))
+#endif
+    )
+  {
+    flt_munmap_file(c.view,c.size);
+    return FLT_ERR_CACHE;
+  }
+
+  // from now on of is filled, errors are released as any other load error
+  of->cache = (flt_cache*)flt_malloc(sizeof(flt_cache));
+  if ( !of->cache ) { flt_munmap_file(c.view,c.size); return FLT_ERR_MEMOUT; }
+  *of->cache = c;
+  if ( !of->arena && !flt_arena_create(&of->arena, FLT_ARENA_CHUNK_SIZE) ) return FLT_ERR_MEMOUT; // nodes point into the cache
+
+  if ( head->header )
+  {
+    of->header = (flt_header*)flt_malloc(sizeof(flt_header));
+    if ( !of->header ) return FLT_ERR_MEMOUT;
+    memcpy(of->header,flt_cache_ptr(&c,head->header,sizeof(flt_header)),sizeof(flt_header));
+  }
+
+  if ( head->has & FLT_CACHE_HAS_PAL )
+  {
+    of->pal = (flt_palettes*)flt_calloc(1,sizeof(flt_palettes));
+    if ( !of->pal ) return FLT_ERR_MEMOUT;
+    of->pal->vtx_array = (fltu8*)flt_cache_ptr(&c,head->vtx,(fltu64)head->vtx_count*vsize);
+    of->pal->vtx_count = of->pal->vtx_array ? head->vtx_count : 0;
+    texs = (const flt_cache_tex*)flt_cache_ptr(&c,head->tex,(fltu64)head->tex_count*sizeof(flt_cache_tex));
+    for ( i=0; texs && i<head->tex_count; ++i )
+    {
+      pt = (flt_pal_tex*)flt_arena_calloc(of->arena,sizeof(flt_pal_tex));
+      if ( !pt ) return FLT_ERR_MEMOUT;
+      pt->name = flt_cache_str(&c,texs[i].name);
+      pt->patt_ndx = texs[i].patt_ndx;
+      pt->xy_loc[0] = texs[i].xy_loc[0];
+      pt->xy_loc[1] = texs[i].xy_loc[1];
+#ifdef FLT_TEXTURE_ATTRIBS_IN_NODE
+      pt->width = texs[i].whd[0]; pt->height = texs[i].whd[1]; pt->depth = texs[i].whd[2];
+#endif
+      if ( last ) last->next = pt;
+      else of->pal->tex_head = pt;
+      last = pt;
+      ++of->pal->tex_count;
+      if ( opts->cb_texture ) 
+        opts->cb_texture(pt,of,opts->cb_user_data);
+    }
+  }
+
+#ifdef FLT_UNIQUE_FACES
+  // indices and unique faces in place (faces with names are copied to point to them)
+  if ( of->indices )
+  {
+    flt_safefree(of->indices->data);
+    of->indices->data = (flt_array_type*)flt_cache_ptr(&c,head->indices,(fltu64)head->indices_count*sizeof(flt_array_type));
+    of->indices->size = of->indices->capacity = of->indices->data ? head->indices_count : 0;
+  }
+  else if ( of->tris )
+  {
+    flt_safefree(of->tris->vtx);
+    flt_safefree(of->tris->face);
+    of->tris->index_size = head->index_size;
+    of->tris->vtx = (void*)flt_cache_ptr(&c,head->indices,(fltu64)head->indices_count*head->index_size);
+    of->tris->face = (fltu32*)flt_cache_ptr(&c,head->tri_faces,(fltu64)(head->indices_count/3)*sizeof(fltu32));
+    of->tris->count = of->tris->vtx && of->tris->face ? head->indices_count : 0;
+    of->tris->capacity = of->tris->count/3;
+  }
+  if ( of->faces && head->face_count )
+  {
+    flt_safefree(of->faces->faces);
+    flt_safefree(of->faces->hashes);
+    flt_safefree(of->faces->slots);
+    of->faces->hashes = (fltu64*)flt_cache_ptr(&c,head->face_hashes,(fltu64)head->face_count*sizeof(fltu64));
+    of->faces->slots = (fltu64*)flt_cache_ptr(&c,head->face_slots,(fltu64)head->face_nslots*sizeof(fltu64));
+    of->faces->count = of->faces->capacity = head->face_count;
+    of->faces->nslots = head->face_nslots;
+#ifdef FLT_LEAN_FACES
+    of->faces->faces = (flt_face*)flt_cache_ptr(&c,head->faces,(fltu64)head->face_count*sizeof(flt_face));
+#else
+    of->faces->faces = (flt_face*)flt_malloc(head->face_count*sizeof(flt_face));
+    if ( !of->faces->faces ) return FLT_ERR_MEMOUT;
+    memcpy(of->faces->faces,flt_cache_ptr(&c,head->faces,(fltu64)head->face_count*sizeof(flt_face)),head->face_count*sizeof(flt_face));
+    {
+      const fltu64* names = (const fltu64*)flt_cache_ptr(&c,head->face_names,(fltu64)head->face_count*sizeof(fltu64));
+      for ( i=0; i<head->face_count; ++i )
+      {
+        of->faces->faces[i].name = names ? flt_cache_str(&c,names[i]) : FLT_NULL;
+        if ( of->faces->faces[i].name && of->names ) 
+          of->faces->faces[i].name = flt_names_intern(of,of->faces->faces[i].name,(fltu32)strlen(of->faces->faces[i].name),FLT_FALSE);
+      }
+    }
+#endif
+  }
+#endif
+
+  if ( head->has & FLT_CACHE_HAS_HIE )
+  {
+    of->hie = (flt_hie*)flt_calloc(1,sizeof(flt_hie));
+    if ( !of->hie ) return FLT_ERR_MEMOUT;
+    if ( head->node_count )
+    {
+      of->hie->node_root = flt_cache_read_node(of,&ndx);
+      if ( !of->hie->node_root ) return FLT_ERR_MEMOUT;
+    }
+    of->hie->node_count = head->hie_node_count;
+  }
+  return FLT_OK;
+}
+
+int flt_load_cache(const char* cachefile, const char* srcfile, flt* of, flt_opts* opts)
+{
+  flt_context* ctx = flt_load_begin(of,opts);
+  int err;
+  if ( !ctx ) { of->errcode=FLT_ERR_MEMOUT; flt_future_complete(of); return of->errcode; }
+  if ( !cachefile ) return flt_err(FLT_ERR_FOPEN, of);
+
+  if ( srcfile && !of->filename ) 
+    of->filename = flt_strdup(srcfile);
+  ctx->basepath = flt_path_base(srcfile ? srcfile : cachefile); // for the external references
+  err = flt_cache_read(of,cachefile,srcfile);
+  if ( err != FLT_OK ) return flt_err(err, of);
+  return flt_load_end(of);
+}
+
+// pointers of of into the cache mapping are not freed
+void flt_cache_detach(flt* of)
+{
+  if ( of->pal && flt_cache_owns(of->cache,of->pal->vtx_array) ) of->pal->vtx_array=FLT_NULL;
+#ifdef FLT_UNIQUE_FACES
+  if ( of->indices && flt_cache_owns(of->cache,of->indices->data) ) of->indices->data=FLT_NULL;
+  if ( of->tris && flt_cache_owns(of->cache,of->tris->vtx) ) of->tris->vtx=FLT_NULL;
+  if ( of->tris && flt_cache_owns(of->cache,of->tris->face) ) of->tris->face=FLT_NULL;
+  if ( of->faces )
+  {
+    if ( flt_cache_owns(of->cache,of->faces->faces) ) of->faces->faces=FLT_NULL;
+    if ( flt_cache_owns(of->cache,of->faces->hashes) ) of->faces->hashes=FLT_NULL;
+    if ( flt_cache_owns(of->cache,of->faces->slots) ) of->faces->slots=FLT_NULL;
+  }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                    STATS
+////////////////////////////////////////////////////////////////////////////////////////////////
+void flt_stats_merge(flt_stats* dst, const flt_stats* src)
+{
+  int i;
+  if ( !dst || !src ) return;
+  for ( i=0; i<FLT_OP_MAX; ++i )
+  {
+    dst->rec_count[i] += src->rec_count[i];
+    dst->rec_bytes[i] += src->rec_bytes[i];
+    dst->rec_time[i] += src->rec_time[i];
+  }
+  dst->faces += src->faces;
+  dst->unique_faces += src->unique_faces;
+  dst->indices += src->indices;
+  dst->vertices += src->vertices;
+  dst->allocs += src->allocs;
+  dst->alloc_bytes += src->alloc_bytes;
+  dst->lods_skipped += src->lods_skipped;
+  dst->skipped_bytes += src->skipped_bytes;
+  dst->load_time += src->load_time;
+  dst->files += src->files;
+}
+
+// the files referenced more than once are merged once, visited keeps the ones already done
+void flt_stats_total_rec(const flt* of, flt_stats* total, const flt*** visited, fltu32* count)
+{
+  flt_node_extref* e;
+  const flt** v;
+  fltu32 i;
+
+  if ( !of ) return;
+  for ( i=0; i<*count; ++i )
+  {
+    if ( (*visited)[i] == of ) return;
+  }
+  if ( !(*count & (*count-1)) ) // grows at powers of two
+  {
+    v = (const flt**)flt_realloc((void*)*visited, sizeof(flt*)*flt_max(*count*2,16));
+    if ( !v ) return;
+    *visited = v;
+  }
+  (*visited)[(*count)++] = of;
+
+  flt_stats_merge(total, of->stats);
+  if ( !of->hie ) return;
+  for ( e=of->hie->extref_head; e; e=e->next_extref )
+  {
+    if ( e->of && e->of->loaded==FLT_LOADED )
+      flt_stats_total_rec(e->of, total, visited, count);
+  }
+}
+
+void flt_stats_total(const flt* of, flt_stats* total)
+{
+  const flt** visited=FLT_NULL;
+  fltu32 count=0;
+  if ( !total ) return;
+  flt_stats_total_rec(of, total, &visited, &count);
+  flt_safefree(visited);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                RECORD INDEX
+// One streaming pass. A node ends where the next node of its level (or a higher one) starts, 
+// or after the pop of its level when it has children.
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_recidx_build(const char* filename, const char* indexfile, flt_opts* opts)
+{
+  flt_recidx* idx=FLT_NULL;
+  char* defname=FLT_NULL;
+  int err;
+
+  if ( !filename ) return FLT_ERR_FOPEN;
+  if ( !indexfile )
+  {
+    defname = (char*)flt_malloc(strlen(filename)+strlen(FLT_RECIDX_EXT)+1);
+    if ( !defname ) return FLT_ERR_MEMOUT;
+    strcpy(defname,filename);
+    strcat(defname,FLT_RECIDX_EXT);
+    indexfile = defname;
+  }
+  err = flt_recidx_scan_file(filename, opts, &idx);
+  if ( err == FLT_OK ) 
+    err = flt_recidx_write(idx, indexfile, filename);
+  flt_recidx_free(&idx);
+  flt_safefree(defname);
+  return err;
+}
+
+int flt_recidx_scan_file(const char* filename, flt_opts* opts, flt_recidx** idx)
+{
+  flt_recidx_scan s;
+  int err;
+
+  memset(&s,0,sizeof(s));
+  s.prelude = FLT_RECIDX_NONE;
+  *idx = s.idx = (flt_recidx*)flt_calloc(1,sizeof(flt_recidx));
+  if ( !s.idx ) return FLT_ERR_MEMOUT;
+  err = flt_parse_from_filename(filename, opts, flt_recidx_scan_record, &s);
+  if ( err == FLT_OK ) err = s.err;
+  flt_recidx_close(&s, 0, s.end);
+  if ( !s.idx->hie ) s.idx->hie = s.end; // no hierarchy
+  if ( s.prelude != FLT_RECIDX_NONE ) s.idx->entries[s.prelude].end = s.idx->hie;
+  flt_safefree(s.last);
+  flt_safefree(s.open);
+  if ( err != FLT_OK ) flt_recidx_free(idx);
+  return err;
+}
+
+int flt_recidx_scan_record(const flt_record* rec, void* user_data)
+{
+  flt_recidx_scan* s=(flt_recidx_scan*)user_data;
+  flt_recidx* idx=s->idx;
+  const fltu32 d=rec->depth;
+  fltu32 k, id, parent=FLT_RECIDX_NONE, *arr;
+
+  s->end = rec->offset+rec->length;
+  if ( d+2 > s->depths )
+  {
+    // one more level for the children of a pop
+    k = flt_max(d+2, s->depths*2);
+    arr = (fltu32*)flt_realloc(s->last, k*sizeof(fltu32));
+    if ( arr ) s->last = arr;
+    arr = arr ? (fltu32*)flt_realloc(s->open, k*sizeof(fltu32)) : FLT_NULL;
+    if ( !arr ) { s->err=FLT_ERR_MEMOUT; return FLT_SAX_STOP; }
+    s->open = arr;
+    memset(s->last+s->depths, 0xff, (k-s->depths)*sizeof(fltu32));
+    memset(s->open+s->depths, 0xff, (k-s->depths)*sizeof(fltu32));
+    s->depths = k;
+  }
+
+  switch ( rec->op )
+  {
+  case FLT_OP_PUSHLEVEL:
+    if ( !d && !idx->hie ) 
+    {
+      idx->hie = rec->offset;
+      if ( s->prelude != FLT_RECIDX_NONE ) idx->entries[s->prelude].end = rec->offset;
+      s->prelude = FLT_RECIDX_NONE;
+    }
+    return FLT_SAX_CONTINUE;
+  case FLT_OP_POPLEVEL:
+    flt_recidx_close(s, d+1, rec->offset); // children of the level
+    flt_recidx_close(s, d, s->end);        // the node of the level, with its pop
+    return FLT_SAX_CONTINUE;
+  case FLT_OP_LONGID:
+    id = s->last[d];
+    if ( id != FLT_RECIDX_NONE && id+1 == idx->count && !flt_recidx_name(s, rec, rec->size) ) return FLT_SAX_STOP;
+    return FLT_SAX_CONTINUE;
+  }
+
+  if ( !flt_recidx_node(rec->op) )
+  {
+    // records before the hierarchy (palettes), the ones of nodes are in their range. 
+    // the vertices are in the range of the vertex palette
+    if ( d || idx->hie || (rec->op>=FLT_OP_VERTEX_COLOR && rec->op<=FLT_OP_VERTEX_COLOR_UV) ) return FLT_SAX_CONTINUE;
+    if ( s->prelude != FLT_RECIDX_NONE ) idx->entries[s->prelude].end = rec->offset;
+    s->prelude = flt_recidx_add(s, rec, FLT_RECIDX_NONE);
+    return s->prelude==FLT_RECIDX_NONE ? FLT_SAX_STOP : FLT_SAX_CONTINUE;
+  }
+
+  flt_recidx_close(s, d, rec->offset); // the nodes before in this level
+  if ( rec->op==FLT_OP_FACE || rec->op==FLT_OP_MESH ) // geometry not indexed
+  {
+    s->last[d] = FLT_RECIDX_NONE;
+    return FLT_SAX_CONTINUE;
+  }
+  for ( k=d; k>0 && parent==FLT_RECIDX_NONE; --k ) parent = s->last[k-1];
+  id = flt_recidx_add(s, rec, parent);
+  if ( id==FLT_RECIDX_NONE || !flt_recidx_name(s, rec, rec->op==FLT_OP_EXTREF ? 200 : 8) ) return FLT_SAX_STOP;
+  s->last[d] = s->open[d] = id;
+  return FLT_SAX_CONTINUE;
+}
+
+// beads of the hierarchy, their ancillary records follow them
+int flt_recidx_node(fltu16 op)
+{
+  switch ( op )
+  {
+  case FLT_OP_HEADER: case FLT_OP_GROUP: case FLT_OP_OBJECT: case FLT_OP_FACE: case 14: /*dof*/ case 55: /*bsp*/
+  case 61: /*instance ref*/ case 62: /*instance def*/ case FLT_OP_EXTREF: case FLT_OP_LOD: case FLT_OP_MESH: 
+  case 87: /*road segment*/ case 91: /*sound*/ case 92: /*road path*/ case 95: /*text*/ case FLT_OP_SWITCH: 
+  case 98: /*clip region*/ case 100: /*extension*/ case 101: /*light source*/ case 106: /*curve*/ 
+  case 111: /*light point*/ case 115: /*cat*/ case 127: /*road construction*/ case 130: /*indexed light point*/ 
+  case 131: /*light point system*/
+    return FLT_TRUE;
+  }
+  return FLT_FALSE;
+}
+
+// new entry of the record, FLT_RECIDX_NONE if out of memory
+fltu32 flt_recidx_add(flt_recidx_scan* s, const flt_record* rec, fltu32 parent)
+{
+  flt_recidx* idx=s->idx;
+  flt_recidx_entry* e;
+  fltu32 cap;
+
+  if ( idx->count == s->cap )
+  {
+    cap = flt_max(s->cap*2, 256);
+    e = (flt_recidx_entry*)flt_realloc(idx->entries, cap*sizeof(flt_recidx_entry));
+    if ( !e ) { s->err=FLT_ERR_MEMOUT; return FLT_RECIDX_NONE; }
+    idx->entries = e;
+    s->cap = cap;
+  }
+  e = idx->entries+idx->count;
+  memset(e,0,sizeof(flt_recidx_entry));
+  e->offset = rec->offset;
+  e->end = rec->offset+rec->length;
+  e->parent = parent;
+  e->name = FLT_RECIDX_NONE;
+  e->op = rec->op;
+  e->length = rec->length;
+  e->depth = (fltu16)rec->depth;
+  return idx->count++;
+}
+
+// name of the last entry from a string field at the start of the record. 0 if out of memory
+int flt_recidx_name(flt_recidx_scan* s, const flt_record* rec, fltu32 maxlen)
+{
+  flt_recidx* idx=s->idx;
+  char* names;
+  fltu32 cap, len;
+
+  if ( idx->names_size+maxlen+1 > s->names_cap )
+  {
+    cap = flt_max(idx->names_size+maxlen+1, flt_max(s->names_cap*2, 1024));
+    names = (char*)flt_realloc(idx->names, cap);
+    if ( !names ) { s->err=FLT_ERR_MEMOUT; return FLT_FALSE; }
+    idx->names = names;
+    s->names_cap = cap;
+  }
+  len = flt_record_str(rec, 0, maxlen, idx->names+idx->names_size, maxlen+1);
+  idx->entries[idx->count-1].name = len ? idx->names_size : FLT_RECIDX_NONE;
+  if ( len ) idx->names_size += len+1;
+  return FLT_TRUE;
+}
+
+// the nodes still open at depth and deeper end at end
+void flt_recidx_close(flt_recidx_scan* s, fltu32 depth, fltu64 end)
+{
+  fltu32 k;
+  for ( k=depth; k<s->depths; ++k )
+  {
+    if ( s->open[k] != FLT_RECIDX_NONE ) s->idx->entries[s->open[k]].end = end;
+    s->open[k] = FLT_RECIDX_NONE;
+    if ( k > depth ) s->last[k] = FLT_RECIDX_NONE;
+  }
+}
+
+int flt_recidx_write(const flt_recidx* idx, const char* indexfile, const char* srcfile)
+{
+  flt_recidx_head head;
+  char* tmpname;
+  FILE* f;
+  int err=FLT_OK;
+
+  memset(&head,0,sizeof(head));
+  head.magic = FLT_RECIDX_MAGIC;
+  head.version = FLT_RECIDX_VERSION;
+  head.count = idx->count;
+  head.names_size = idx->names_size;
+  head.hie = idx->hie;
+  if ( !flt_cache_source(srcfile, &head.src_size, &head.src_mtime, &head.src_hash) ) return FLT_ERR_FOPEN;
+
+  // written to a temporary file (own one of this writer) and renamed as the cache
+  tmpname = flt_file_tmpname(indexfile);
+  if ( !tmpname ) return FLT_ERR_MEMOUT;
+  f = fopen(tmpname,"wb");
+  if ( !f ) { flt_free(tmpname); return FLT_ERR_FOPEN; }
+  if ( fwrite(&head,1,sizeof(head),f)!=sizeof(head) 
+    || (idx->count && fwrite(idx->entries,sizeof(flt_recidx_entry),idx->count,f)!=idx->count)
+    || (idx->names_size && fwrite(idx->names,1,idx->names_size,f)!=idx->names_size) )
+    err = FLT_ERR_FOPEN;
+  if ( fclose(f)!=0 ) err = FLT_ERR_FOPEN;
+  if ( !err )
+  {
+#ifdef _MSC_VER
+    remove(indexfile); // rename doesn't replace
+#endif
+    if ( rename(tmpname,indexfile)!=0 ) err=FLT_ERR_FOPEN;
+  }
+  if ( err ) remove(tmpname);
+  flt_free(tmpname);
+  return err;
+}
+
+// unique temporary name for a file written and then renamed to filename (process id and a counter)
+char* flt_file_tmpname(const char* filename)
+{
+  static fltatom32 counter=0;
+  char* tmpname = (char*)flt_malloc(strlen(filename)+32);
+  unsigned long pid;
+#ifdef _MSC_VER
+  pid = (unsigned long)GetCurrentProcessId();
+#else
+  pid = (unsigned long)getpid();
+#endif
+  if ( tmpname ) sprintf(tmpname, "%s.%lu.%ld.tmp", filename, pid, (long)flt_atomic_inc(&counter));
+  return tmpname;
+}
+
+int flt_recidx_load(const char* indexfile, const char* srcfile, flt_recidx** idx)
+{
+  flt_recidx_head head;
+  flt_recidx* x;
+  fltu32 i;
+  FILE* f;
+  int err=FLT_ERR_RECIDX;
+
+  *idx = FLT_NULL;
+  f = indexfile ? fopen(indexfile,"rb") : FLT_NULL;
+  if ( !f ) return FLT_ERR_RECIDX;
+  if ( fread(&head,1,sizeof(head),f)!=sizeof(head) || head.magic!=FLT_RECIDX_MAGIC || head.version!=FLT_RECIDX_VERSION
+    || (srcfile && !flt_cache_source_valid(srcfile,head.src_size,head.src_mtime,head.src_hash)) )
+  {
+    fclose(f);
+    return FLT_ERR_RECIDX;
+  }
+
+  x = (flt_recidx*)flt_calloc(1,sizeof(flt_recidx));
+  if ( x )
+  {
+    x->count = head.count;
+    x->names_size = head.names_size;
+    x->hie = head.hie;
+    x->entries = (flt_recidx_entry*)flt_malloc(flt_max((fltu64)head.count*sizeof(flt_recidx_entry),1));
+    x->names = (char*)flt_malloc(flt_max(head.names_size,1));
+    if ( !x->entries || !x->names ) err = FLT_ERR_MEMOUT;
+    else if ( fread(x->entries,sizeof(flt_recidx_entry),head.count,f)==head.count 
+      && fread(x->names,1,head.names_size,f)==head.names_size ) err = FLT_OK;
+
+    // ranges inside the indexed file, they're seeked to without checks
+    if ( err == FLT_OK && head.hie > head.src_size ) err = FLT_ERR_RECIDX;
+    for ( i=0; err==FLT_OK && i<head.count; ++i )
+    {
+      if ( x->entries[i].offset > x->entries[i].end || x->entries[i].end > head.src_size ) 
+        err = FLT_ERR_RECIDX;
+    }
+  }
+  else
+    err = FLT_ERR_MEMOUT;
+  fclose(f);
+  if ( err != FLT_OK ) flt_recidx_free(&x);
+  *idx = x;
+  return err;
+}
+
+void flt_recidx_free(flt_recidx** idx)
+{
+  if ( !idx || !*idx ) return;
+  flt_safefree((*idx)->entries);
+  flt_safefree((*idx)->names);
+  flt_free(*idx);
+  *idx = FLT_NULL;
+}
+
+fltu32 flt_recidx_find(const flt_recidx* idx, const char* name)
+{
+  fltu32 i;
+  if ( !idx || !name ) return FLT_RECIDX_NONE;
+  for ( i=0; i<idx->count; ++i )
+  {
+    if ( idx->entries[i].name < idx->names_size && !strcmp(idx->names+idx->entries[i].name, name) )
+      return i;
+  }
+  return FLT_RECIDX_NONE;
+}
+
+// ranges of the load: header and palettes, then the subtree of nodename if any
+int flt_recidx_ranges(flt* of, const char* nodename)
+{
+  flt_context* ctx=of->ctx;
+  flt_recidx* idx=FLT_NULL;
+  char* indexfile;
+  fltu32 id;
+  int err;
+
+  indexfile = (char*)flt_malloc(strlen(of->filename)+strlen(FLT_RECIDX_EXT)+1);
+  if ( !indexfile ) return FLT_ERR_MEMOUT;
+  strcpy(indexfile,of->filename);
+  strcat(indexfile,FLT_RECIDX_EXT);
+  err = flt_recidx_load(indexfile, of->filename, &idx);
+  if ( err == FLT_ERR_RECIDX )
+  {
+    // not there or stale, built again (failing to write it doesn't fail the load)
+    err = flt_recidx_scan_file(of->filename, ctx->opts, &idx);
+    if ( err == FLT_OK ) flt_recidx_write(idx, indexfile, of->filename);
+  }
+  flt_free(indexfile);
+  if ( err != FLT_OK ) return err;
+
+  ctx->ranges[0] = 0;
+  ctx->ranges[1] = idx->hie;
+  ctx->nranges = 1;
+  if ( nodename )
+  {
+    id = flt_recidx_find(idx, nodename);
+    if ( id == FLT_RECIDX_NONE || idx->entries[id].offset < idx->hie ) 
+      err = FLT_ERR_RECIDX;
+    else
+    {
+      ctx->ranges[2] = idx->entries[id].offset;
+      ctx->ranges[3] = idx->entries[id].end;
+      ctx->nranges = 2;
+    }
+  }
+  flt_recidx_free(&idx);
+  return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                LOAD FUTURE
+////////////////////////////////////////////////////////////////////////////////////////////////
+flt_future* flt_future_create()
+{
+  flt_future* fu = (flt_future*)flt_calloc(1,sizeof(flt_future));
+  if ( !fu ) return FLT_NULL;
+  fu->cs = flt_critsec_create();
+  fu->ev = flt_event_create();
+  if ( !fu->cs || !fu->ev ) flt_future_destroy(&fu);
+  return fu;
+}
+
+void flt_future_destroy(flt_future** fu)
+{
+  flt_future_cont* c, *n;
+  if ( !fu || !*fu ) return;
+  c = (*fu)->conts;
+  while (c) { n=c->next; flt_free(c); c=n; }
+  if ( (*fu)->ev ) flt_event_destroy((*fu)->ev);
+  if ( (*fu)->cs ) flt_critsec_destroy((*fu)->cs);
+  flt_safefree(*fu);
+}
+
+// load of 'of' finished (ok or error). runs continuations in this thread and wakes waiters. done is only 
+// set once nothing else of 'of' or the future is touched here but leaving cs, others can release them then
+void flt_future_complete(flt* of)
+{
+  flt_future* fu = of->future;
+  flt_future_cont* c, *n;
+
+  if ( !fu ) return;
+  flt_critsec_enter(fu->cs);
+  while ( fu->conts ) // the ones added while running these too (not done yet)
+  {
+    c = fu->conts; fu->conts = FLT_NULL;
+    flt_critsec_leave(fu->cs);
+    while (c)
+    {
+      n = c->next;
+      c->cb(of, c->user_data);
+      flt_free(c);
+      c = n;
+    }
+    flt_critsec_enter(fu->cs);
+  }
+  fu->done = FLT_TRUE;
+  if ( fu->waiters ) flt_event_signal(fu->ev); // every waiter wakes the next one
+  flt_critsec_leave(fu->cs);
+}
+
+int flt_wait(flt* of)
+{
+  flt_future* fu = of ? of->future : FLT_NULL;
+
+  if ( !fu ) return of ? of->errcode : FLT_ERR_MEMOUT;
+  flt_critsec_enter(fu->cs);
+  while ( !fu->done )
+  {
+    ++fu->waiters;
+    flt_critsec_leave(fu->cs);
+    flt_event_wait(fu->ev);
+    flt_critsec_enter(fu->cs);
+    --fu->waiters;
+  }
+  if ( fu->waiters ) flt_event_signal(fu->ev); // before leaving, fu can be released after
+  flt_critsec_leave(fu->cs);
+  return of->errcode;
+}
+
+int flt_then(flt* of, flt_callback_loaded cb, void* user_data)
+{
+  flt_future* fu = of ? of->future : FLT_NULL;
+  flt_future_cont* c;
+
+  if ( !cb ) return FLT_FALSE;
+  if ( fu )
+  {
+    c = (flt_future_cont*)flt_calloc(1,sizeof(flt_future_cont));
+    if ( !c ) return FLT_FALSE;
+    c->cb = cb;
+    c->user_data = user_data;
+    flt_critsec_enter(fu->cs);
+    if ( !fu->done )
+    {
+      c->next = fu->conts; 
+      fu->conts = c;
+      c = FLT_NULL;
+    }
+    flt_critsec_leave(fu->cs);
+    if ( !c ) return FLT_TRUE; // called when completed
+    flt_free(c);
+  }
+  cb(of, user_data); // already finished
+  return FLT_TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                ASYNC LOAD
+////////////////////////////////////////////////////////////////////////////////////////////////
+flt_async* flt_load_async(const char* filename, flt* of, flt_opts* opts)
+{
+  flt_async* job;
+
+  if ( !filename || !of || !opts ) return FLT_NULL;
+  job = (flt_async*)flt_calloc(1,sizeof(flt_async));
+  if ( !job ) return FLT_NULL;
+  job->of = of;
+  job->opts = opts;
+  job->filename = flt_strdup(filename);
+  if ( !of->future )
+  {
+    of->future = flt_future_create(); // before the thread starts, flt_wait/flt_then right after this returns
+    job->own_future = FLT_TRUE;
+  }
+  of->async = job;
+  if ( job->filename && of->future )
+    job->thread = flt_thread_create(flt_async_thread, job);
+  if ( !job->thread )
+  {
+    of->async = FLT_NULL;
+    if ( job->own_future ) flt_future_destroy(&of->future);
+    flt_safefree(job->filename);
+    flt_free(job);
+    return FLT_NULL;
+  }
+  return job;
+}
+
+void flt_async_thread(void* arg)
+{
+  flt_async* job = (flt_async*)arg;
+  flt_load_from_filename(job->filename, job->of, job->opts);
+  flt_atomic_inc((fltatom32*)&job->done);
+}
+
+// position of the record loop for the progress. true if the load has to stop
+int flt_async_poll(flt* of)
+{
+  flt_async* job = of->async;
+  const flt_context* ctx = of->ctx;
+  fltu64 size, mtime;
+
+  if ( !job->size ) // file opened and its name resolved now
+  {
+    // the window is the whole input if mapped or in memory, only a block with the block reader
+    if ( ctx->mem && !ctx->br ) size = ctx->memsize;
+    else if ( !of->filename || !flt_file_stat(of->filename, &size, &mtime) || !size ) size = (fltu64)-1;
+    flt_atomic_store64(&job->size, size);
+  }
+  flt_atomic_store64(&job->pos, flt_input_tell(of->ctx));
+  return job->cancel!=0;
+}
+
+float flt_async_progress(const flt_async* job)
+{
+  fltu64 size;
+  if ( !job ) return 0.0f;
+  if ( job->done ) return 1.0f;
+  size = flt_atomic_load64((fltu64*)&job->size);
+  return size ? (float)flt_min((double)flt_atomic_load64((fltu64*)&job->pos)/(double)size,0.99) : 0.0f; // 1 once the xrefs are resolved too
+}
+
+void flt_async_cancel(flt_async* job)
+{
+  if ( job ) flt_atomic_inc((fltatom32*)&job->cancel);
+}
+
+int flt_async_join(flt_async** job)
+{
+  flt* of;
+  if ( !job || !*job ) return FLT_ERR_MEMOUT;
+  of = (*job)->of;
+  flt_thread_join((*job)->thread);
+  of->async = FLT_NULL;
+  if ( (*job)->own_future ) flt_future_destroy(&of->future);
+  flt_safefree((*job)->filename);
+  flt_safefree(*job);
+  return of->errcode;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                XREF JOB
+////////////////////////////////////////////////////////////////////////////////////////////////
+// creates the threads (xref_threads-1, the owner thread works too) unless there's an executor
+int flt_xrefjob_create(flt_xrefjob** job, flt_opts* opts)
+{
+  flt_xrefjob* j = (flt_xrefjob*)flt_calloc(1,sizeof(flt_xrefjob));
+  int i;
+  if ( !j ) return FLT_FALSE;
+  *job = j;
+  j->opts = opts;
+  j->pending = 1; // owner submitting
+  j->cs = flt_critsec_create();
+  j->ev_work = flt_event_create();
+  j->ev_done = flt_event_create();
+  if ( !j->cs || !j->ev_work || !j->ev_done ) { flt_xrefjob_destroy(job); return FLT_FALSE; }
+
+  if ( !opts->cb_exec && opts->xref_threads>1 )
+  {
+    j->threads = (flt_thread**)flt_calloc(opts->xref_threads-1,sizeof(flt_thread*));
+    for (i=0; j->threads && i<opts->xref_threads-1; ++i)
+    {
+      j->threads[j->nthreads] = flt_thread_create(flt_xrefjob_worker,j);
+      if ( j->threads[j->nthreads] ) ++j->nthreads; // if not, fewer threads
+    }
+  }
+  return FLT_TRUE;
+}
+
+void flt_xrefjob_destroy(flt_xrefjob** job)
+{
+  flt_xrefjob* j;
+  int i;
+  if ( !job || !*job ) return;
+  j = *job;
+
+  // workers exit waking each other
+  if ( j->cs )
+  {
+    flt_critsec_enter(j->cs);
+    j->quit = 1;
+    flt_critsec_leave(j->cs);
+  }
+  if ( j->nthreads ) flt_event_signal(j->ev_work);
+  for (i=0;i<j->nthreads;++i)
+    flt_thread_join(j->threads[i]);
+  flt_safefree(j->threads);
+  if ( j->ev_work ) flt_event_destroy(j->ev_work);
+  if ( j->ev_done ) flt_event_destroy(j->ev_done);
+  if ( j->cs ) flt_critsec_destroy(j->cs);
+  flt_safefree(*job);
+}
+
+// queues the load of the extref (or gives it to the executor). filename is owned by the task
+void flt_xrefjob_submit(flt_xrefjob* job, flt_node_extref* extref, char* filename)
+{
+  flt_xreftask* task = (flt_xreftask*)flt_calloc(1,sizeof(flt_xreftask));
+  if ( !task )
+  {
+    flt_extref_load(extref,filename,job->opts); // no memory for the task, loading it now
+    return;
+  }
+  task->job = job;
+  task->extref = extref;
+  task->filename = filename;
+  flt_atomic_inc(&job->pending);
+
+  if ( job->opts->cb_exec )
+  {
+    job->opts->cb_exec(flt_xrefjob_run, task, job->opts->cb_user_data);
+    return;
+  }
+  flt_critsec_enter(job->cs);
+  if ( job->tail ) job->tail->next = task;
+  else job->head = task;
+  job->tail = task;
+  flt_critsec_leave(job->cs);
+  flt_event_signal(job->ev_work);
+}
+
+flt_xreftask* flt_xrefjob_pop(flt_xrefjob* job)
+{
+  flt_xreftask* task;
+  int more;
+
+  flt_critsec_enter(job->cs);
+  task = job->head;
+  if ( task )
+  {
+    job->head = task->next;
+    if ( !job->head ) job->tail = FLT_NULL;
+  }
+  more = job->head != FLT_NULL;
+  flt_critsec_leave(job->cs);
+  if ( more ) flt_event_signal(job->ev_work); // wakes another worker for the rest
+  return task;
+}
+
+// loads the xref file. its own xrefs are submitted to the same job before this task finishes
+void flt_xrefjob_run(void* _task)
+{
+  flt_xreftask* task = (flt_xreftask*)_task;
+  flt_xrefjob* job = task->job;
+
+  flt_extref_load(task->extref,task->filename,job->opts);
+  flt_free(task);
+  if ( flt_atomic_dec(&job->pending)==0 )
+    flt_event_signal(job->ev_done);
+}
+
+void flt_xrefjob_worker(void* arg)
+{
+  flt_xrefjob* job=(flt_xrefjob*)arg;
+  flt_xreftask* task;
+  int quit;
+
+  for (;;)
+  {
+    task = flt_xrefjob_pop(job);
+    if ( task ) 
+    {
+      flt_xrefjob_run(task);
+      continue;
+    }
+    flt_event_wait(job->ev_work);
+    flt_critsec_enter(job->cs);
+    quit = job->quit;
+    flt_critsec_leave(job->cs);
+    if ( quit ) { flt_event_signal(job->ev_work); break; }
+  }
+}
+
+// owner thread loads files too until there are no more tasks in queue, then waits for the rest
+void flt_xrefjob_wait(flt_xrefjob* job)
+{
+  flt_xreftask* task;
+
+  if ( flt_atomic_dec(&job->pending)==0 ) return; // owner done submitting
+  for (;;)
+  {
+    task = job->opts->cb_exec ? FLT_NULL : flt_xrefjob_pop(job);
+    if ( task ) 
+    {
+      flt_xrefjob_run(task);
+      continue;
+    }
+    flt_event_wait(job->ev_done);
+    if ( job->pending==0 ) break;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                STACK
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_stack_create(flt_stack** s, int capacity)
+{
+  flt_stack* _s = (flt_stack*)flt_calloc(1,sizeof(flt_stack));
+  if ( !_s ) return FLT_FALSE;  
+  if (!capacity) 
+    capacity = FLT_STACKARRAY_SIZE;
+
+  _s->entries = (flt_stack_type*)flt_malloc(sizeof(flt_stack_type)*capacity);
+  if (!_s->entries) return  FLT_FALSE;
+  _s->capacity = capacity;
+
+  *s = _s;
+  return FLT_TRUE;
+}
+
+void flt_stack_destroy(flt_stack** s)
+{
+  if ( !s || !*s ) return;
+
+  flt_safefree((*s)->entries);
+  flt_safefree((*s));
+}
+
+void flt_stack_push32(flt_stack* s, fltu32 val)
+{
+#ifdef FLT_PLATFORM_64  
+  flt_stack_type* se;
+#endif
+  FLT_ASSERT(s->count < s->capacity && "stack ran out of memory, increase FLT_STACK_SIZE");
+
+#ifdef FLT_PLATFORM_64
+  se = s->entries+(s->count++);
+  se->val32 = val;
+  se->node = FLT_NULL;
+#else
+  s->entries[s->count++]=FLTMAKE64(FLT_NODE_NONE,val);
+#endif
+}
+
+void flt_stack_pushn(flt_stack* s, flt_node* node)
+{
+#ifdef FLT_PLATFORM_64  
+  flt_stack_type* se;
+#endif
+  FLT_ASSERT(s->count < s->capacity && "stack ran out of memory, increase FLT_STACK_SIZE");
+
+#ifdef FLT_PLATFORM_64  
+  se = s->entries+(s->count++);
+  se->val32=0; 
+  se->node=node;
+#else
+  s->entries[s->count++]=node ? FLTMAKE64(node->type,node) : 0;
+#endif
+}
+
+flt_node* flt_stack_topn(flt_stack* s)
+{
+  flt_node* ret=FLT_NULL;
+#ifdef FLT_PLATFORM_64
+  if (s->count)
+    ret = s->entries[s->count-1].node;
+#else
+  fltu32 type,val;
+  if (s->count)
+  {
+    FLTGET32(s->entries[s->count-1],type,val);
+    if (type)
+      ret=(flt_node*)val;
+  }
+#endif
+  return ret;
+}
+
+fltu32 flt_stack_top32_not_null(flt_stack* s)
+{
+  int i=s->count-1;
+#ifdef FLT_PLATFORM_64
+  while(i>=0)
+  {
+    if ( s->entries[i].val32 && !s->entries[i].node )
+      return s->entries[i].val32;
+    --i;
+  }
+#else
+  fltu32 type,val;
+
+  while (i>=0)
+  {
+    if ( s->entries[i] )
+    {
+      FLTGET32(s->entries[i],type,val);
+      if (type==FLT_NODE_NONE)
+        return val;
+    }
+    --i;
+  }
+#endif
+  return 0xffffffff;
+}
+
+
+flt_node* flt_stack_topn_not_null(flt_stack* s)
+{
+  int i=s->count-1;
+#ifdef FLT_PLATFORM_64
+  while(i>=0)
+  {
+    if ( s->entries[i].node )
+      return s->entries[i].node;
+    --i;
+  }
+#else
+  fltu32 type,val;
+  
+  while (i>=0)
+  {
+    if ( s->entries[i] )
+    {
+      FLTGET32(s->entries[i],type,val);
+      if (type!=FLT_NODE_NONE)
+        return (flt_node*)val;
+    }
+    --i;
+  }
+#endif
+  return FLT_NULL;
+}
+
+flt_node* flt_stack_popn(flt_stack* s)
+{
+  flt_node* v=FLT_NULL;
+#ifdef FLT_PLATFORM_64
+  if (s->count)
+    v=s->entries[--s->count].node;
+#else
+  fltu32 type,val;
+  if (s->count)
+  {
+    --s->count;
+    FLTGET32(s->entries[s->count],type,val);
+    if (type)
+      v = (flt_node*)val;
+  }
+#endif
+  return v;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                    ARRAY  
+////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef FLT_UNIQUE_FACES
+int flt_array_create(flt_array** arr, fltu32 capacity, flt_array_growpolicy grow)
+{
+  *arr = (flt_array*)flt_calloc(1,sizeof(flt_array));
+  if ( !*arr ) return FLT_FALSE;
+  (*arr)->capacity = capacity>0?capacity:FLT_ARRAY_INITCAP;
+  (*arr)->size = 0;
+  (*arr)->data = (flt_array_type*)flt_malloc(sizeof(flt_array_type)*capacity);
+  if ( !(*arr)->data ) { flt_array_destroy(arr); return FLT_FALSE; }
+  if ( !grow ) grow = flt_array_grow_double;
+  (*arr)->growpolicy = grow;
+  return FLT_TRUE;
+}
+
+void flt_array_destroy(flt_array** arr)
+{
+  if ( !arr || !*arr ) return;
+  flt_safefree((*arr)->data);
+  flt_free(*arr);
+  *arr=FLT_NULL;
+}
+
+void flt_array_grow_double(flt_array* arr)
+{
+  fltu32 newcap = arr->capacity*2;
+  arr->data = (flt_array_type*)flt_realloc(arr->data, sizeof(flt_array_type)*newcap);
+  if( !arr->data ) { FLT_BREAK; return; }
+  arr->capacity = newcap;
+}
+
+void flt_array_push_back(flt_array* arr, flt_array_type elem)
+{
+  if (arr->size>=arr->capacity)
+    arr->growpolicy(arr);    
+  arr->data[arr->size++]=elem;
+}
+
+flt_array_type flt_array_pop_back(flt_array* arr)
+{
+  if ( arr->size==0 ) return FLT_NULL;
+  return arr->data[--arr->size];
+}
+
+flt_array_type flt_array_at(flt_array* arr, fltu32 index)
+{
+  return index >= 0 && index < arr->size ? arr->data[index] : FLT_NULL;
+}
+
+void flt_array_clear(flt_array* arr)
+{
+  arr->size=0;
+}
+
+void flt_array_ensure(flt_array* arr, fltu32 cout_new_elements)
+{
+  const fltu32 newcap = arr->size+cout_new_elements;
+  if ( newcap <= arr->capacity ) return;
+  arr->capacity = newcap;
+  flt_array_grow_double(arr); // ensure makes use directly of grow_double policy
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// triangle streams (FLT_OPT_LOAD_INDEX_STREAMS). vertex no in 16 bits until one doesn't fit
 ////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_earth_ellip_name(int eem)
+int flt_tris_create(flt_tris** t, fltu32 capacity)
 {
-  static char tmp[16];
-#ifndef FLT_NO_OPNAMES
-  if ( eem==-1 ) return "User Defined";
-  static const char* names[]={"WGS 1984", "WGS 1972", "Bessel", "Clarke 1866", "NAD1927"};
-  return eem>=0 && eem<5?names[eem]:itoa(eem,tmp,10);
-#else
-  return itoa(eem,tmp,10);
-#endif
+  *t = (flt_tris*)flt_calloc(1,sizeof(flt_tris));
+  if ( !*t ) return FLT_FALSE;
+  (*t)->index_size = sizeof(fltu16);
+  if ( !flt_tris_reserve(*t, capacity>0?capacity:FLT_ARRAY_INITCAP) ) { flt_tris_destroy(t); return FLT_FALSE; }
+  return FLT_TRUE;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_face_drawtype(fltu16 drawtype)
+void flt_tris_destroy(flt_tris** t)
 {
-  static char tmp[16];
-#ifndef FLT_NO_OPNAMES
-  static const char* names[]={"Draw Solid Culling", "Draw Solid DSided", "Draw Wireframe Close", 
-    "Draw Wireframe", "Sorround WF AltColor","", "", "",  "Omni light", "Unidir light", "Bidir light"};
-  return drawtype<11?names[drawtype]:itoa(drawtype,tmp,10);
-#else
-  return itoa(drawtype,tmp,10);
-#endif
+  if ( !t || !*t ) return;
+  flt_safefree((*t)->vtx);
+  flt_safefree((*t)->face);
+  flt_free(*t);
+  *t=FLT_NULL;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_face_lightmode(fltu16 lm)
+// room for ntris more triangles (capacity doubled)
+int flt_tris_reserve(flt_tris* t, fltu32 ntris)
 {
-  static char tmp[16];
-#ifndef FLT_NO_OPNAMES
-  static const char* names[]={"Flat", "Gouraud", "Lit", "Lit-Gouraud"};
-  return lm<4?names[lm]:itoa(lm,tmp,10);
-#else
-  return itoa(lm,tmp,10);
-#endif
+  fltu32 cap = t->capacity ? t->capacity : FLT_ARRAY_INITCAP;
+  void* vtx;
+  fltu32* face;
+
+  if ( t->count/3+ntris <= t->capacity && t->vtx ) return FLT_TRUE;
+  while ( cap < t->count/3+ntris ) cap *= 2;
+  vtx = flt_realloc(t->vtx, (fltu64)cap*3*t->index_size);
+  if ( !vtx ) return FLT_FALSE;
+  t->vtx = vtx;
+  face = (fltu32*)flt_realloc(t->face, (fltu64)cap*sizeof(fltu32));
+  if ( !face ) return FLT_FALSE;
+  t->face = face;
+  t->capacity = cap;
+  return FLT_TRUE;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_header_flags_name(flti32 flags)
+// vertex stream from 16 to 32 bits. keep if the old one isn't owned (cache)
+int flt_tris_widen(flt_tris* t, int keep)
 {
-  static char tmp[64];
-#ifndef FLT_NO_OPNAMES
-  *tmp='['; *(tmp+1)=0;  
-  if ( flags & (1<<31) )  sprintf(tmp, "%s%s", tmp, "0" );
-  if ( flags & (1<<30) )  sprintf(tmp, "%s | %s", tmp, "1");
-  if ( flags & (1<<29) )  sprintf(tmp, "%s | %s", tmp, "2" );
-  sprintf(tmp, "%s]", tmp );
-  return tmp;
-#else
-  return itoa(flags,tmp,16);
-#endif
+  fltu32* vtx = (fltu32*)flt_malloc((fltu64)t->capacity*3*sizeof(fltu32));
+  fltu32 i;
+  if ( !vtx ) return FLT_FALSE;
+  for ( i=0; i<t->count; ++i ) vtx[i] = ((const fltu16*)t->vtx)[i];
+  if ( !keep ) flt_free(t->vtx);
+  t->vtx = vtx;
+  t->index_size = sizeof(fltu32);
+  return FLT_TRUE;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-const char* flt_get_err_reason(int errcode)
+// one triangle, room reserved before (flt_tris_reserve)
+int flt_tris_push(flt_tris* t, fltu32 face, const fltu32* vtx)
 {
-#ifdef FLT_LONG_ERR_MESSAGES
-  switch ( errcode )
+  fltu16* v16;
+  fltu32* v32;
+  if ( t->index_size==sizeof(fltu16) && (vtx[0]>0xffff || vtx[1]>0xffff || vtx[2]>0xffff) && !flt_tris_widen(t,FLT_FALSE) ) 
+    return FLT_FALSE;
+  t->face[t->count/3] = face;
+  if ( t->index_size==sizeof(fltu16) )
   {
-  case FLT_OK         : return "Ok"; 
-  case FLT_ERR_FOPEN  : return "IO Error opening/reading file or not found"; 
-  case FLT_ERR_VERSION: return "Version error. Max. supported version FLT_GREATER_SUPPORTED_VERSION";
-  case FLT_ERR_MEMOUT : return "Running out of memory. Malloc returns null";
-  case FLT_ERR_READBEYOND_REC: return "Read beyond record. Skip bytes is negative. Version error?";
-  case FLT_ERR_ALREADY: return "Already parsed and registered in the context dictionary";
+    v16 = (fltu16*)t->vtx+t->count;
+    v16[0]=(fltu16)vtx[0]; v16[1]=(fltu16)vtx[1]; v16[2]=(fltu16)vtx[2];
   }
-#else
-  switch ( errcode )
+  else
   {
-  case FLT_OK         : return "Ok"; 
-  case FLT_ERR_FOPEN  : return "File error"; 
-  case FLT_ERR_VERSION: return "Version unsupported";
-  case FLT_ERR_MEMOUT : return "Out of mem";
-  case FLT_ERR_READBEYOND_REC: return "Read beyond record"; 
-  case FLT_ERR_ALREADY: return "Already parsed";
+    v32 = (fltu32*)t->vtx+t->count;
+    v32[0]=vtx[0]; v32[1]=vtx[1]; v32[2]=vtx[2];
   }
-#endif
-  return "Unknown";
+  t->count += 3;
+  return FLT_TRUE;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////
-int flt_get_op_from_node_type(int nodetype)
+fltu32 flt_index_count(const flt* of)
 {
-  int ops[FLT_NODE_MAX]={0,0,FLT_OP_EXTREF, FLT_OP_GROUP, FLT_OP_OBJECT, FLT_OP_MESH, 
-    FLT_OP_LOD, FLT_OP_FACE, FLT_OP_VERTEX_LIST, FLT_OP_SWITCH};
-  
-  return (nodetype >=0 && nodetype < FLT_NODE_MAX) ? ops[nodetype] : 0;
+  if ( of->tris ) return of->tris->count;
+  return of->indices ? of->indices->size : 0;
 }
 
+fltu32 flt_index_vertex(const flt* of, fltu32 i)
+{
+  if ( !of->tris ) return FLTGETLO32(of->indices->data[i]);
+  return of->tris->index_size==sizeof(fltu16) ? ((const fltu16*)of->tris->vtx)[i] : ((const fltu32*)of->tris->vtx)[i];
+}
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-// Encodes/decodes a vertex stream semantic word with the semantic, size and offset
-// 4 msb for semantic, and 6 bits for size and 6 for offset
-////////////////////////////////////////////////////////////////////////////////////////////////
-fltu16 flt_vtx_stream_enc(fltu8 semantic, fltu8 offset, fltu8 size)
+fltu32 flt_index_face(const flt* of, fltu32 i)
 {
-  return (fltu16)( (fltu16)(semantic<<12) | (fltu16)((size<<6)&0x0fc0) | (fltu16)(offset&0x003f) );
+  return of->tris ? of->tris->face[i/3] : FLTGETHI32(of->indices->data[i]);
 }
 
-void flt_vtx_stream_dec(fltu16 sem, fltu8* semantic, fltu8* offset, fltu8* size)
+// v must fit in the vertex stream (renumbering)
+void flt_index_set_vertex(flt* of, fltu32 i, fltu32 v)
 {
-  *semantic = (fltu8)(sem>>12);
-  *size = (fltu8)( (sem&0x0fc0)>>6 );
-  *offset=(fltu8)( sem&0x003f );
+  if ( !of->tris ) 
+    of->indices->data[i] = FLTMAKE64(FLTGETHI32(of->indices->data[i]), v);
+  else if ( of->tris->index_size==sizeof(fltu16) ) 
+    ((fltu16*)of->tris->vtx)[i] = (fltu16)v;
+  else 
+    ((fltu32*)of->tris->vtx)[i] = v;
 }
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
-// extract base path from filename (caller should free the returned pointer)
+//                                    HASH
 ////////////////////////////////////////////////////////////////////////////////////////////////
-char* flt_path_base(const char* filename)
+#define flt_rotl64(x,r) (((x)<<(r))|((x)>>(64-(r))))
+
+// 64 bits hash of bytes (faces, cache validation), 8 bytes per step (murmur3 like mixing)
+fltu64 flt_hash_bytes(const void* data, fltu32 size)
 {
-  char *ret, *ptr;
-  size_t len;
-  if ( !filename) return FLT_NULL;
+  const fltu8* p=(const fltu8*)data;
+  const fltu64 c1=0x87c37b91114253d5ULL, c2=0x4cf5ad432745937fULL;
+  fltu64 h=size, k;
 
-  len = strlen(filename);
-  ret=flt_strdup(filename);
-  ptr=ret+len;
-  while (ptr!=ret)
+  for ( ; size>=8; size-=8, p+=8 )
   {
-    if ( *ptr=='\\' || *ptr=='/' )
-    {
-      // weren't not last
-      if ( ptr+1 != ret+len ) *(ptr+1)='\0';
-      return ret;
-    }
-    --ptr;
+    memcpy(&k,p,8);
+    k*=c1; k=flt_rotl64(k,31); k*=c2;
+    h^=k; h=flt_rotl64(h,27)*5+0x52dce729;
   }
-  flt_safefree(ret);
-  return FLT_NULL;
+  if ( size )
+  {
+    k=0;
+    memcpy(&k,p,size);
+    k*=c1; k=flt_rotl64(k,31); k*=c2;
+    h^=k;
+  }
+  h^=h>>33; h*=0xff51afd7ed558ccdULL;
+  h^=h>>33; h*=0xc4ceb9fe1a85ec53ULL;
+  h^=h>>33;
+  return h;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
-// try to open the filename, and if couldn't then uses the search paths...
+//                                    ARENA  
 ////////////////////////////////////////////////////////////////////////////////////////////////
-FILE* flt_fopen(const char* filename, flt* of)
+#define FLT_ARENA_HEADER ((sizeof(flt_arena_chunk)+FLT_ARENA_ALIGN-1) & ~(FLT_ARENA_ALIGN-1))
+#define flt_arena_round(sz) (((sz)+FLT_ARENA_ALIGN-1) & ~(FLT_ARENA_ALIGN-1))
+#define flt_arena_data(c) ((fltu8*)(c)+FLT_ARENA_HEADER)
+
+int flt_arena_create(flt_arena** a, fltu32 chunksize)
 {
-  flt_context* ctx=of->ctx;  
-  flt_opts* opts=ctx->opts;
-  fltu32 i=0;  
-  char* basefile;
-  const char* spath;
+  *a = (flt_arena*)flt_calloc(1,sizeof(flt_arena));
+  if ( !*a ) return FLT_FALSE;
+  (*a)->chunksize = chunksize;
+  return FLT_TRUE;
+}
 
-  strcpy(ctx->tmpbuff,filename);
-  ctx->f = fopen(ctx->tmpbuff,"rb");
-  if( !ctx->f && opts->search_paths ) // failed original, use search paths if valid
+void flt_arena_destroy(flt_arena** a)
+{
+  flt_arena_chunk *c, *cn;
+  if ( !a || !*a ) return;
+  c=(*a)->head;
+  while (c)
   {
-    // get the base file name
-    basefile = flt_path_basefile(filename);
-    while ( basefile ) // infinite if base file, but breaking in
-    {
-      spath = opts->search_paths[i];
-      if ( !spath ) break;
-      *ctx->tmpbuff='\0'; // empty the target
-      strcat(ctx->tmpbuff, spath);
-      if ( !flt_path_endsok(spath) ) strcat(ctx->tmpbuff, "/" );      
-      strcat(ctx->tmpbuff, basefile);
-      ctx->f = fopen(ctx->tmpbuff,"rb");
-      if (ctx->f) break;
-      ++i;
-    }
-    flt_safefree(basefile);
+    cn=c->next;
+    flt_free(c);
+    c=cn;
   }
+  flt_safefree(*a);
+}
 
-  // if open ok, saves correct filename and base path
-  if ( ctx->f )
+void* flt_arena_alloc(flt_arena* a, fltu32 size)
+{
+  flt_arena_chunk* c=a->head;
+  fltu32 offs;
+
+  size = flt_arena_round(size);
+  if ( c && c->used+size <= c->size )
   {
-    if ( !of->filename )
-      of->filename = flt_strdup(ctx->tmpbuff);  
-    ctx->basepath = flt_path_base(ctx->tmpbuff);
+    // bump
+    offs = c->used;
+    c->used += size;
+    a->last = offs;
+    a->total += size;
+    return flt_arena_data(c)+offs;
   }
-  return ctx->f;
+
+  // new chunk. large allocations get their own one and current chunk keeps bumping
+  c = (flt_arena_chunk*)flt_malloc(FLT_ARENA_HEADER+flt_max(size,a->chunksize));
+  if ( !c ) return FLT_NULL;
+  c->size = flt_max(size,a->chunksize);
+  c->used = size;
+  a->total += size;
+  if ( a->head && size > a->chunksize/4 )
+  {
+    c->next = a->head->next;
+    a->head->next = c;
+  }
+  else
+  {
+    c->next = a->head;
+    a->head = c;
+    a->last = 0;
+  }
+  return flt_arena_data(c);
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-// extract the filename from a path
-////////////////////////////////////////////////////////////////////////////////////////////////
-char* flt_path_basefile(const char* filename)
+void* flt_arena_calloc(flt_arena* a, fltu32 size)
 {
-  const char *ptr;
-  size_t len;
+  void* p = flt_arena_alloc(a,size);
+  if ( p ) memset(p,0,size);
+  return p;
+}
 
-  if ( !filename ) return FLT_NULL;
-  len = strlen(filename);
-  ptr = filename + len;
-  while ( ptr != filename )
+// grows in place when p is the last allocation, otherwise copies it (old memory isn't reused)
+void* flt_arena_realloc(flt_arena* a, void* p, fltu32 oldsize, fltu32 newsize)
+{
+  flt_arena_chunk* c=a->head;
+  fltu32 end;
+  void* np;
+
+  if ( !p ) return flt_arena_alloc(a,newsize);
+  if ( c && (fltu8*)p == flt_arena_data(c)+a->last )
   {
-    if ( *ptr=='\\' || *ptr=='/' )
+    end = a->last+flt_arena_round(newsize);
+    if ( end <= c->size )
     {
-      ++ptr;
-      break;
+      if ( end > c->used ) { a->total += end-c->used; c->used = end; }
+      return p;
     }
-    --ptr;
   }
+  np = flt_arena_alloc(a,newsize);
+  if ( np ) memcpy(np,p,flt_min(oldsize,newsize));
+  return np;
+}
 
-  if ( ptr==filename+len ) return FLT_NULL;
-  return flt_strdup(ptr);  
+char* flt_arena_strdup(flt_arena* a, const char* str)
+{
+  const fltu32 len=(fltu32)strlen(str);
+  char* outstr=(char*)flt_arena_alloc(a,len+1);
+  if ( outstr ) memcpy(outstr,str,len+1);
+  return outstr;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-// returns 1 if path ends with / or \
-////////////////////////////////////////////////////////////////////////////////////////////////
-int flt_path_endsok(const char* filename)
+void* flt_of_calloc(flt* of, fltu32 size)
 {
-  size_t len;
-  const char* ptr;
+  flt_stat_add(of, allocs, 1);
+  flt_stat_add(of, alloc_bytes, size);
+  return of->arena ? flt_arena_calloc(of->arena,size) : flt_calloc(1,size);
+}
 
-  if ( !filename || !*filename ) return FLT_FALSE;
-  len = strlen(filename);
-  ptr = filename+len-1;
-  while (ptr!=filename && (*ptr==' ' || *ptr=='\t') )
-    --ptr;
-  return (*ptr=='\\' || *ptr=='/') ? FLT_TRUE : FLT_FALSE;
+void* flt_of_realloc(flt* of, void* p, fltu32 oldsize, fltu32 newsize)
+{
+  flt_stat_add(of, allocs, 1);
+  flt_stat_add(of, alloc_bytes, newsize>oldsize ? newsize-oldsize : 0);
+  return of->arena ? flt_arena_realloc(of->arena,p,oldsize,newsize) : flt_realloc(p,newsize);
+}
+
+char* flt_of_strdup(flt* of, const char* str)
+{
+  flt_stat_add(of, allocs, 1);
+  flt_stat_add(of, alloc_bytes, strlen(str)+1);
+  return of->arena ? flt_arena_strdup(of->arena,str) : flt_strdup(str);
+}
+
+void flt_of_free(flt* of, void* p)
+{
+  if ( !of->arena && p ) flt_free(p);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
-// custom strdup implementation making use of optionally user defined malloc
+//                                  INTERNED NAMES
 ////////////////////////////////////////////////////////////////////////////////////////////////
-char* flt_strdup_internal(const char* str)
+int flt_names_create(flt_names** ns, fltu32 capacity)
 {
-  const int len=(int)strlen(str);
-  char* outstr=(char*)flt_malloc(len+1);
-  memcpy(outstr, str, len+1);
-  return outstr;
+  fltu32 n=16;
+  while ( n < capacity ) n<<=1;
+  *ns = (flt_names*)flt_calloc(1,sizeof(flt_names));
+  if ( !*ns ) return FLT_FALSE;
+  (*ns)->slots = (char**)flt_calloc(n,sizeof(char*));
+  (*ns)->hashes = (fltu32*)flt_malloc(n*sizeof(fltu32));
+  (*ns)->mask = n-1;
+  if ( !(*ns)->slots || !(*ns)->hashes || !flt_arena_create(&(*ns)->strs, FLT_NAMES_CHUNK_SIZE) )
+  {
+    flt_names_destroy(ns);
+    return FLT_FALSE;
+  }
+  return FLT_TRUE;
+}
+
+void flt_names_destroy(flt_names** ns)
+{
+  if ( !ns || !*ns ) return;
+  flt_arena_destroy(&(*ns)->strs);
+  flt_safefree((*ns)->slots);
+  flt_safefree((*ns)->hashes);
+  flt_safefree(*ns);
+}
+
+// FNV-1a of len chars
+fltu32 flt_names_hash(const char* str, fltu32 len)
+{
+  fltu32 h=2166136261u, i;
+  for ( i=0; i<len; ++i ) 
+  {
+    h ^= (fltu8)str[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// slot of the name, or the empty one where it goes
+fltu32 flt_names_slot(const flt_names* ns, const char* str, fltu32 len, fltu32 hash)
+{
+  fltu32 s=hash & ns->mask;
+  while ( ns->slots[s] && (ns->hashes[s]!=hash || strncmp(ns->slots[s],str,len) || ns->slots[s][len]) )
+    s = (s+1) & ns->mask;
+  return s;
+}
+
+int flt_names_grow(flt_names* ns)
+{
+  const fltu32 oldn=ns->mask+1;
+  char** oldslots=ns->slots;
+  fltu32* oldhashes=ns->hashes;
+  fltu32 i, s;
+
+  ns->slots = (char**)flt_calloc(oldn*2,sizeof(char*));
+  ns->hashes = (fltu32*)flt_malloc(oldn*2*sizeof(fltu32));
+  if ( !ns->slots || !ns->hashes )
+  {
+    flt_safefree(ns->slots);
+    flt_safefree(ns->hashes);
+    ns->slots = oldslots;
+    ns->hashes = oldhashes;
+    return FLT_FALSE;
+  }
+  ns->mask = oldn*2-1;
+  for ( i=0; i<oldn; ++i )
+  {
+    if ( !oldslots[i] ) continue;
+    s = oldhashes[i] & ns->mask;
+    while ( ns->slots[s] ) s = (s+1) & ns->mask;
+    ns->slots[s] = oldslots[i];
+    ns->hashes[s] = oldhashes[i];
+  }
+  flt_free(oldslots);
+  flt_free(oldhashes);
+  return FLT_TRUE;
+}
+
+// the interned name of the first len chars of str, added if new. copy 0 keeps str itself (zero terminated 
+// and living as long as of, the cache view). null if out of memory
+char* flt_names_intern(flt* of, const char* str, fltu32 len, int copy)
+{
+  flt_names* ns=of->names;
+  const fltu32 hash=flt_names_hash(str,len);
+  fltu32 s=flt_names_slot(ns,str,len,hash);
+  char* name;
+
+  if ( ns->slots[s] ) return ns->slots[s];
+  if ( (ns->count+1)*4 > (ns->mask+1)*3 )
+  {
+    if ( !flt_names_grow(ns) ) return FLT_NULL;
+    s = flt_names_slot(ns,str,len,hash);
+  }
+  if ( copy )
+  {
+    name = (char*)flt_arena_alloc(ns->strs,len+1);
+    if ( !name ) return FLT_NULL;
+    memcpy(name,str,len);
+    name[len] = 0;
+    flt_stat_add(of, allocs, 1);
+    flt_stat_add(of, alloc_bytes, len+1);
+  }
+  else
+    name = (char*)str;
+  ns->slots[s] = name;
+  ns->hashes[s] = hash;
+  ++ns->count;
+  return name;
+}
+
+const char* flt_name_find(const flt* of, const char* name)
+{
+  const fltu32 len=name ? (fltu32)strlen(name) : 0;
+  if ( !of || !of->names || !name ) return FLT_NULL;
+  return of->names->slots[flt_names_slot(of->names,name,len,flt_names_hash(name,len))];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+//                                  FLAT HIERARCHY
+// The tree is counted, then copied in preorder. The names are hashed backwards so every chain
+// of nodes with the same name is in preorder.
 ////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef FLT_ALIGNED
-void* flt_aligned_calloc(size_t nelem, size_t elsize, size_t alignment)
+int flt_flat_build(flt* of)
 {
-  void* mem;
-  elsize *= nelem;
-  mem=_aligned_malloc(elsize,alignment);
-  if (mem)
-    memset(mem,0,elsize);
-  return mem;
+  flt_flat* fl;
+  fltu32 count=0, npairs=0, distinct=0, i, s;
+  const fltu32 nslots=16;
+  void** typed;
+  int t;
+
+  flt_flat_destroy(&of->flat);
+  if ( !of->hie || !of->hie->node_root ) return FLT_OK;
+  fl = of->flat = (flt_flat*)flt_calloc(1,sizeof(flt_flat));
+  if ( !fl ) return FLT_ERR_MEMOUT;
+  flt_flat_count(of->hie->node_root, &count, &npairs);
+  fl->size = (fltu32*)flt_malloc(sizeof(fltu32)*count);
+  fl->parent = (fltu32*)flt_malloc(sizeof(fltu32)*count);
+  fl->type = (fltu8*)flt_malloc(count);
+  fl->name = (const char**)flt_malloc(sizeof(char*)*count);
+  fl->data = (fltu32*)flt_malloc(sizeof(fltu32)*count);
+  fl->node = (flt_node**)flt_malloc(sizeof(flt_node*)*count);
+  fl->name_next = (fltu32*)flt_malloc(sizeof(fltu32)*count);
+  fl->name_slots = (fltu32*)flt_malloc(sizeof(fltu32)*nslots);
+  if ( !fl->size || !fl->parent || !fl->type || !fl->name || !fl->data || !fl->node || !fl->name_next || !fl->name_slots ) 
+  {
+    flt_flat_destroy(&of->flat);
+    return FLT_ERR_MEMOUT;
+  }
+
+  // an array per type, sized with a first pass by type
+  flt_flat_types(fl, of->hie->node_root);
+  for ( t=0; t<FLT_NODE_MAX; ++t )
+  {
+    typed = flt_flat_typed(fl,t);
+    if ( !typed || !fl->type_count[t] ) continue;
+    *typed = flt_malloc((size_t)flt_node_sizes[t]*fl->type_count[t]);
+    if ( !*typed )
+    {
+      flt_flat_destroy(&of->flat);
+      return FLT_ERR_MEMOUT;
+    }
+    fl->type_count[t] = 0; // entries as filled
+  }
+#ifdef FLT_UNIQUE_FACES
+  fl->pairs = (fltu64*)flt_malloc(sizeof(fltu64)*flt_max(npairs,1));
+  fl->pair_first = (fltu32*)flt_malloc(sizeof(fltu32)*(count+1));
+  if ( !fl->pairs || !fl->pair_first )
+  {
+    flt_flat_destroy(&of->flat);
+    return FLT_ERR_MEMOUT;
+  }
+#endif
+  fl->name_mask = nslots-1;
+  memset(fl->name_slots, 0xff, sizeof(fltu32)*nslots);
+  npairs = 0;
+  flt_flat_fill(fl, of->hie->node_root, FLT_FLAT_NONE, &npairs);
+#ifdef FLT_UNIQUE_FACES
+  fl->pair_first[fl->node_count] = npairs;
+#endif
+
+  for ( i=fl->node_count; i-- > 0; )
+  {
+    fl->name_next[i] = FLT_FLAT_NONE;
+    if ( !fl->name[i] ) continue;
+    s = flt_flat_slot(fl, fl->name[i]);
+    if ( fl->name_slots[s]==FLT_FLAT_NONE && ++distinct*4 > (fl->name_mask+1)*3 ) // grows at 3/4
+    {
+      if ( !flt_flat_grow(fl) ) 
+      {
+        flt_flat_destroy(&of->flat);
+        return FLT_ERR_MEMOUT;
+      }
+      s = flt_flat_slot(fl, fl->name[i]);
+    }
+    fl->name_next[i] = fl->name_slots[s];
+    fl->name_slots[s] = i;
+  }
+  return FLT_OK;
 }
-#endif
-////////////////////////////////////////////////////////////////////////////////////////////////
-//                                DICTIONARY
-////////////////////////////////////////////////////////////////////////////////////////////////
-// djb2
-fltu32 flt_dict_hash_djb2(const unsigned char* str, int unused) 
+
+fltu32 flt_flat_find(const flt_flat* fl, const char* name)
 {
-  unused;
-  fltu32 hash = 5381;
-  int c;
-  while (c = *str++) hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-  return hash;
+  if ( !fl || !name ) return FLT_FLAT_NONE;
+  return fl->name_slots[flt_flat_slot(fl,name)];
 }
 
-fltu32 flt_dict_hash_face_djb2(const unsigned char* data, int size)
+void flt_flat_destroy(flt_flat** fl)
 {
-  fltu32 hash = 5381;
-  int c,i;
-  for (i=0;i<size;++i)
+  void** typed;
+  int t;
+  if ( !*fl ) return;
+  for ( t=0; t<FLT_NODE_MAX; ++t )
   {
-    c=*data++;
-    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    if ( (typed=flt_flat_typed(*fl,t)) != FLT_NULL ) flt_safefree(*typed);
   }
-  return hash;
+  flt_safefree((*fl)->size);
+  flt_safefree((*fl)->parent);
+  flt_safefree((*fl)->type);
+  flt_safefree((*fl)->name);
+  flt_safefree((*fl)->data);
+  flt_safefree((*fl)->node);
+  flt_safefree((*fl)->name_next);
+  flt_safefree((*fl)->name_slots);
+#ifdef FLT_UNIQUE_FACES
+  flt_safefree((*fl)->pairs);
+  flt_safefree((*fl)->pair_first);
+#endif
+  flt_safefree(*fl);
 }
 
-int flt_dict_keycomp_string(const char* a, const char* b, int extra)
+// nodes and pairs of the subtree of n
+void flt_flat_count(const flt_node* n, fltu32* count, fltu32* npairs)
 {
-  return strcmp(a,b);
+  const flt_node* c;
+  ++*count;
+#ifdef FLT_UNIQUE_FACES
+  *npairs += n->ndx_pairs_count;
+#endif
+  for ( c=n->child_head; c; c=c->next ) 
+    flt_flat_count(c, count, npairs);
 }
 
-int flt_dict_keycomp_face(const char* a, const char* b, int size)
+// nodes of every type in the subtree of n
+void flt_flat_types(flt_flat* fl, const flt_node* n)
 {
-  return memcmp(a,b,size);
+  const flt_node* c;
+  if ( n->type < FLT_NODE_MAX ) ++fl->type_count[n->type];
+  for ( c=n->child_head; c; c=c->next ) 
+    flt_flat_types(fl, c);
 }
 
-// create_cs==1 to create a critical section object
-void flt_dict_create(int capacity, int create_cs, flt_dict** dict, flt_dict_hash hashf, flt_dict_keycomp keycomp)
+// array of the nodes of a type in fl, null if the type has none (root)
+void** flt_flat_typed(flt_flat* fl, int type)
 {
-  flt_dict* d = (flt_dict*)flt_malloc(sizeof(flt_dict));
-  d->cs = create_cs ? flt_critsec_create() : FLT_NULL;
-  d->hasht = (flt_dict_node**)flt_calloc(capacity,sizeof(flt_dict_node*));
-  d->capacity = capacity;
-  d->count = 0;
-  d->hashf = hashf;
-  d->keycomp = keycomp;
-  d->ref = 1;
-  *dict = d;
+  switch ( type )
+  {
+  case FLT_NODE_EXTREF: return (void**)&fl->extrefs;
+  case FLT_NODE_GROUP:  return (void**)&fl->groups;
+  case FLT_NODE_OBJECT: return (void**)&fl->objects;
+  case FLT_NODE_MESH:   return (void**)&fl->meshes;
+  case FLT_NODE_LOD:    return (void**)&fl->lods;
+#ifndef FLT_UNIQUE_FACES
+  case FLT_NODE_FACE:   return (void**)&fl->faces;
+#endif
+  case FLT_NODE_VLIST:  return (void**)&fl->vlists;
+  case FLT_NODE_SWITCH: return (void**)&fl->switches;
+  }
+  return FLT_NULL;
 }
 
-void flt_dict_visit(flt_dict*dict, flt_dict_visitor visitor, void* userdata)
+// n at fl->node_count and its subtree after it
+void flt_flat_fill(flt_flat* fl, flt_node* n, fltu32 parent, fltu32* npairs)
 {
-  int i;
-  flt_dict_node *n;
+  const fltu32 i=fl->node_count++;
+  void** typed=flt_flat_typed(fl,n->type);
+  flt_node* c;
 
-  if ( dict->cs ) flt_critsec_enter(dict->cs);
-  i=dict->capacity;
-  while(i--)
+  fl->parent[i] = parent;
+  fl->type[i] = (fltu8)n->type;
+  fl->name[i] = n->name;
+  fl->node[i] = n;
+  fl->data[i] = FLT_FLAT_NONE;
+  if ( typed && *typed ) // copy of the node with the data of its type
   {
-    n=dict->hasht[i];
-    while (n)
-    {
-      visitor(n->key, n->value, userdata);
-      n=n->next;
-    }
+    fl->data[i] = fl->type_count[n->type]++;
+    memcpy((fltu8*)*typed+(size_t)fl->data[i]*flt_node_sizes[n->type], n, flt_node_sizes[n->type]);
   }
-  if ( dict->cs ) flt_critsec_leave(dict->cs);
+#ifdef FLT_UNIQUE_FACES
+  fl->pair_first[i] = *npairs;
+  if ( n->ndx_pairs_count ) memcpy(fl->pairs+*npairs, n->ndx_pairs, sizeof(fltu64)*n->ndx_pairs_count);
+  *npairs += n->ndx_pairs_count;
+#endif
+  for ( c=n->child_head; c; c=c->next ) 
+    flt_flat_fill(fl, c, i, npairs);
+  fl->size[i] = fl->node_count-i;
 }
 
-void flt_dict_destroy(flt_dict** dict, int free_elms, flt_dict_visitor destructor)
+// slot of the name in the hash, or the empty one where it goes
+fltu32 flt_flat_slot(const flt_flat* fl, const char* name)
 {
-  int i;
-  flt_dict_node *n, *nn;
+  fltu32 s=flt_names_hash(name,(fltu32)strlen(name)) & fl->name_mask, j;
+  while ( (j=fl->name_slots[s])!=FLT_FLAT_NONE && fl->name[j]!=name && strcmp(fl->name[j],name) )
+    s = (s+1) & fl->name_mask;
+  return s;
+}
 
-  if ( (*dict)->cs ) flt_critsec_enter((*dict)->cs);
-  
-  // entries and their lists
-  for (i=0;i<(*dict)->capacity;++i)
+// twice the slots, the first node of every name hashed again
+int flt_flat_grow(flt_flat* fl)
+{
+  const fltu32 oldn=fl->name_mask+1;
+  fltu32* old=fl->name_slots;
+  fltu32 i;
+
+  fl->name_slots = (fltu32*)flt_malloc(sizeof(fltu32)*oldn*2);
+  if ( !fl->name_slots ) 
   {
-    n=(*dict)->hasht[i];
-    while (n)
-    {
-      nn=n->next;
-      if ( destructor )
-        destructor(n->key, n->value, FLT_NULL);
-      if ( free_elms )
-        flt_safefree(n->value);
-      flt_free(n->key);
-      flt_free(n);
-      n=nn;
-    }
+    fl->name_slots = old;
+    return FLT_FALSE;
   }
-  flt_safefree((*dict)->hasht);
-  if ( (*dict)->cs ) 
+  memset(fl->name_slots, 0xff, sizeof(fltu32)*oldn*2);
+  fl->name_mask = oldn*2-1;
+  for ( i=0; i<oldn; ++i )
   {
-    flt_critsec_leave((*dict)->cs);
-    flt_critsec_destroy((*dict)->cs);
+    if ( old[i]!=FLT_FLAT_NONE ) 
+      fl->name_slots[flt_flat_slot(fl,fl->name[old[i]])] = old[i];
   }
-  flt_safefree(*dict);
+  flt_free(old);
+  return FLT_TRUE;
 }
 
-// caller saves hash computation and possible comparison in flat list
-void* flt_dict_gethe(flt_dict* dict, fltu32 hashe, fltu32* hashkey)
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                  FACE TABLE
+////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef FLT_UNIQUE_FACES
+
+int flt_facetable_create(flt_facetable** ft, fltu32 capacity)
 {
-  flt_dict_node *n;
-  fltu16 entry, entryoff;
-  FLTGET16(hashe,entryoff,entry);
-  if ( dict->cs ) flt_critsec_enter(dict->cs);
-  n = dict->hasht[entry];  
-  while(entryoff--)
-    n=n->next;  
-  if ( dict->cs ) flt_critsec_leave(dict->cs);
-  if(hashkey) *hashkey=n->keyhash;
-  return n->value;
+  flt_facetable* t = (flt_facetable*)flt_calloc(1,sizeof(flt_facetable));
+  if ( !t ) return FLT_FALSE;
+  *ft = t;
+  t->capacity = capacity ? capacity : 64;
+  t->nslots = 64;
+  while ( t->nslots < t->capacity+t->capacity/2 ) t->nslots<<=1; // keeps load factor under 2/3 until first grow
+  t->faces = (flt_face*)flt_malloc(sizeof(flt_face)*t->capacity);
+  t->hashes = (fltu64*)flt_malloc(sizeof(fltu64)*t->capacity);
+  t->slots = (fltu64*)flt_calloc(t->nslots,sizeof(fltu64));
+  if ( !t->faces || !t->hashes || !t->slots ) { flt_facetable_destroy(ft,FLT_FALSE); return FLT_FALSE; }
+  return FLT_TRUE;
 }
 
-// caller can save hash computation
-void* flt_dict_geth(flt_dict* dict, const char* key, int size, fltu32 hash, fltu32* hashe)
+void flt_facetable_destroy(flt_facetable** ft, int free_names)
 {
-  flt_dict_node *n;
-  const int entry = hash % dict->capacity;
-  fltu16 hoff=0;
-
-  if ( dict->cs ) flt_critsec_enter(dict->cs);
-  n = dict->hasht[entry];  
-  while(n)
+#ifndef FLT_LEAN_FACES
+  fltu32 i;
+#endif
+  if ( !ft || !*ft ) return;
+#ifndef FLT_LEAN_FACES
+  if ( free_names )
   {
-    if ( /*n->keyhash == hash &&*/ dict->keycomp(n->key,key,size)==0 ){ break; }
-    ++hoff;
-    n=n->next;
+    for (i=0;i<(*ft)->count;++i)
+      flt_safefree((*ft)->faces[i].name);
   }
-  if ( dict->cs ) flt_critsec_leave(dict->cs);
-  *hashe = FLTMAKE32(hoff,(fltu16)entry);
-  return n ? n->value : FLT_NULL;
-}
-
-// this perform hash computation
-void* flt_dict_get(flt_dict* dict, const char* key, int size)
-{
-  fltu32 he;
-  return flt_dict_geth(dict,key,size,dict->hashf((const unsigned char*)key,size),&he);
+#endif
+  flt_safefree((*ft)->faces);
+  flt_safefree((*ft)->hashes);
+  flt_safefree((*ft)->slots);
+  flt_safefree(*ft);
 }
 
-flt_dict_node* flt_dict_create_node(const char* key, fltu32 keyhash, void* value, int size)
+// doubles the slots and the faces capacity. slots are rebuilt from stored hashes
+int flt_facetable_grow(flt_facetable* ft)
 {
-  flt_dict_node *n = (flt_dict_node*)flt_malloc(sizeof(flt_dict_node));
-  if ( size ) // we got size, just alloc+memcpy the key
+  const fltu32 nslots=ft->nslots<<1, mask=nslots-1;
+  fltu64* slots;
+  fltu32 id, i;
+  void* p;
+
+  slots = (fltu64*)flt_calloc(nslots,sizeof(fltu64));
+  if ( !slots ) return FLT_FALSE;
+  for (id=0;id<ft->count;++id)
   {
-    n->key = (char*)flt_malloc(size);
-    memcpy(n->key,key,size);
+    i = (fltu32)ft->hashes[id] & mask;
+    while ( slots[i] ) i=(i+1)&mask;
+    slots[i] = (ft->hashes[id]&0xffffffff00000000ULL) | (id+1);
   }
-  else
+  flt_free(ft->slots);
+  ft->slots = slots;
+  ft->nslots = nslots;
+
+  if ( ft->count*2 >= ft->capacity )
   {
-    n->key = flt_strdup(key); // 0 size is for strings
+    p = flt_realloc(ft->faces, sizeof(flt_face)*ft->capacity*2);
+    if ( !p ) return FLT_FALSE;
+    ft->faces = (flt_face*)p;
+    p = flt_realloc(ft->hashes, sizeof(fltu64)*ft->capacity*2);
+    if ( !p ) return FLT_FALSE;
+    ft->hashes = (fltu64*)p;
+    ft->capacity *= 2;
   }
-  n->keyhash = keyhash;
-  n->value = value;
-  n->next = FLT_NULL;
-  return n;
+  return FLT_TRUE;
 }
 
-int flt_dict_insert(flt_dict* dict, const char* key, void* value, fltopt int size, fltopt fltu32 hash, fltopt fltu32* hashentry)
+// returns the id of the face, inserting it if not found (isnew=1). 0xffffffff if out of memory
+fltu32 flt_facetable_insert(flt_facetable* ft, const flt_face* face, fltu64 hash, int* isnew)
 {
-  flt_dict_node *n, *ln;
-  fltu32 hashk;
-  int entry;
-  fltu16 hoff=0;
+  const fltu64 tag=hash&0xffffffff00000000ULL;
+  fltu32 mask=ft->nslots-1, i=(fltu32)hash&mask, id;
+  fltu64 slot;
 
-  if ( !value || !dict ) 
-    return FLT_FALSE; // must insert non-null value.  
-  hashk = !hash ? dict->hashf((const unsigned char*)key, size) : hash;
-  if ( dict->cs ) flt_critsec_enter(dict->cs); // acquire
-  entry = hashk % dict->capacity;
-  n=dict->hasht[entry];
-  ++dict->count;
-  if ( !n )
-  {
-    dict->hasht[entry]=flt_dict_create_node(key,hashk,value,size); // not found in entry, add it
-  }
-  else
+  *isnew = FLT_FALSE;
+  while ( (slot=ft->slots[i]) != 0 )
   {
-    ln=n;
-    // entry collision: append to the end of list: new entry, just hash collision || or already exists element
-    while (n)
+    // stored hash before comparing the whole face
+    if ( (slot&0xffffffff00000000ULL)==tag )
     {
-      // same keyhash and same keyname (exists)
-      if ( n->keyhash == hashk && dict->keycomp(n->key,key,size)==0 ) { n->value = value; ln=0; --dict->count; break; }
-      ++hoff;
-      ln=n;
-      n=n->next;
-    }    
-    if (ln) ln->next = flt_dict_create_node(key,hashk,value,size);
+      id = FLTGETLO32(slot)-1;
+      if ( ft->hashes[id]==hash && memcmp(ft->faces+id,face,FLT_FACESIZE_HASH)==0 )
+        return id;
+    }
+    i=(i+1)&mask;
   }
 
-  if ( hashentry )
-    *hashentry = FLTMAKE32( hoff, (fltu16)entry ) ;
-
-  if ( dict->cs ) flt_critsec_leave(dict->cs);
-  return FLT_TRUE;
+  // new face. grows keeping load factor under 3/4
+  if ( (ft->count+1)*4 > ft->nslots*3 || ft->count >= ft->capacity )
+  {
+    if ( !flt_facetable_grow(ft) ) return 0xffffffff;
+    mask=ft->nslots-1; 
+    i=(fltu32)hash&mask;
+    while ( ft->slots[i] ) i=(i+1)&mask;
+  }
+  id = ft->count++;
+  ft->faces[id] = *face;
+  ft->hashes[id] = hash;
+  ft->slots[i] = tag | (id+1);
+  *isnew = FLT_TRUE;
+  return id;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
-//                            CRITICAL SECTION / ATOMIC
+//                                  BATCHES
+// Faces are sorted by state and merged, triangles are then counted per batch and placed in 
+// their batch range (counting sort), keeping the file order inside every batch.
 ////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef _MSC_VER
-typedef struct flt_critsec
+int flt_batches_build(flt* of)
 {
-  CRITICAL_SECTION cs;
-}flt_critsec;
+  flt_facetable* ft=of->faces;
+  flt_batches* bs;
+  flt_batch* b;
+  fltu32* facebatch;
+  fltu32 i, k, n, id, vtx, maxvtx=0, start=0, nfaces, nindices;
+
+  flt_batches_destroy(&of->batches);
+  bs = of->batches = (flt_batches*)flt_calloc(1,sizeof(flt_batches));
+  if ( !bs ) return FLT_ERR_MEMOUT;
+  nfaces = ft ? ft->count : 0;
+  nindices = flt_index_count(of)/3*3;
+  if ( !nfaces || !nindices ) return FLT_OK;
+
+  // triangles of every face (no of indices) and the largest vertex no
+  facebatch = (fltu32*)flt_calloc(nfaces,sizeof(fltu32));
+  if ( !facebatch ) return FLT_ERR_MEMOUT;
+  for ( i=0; i<nindices; i+=3 )
+  {
+    id = flt_index_face(of,i);
+    if ( id < nfaces ) facebatch[id] += 3;
+    for ( k=0; k<3; ++k ) { vtx=flt_index_vertex(of,i+k); if ( vtx > maxvtx ) maxvtx = vtx; }
+  }
 
-flt_critsec* flt_critsec_create()
-{
-  flt_critsec* cs=(flt_critsec*)flt_malloc(sizeof(flt_critsec));
-  InitializeCriticalSection(&cs->cs);
-  return cs;
-}
+  // a batch per face sorted by state, then the faces with triangles of the same state merged
+  bs->batches = (flt_batch*)flt_calloc(nfaces,sizeof(flt_batch));
+  if ( !bs->batches ) { flt_free(facebatch); return FLT_ERR_MEMOUT; }
+  for ( i=0; i<nfaces; ++i )
+  {
+    b = bs->batches+i;
+    b->texbase_pat = ft->faces[i].texbase_pat;
+    b->texdetail_pat = ft->faces[i].texdetail_pat;
+    b->mat_pat = ft->faces[i].mat_pat;
+    b->shader_ndx = ft->faces[i].shader_ndx;
+#ifndef FLT_LEAN_FACES
+    b->draw_type = ft->faces[i].draw_type;
+#endif
+    b->face = i;
+  }
+  qsort(bs->batches, nfaces, sizeof(flt_batch), flt_batch_cmp);
+  for ( i=0, n=0; i<nfaces; ++i )
+  {
+    b = bs->batches+i;
+    id = b->face;
+    if ( !facebatch[id] ) continue; // no triangles
+    if ( !n || flt_batch_state_cmp(bs->batches+n-1,b)!=0 ) { bs->batches[n] = *b; ++n; } 
+    bs->batches[n-1].count += facebatch[id];
+    facebatch[id] = n-1; // now the batch of the face
+  }
+  bs->batch_count = n;
 
-void flt_critsec_destroy(flt_critsec* cs)
-{
-  DeleteCriticalSection(&cs->cs);
-  flt_free(cs);
+  // ranges, counts are the cursors while placing the triangles
+  for ( i=0; i<n; ++i )
+  {
+    b = bs->batches+i;
+    b->start = start;
+    start += b->count;
+    b->count = 0;
+  }
+  bs->index_count = start;
+  bs->index_size = maxvtx < 0xffff ? sizeof(fltu16) : sizeof(fltu32);
+  bs->indices = flt_malloc(flt_max(bs->index_size*start,1));
+  if ( !bs->indices ) { flt_free(facebatch); return FLT_ERR_MEMOUT; }
+  for ( i=0; i<nindices; i+=3 )
+  {
+    id = flt_index_face(of,i);
+    if ( id >= nfaces ) continue;
+    b = bs->batches+facebatch[id];
+    k = b->start+b->count;
+    b->count += 3;
+    flt_batch_set_index(bs, k,   flt_index_vertex(of,i));
+    flt_batch_set_index(bs, k+1, flt_index_vertex(of,i+1));
+    flt_batch_set_index(bs, k+2, flt_index_vertex(of,i+2));
+  }
+  flt_free(facebatch);
+  return FLT_OK;
 }
 
-void flt_critsec_enter(flt_critsec* cs)
+fltu32 flt_batch_index(const flt_batches* bs, fltu32 i)
 {
-  EnterCriticalSection(&cs->cs);
+  return bs->index_size==sizeof(fltu16) ? ((const fltu16*)bs->indices)[i] : ((const fltu32*)bs->indices)[i];
 }
 
-void flt_critsec_leave(flt_critsec* cs)
+void flt_batch_set_index(flt_batches* bs, fltu32 i, fltu32 v)
 {
-  LeaveCriticalSection(&cs->cs);
+  if ( bs->index_size==sizeof(fltu16) ) ((fltu16*)bs->indices)[i]=(fltu16)v; else ((fltu32*)bs->indices)[i]=v;
 }
 
-flti32 flt_atomic_dec(fltatom32* c)
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                    BVH
+// Binned SAH: the centroids of the triangles of a node are binned on every axis and the split 
+// with the lowest area*triangles of both sides taken, a leaf if that's not cheaper than testing
+// all of them. The top is split in the calling thread until the subtrees are small enough to be
+// tasks, every one built by a thread in its own nodes and appended at the end.
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_bvh_build(flt* of, flt_node* node, fltu16 nthreads)
 {
-  return InterlockedDecrement(c);
+  flt_bvh_builder b;
+  flt_bvh* bvh;
+  flt_bvh_node* nodes=FLT_NULL, *nd;
+  flt_bvh_task* task;
+  struct flt_thread** threads;
+  float *box=FLT_NULL, *v, q[9], e1[3], e2[3];
+  double p[3], mn[3], mx[3];
+  fltu32 *tris, *ref=FLT_NULL, i, j, k, n=0, m, cap, base, node_count=1, depth=0, nt;
+  const fltu32 pflags = of->ctx ? of->ctx->pflags : 0;
+  const fltu32 vsize = flt_compute_vertex_size(pflags);
+  int err=FLT_ERR_MEMOUT;
+
+  flt_bvh_destroy(&of->bvh);
+  bvh = of->bvh = (flt_bvh*)flt_calloc(1,sizeof(flt_bvh));
+  if ( !bvh ) return FLT_ERR_MEMOUT;
+  if ( !node && of->hie ) node = of->hie->node_root;
+  cap = flt_index_count(of)/3;
+  if ( !node || !cap || !of->pal || !of->pal->vtx_count || !(pflags & FLT_OPT_PAL_VTX_POSITION) ) return FLT_OK;
+  tris = (fltu32*)flt_malloc(sizeof(fltu32)*cap);
+  if ( !tris ) return FLT_ERR_MEMOUT;
+  flt_collect_tris(node, tris, &n, cap);
+  if ( !n ) { flt_free(tris); return FLT_OK; }
+
+  // origin at the center, then the box of every triangle relative to it
+  for ( k=0; k<3; ++k ) { mn[k]=DBL_MAX; mx[k]=-DBL_MAX; }
+  for ( i=0; i<n*3; ++i )
+  {
+    flt_vertex_position(of->pal->vtx_array+(fltu64)flt_index_vertex(of,tris[i/3]*3+i%3)*vsize, pflags, p);
+    for ( k=0; k<3; ++k ) { if ( p[k]<mn[k] ) mn[k]=p[k]; if ( p[k]>mx[k] ) mx[k]=p[k]; }
+  }
+  for ( k=0; k<3; ++k ) bvh->origin[k] = (mn[k]+mx[k])*0.5;
+  box = (float*)flt_malloc(sizeof(float)*6*n);
+  ref = (fltu32*)flt_malloc(sizeof(fltu32)*n);
+  nodes = (flt_bvh_node*)flt_malloc(sizeof(flt_bvh_node)*2*n);
+  if ( !box || !ref || !nodes ) goto bvh_end;
+  for ( i=0, m=0; i<n; ++i )
+  {
+    for ( j=0; j<3; ++j )
+    {
+      flt_vertex_position(of->pal->vtx_array+(fltu64)flt_index_vertex(of,tris[i]*3+j)*vsize, pflags, p);
+      for ( k=0; k<3; ++k ) q[j*3+k] = (float)(p[k]-bvh->origin[k]);
+    }
+
+    // degenerated ones (no area) can't be hit, not in the tree
+    for ( k=0; k<3; ++k ) { e1[k]=q[3+k]-q[k]; e2[k]=q[6+k]-q[k]; }
+    if ( e1[1]*e2[2]-e1[2]*e2[1]==0.0f && e1[2]*e2[0]-e1[0]*e2[2]==0.0f && e1[0]*e2[1]-e1[1]*e2[0]==0.0f ) continue;
+    tris[m] = tris[i];
+    ref[m] = m;
+    v = box+m*6;
+    for ( k=0; k<3; ++k ) 
+    { 
+      v[k] = flt_min(flt_min(q[k],q[3+k]),q[6+k]);
+      v[k+3] = flt_max(flt_max(q[k],q[3+k]),q[6+k]);
+    }
+    ++m;
+  }
+  n = m;
+  if ( !n ) { err=FLT_OK; goto bvh_end; }
+
+  // top of the tree, subtrees for the threads if any
+  memset(&b,0,sizeof(b));
+  b.box = box;
+  b.ref = ref;
+  b.nodes = nodes;
+  b.defer = nthreads>1 ? flt_max(n/(nthreads*4u),FLT_BVH_TASK_MIN) : 0;
+  nodes[0].first = 0;
+  nodes[0].count = n;
+  flt_bvh_bounds(&b, nodes);
+  err = flt_bvh_split(&b, nodes, &node_count, 0, 0, &depth, FLT_TRUE);
+  if ( err==FLT_OK && b.task_count )
+  {
+    // this thread works too. if a thread can't be created the others take its tasks
+    nt = flt_min((fltu32)nthreads,b.task_count)-1;
+    threads = (struct flt_thread**)flt_calloc(flt_max(nt,1),sizeof(struct flt_thread*));
+    for ( i=0; threads && i<nt; ++i ) threads[i] = flt_thread_create(flt_bvh_worker, &b);
+    flt_bvh_worker(&b);
+    for ( i=0; threads && i<nt; ++i ) if ( threads[i] ) flt_thread_join(threads[i]);
+    flt_safefree(threads);
+    err = b.err;
+  }
+
+  // subtrees appended, their root in place of the node they're for
+  for ( i=0; i<b.task_count; ++i )
+  {
+    task = b.tasks+i;
+    if ( err==FLT_OK )
+    {
+      base = node_count;
+      for ( j=0; j<task->node_count; ++j )
+      {
+        nd = j ? nodes+base+j-1 : nodes+task->node;
+        *nd = task->nodes[j];
+        if ( !nd->count ) nd->first += base-1;
+      }
+      node_count += task->node_count-1;
+      depth = flt_max(depth,task->depth);
+    }
+    flt_safefree(task->nodes);
+  }
+  flt_safefree(b.tasks);
+  if ( err!=FLT_OK ) goto bvh_end;
+
+  // triangles in leaf order with their corners
+  err = FLT_ERR_MEMOUT;
+  bvh->tris = (fltu32*)flt_malloc(sizeof(fltu32)*n);
+  bvh->verts = (float*)flt_malloc(sizeof(float)*9*n);
+  if ( !bvh->tris || !bvh->verts ) goto bvh_end;
+  for ( i=0; i<n; ++i )
+  {
+    bvh->tris[i] = tris[ref[i]];
+    v = bvh->verts+i*9;
+    for ( j=0; j<3; ++j )
+    {
+      flt_vertex_position(of->pal->vtx_array+(fltu64)flt_index_vertex(of,bvh->tris[i]*3+j)*vsize, pflags, p);
+      for ( k=0; k<3; ++k ) v[j*3+k] = (float)(p[k]-bvh->origin[k]);
+    }
+  }
+  bvh->nodes = nodes;
+  nodes = (flt_bvh_node*)flt_realloc(bvh->nodes, sizeof(flt_bvh_node)*node_count); // shrunk to the nodes used
+  if ( nodes ) bvh->nodes = nodes;
+  nodes = FLT_NULL;
+  bvh->node_count = node_count;
+  bvh->tri_count = n;
+  bvh->depth = depth;
+  err = FLT_OK;
+
+bvh_end:
+  flt_free(tris);
+  flt_safefree(box);
+  flt_safefree(ref);
+  flt_safefree(nodes);
+  if ( err!=FLT_OK ) 
+  {
+    flt_safefree(bvh->tris);
+    flt_safefree(bvh->verts);
+  }
+  return err;
 }
 
-flti32 flt_atomic_inc(fltatom32* c)
+// triangles (no) in the ndx_pairs of n and its children, up to cap
+void flt_collect_tris(const flt_node* n, fltu32* tris, fltu32* count, fltu32 cap)
 {
-  return InterlockedIncrement(c);
+  fltu32 i, start, end;
+  const flt_node* child;
+
+  for ( i=0; i<n->ndx_pairs_count; ++i )
+  {
+    FLTGET32(n->ndx_pairs[i],start,end); // end included
+    for ( ; start+2<=end && *count<cap; start+=3 ) 
+      tris[(*count)++] = start/3;
+  }
+  for ( child=n->child_head; child; child=child->next )
+    flt_collect_tris(child, tris, count, cap);
 }
 
-void flt_atomic_add(fltatom32* c, fltu32 val)
+// half of the surface area
+float flt_bvh_area(const float* mn, const float* mx)
 {
-  InterlockedExchangeAdd(c,(LONG)val);
+  const float dx=mx[0]-mn[0], dy=mx[1]-mn[1], dz=mx[2]-mn[2];
+  return dx*dy+dy*dz+dz*dx;
 }
 
-#else // perhaps pthread/gcc builtings ? // add other platforms here
-
-typedef struct flt_critsec
+// bounds of the triangles of the node (first/count of ref)
+void flt_bvh_bounds(const flt_bvh_builder* b, flt_bvh_node* node)
 {
-  pthread_mutex_t mtx;
-}flt_critsec;
+  const float* box;
+  fltu32 i, k;
 
-flt_critsec* flt_critsec_create()
-{
-  flt_critsec* cs;
-  cs=(flt_critsec*)flt_malloc(sizeof(flt_critsec));
-  pthread_mutex_init(&cs->mtx, ... );
-  return cs;
+  for ( k=0; k<3; ++k ) { node->min[k]=FLT_MAX; node->max[k]=-FLT_MAX; }
+  for ( i=node->first; i<node->first+node->count; ++i )
+  {
+    box = b->box+b->ref[i]*6;
+    for ( k=0; k<3; ++k )
+    {
+      if ( box[k]<node->min[k] ) node->min[k]=box[k];
+      if ( box[k+3]>node->max[k] ) node->max[k]=box[k+3];
+    }
+  }
 }
 
-void flt_critsec_destroy(flt_critsec* cs)
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Splits the node root (first/count of ref, bounds set) and its children until leaves, the 
+// children pairs added at node_count. Nodes have room for 2*count. With top, the ones of up to 
+// b->defer triangles are left as tasks instead. Returns FLT_OK or FLT_ERR_MEMOUT
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_bvh_split(flt_bvh_builder* b, flt_bvh_node* nodes, fltu32* node_count, fltu32 root, fltu32 depth, fltu32* maxdepth, int top)
 {
-  pthread_mutex_destroy(&cs->mtx);
-  flt_free(cs);
-}
+  fltu32 bincount[FLT_BVH_BINS], lcount[FLT_BVH_BINS];
+  float binmin[FLT_BVH_BINS][3], binmax[FLT_BVH_BINS][3], larea[FLT_BVH_BINS];
+  float mn[3], mx[3], cmin[3], cmax[3], scale[3], c, cost, best;
+  fltu32 *stack, sp=0, i, j, k, n, axis, bin, first, count, l, r, t, bestaxis, bestbin=0;
+  flt_bvh_node* node;
+  flt_bvh_task* task;
+  const float* box;
+  void* p;
+
+  // every node in the stack has triangles of its own
+  stack = (fltu32*)flt_malloc(sizeof(fltu32)*2*(nodes[root].count+1));
+  if ( !stack ) return FLT_ERR_MEMOUT;
+  stack[sp++] = root;
+  stack[sp++] = depth;
+  while ( sp )
+  {
+    depth = stack[--sp];
+    node = nodes+stack[--sp];
+    first = node->first;
+    count = node->count;
+    if ( depth>*maxdepth ) *maxdepth = depth;
+    if ( count<=FLT_BVH_LEAF_SIZE ) continue;
+    if ( top && count<=b->defer )
+    {
+      if ( b->task_count>=b->task_cap )
+      {
+        p = flt_realloc(b->tasks, sizeof(flt_bvh_task)*flt_max(b->task_cap*2,64));
+        if ( !p ) { flt_free(stack); return FLT_ERR_MEMOUT; }
+        b->tasks = (flt_bvh_task*)p;
+        b->task_cap = flt_max(b->task_cap*2,64);
+      }
+      task = b->tasks+b->task_count++;
+      memset(task,0,sizeof(flt_bvh_task));
+      task->node = (fltu32)(node-nodes);
+      task->depth = depth;
+      continue;
+    }
+
+    // bounds of the centroids
+    for ( k=0; k<3; ++k ) { cmin[k]=FLT_MAX; cmax[k]=-FLT_MAX; }
+    for ( i=first; i<first+count; ++i )
+    {
+      box = b->box+b->ref[i]*6;
+      for ( k=0; k<3; ++k ) { c=(box[k]+box[k+3])*0.5f; if ( c<cmin[k] ) cmin[k]=c; if ( c>cmax[k] ) cmax[k]=c; }
+    }
+
+    // cheapest split of the bins of every axis. forced over FLT_BVH_LEAF_MAX
+    best = count>FLT_BVH_LEAF_MAX ? FLT_MAX : flt_bvh_area(node->min,node->max)*(count-1);
+    bestaxis = 3;
+    for ( axis=0; axis<3; ++axis )
+    {
+      if ( !(cmax[axis]>cmin[axis]) ) continue;
+      scale[axis] = FLT_BVH_BINS/(cmax[axis]-cmin[axis]);
+      for ( j=0; j<FLT_BVH_BINS; ++j )
+      {
+        bincount[j] = 0;
+        for ( k=0; k<3; ++k ) { binmin[j][k]=FLT_MAX; binmax[j][k]=-FLT_MAX; }
+      }
+      for ( i=first; i<first+count; ++i )
+      {
+        box = b->box+b->ref[i]*6;
+        bin = (fltu32)(((box[axis]+box[axis+3])*0.5f-cmin[axis])*scale[axis]);
+        if ( bin>=FLT_BVH_BINS ) bin = FLT_BVH_BINS-1;
+        ++bincount[bin];
+        for ( k=0; k<3; ++k )
+        {
+          if ( box[k]<binmin[bin][k] ) binmin[bin][k]=box[k];
+          if ( box[k+3]>binmax[bin][k] ) binmax[bin][k]=box[k+3];
+        }
+      }
+
+      // left side of every split from the start, right one from the end
+      for ( k=0; k<3; ++k ) { mn[k]=FLT_MAX; mx[k]=-FLT_MAX; }
+      for ( j=0, n=0; j<FLT_BVH_BINS-1; ++j )
+      {
+        n += bincount[j];
+        for ( k=0; k<3; ++k ) { mn[k]=flt_min(mn[k],binmin[j][k]); mx[k]=flt_max(mx[k],binmax[j][k]); }
+        lcount[j] = n;
+        larea[j] = n ? flt_bvh_area(mn,mx) : 0.0f;
+      }
+      for ( k=0; k<3; ++k ) { mn[k]=FLT_MAX; mx[k]=-FLT_MAX; }
+      for ( j=FLT_BVH_BINS-1, n=0; j>0; --j )
+      {
+        n += bincount[j];
+        for ( k=0; k<3; ++k ) { mn[k]=flt_min(mn[k],binmin[j][k]); mx[k]=flt_max(mx[k],binmax[j][k]); }
+        if ( !n || !lcount[j-1] ) continue;
+        cost = larea[j-1]*lcount[j-1] + flt_bvh_area(mn,mx)*n;
+        if ( cost<best ) { best=cost; bestaxis=axis; bestbin=j-1; }
+      }
+    }
+    if ( bestaxis==3 ) continue; // leaf
 
-void flt_critsec_enter(flt_critsec* cs)
-{
-  pthread_mutex_lock(&cs->mtx);
+    // triangles of the bins up to bestbin on the left
+    l = first;
+    r = first+count;
+    while ( l<r )
+    {
+      box = b->box+b->ref[l]*6;
+      bin = (fltu32)(((box[bestaxis]+box[bestaxis+3])*0.5f-cmin[bestaxis])*scale[bestaxis]);
+      if ( bin<=bestbin ) { ++l; continue; }
+      t = b->ref[l]; b->ref[l] = b->ref[--r]; b->ref[r] = t;
+    }
+    if ( l==first || l==first+count ) continue;
+
+    // children pair
+    k = *node_count;
+    *node_count += 2;
+    nodes[k].first = first;
+    nodes[k].count = l-first;
+    nodes[k+1].first = l;
+    nodes[k+1].count = first+count-l;
+    flt_bvh_bounds(b, nodes+k);
+    flt_bvh_bounds(b, nodes+k+1);
+    node->first = k;
+    node->count = 0;
+    stack[sp++] = k;
+    stack[sp++] = depth+1;
+    stack[sp++] = k+1;
+    stack[sp++] = depth+1;
+  }
+  flt_free(stack);
+  return FLT_OK;
 }
 
-void flt_critsec_leave(flt_critsec* cs)
+// builds tasks until there are no more left
+void flt_bvh_worker(void* arg)
 {
-  pthread_mutex_unlock(&cs->mtx);
-}
+  flt_bvh_builder* b=(flt_bvh_builder*)arg;
+  flt_bvh_task* task;
+  fltu32 i;
 
-flti32 flt_atomic_dec(fltatom32* c)
-{
-  return __sync_sub_and_fetch(c,1);
+  while ( (i=(fltu32)flt_atomic_inc(&b->next)-1) < b->task_count )
+  {
+    task = b->tasks+i;
+    task->nodes = (flt_bvh_node*)flt_malloc(sizeof(flt_bvh_node)*2*b->nodes[task->node].count);
+    if ( !task->nodes ) { b->err = FLT_ERR_MEMOUT; continue; }
+    task->nodes[0] = b->nodes[task->node];
+    task->node_count = 1;
+    if ( flt_bvh_split(b, task->nodes, &task->node_count, 0, task->depth, &task->depth, FLT_FALSE)!=FLT_OK )
+      b->err = FLT_ERR_MEMOUT;
+  }
 }
 
-flti32 flt_atomic_inc(fltatom32* c)
+void flt_bvh_destroy(flt_bvh** bvh)
 {
-  return __sync_add_and_fetch(c,1);
+  if ( !*bvh ) return;
+  flt_safefree((*bvh)->nodes);
+  flt_safefree((*bvh)->tris);
+  flt_safefree((*bvh)->verts);
+  flt_safefree(*bvh);
 }
-#endif
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-//                                STACK
-////////////////////////////////////////////////////////////////////////////////////////////////
-int flt_stack_create(flt_stack** s, int capacity)
+// ray (inv is 1/dir) against the box of n, tentry the distance where it enters
+int flt_bvh_slab(const flt_bvh_node* n, const float* o, const float* inv, float tmax, float* tentry)
 {
-  flt_stack* _s = (flt_stack*)flt_calloc(1,sizeof(flt_stack));
-  if ( !_s ) return FLT_FALSE;  
-  if (!capacity) 
-    capacity = FLT_STACKARRAY_SIZE;
-
-  _s->entries = (flt_stack_type*)flt_malloc(sizeof(flt_stack_type)*capacity);
-  if (!_s->entries) return  FLT_FALSE;
-  _s->capacity = capacity;
+  float t0=0.0f, t1=tmax, ta, tb, t;
+  int k;
 
-  *s = _s;
-  return FLT_TRUE;
+  for ( k=0; k<3; ++k )
+  {
+    ta = (n->min[k]-o[k])*inv[k];
+    tb = (n->max[k]-o[k])*inv[k];
+    if ( ta>tb ) { t=ta; ta=tb; tb=t; }
+    if ( ta>t0 ) t0=ta;
+    if ( tb<t1 ) t1=tb;
+  }
+  *tentry = t0;
+  return t0<=t1;
 }
 
-void flt_stack_destroy(flt_stack** s)
+// ray against the triangle of 3 corners vtx, both sides (Moller-Trumbore). hit if t<tmax
+int flt_bvh_tri(const float* vtx, const float* o, const float* d, float tmax, float* t, float* u, float* v)
 {
-  if ( !s || !*s ) return;
-
-  flt_safefree((*s)->entries);
-  flt_safefree((*s));
+  float e1[3], e2[3], p[3], s[3], q[3], det, inv;
+  int k;
+
+  for ( k=0; k<3; ++k ) { e1[k]=vtx[3+k]-vtx[k]; e2[k]=vtx[6+k]-vtx[k]; s[k]=o[k]-vtx[k]; }
+  p[0]=d[1]*e2[2]-d[2]*e2[1]; p[1]=d[2]*e2[0]-d[0]*e2[2]; p[2]=d[0]*e2[1]-d[1]*e2[0];
+  det = e1[0]*p[0]+e1[1]*p[1]+e1[2]*p[2];
+  if ( det==0.0f ) return FLT_FALSE; // parallel
+  inv = 1.0f/det;
+  *u = (s[0]*p[0]+s[1]*p[1]+s[2]*p[2])*inv;
+  if ( *u<0.0f || *u>1.0f ) return FLT_FALSE;
+  q[0]=s[1]*e1[2]-s[2]*e1[1]; q[1]=s[2]*e1[0]-s[0]*e1[2]; q[2]=s[0]*e1[1]-s[1]*e1[0];
+  *v = (d[0]*q[0]+d[1]*q[1]+d[2]*q[2])*inv;
+  if ( *v<0.0f || *u+*v>1.0f ) return FLT_FALSE;
+  *t = (e2[0]*q[0]+e2[1]*q[1]+e2[2]*q[2])*inv;
+  return *t>=0.0f && *t<tmax;
 }
 
-void flt_stack_push32(flt_stack* s, fltu32 val)
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Rays one after the other with the same traversal stack, children visited nearest first and 
+// skipped once they're farther than the closest hit
+////////////////////////////////////////////////////////////////////////////////////////////////
+fltu32 flt_bvh_raycast(const flt* of, const flt_ray* rays, flt_hit* hits, fltu32 count, int anyhit)
 {
-#ifdef FLT_PLATFORM_64  
-  flt_stack_type* se;
-#endif
-  FLT_ASSERT(s->count < s->capacity && "stack ran out of memory, increase FLT_STACK_SIZE");
+  const flt_bvh* bvh=of->bvh;
+  const flt_bvh_node* node;
+  flt_hit* hit;
+  fltu32 *stack, sp, i, j, nhits=0;
+  float *stackt, o[3], inv[3], ta, tb, t, u, v;
+  int k, ha, hb;
+
+  for ( i=0; i<count; ++i )
+  {
+    memset(hits+i,0,sizeof(flt_hit));
+    hits[i].t = rays[i].tmax;
+    hits[i].tri = hits[i].face = FLT_BVH_NO_HIT;
+  }
+  if ( !bvh || !bvh->node_count ) return 0;
 
-#ifdef FLT_PLATFORM_64
-  se = s->entries+(s->count++);
-  se->val32 = val;
-  se->node = FLT_NULL;
-#else
-  s->entries[s->count++]=FLTMAKE64(FLT_NODE_NONE,val);
-#endif
-}
+  // a level pops one node and pushes two at most
+  stack = (fltu32*)flt_malloc((sizeof(fltu32)+sizeof(float))*(bvh->depth+2));
+  if ( !stack ) return 0;
+  stackt = (float*)(stack+bvh->depth+2);
+  for ( i=0; i<count; ++i )
+  {
+    hit = hits+i;
+    for ( k=0; k<3; ++k )
+    {
+      o[k] = (float)(rays[i].origin[k]-bvh->origin[k]);
+      inv[k] = rays[i].dir[k]!=0.0f ? 1.0f/rays[i].dir[k] : FLT_MAX;
+    }
+    sp = 0;
+    if ( flt_bvh_slab(bvh->nodes, o, inv, hit->t, &ta) ) { stack[sp]=0; stackt[sp++]=ta; }
+    while ( sp )
+    {
+      --sp;
+      if ( stackt[sp]>hit->t ) continue; // farther than the closest hit
+      node = bvh->nodes+stack[sp];
+      if ( node->count )
+      {
+        for ( j=node->first; j<node->first+node->count; ++j )
+        {
+          if ( !flt_bvh_tri(bvh->verts+j*9, o, rays[i].dir, hit->t, &t, &u, &v) ) continue;
+          hit->t = t;
+          hit->u = u;
+          hit->v = v;
+          hit->tri = bvh->tris[j];
+          if ( anyhit ) break;
+        }
+        if ( anyhit && hit->tri!=FLT_BVH_NO_HIT ) break;
+        continue;
+      }
 
-void flt_stack_pushn(flt_stack* s, flt_node* node)
-{
-#ifdef FLT_PLATFORM_64  
-  flt_stack_type* se;
-#endif
-  FLT_ASSERT(s->count < s->capacity && "stack ran out of memory, increase FLT_STACK_SIZE");
+      // nearest child on top
+      j = node->first;
+      ha = flt_bvh_slab(bvh->nodes+j, o, inv, hit->t, &ta);
+      hb = flt_bvh_slab(bvh->nodes+j+1, o, inv, hit->t, &tb);
+      if ( ha && hb && tb<ta ) 
+      { 
+        stack[sp]=j; stackt[sp++]=ta; 
+        stack[sp]=j+1; stackt[sp++]=tb; 
+      }
+      else
+      {
+        if ( hb ) { stack[sp]=j+1; stackt[sp++]=tb; }
+        if ( ha ) { stack[sp]=j; stackt[sp++]=ta; }
+      }
+    }
+    if ( hit->tri==FLT_BVH_NO_HIT ) continue;
 
-#ifdef FLT_PLATFORM_64  
-  se = s->entries+(s->count++);
-  se->val32=0; 
-  se->node=node;
-#else
-  s->entries[s->count++]=node ? FLTMAKE64(node->type,node) : 0;
+    // attributes of the face
+    ++nhits;
+    hit->face = flt_index_face(of, hit->tri*3);
+#ifndef FLT_LEAN_FACES
+    if ( of->faces && hit->face<of->faces->count )
+    {
+      hit->smc_id = of->faces->faces[hit->face].smc_id;
+      hit->feat_id = of->faces->faces[hit->face].feat_id;
+    }
 #endif
-}
-
-flt_node* flt_stack_topn(flt_stack* s)
-{
-  flt_node* ret=FLT_NULL;
-#ifdef FLT_PLATFORM_64
-  if (s->count)
-    ret = s->entries[s->count-1].node;
-#else
-  fltu32 type,val;
-  if (s->count)
-  {
-    FLTGET32(s->entries[s->count-1],type,val);
-    if (type)
-      ret=(flt_node*)val;
   }
-#endif
-  return ret;
+  flt_free(stack);
+  return nhits;
 }
 
-fltu32 flt_stack_top32_not_null(flt_stack* s)
+////////////////////////////////////////////////////////////////////////////////////////////////
+//                                  TERRAIN
+// Triangles are referenced by every cell their xy box overlaps (counting sort of the refs). A 
+// query tests the triangles of its cell with the precomputed barycentric setup, no divisions.
+////////////////////////////////////////////////////////////////////////////////////////////////
+int flt_terrain_build(flt* of, flt_node* node, float cell_size, int terrain_only)
 {
-  int i=s->count-1;
-#ifdef FLT_PLATFORM_64
-  while(i>=0)
+  flt_terrain* ter;
+  flt_terrain_tri* t;
+  fltu32 *tris, *cells, i, j, k, n=0, m, cap, face, x, y, x0, y0, x1, y1;
+  double p[3], q[3][3], mn[3], mx[3], e1x, e1y, e2x, e2y, det;
+  float* box=FLT_NULL;
+  const fltu32 pflags = of->ctx ? of->ctx->pflags : 0;
+  const fltu32 vsize = flt_compute_vertex_size(pflags);
+  int err=FLT_ERR_MEMOUT;
+
+  flt_terrain_destroy(&of->terrain);
+  ter = of->terrain = (flt_terrain*)flt_calloc(1,sizeof(flt_terrain));
+  if ( !ter ) return FLT_ERR_MEMOUT;
+  if ( !node && of->hie ) node = of->hie->node_root;
+  cap = flt_index_count(of)/3;
+  if ( !node || !cap || !of->pal || !of->pal->vtx_count || !(pflags & FLT_OPT_PAL_VTX_POSITION) ) return FLT_OK;
+  tris = (fltu32*)flt_malloc(sizeof(fltu32)*cap);
+  if ( !tris ) return FLT_ERR_MEMOUT;
+  flt_collect_tris(node, tris, &n, cap);
+
+  // triangles kept and the extent
+  for ( k=0; k<3; ++k ) { mn[k]=DBL_MAX; mx[k]=-DBL_MAX; }
+  for ( i=0, m=0; i<n; ++i )
   {
-    if ( s->entries[i].val32 && !s->entries[i].node )
-      return s->entries[i].val32;
-    --i;
+    if ( terrain_only )
+    {
+      face = flt_index_face(of,tris[i]*3);
+      if ( !of->faces || face>=of->faces->count || !(of->faces->faces[face].flags & FLT_FACE_TERRAIN) ) continue;
+    }
+    for ( j=0; j<3; ++j )
+    {
+      flt_vertex_position(of->pal->vtx_array+(fltu64)flt_index_vertex(of,tris[i]*3+j)*vsize, pflags, p);
+      for ( k=0; k<3; ++k ) { if ( p[k]<mn[k] ) mn[k]=p[k]; if ( p[k]>mx[k] ) mx[k]=p[k]; }
+    }
+    tris[m++] = tris[i];
   }
-#else
-  fltu32 type,val;
-
-  while (i>=0)
+  n = m;
+  if ( !n ) { flt_free(tris); return FLT_OK; }
+
+  // cells of about 2 triangles
+  if ( cell_size<=0.0f ) 
+    cell_size = (float)sqrt(flt_max((mx[0]-mn[0])*(mx[1]-mn[1]),1e-6)*2.0/n);
+  cell_size = (float)flt_max(cell_size, flt_max(mx[0]-mn[0],mx[1]-mn[1])/(FLT_TERRAIN_MAX_CELLS-1));
+  if ( cell_size<=0.0f ) cell_size = 1.0f;
+  ter->origin[0] = mn[0];
+  ter->origin[1] = mn[1];
+  ter->origin[2] = (mn[2]+mx[2])*0.5;
+  ter->cell_size = cell_size;
+  ter->nx = flt_min((fltu32)((mx[0]-mn[0])/cell_size)+1, FLT_TERRAIN_MAX_CELLS);
+  ter->ny = flt_min((fltu32)((mx[1]-mn[1])/cell_size)+1, FLT_TERRAIN_MAX_CELLS);
+
+  // plane and barycentric setup, vertical ones out
+  ter->tris = (flt_terrain_tri*)flt_malloc(sizeof(flt_terrain_tri)*n);
+  box = (float*)flt_malloc(sizeof(float)*4*n);
+  cells = ter->cells = (fltu32*)flt_calloc((fltu64)ter->nx*ter->ny+1,sizeof(fltu32));
+  if ( !ter->tris || !box || !cells ) goto terrain_end;
+  for ( i=0, m=0; i<n; ++i )
   {
-    if ( s->entries[i] )
+    for ( j=0; j<3; ++j )
     {
-      FLTGET32(s->entries[i],type,val);
-      if (type==FLT_NODE_NONE)
-        return val;
+      flt_vertex_position(of->pal->vtx_array+(fltu64)flt_index_vertex(of,tris[i]*3+j)*vsize, pflags, p);
+      for ( k=0; k<3; ++k ) q[j][k] = p[k]-ter->origin[k];
     }
-    --i;
+    e1x = q[1][0]-q[0][0]; e1y = q[1][1]-q[0][1];
+    e2x = q[2][0]-q[0][0]; e2y = q[2][1]-q[0][1];
+    det = e1x*e2y-e1y*e2x;
+    if ( det==0.0 ) continue;
+    t = ter->tris+m;
+    t->x0 = (float)q[0][0]; 
+    t->y0 = (float)q[0][1];
+    t->z0 = (float)q[0][2];
+    t->a1 = (float)(e2y/det); t->b1 = (float)(-e2x/det);
+    t->a2 = (float)(-e1y/det); t->b2 = (float)(e1x/det);
+    t->dzdx = (float)((e2y*(q[1][2]-q[0][2])-e1y*(q[2][2]-q[0][2]))/det);
+    t->dzdy = (float)((e1x*(q[2][2]-q[0][2])-e2x*(q[1][2]-q[0][2]))/det);
+
+    // cells it overlaps
+    for ( k=0; k<2; ++k )
+    {
+      box[m*4+k] = (float)(flt_min(flt_min(q[0][k],q[1][k]),q[2][k])/cell_size);
+      box[m*4+k+2] = (float)(flt_max(flt_max(q[0][k],q[1][k]),q[2][k])/cell_size);
+    }
+    ++m;
   }
-#endif
-  return 0xffffffff;
-}
+  ter->tri_count = n = m;
 
+  // refs per cell counted, then placed
+  for ( i=0; i<n; ++i )
+  {
+    x0 = flt_min((fltu32)box[i*4],ter->nx-1); x1 = flt_min((fltu32)box[i*4+2],ter->nx-1);
+    y0 = flt_min((fltu32)box[i*4+1],ter->ny-1); y1 = flt_min((fltu32)box[i*4+3],ter->ny-1);
+    for ( y=y0; y<=y1; ++y ) for ( x=x0; x<=x1; ++x ) ++cells[y*ter->nx+x+1];
+  }
+  for ( i=0; i<ter->nx*ter->ny; ++i ) cells[i+1] += cells[i];
+  ter->refs = (fltu32*)flt_malloc(sizeof(fltu32)*flt_max(cells[ter->nx*ter->ny],1));
+  if ( !ter->refs ) goto terrain_end;
+  for ( i=0; i<n; ++i )
+  {
+    x0 = flt_min((fltu32)box[i*4],ter->nx-1); x1 = flt_min((fltu32)box[i*4+2],ter->nx-1);
+    y0 = flt_min((fltu32)box[i*4+1],ter->ny-1); y1 = flt_min((fltu32)box[i*4+3],ter->ny-1);
+    for ( y=y0; y<=y1; ++y ) for ( x=x0; x<=x1; ++x ) ter->refs[cells[y*ter->nx+x]++] = i;
+  }
+  for ( i=ter->nx*ter->ny; i>0; --i ) cells[i] = cells[i-1]; // cursors were the starts of the next cell
+  cells[0] = 0;
+  err = FLT_OK;
+
+terrain_end:
+  flt_free(tris);
+  flt_safefree(box);
+  if ( err!=FLT_OK ) 
+  {
+    flt_safefree(ter->tris);
+    flt_safefree(ter->cells);
+    flt_safefree(ter->refs);
+    ter->tri_count = ter->nx = ter->ny = 0;
+  }
+  return err;
+}
 
-flt_node* flt_stack_topn_not_null(flt_stack* s)
+fltu32 flt_query_height(const flt* of, const double* xs, const double* ys, fltu32 n, double* out_z, float* out_normal)
 {
-  int i=s->count-1;
-#ifdef FLT_PLATFORM_64
-  while(i>=0)
+  const flt_terrain* ter=of->terrain;
+  const flt_terrain_tri *t, *best;
+  const fltu32* r, *end;
+  fltu32 i, cx, cy, found=0;
+  float x, y, dx, dy, l1, l2, z, bestz, len, inv;
+
+  if ( !ter || !ter->tri_count ) 
   {
-    if ( s->entries[i].node )
-      return s->entries[i].node;
-    --i;
+    for ( i=0; i<n; ++i ) out_z[i] = -DBL_MAX;
+    if ( out_normal ) memset(out_normal,0,sizeof(float)*3*n);
+    return 0;
   }
-#else
-  fltu32 type,val;
-  
-  while (i>=0)
+  inv = 1.0f/ter->cell_size;
+  for ( i=0; i<n; ++i )
   {
-    if ( s->entries[i] )
+    x = (float)(xs[i]-ter->origin[0]);
+    y = (float)(ys[i]-ter->origin[1]);
+    best = FLT_NULL;
+    bestz = -FLT_MAX;
+    if ( x>=0.0f && y>=0.0f )
     {
-      FLTGET32(s->entries[i],type,val);
-      if (type!=FLT_NODE_NONE)
-        return (flt_node*)val;
+      cx = (fltu32)(x*inv);
+      cy = (fltu32)(y*inv);
+      if ( cx<ter->nx && cy<ter->ny )
+      {
+        r = ter->refs+ter->cells[cy*ter->nx+cx];
+        end = ter->refs+ter->cells[cy*ter->nx+cx+1];
+        for ( ; r<end; ++r )
+        {
+          t = ter->tris+*r;
+          dx = x-t->x0;
+          dy = y-t->y0;
+          l1 = t->a1*dx+t->b1*dy;
+          l2 = t->a2*dx+t->b2*dy;
+          if ( l1<-FLT_TERRAIN_EPS || l2<-FLT_TERRAIN_EPS || l1+l2>1.0f+FLT_TERRAIN_EPS ) continue;
+          z = t->z0+t->dzdx*dx+t->dzdy*dy;
+          if ( z>bestz ) { bestz=z; best=t; }
+        }
+      }
+    }
+    if ( !best )
+    {
+      out_z[i] = -DBL_MAX;
+      if ( out_normal ) out_normal[i*3]=out_normal[i*3+1]=out_normal[i*3+2]=0.0f;
+      continue;
+    }
+    ++found;
+    out_z[i] = ter->origin[2]+bestz;
+    if ( out_normal )
+    {
+      // (-dz/dx, -dz/dy, 1) normalized, always up
+      len = 1.0f/sqrtf(best->dzdx*best->dzdx+best->dzdy*best->dzdy+1.0f);
+      out_normal[i*3] = -best->dzdx*len;
+      out_normal[i*3+1] = -best->dzdy*len;
+      out_normal[i*3+2] = len;
     }
-    --i;
   }
-#endif
-  return FLT_NULL;
+  return found;
 }
 
-flt_node* flt_stack_popn(flt_stack* s)
+void flt_terrain_destroy(flt_terrain** t)
 {
-  flt_node* v=FLT_NULL;
-#ifdef FLT_PLATFORM_64
-  if (s->count)
-    v=s->entries[--s->count].node;
-#else
-  fltu32 type,val;
-  if (s->count)
-  {
-    --s->count;
-    FLTGET32(s->entries[s->count],type,val);
-    if (type)
-      v = (flt_node*)val;
-  }
-#endif
-  return v;
+  if ( !*t ) return;
+  flt_safefree((*t)->tris);
+  flt_safefree((*t)->cells);
+  flt_safefree((*t)->refs);
+  flt_safefree(*t);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
-//                                    ARRAY  
+// Vertex cache optimization (Forsyth, linear speed vertex cache optimisation). Every batch is 
+// reordered on its own greedily, taking the triangle with the best score among the ones of the 
+// vertices in an LRU cache model. Then the vertices are renumbered in order of first use.
 ////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef FLT_UNIQUE_FACES
-int flt_array_create(flt_array** arr, fltu32 capacity, flt_array_growpolicy grow)
+int flt_batches_optimize(flt* of, fltu32 cache_size, float* acmr_before, float* acmr_after)
 {
-  *arr = (flt_array*)flt_calloc(1,sizeof(flt_array));
-  if ( !*arr ) return FLT_FALSE;
-  (*arr)->capacity = capacity>0?capacity:FLT_ARRAY_INITCAP;
-  (*arr)->size = 0;
-  (*arr)->data = (flt_array_type*)flt_malloc(sizeof(flt_array_type)*capacity);
-  if ( !(*arr)->data ) { flt_array_destroy(arr); return FLT_FALSE; }
-  if ( !grow ) grow = flt_array_grow_double;
-  (*arr)->growpolicy = grow;
-  return FLT_TRUE;
+  flt_batches* bs=of->batches;
+  flt_vcache vc;
+  fltu32* inds;
+  fltu8* mem;
+  fltu32 i, n, maxvtx=0, maxcount=0;
+  int err=FLT_OK;
+
+  if ( acmr_before ) *acmr_before=0.0f;
+  if ( acmr_after ) *acmr_after=0.0f;
+  if ( !bs || !bs->index_count ) return FLT_OK;
+  cache_size = cache_size ? flt_max(flt_min(cache_size,FLT_VCACHE_MAX),4) : FLT_VCACHE_SIZE;
+
+  // 32 bits copy of the indices to work on
+  n = bs->index_count;
+  inds = (fltu32*)flt_malloc(sizeof(fltu32)*n);
+  if ( !inds ) return FLT_ERR_MEMOUT;
+  for ( i=0; i<n; ++i ) { inds[i]=flt_batch_index(bs,i); if ( inds[i]>maxvtx ) maxvtx=inds[i]; }
+  for ( i=0; i<bs->batch_count; ++i ) maxcount = flt_max(maxcount, bs->batches[i].count);
+  if ( acmr_before ) *acmr_before = flt_vcache_acmr(bs,inds,cache_size);
+
+  // working arrays in one allocation
+  memset(&vc,0,sizeof(vc));
+  vc.size = cache_size;
+  mem = (fltu8*)flt_malloc(sizeof(fltu32)*((fltu64)maxvtx+1 + maxcount*7+1) + sizeof(float)*maxcount*2);
+  if ( !mem ) { flt_free(inds); return FLT_ERR_MEMOUT; }
+  vc.local = (fltu32*)mem;
+  vc.verts = vc.local+maxvtx+1;
+  vc.corners = vc.verts+maxcount;
+  vc.live = vc.corners+maxcount;
+  vc.adjofs = vc.live+maxcount;
+  vc.adj = vc.adjofs+maxcount+1;
+  vc.out = vc.adj+maxcount;
+  vc.pos = (flti32*)(vc.out+maxcount);
+  vc.vscore = (float*)(vc.pos+maxcount);
+  vc.tscore = vc.vscore+maxcount;
+  memset(vc.local,0xff,sizeof(fltu32)*((fltu64)maxvtx+1));
+  for ( i=0; i<bs->batch_count; ++i )
+    flt_vcache_batch(&vc, inds+bs->batches[i].start, bs->batches[i].count/3);
+  flt_free(mem);
+
+  // vertex fetch order, then back to the batches
+  if ( of->pal && of->pal->vtx_array && of->ctx )
+    err = flt_vfetch_reorder(of,inds,n);
+  if ( err == FLT_OK )
+  {
+    for ( i=0; i<n; ++i ) flt_batch_set_index(bs,i,inds[i]);
+    if ( acmr_after ) *acmr_after = flt_vcache_acmr(bs,inds,cache_size);
+  }
+  flt_free(inds);
+  return err;
 }
 
-void flt_array_destroy(flt_array** arr)
+// score of a vertex: recently used ones (the last triangle a bit less) and the ones with few triangles left
+float flt_vcache_score(const flt_vcache* vc, fltu32 v)
 {
-  if ( !arr || !*arr ) return;
-  flt_safefree((*arr)->data);
-  flt_free(*arr);
-  *arr=FLT_NULL;
+  const flti32 pos=vc->pos[v];
+  float s=0.0f, x;
+
+  if ( !vc->live[v] ) return -1.0f;
+  if ( pos >= 0 )
+  {
+    if ( pos < 3 ) s = 0.75f;
+    else { x = 1.0f-(float)(pos-3)/(float)(vc->size-3); s = x*sqrtf(x); }
+  }
+  return s + 2.0f/sqrtf((float)vc->live[v]);
 }
 
-void flt_array_grow_double(flt_array* arr)
+// reorders the triangles of a batch in place
+void flt_vcache_batch(flt_vcache* vc, fltu32* inds, fltu32 ntris)
 {
-  fltu32 newcap = arr->capacity*2;
-  arr->data = (flt_array_type*)flt_realloc(arr->data, sizeof(flt_array_type)*newcap);
-  if( !arr->data ) { FLT_BREAK; return; }
-  arr->capacity = newcap;
+  const fltu32 n=ntris*3;
+  fltu32 newc[FLT_VCACHE_MAX+3];
+  fltu32 i, k, v, t, e, nv=0, ncache=0, nnew, best;
+  float score, bestscore;
+
+  if ( ntris < 2 ) return;
+
+  // local ids and triangles of every vertex
+  for ( i=0; i<n; ++i )
+  {
+    v = inds[i];
+    if ( vc->local[v]==0xffffffff ) { vc->local[v]=nv; vc->verts[nv]=v; vc->live[nv]=0; vc->pos[nv]=-1; ++nv; }
+    vc->corners[i] = vc->local[v];
+    ++vc->live[vc->corners[i]];
+  }
+  vc->adjofs[0]=0;
+  for ( v=0; v<nv; ++v ) { vc->adjofs[v+1]=vc->adjofs[v]+vc->live[v]; vc->out[v]=vc->adjofs[v]; }
+  for ( i=0; i<n; ++i ) vc->adj[vc->out[vc->corners[i]]++] = i/3;
+  for ( v=0; v<nv; ++v ) vc->vscore[v]=flt_vcache_score(vc,v);
+  best=0; bestscore=-1.0f;
+  for ( t=0; t<ntris; ++t )
+  {
+    vc->tscore[t] = vc->vscore[vc->corners[t*3]]+vc->vscore[vc->corners[t*3+1]]+vc->vscore[vc->corners[t*3+2]];
+    if ( vc->tscore[t] > bestscore ) { bestscore=vc->tscore[t]; best=t; }
+  }
+
+  for ( e=0; e<ntris; ++e )
+  {
+    // none around the cache, the best of the rest
+    if ( best==0xffffffff )
+    {
+      bestscore=-1.0f;
+      for ( t=0; t<ntris; ++t ) if ( vc->tscore[t] > bestscore ) { bestscore=vc->tscore[t]; best=t; }
+    }
+    t = best;
+    vc->tscore[t] = -1.0f;
+    for ( k=0; k<3; ++k ) { v=vc->corners[t*3+k]; vc->out[e*3+k]=vc->verts[v]; --vc->live[v]; }
+
+    // the triangle at the front of the cache, the ones going out get no position
+    nnew=0;
+    for ( k=0; k<3; ++k ) { v=vc->corners[t*3+k]; if ( vc->pos[v]!=-2 ) { newc[nnew++]=v; vc->pos[v]=-2; } }
+    for ( i=0; i<ncache; ++i ) { v=vc->cache[i]; if ( vc->pos[v]!=-2 ) { newc[nnew++]=v; vc->pos[v]=-2; } }
+    ncache = flt_min(nnew,vc->size);
+    for ( i=0; i<nnew; ++i )
+    {
+      v = newc[i];
+      vc->pos[v] = i<ncache ? (flti32)i : -1;
+      if ( i<ncache ) vc->cache[i]=v;
+      vc->vscore[v] = flt_vcache_score(vc,v);
+    }
+
+    // scores of the triangles of those vertices, the next one the best of them
+    best=0xffffffff; bestscore=-1.0f;
+    for ( i=0; i<nnew; ++i )
+    {
+      v = newc[i];
+      for ( k=vc->adjofs[v]; k<vc->adjofs[v+1]; ++k )
+      {
+        t = vc->adj[k];
+        if ( vc->tscore[t] < 0.0f ) continue;
+        score = vc->vscore[vc->corners[t*3]]+vc->vscore[vc->corners[t*3+1]]+vc->vscore[vc->corners[t*3+2]];
+        vc->tscore[t] = score;
+        if ( score > bestscore ) { bestscore=score; best=t; }
+      }
+    }
+  }
+
+  memcpy(inds, vc->out, sizeof(fltu32)*n);
+  for ( v=0; v<nv; ++v ) vc->local[vc->verts[v]]=0xffffffff;
 }
 
-void flt_array_push_back(flt_array* arr, flt_array_type elem)
+// average cache misses per triangle with a FIFO cache, empty at the start of every batch (draw)
+float flt_vcache_acmr(const flt_batches* bs, const fltu32* inds, fltu32 size)
 {
-  if (arr->size>=arr->capacity)
-    arr->growpolicy(arr);    
-  arr->data[arr->size++]=elem;
+  fltu32 fifo[FLT_VCACHE_MAX];
+  fltu32 b, i, k, count, head, misses=0;
+  const fltu32* p;
+
+  if ( !bs->index_count ) return 0.0f;
+  for ( b=0; b<bs->batch_count; ++b )
+  {
+    p = inds+bs->batches[b].start;
+    count = head = 0;
+    for ( i=0; i<bs->batches[b].count; ++i )
+    {
+      for ( k=0; k<count && fifo[k]!=p[i]; ++k );
+      if ( k<count ) continue;
+      ++misses;
+      fifo[head] = p[i];
+      head = (head+1)%size;
+      if ( count<size ) ++count;
+    }
+  }
+  return (float)misses/(float)(bs->index_count/3);
 }
 
-flt_array_type flt_array_pop_back(flt_array* arr)
+// vertices of pal->vtx_array in the order the batches use them (the rest after them, as they were).
+// the batch indices in inds and of->indices renumbered
+int flt_vfetch_reorder(flt* of, fltu32* inds, fltu32 count)
 {
-  if ( arr->size==0 ) return FLT_NULL;
-  return arr->data[--arr->size];
+  const fltu32 nv=of->pal->vtx_count, vsize=flt_compute_vertex_size(of->ctx->pflags);
+  fltu8* vtx=of->pal->vtx_array;
+  const fltu32 nindices=flt_index_count(of);
+  fltu8* newvtx;
+  void* data, *olddata;
+  fltu32* remap;
+  fltu32 i, v, next=0, isize;
+
+  if ( !nv || !vsize ) return FLT_OK;
+  if ( of->tris && of->tris->index_size==sizeof(fltu16) && nv>0x10000 // renumbered might not fit in 16 bits
+    && !flt_tris_widen(of->tris, flt_cache_owns(of->cache,of->tris->vtx)) ) 
+    return FLT_ERR_MEMOUT;
+  remap = (fltu32*)flt_malloc(sizeof(fltu32)*nv);
+  newvtx = (fltu8*)flt_malloc((fltu64)nv*vsize);
+  isize = of->tris ? of->tris->index_size : sizeof(flt_array_type);
+  data = olddata = of->tris ? of->tris->vtx : (void*)of->indices->data;
+  if ( flt_cache_owns(of->cache,data) && nindices ) // in place from the cache, read only
+  {
+    data = flt_malloc((fltu64)isize*nindices);
+    if ( data ) memcpy(data, olddata, (fltu64)isize*nindices);
+  }
+  if ( !remap || !newvtx || !data ) 
+  {
+    flt_safefree(remap); 
+    flt_safefree(newvtx); 
+    if ( data != olddata ) flt_safefree(data);
+    return FLT_ERR_MEMOUT;
+  }
+  if ( of->tris ) 
+    of->tris->vtx = data;
+  else
+    of->indices->data = (flt_array_type*)data;
+  memset(remap,0xff,sizeof(fltu32)*nv);
+  for ( i=0; i<count; ++i ) { v=inds[i]; if ( v<nv && remap[v]==0xffffffff ) remap[v]=next++; }
+  for ( v=0; v<nv; ++v ) if ( remap[v]==0xffffffff ) remap[v]=next++;
+
+  for ( v=0; v<nv; ++v ) memcpy(newvtx+(fltu64)remap[v]*vsize, vtx+(fltu64)v*vsize, vsize);
+  if ( !flt_cache_owns(of->cache,vtx) ) flt_free(vtx);
+  of->pal->vtx_array = newvtx;
+  for ( i=0; i<count; ++i ) if ( inds[i]<nv ) inds[i]=remap[inds[i]];
+  for ( i=0; i<nindices; ++i )
+  {
+    v = flt_index_vertex(of,i);
+    if ( v<nv ) flt_index_set_vertex(of,i,remap[v]);
+  }
+  if ( data != olddata && of->indices ) of->indices->capacity=of->indices->size;
+  if ( data != olddata && of->tris ) of->tris->capacity=of->tris->count/3;
+  flt_free(remap);
+  return FLT_OK;
 }
 
-flt_array_type flt_array_at(flt_array* arr, fltu32 index)
+void flt_batches_destroy(flt_batches** bs)
 {
-  return index >= 0 && index < arr->size ? arr->data[index] : FLT_NULL;
+  if ( !bs || !*bs ) return;
+  flt_safefree((*bs)->indices);
+  flt_safefree((*bs)->batches);
+  flt_safefree(*bs);
 }
 
-void flt_array_clear(flt_array* arr)
+// order of the states: textures, material, shader, draw type
+int flt_batch_state_cmp(const flt_batch* a, const flt_batch* b)
 {
-  arr->size=0;
+  if ( a->texbase_pat != b->texbase_pat ) return a->texbase_pat < b->texbase_pat ? -1 : 1;
+  if ( a->texdetail_pat != b->texdetail_pat ) return a->texdetail_pat < b->texdetail_pat ? -1 : 1;
+  if ( a->mat_pat != b->mat_pat ) return a->mat_pat < b->mat_pat ? -1 : 1;
+  if ( a->shader_ndx != b->shader_ndx ) return a->shader_ndx < b->shader_ndx ? -1 : 1;
+  if ( a->draw_type != b->draw_type ) return a->draw_type < b->draw_type ? -1 : 1;
+  return 0;
 }
 
-void flt_array_ensure(flt_array* arr, fltu32 cout_new_elements)
+// qsort of the batches by state, first face first
+int flt_batch_cmp(const void* a, const void* b)
 {
-  const fltu32 newcap = arr->size+cout_new_elements;
-  if ( newcap <= arr->capacity ) return;
-  arr->capacity = newcap;
-  flt_array_grow_double(arr); // ensure makes use directly of grow_double policy
+  const flt_batch* x=(const flt_batch*)a;
+  const flt_batch* y=(const flt_batch*)b;
+  const int c=flt_batch_state_cmp(x,y);
+  if ( c ) return c;
+  return x->face < y->face ? -1 : (x->face > y->face ? 1 : 0);
 }
 #endif
 
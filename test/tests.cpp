@@ -0,0 +1,367 @@
+#pragma warning(disable:4100 4005)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#define FLT_UNIQUE_FACES
+#define FLT_IMPLEMENTATION
+#include <flt.h>
+#include <vector>
+
+// Behavior tests of flt.h. The files are written in memory record by record and loaded
+// with flt_load_from_memory. Returns the no of failed checks.
+
+static int g_failed = 0;
+
+#define TEST_CHECK(c) do { if ( !(c) ) { ++g_failed; printf("%s(%d): failed %s\n", __FILE__, __LINE__, #c); } } while(0)
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Writer of big endian records
+////////////////////////////////////////////////////////////////////////////////////////////////
+struct fltWriter
+{
+  std::vector<fltu8> buff;
+
+  void u8(fltu8 v){ buff.push_back(v); }
+  void u16(fltu16 v){ u8(v>>8); u8(v&0xff); }
+  void u32(fltu32 v){ u16(v>>16); u16(v&0xffff); }
+  void f32(float v){ fltu32 u; memcpy(&u,&v,4); u32(u); }
+  void f64(double v){ fltu64 u; memcpy(&u,&v,8); u32((fltu32)(u>>32)); u32((fltu32)u); }
+  void zeros(size_t n){ buff.insert(buff.end(), n, 0); }
+  void name(const char* s, size_t n){ size_t l=strlen(s); for (size_t i=0;i<n;++i) u8(i<l?s[i]:0); }
+  void op(fltu16 op, size_t length){ u16(op); u16((fltu16)length); }
+
+  void header(){ op(FLT_OP_HEADER,324); name("db",8); u32(1640); u32(3); zeros(320-16); }
+  void push(){ op(FLT_OP_PUSHLEVEL,4); }
+  void pop(){ op(FLT_OP_POPLEVEL,4); }
+  void group(const char* n){ op(FLT_OP_GROUP,44); name(n,8); zeros(32); }
+  void face(const char* n)
+  {
+    op(FLT_OP_FACE,80); name(n,8); zeros(14); u16((fltu16)-1); zeros(28);
+    u32(0xff00ff00); zeros(18); u16(0xffff);
+  }
+  // vertex palette header, followed by vtx68 records
+  void vtxpal(fltu32 nverts){ op(FLT_OP_PAL_VERTEX,8); u32(8+nverts*40); }
+  void vtx68(double x, double y, double z){ op(FLT_OP_VERTEX_COLOR,40); u16(0); u16(0); f64(x); f64(y); f64(z); u32(0xffffffff); u32(0); }
+  void vlist(const fltu32* vtxs, fltu32 n)
+  {
+    op(FLT_OP_VERTEX_LIST,4+n*4);
+    for (fltu32 i=0;i<n;++i) u32(8+vtxs[i]*40); // palette byte offsets
+  }
+};
+
+static int test_load(const fltWriter& w, flt* of, fltu32 pflags)
+{
+  flt_opts opts;
+  memset(&opts,0,sizeof(opts));
+  memset(of,0,sizeof(flt));
+  opts.pflags = pflags;
+  opts.hflags = FLT_OPT_HIE_ALL_NODES;
+  return flt_load_from_memory(w.buff.data(), w.buff.size(), of, &opts);
+}
+
+// position of the vertex of index i of the triangles
+static void test_index_pos(const flt* of, fltu32 pflags, fltu32 i, double* p)
+{
+  flt_vertex_position(of->pal->vtx_array+(fltu64)flt_index_vertex(of,i)*flt_compute_vertex_size(pflags), pflags, p);
+}
+
+// height field of the grid tests
+static double test_height(double x, double y)
+{
+  return sin(x*0.7)*2.0 + cos(y*0.4)*3.0 + x*0.25;
+}
+
+// nxn grid of quads in [0,n]x[0,n], two triangles each, one face per quad
+static void test_write_grid(fltWriter& w, fltu32 n)
+{
+  fltu32 x, y, q[4];
+
+  w.header();
+  w.vtxpal((n+1)*(n+1));
+  for (y=0;y<=n;++y)
+    for (x=0;x<=n;++x)
+      w.vtx68(x, y, test_height(x,y));
+  w.push(); w.group("g1"); w.push();
+  for (y=0;y<n;++y)
+  {
+    for (x=0;x<n;++x)
+    {
+      q[0]=y*(n+1)+x; q[1]=q[0]+1; q[2]=q[1]+n+1; q[3]=q[0]+n+1;
+      w.face("f"); w.push(); w.vlist(q,4); w.pop();
+    }
+  }
+  w.pop(); w.pop();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// A vertex list split across continuation records gives the same triangles as in one record
+////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_continuation()
+{
+  const fltu32 pflags = FLT_OPT_PAL_VERTEX|FLT_OPT_PAL_VTX_POSITION;
+  const fltu32 poly[6]={0,1,2,3,4,5};
+  fltWriter whole, split;
+  flt a, b;
+  fltu32 i;
+
+  for (int k=0;k<2;++k)
+  {
+    fltWriter& w = k ? split : whole;
+    w.header();
+    w.vtxpal(6);
+    for (i=0;i<6;++i) w.vtx68(cos(i*1.047), sin(i*1.047), 0.0);
+    w.push(); w.group("g1"); w.push(); w.face("f"); w.push();
+    if ( k )
+    {
+      // 2 indices in the vertex list, 3 and 1 in two continuations
+      w.vlist(poly,2);
+      w.op(FLT_OP_CONTINUATION,4+3*4); for (i=2;i<5;++i) w.u32(8+poly[i]*40);
+      w.op(FLT_OP_CONTINUATION,4+1*4); w.u32(8+poly[5]*40);
+    }
+    else
+    {
+      w.vlist(poly,6);
+    }
+    w.pop(); w.pop(); w.pop();
+  }
+
+  TEST_CHECK( test_load(whole,&a,pflags) == FLT_OK );
+  TEST_CHECK( test_load(split,&b,pflags) == FLT_OK );
+  TEST_CHECK( flt_index_count(&a) == 4*3 ); // fan of the hexagon
+  TEST_CHECK( flt_index_count(&b) == flt_index_count(&a) );
+  for (i=0;i<flt_index_count(&a) && i<flt_index_count(&b);++i)
+    TEST_CHECK( flt_index_vertex(&a,i) == flt_index_vertex(&b,i) );
+  flt_release(&a);
+  flt_release(&b);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Welding converts the duplicated vertices once and their references use the first one
+////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_weld()
+{
+  const fltu32 pflags = FLT_OPT_PAL_VERTEX|FLT_OPT_PAL_VTX_POSITION|FLT_OPT_PAL_VTX_COLOR|FLT_OPT_PAL_VTX_WELD;
+  const double pos[4][3]={ {0,0,0}, {1,0,0}, {1,1,0}, {0,1,2} };
+  const fltu32 tri0[3]={0,1,2}, tri1[3]={4,6,7}; // vertices 4..7 repeat 0..3
+  fltWriter w;
+  flt of;
+  double p[3];
+  fltu32 i;
+
+  w.header();
+  w.vtxpal(8);
+  for (i=0;i<8;++i) w.vtx68(pos[i&3][0], pos[i&3][1], pos[i&3][2]);
+  w.push(); w.group("g1"); w.push();
+  w.face("f0"); w.push(); w.vlist(tri0,3); w.pop();
+  w.face("f1"); w.push(); w.vlist(tri1,3); w.pop();
+  w.pop(); w.pop();
+
+  TEST_CHECK( test_load(w,&of,pflags) == FLT_OK );
+  TEST_CHECK( of.pal && of.pal->vtx_count == 4 );
+  TEST_CHECK( flt_index_count(&of) == 6 );
+  if ( of.pal && flt_index_count(&of) == 6 )
+  {
+    TEST_CHECK( flt_index_vertex(&of,3) == 0 );
+    TEST_CHECK( flt_index_vertex(&of,4) == 2 );
+    TEST_CHECK( flt_index_vertex(&of,5) == 3 );
+    for (i=0;i<6;++i)
+    {
+      test_index_pos(&of, pflags, i, p);
+      const double* e = pos[(i<3?tri0[i]:tri1[i-3])&3];
+      TEST_CHECK( p[0]==e[0] && p[1]==e[1] && p[2]==e[2] );
+    }
+  }
+  flt_release(&of);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Rays against the BVH hit the same triangle at the same distance as testing all of them
+////////////////////////////////////////////////////////////////////////////////////////////////
+static int test_ray_tri(const double* o, const double* d, const double v[3][3], double* t)
+{
+  double e1[3], e2[3], s[3], pv[3], qv[3], det, u, v2;
+  int k;
+
+  for (k=0;k<3;++k){ e1[k]=v[1][k]-v[0][k]; e2[k]=v[2][k]-v[0][k]; s[k]=o[k]-v[0][k]; }
+  pv[0]=d[1]*e2[2]-d[2]*e2[1]; pv[1]=d[2]*e2[0]-d[0]*e2[2]; pv[2]=d[0]*e2[1]-d[1]*e2[0];
+  det = e1[0]*pv[0]+e1[1]*pv[1]+e1[2]*pv[2];
+  if ( fabs(det) < 1e-12 ) return 0;
+  u = (s[0]*pv[0]+s[1]*pv[1]+s[2]*pv[2])/det;
+  if ( u < 0 || u > 1 ) return 0;
+  qv[0]=s[1]*e1[2]-s[2]*e1[1]; qv[1]=s[2]*e1[0]-s[0]*e1[2]; qv[2]=s[0]*e1[1]-s[1]*e1[0];
+  v2 = (d[0]*qv[0]+d[1]*qv[1]+d[2]*qv[2])/det;
+  if ( v2 < 0 || u+v2 > 1 ) return 0;
+  *t = (e2[0]*qv[0]+e2[1]*qv[1]+e2[2]*qv[2])/det;
+  return *t >= 0;
+}
+
+static void test_bvh()
+{
+  const fltu32 pflags = FLT_OPT_PAL_VERTEX|FLT_OPT_PAL_VTX_POSITION;
+  const fltu32 n = 24, nrays = 500;
+  fltWriter w;
+  flt of;
+  std::vector<flt_ray> rays(nrays);
+  std::vector<flt_hit> hits(nrays), anyhits(nrays);
+  double o[3], d[3], v[3][3], t, best;
+  fltu32 i, j, k, besttri, nhits=0;
+
+  test_write_grid(w,n);
+  TEST_CHECK( test_load(w,&of,pflags) == FLT_OK );
+  TEST_CHECK( flt_bvh_build(&of,FLT_NULL,2) == FLT_OK );
+  TEST_CHECK( of.bvh && of.bvh->tri_count == n*n*2 );
+  if ( !of.bvh || !of.bvh->tri_count ) { flt_release(&of); return; }
+
+  // from above the grid to points around it, some too short to reach it
+  srand(7);
+  for (i=0;i<nrays;++i)
+  {
+    flt_ray* r = &rays[i];
+    r->origin[0] = (rand()%1000)*0.001*n; r->origin[1] = (rand()%1000)*0.001*n; r->origin[2] = 20.0;
+    r->dir[0] = (float)((rand()%1000)*0.002*n - n*0.5 - r->origin[0]*0.5);
+    r->dir[1] = (float)((rand()%1000)*0.002*n - n*0.5 - r->origin[1]*0.5);
+    r->dir[2] = -(float)(10+rand()%30);
+    r->tmax = i%5 ? 1e30f : 0.5f;
+  }
+  nhits = flt_bvh_raycast(&of, rays.data(), hits.data(), nrays, FLT_FALSE);
+  TEST_CHECK( flt_bvh_raycast(&of, rays.data(), anyhits.data(), nrays, FLT_TRUE) == nhits );
+  TEST_CHECK( nhits > 0 && nhits < nrays );
+
+  for (i=0;i<nrays;++i)
+  {
+    for (k=0;k<3;++k){ o[k]=rays[i].origin[k]; d[k]=rays[i].dir[k]; }
+    best = rays[i].tmax;
+    besttri = FLT_BVH_NO_HIT;
+    for (j=0;j<flt_index_count(&of)/3;++j)
+    {
+      for (k=0;k<3;++k) test_index_pos(&of, pflags, j*3+k, v[k]);
+      if ( test_ray_tri(o,d,v,&t) && t <= best ) { best=t; besttri=j; }
+    }
+    TEST_CHECK( (hits[i].tri==FLT_BVH_NO_HIT) == (besttri==FLT_BVH_NO_HIT) );
+    TEST_CHECK( (anyhits[i].tri==FLT_BVH_NO_HIT) == (besttri==FLT_BVH_NO_HIT) );
+    if ( besttri != FLT_BVH_NO_HIT && hits[i].tri != FLT_BVH_NO_HIT )
+    {
+      TEST_CHECK( fabs(hits[i].t-best) <= 1e-4*best+1e-5 );
+      TEST_CHECK( hits[i].face == flt_index_face(&of,hits[i].tri*3) );
+    }
+  }
+  flt_release(&of);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Heights of the terrain are the ones of the source triangles
+////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_terrain()
+{
+  const fltu32 pflags = FLT_OPT_PAL_VERTEX|FLT_OPT_PAL_VTX_POSITION;
+  const fltu32 n = 16, npts = 400;
+  fltWriter w;
+  flt of;
+  std::vector<double> xs(npts), ys(npts), zs(npts);
+  std::vector<float> normals(npts*3);
+  double v[3][3], det, l1, l2, best;
+  fltu32 i, j, k, found, bfound=0;
+
+  test_write_grid(w,n);
+  TEST_CHECK( test_load(w,&of,pflags) == FLT_OK );
+  TEST_CHECK( flt_terrain_build(&of,FLT_NULL,0.0f,FLT_FALSE) == FLT_OK );
+  TEST_CHECK( of.terrain && of.terrain->tri_count == n*n*2 );
+  if ( !of.terrain || !of.terrain->tri_count ) { flt_release(&of); return; }
+
+  // inside and a bit outside the grid
+  srand(11);
+  for (i=0;i<npts;++i)
+  {
+    xs[i] = (rand()%1000)*0.0012*n - 0.1*n;
+    ys[i] = (rand()%1000)*0.0012*n - 0.1*n;
+  }
+  found = flt_query_height(&of, xs.data(), ys.data(), npts, zs.data(), normals.data());
+
+  for (i=0;i<npts;++i)
+  {
+    best = -DBL_MAX;
+    for (j=0;j<flt_index_count(&of)/3;++j)
+    {
+      for (k=0;k<3;++k) test_index_pos(&of, pflags, j*3+k, v[k]);
+      det = (v[1][0]-v[0][0])*(v[2][1]-v[0][1]) - (v[1][1]-v[0][1])*(v[2][0]-v[0][0]);
+      l1 = ((xs[i]-v[0][0])*(v[2][1]-v[0][1]) - (ys[i]-v[0][1])*(v[2][0]-v[0][0]))/det;
+      l2 = ((v[1][0]-v[0][0])*(ys[i]-v[0][1]) - (v[1][1]-v[0][1])*(xs[i]-v[0][0]))/det;
+      if ( l1 < -1e-9 || l2 < -1e-9 || l1+l2 > 1+1e-9 ) continue;
+      best = flt_max(best, v[0][2] + l1*(v[1][2]-v[0][2]) + l2*(v[2][2]-v[0][2]));
+    }
+    if ( best == -DBL_MAX )
+    {
+      TEST_CHECK( zs[i] == -DBL_MAX );
+      continue;
+    }
+    ++bfound;
+    TEST_CHECK( fabs(zs[i]-best) < 1e-3 );
+    TEST_CHECK( normals[i*3+2] > 0.0f );
+  }
+  TEST_CHECK( found == bfound && found > 0 && found < npts );
+  flt_release(&of);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Records cut short by the end of the input (or shorter than their fields) are read as zeros
+////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_short_records()
+{
+  const fltu16 ops[]={ FLT_OP_GROUP, FLT_OP_OBJECT, FLT_OP_FACE, FLT_OP_LOD, FLT_OP_MESH, FLT_OP_EXTREF,
+    FLT_OP_SWITCH, FLT_OP_PAL_TEXTURE, FLT_OP_PAL_VERTEX, FLT_OP_VERTEX_LIST, FLT_OP_LONGID };
+  const fltu32 pflags = FLT_OPT_PAL_ALL|FLT_OPT_PAL_VTX_POSITION;
+  fltu32 i, extra, claimed;
+  flt of;
+
+  for (i=0;i<sizeof(ops)/sizeof(ops[0]);++i)
+  {
+    for (extra=0;extra<=8;extra+=4)
+    {
+      for (claimed=0;claimed<2;++claimed)
+      {
+        // the last record has extra bytes of contents, claiming it has more or not
+        fltWriter w;
+        w.header();
+        w.push();
+        w.op(ops[i], 4+extra+(claimed?64:0));
+        w.name("n", extra);
+        int err = test_load(w,&of,pflags);
+        TEST_CHECK( err==FLT_OK || err==FLT_ERR_OPREAD || err==FLT_ERR_READBEYOND_REC );
+        flt_release(&of);
+      }
+    }
+  }
+
+  // a face record of 12 bytes: its name, and the rest of fields zero
+  {
+    const fltu32 tri[3]={0,1,2};
+    fltWriter w;
+    w.header();
+    w.vtxpal(3);
+    for (i=0;i<3;++i) w.vtx68(i, i*i, 1.0);
+    w.push(); w.group("g1"); w.push();
+    w.op(FLT_OP_FACE,12); w.name("short",8);
+    w.push(); w.vlist(tri,3); w.pop();
+    w.pop(); w.pop();
+    TEST_CHECK( test_load(w,&of,pflags) == FLT_OK );
+    TEST_CHECK( flt_index_count(&of) == 3 );
+    TEST_CHECK( of.faces && of.faces->count == 1 );
+    if ( of.faces && of.faces->count )
+      TEST_CHECK( of.faces->faces[0].abgr == 0 && of.faces->faces[0].texbase_pat == 0 );
+    flt_release(&of);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  test_continuation();
+  test_weld();
+  test_bvh();
+  test_terrain();
+  test_short_records();
+  printf("%s: %d failed\n", argc>0?argv[0]:"tests", g_failed);
+  return g_failed;
+}
@@ -244,6 +244,7 @@ struct ElevationConfig
     culling=CULLING_CCW;
     depth=8;
     recurseDir=false;
+    finestLod=false;
   }
   bool validate();
   bool parseCLI(int argc, const char** argv, std::vector<std::string>& outFiles);
@@ -252,6 +253,7 @@ struct ElevationConfig
   std::string basepath;   // (mosaic mode) base path where to save the single mosaic heightfield
   std::string wildcard;   // optional wildcard to gather flt files
   bool recurseDir;        // recurse directories when using wildcards
+  bool finestLod;         // only the finest LOD of every set of sibling LODs is loaded, the others skipped
   bool mosaicMode;        // true to activate single heightmap mosaic
   int forceDim[2];        // width/height of heightmap image or -1 if use flt files extent
   eHFFormat format;       // format for heightfield
@@ -307,14 +309,11 @@ public:
   static std::atomic_int g_numtrisbf; // number of triangles culled
 
 private:
-    // Compute extent of geometry under node
-  static void computeNodeExtent(flt* of, FltExtent* xtent, flt_node* node);
-
-    // Compute extent of whole flt if node==null. (more optimal version)
+    // Extent of geometry under node (bounds of the load), of the whole flt if node==null
   static void computeExtent(flt* of, FltExtent* xtent, flt_node* node);
 
     // Look for the lod given the name and the type.
-  static bool findSpecificNode(flt_node* node, const std::string& lodname, int nodetype, flt_node** outNode);
+  static bool findSpecificNode(flt* of, const std::string& lodname, int nodetype, flt_node** outNode);
 
     // Helper to log a message and return specific error
   template<typename T> static T retErr(T res, const char* format, ...);
@@ -349,7 +348,7 @@ public:
 
   bool fill(flt_node* node);
 private:
-  void fillNodeTris(flt_node* node);
+  void fillNodeTris(fltu32 node);
   void fillTri(double* v0, double* v1, double* v2);
   void fillTriStep(double t);
   void fillMapPoint(double* xyz);
@@ -557,67 +556,19 @@ T Helper::retErr(T res, const char* format, ...)
   return res;
 }
 
-void Helper::computeNodeExtent(flt* of, FltExtent* xtent, flt_node* node)
-{
-  if ( !node ) return;
-  if ( node->ndx_pairs_count )
-  {
-    // for all batches
-    fltu32 start,end;
-    double *v;
-    fltu32 hashe,index;
-    double* vtxarray=(double*)of->pal->vtx_array; // 3 consecutive xyz doubles (see opts when loading flt)
-    for (fltu32 i=0;i<node->ndx_pairs_count;++i)
-    {
-      // get the batch start/end vertices
-      FLTGET32(node->ndx_pairs[i],start,end);
-      // for all this batch indices, compute extent
-      for (fltu32 j=start;j<end; ++j)
-      {
-        FLTGET32(of->indices->data[j],hashe,index);
-        v = vtxarray + (index*3);
-        for (int k=0;k<3;++k)
-        {
-          if ( v[k]<xtent->extent_min[k] ) xtent->extent_min[k] = v[k];
-          if ( v[k]>xtent->extent_max[k] ) xtent->extent_max[k] = v[k];
-        }
-      }
-    }
-  }
-
-  flt_node* child = node->child_head;
-  while (child)
-  {
-    computeNodeExtent(of,xtent,child);
-    child = child->next;
-  }
-}
-
 void Helper::computeExtent(flt* of, FltExtent* xtent, flt_node* node)
 {
   xtent->invalidate();
-  // compute extent
-  if ( of->pal && of->pal->vtx_array && of->pal->vtx_count)
+  if ( !node && of->hie ) 
+    node = of->hie->node_root;
+  if ( !node || !node->bounds ) 
+    return;
+  
+  // computed while loading (see opts)
+  for (int k=0;k<3;++k)
   {
-    if ( !node )
-    {
-      // we assume 3 doubles consecutive (see opts)
-      double* xyz=(double*)of->pal->vtx_array;
-      xtent->invalidate();
-      int j;
-      for ( size_t i = 0; i < of->pal->vtx_count; ++i, xyz+=3 )
-      {
-        for (j=0;j<3;++j)
-        {
-          if ( xyz[j]<xtent->extent_min[j] ) xtent->extent_min[j] = xyz[j];
-          if ( xyz[j]>xtent->extent_max[j] ) xtent->extent_max[j] = xyz[j];
-        }
-      }
-    }
-    else 
-    {
-      computeNodeExtent(of, xtent, node);
-    }
+    xtent->extent_min[k] = node->bounds->min[k];
+    xtent->extent_max[k] = node->bounds->max[k];
   }
 }
 
@@ -626,7 +577,8 @@ bool Helper::loadFlt(const std::string& fltfile, const ElevationConfig& config,
   // load
   flt_opts opts = {0};
   opts.pflags = FLT_OPT_PAL_VERTEX | FLT_OPT_PAL_VTX_POSITION;
-  opts.hflags = FLT_OPT_HIE_ALL_NODES;
+  opts.hflags = FLT_OPT_HIE_ALL_NODES | (config.finestLod ? FLT_OPT_HIE_LOD_FINEST : 0);
+  opts.lflags = FLT_OPT_LOAD_INDEX_STREAMS | FLT_OPT_LOAD_BOUNDS; // only vertex no read, face ids kept once per triangle. extents while loading
   opts.dfaces_size = 1543;
   *outOf = (flt*)calloc(1,sizeof(flt));
   if ( !*outOf ) 
@@ -643,7 +595,7 @@ bool Helper::loadFlt(const std::string& fltfile, const ElevationConfig& config,
   // look for specific node if user passed non-empty parameter
   *outNode = (*outOf)->hie->node_root;
   if ( !config.nodename.empty() )
-    findSpecificNode( (*outOf)->hie->node_root, config.nodename, config.nodetype, outNode);
+    findSpecificNode( *outOf, config.nodename, config.nodetype, outNode);
 
   if ( !(*outNode) )
     return retErr( false, "Invalid node to look geometry. %s\n", fltfile.c_str() );
@@ -744,21 +696,18 @@ bool Helper::saveImage(const ElevationConfig& config, const HeightField& img, co
   return res;
 }
 
-bool Helper::findSpecificNode(flt_node* node, const std::string& lodname, int nodetype, flt_node** outNode)
+bool Helper::findSpecificNode(flt* of, const std::string& lodname, int nodetype, flt_node** outNode)
 {
-  if ( !node ) return false;
-  if ( (nodetype==-1 || nodetype == flt_get_op_from_node_type(node->type)) && lodname == node->name )
+  // nodes with the same name chained in preorder, first one of the type wins
+  if ( flt_flat_build(of) != FLT_OK ) return false;
+  const flt_flat* fl=of->flat;
+  for ( fltu32 i=flt_flat_find(fl,lodname.c_str()); i!=FLT_FLAT_NONE; i=fl->name_next[i] )
   {
-    *outNode = node;
-    return true;
-  }
-
-  flt_node* child=node->child_head;
-  while ( child )
-  {
-    if ( findSpecificNode(child,lodname,nodetype,outNode) )
+    if ( nodetype==-1 || nodetype == flt_get_op_from_node_type(fl->type[i]) )
+    {
+      *outNode = fl->node[i];
       return true;
-    child = child->next;
+    }
   }
   return false;
 }
@@ -822,8 +771,20 @@ void Helper::gatherFilesFromWildcard(const std::string& wildcard, bool recurse,
 bool FltFillCpu::fill(flt_node* node)
 {
   if ( !node ) return false;
-  fillNodeTris(node);
-  return true;
+  flt* of = tinfo.of;
+  if ( !of->flat && flt_flat_build(of) != FLT_OK ) return false;
+
+  // the subtree is a range in preorder
+  const flt_flat* fl=of->flat;
+  for ( fltu32 i=0; i<fl->node_count; ++i )
+  {
+    if ( fl->node[i] == node )
+    {
+      fillNodeTris(i);
+      return true;
+    }
+  }
+  return false;
 }
 
 double FltFillCpu::fillComputeStep(double* v0, double *v1, double* v2)
@@ -948,38 +909,39 @@ void FltFillCpu::fillTriStep(double t)
   fillTriStep(1.0);
 }
 
-void FltFillCpu::fillNodeTris(flt_node* node)
+void FltFillCpu::fillNodeTris(fltu32 node)
 {
-  if ( !node ) return;
   flt* of = tinfo.of;
+  const flt_flat* fl=of->flat;
 
-  // if we got triangles here in this node
-  if ( node->ndx_pairs_count )
+  // the ndx_pairs of the node and all its children are contiguous in the flat hierarchy
+  const fltu32 pfirst=fl->pair_first[node], pend=fl->pair_first[node+fl->size[node]];
+  if ( pfirst < pend )
   {
     // for all batches
     fltu32 start,end;
     double *v0, *v1, *v2;
     double* vtxarray=(double*)of->pal->vtx_array; // 3 consecutive xyz doubles (see opts when loading flt)
-    fltu32 hashe, index;
+    fltu32 index;
     double cross;
     bool doFill;
-    for (fltu32 i=0;i<node->ndx_pairs_count;++i)
+    for (fltu32 i=pfirst;i<pend;++i)
     {
       // get the batch start/end vertices
-      FLTGET32(node->ndx_pairs[i],start,end);
+      FLTGET32(fl->pairs[i],start,end);
 
       // every tree vertices is a triangle, indices to vertices in of->pal->vtx_array
       for (fltu32 j=start;j<end; j+=3)
       {
-        FLTGET32(of->indices->data[j],hashe,index);
+        index = flt_index_vertex(of,j);
         v0 = vtxarray + (index*3);
 
         if ( (j+1)>end ) break;
-        FLTGET32(of->indices->data[j+1],hashe,index);
+        index = flt_index_vertex(of,j+1);
         v1 = vtxarray + (index*3);
 
         if ( (j+2)>end ) break;
-        FLTGET32(of->indices->data[j+2],hashe,index);
+        index = flt_index_vertex(of,j+2);
         v2 = vtxarray + (index*3);
         
         // fill this triangle
@@ -1002,13 +964,6 @@ void FltFillCpu::fillNodeTris(flt_node* node)
       }
     }
   }
-
-  flt_node* child = node->child_head;
-  while ( child )
-  {
-    fillNodeTris(child);
-    child = child->next;
-  }
 }
 
 #pragma endregion
@@ -1109,6 +1064,7 @@ int printUsage( const char* exec )
   printf("\t -d <w> <h>   : Optional. Force resolution for the final image, w=width, h=height. 0 for aspect-ratio\n" );    
   printf("\t -w <wildcard>: Wildcard for files, i.e. flight*.flt\n" );
   printf("\t -r           : Recurse directories for wildcard. Default=false\n" );
+  printf("\t -l           : Only the finest LOD of every tile, coarser LODs not loaded. Default=false\n" );
   printf("\t -c <culling> : 0:none 1:cw 2:ccw. Default=2\n");
   printf("\t -m           : Enable Mosaic mode. All in one image. Default=disabled\n" );
   printf("\t -g           : Enable GPU acceleration. Default=disabled\n" ); // will be removed and will use GPU acceleration where available by default
@@ -1173,6 +1129,7 @@ bool ElevationConfig::parseCLI(int argc, const char** argv, std::vector<std::str
       case 'z': if (i+1<argc) depth=atoi(argv[++i]); break;
       case 'm': mosaicMode=true; break;
       case 'r': recurseDir=true; break;
+      case 'l': finestLod=true; break;
       case 'd': 
         if (i+1<argc) forceDim[0]=atoi(argv[++i]); 
         if (i+1<argc) forceDim[1]=atoi(argv[++i]); 
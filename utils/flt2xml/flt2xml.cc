@@ -205,120 +205,145 @@ double fltGetTime()
 #endif
 }
 
-void fltCountNode(flt_node* n, fltu32* tris,bool siblings)
+// ndx_pairs of node i of the flat hierarchy
+void fltFlatPairs(const flt_flat* fl, fltu32 i, const fltu64** pairs, fltu32* count)
 {
-  if ( !n ) return;
-  
-  while (n)
+#ifdef FLT_UNIQUE_FACES
+  *pairs = fl->pairs+fl->pair_first[i];
+  *count = fl->pair_first[i+1]-fl->pair_first[i];
+#else
+  *pairs = FLT_NULL;
+  *count = 0;
+#endif
+}
+
+// Triangles of every node: its own ndx_pairs if it has any, otherwise the ones of its children.
+// Reverse preorder visits the children before their parent
+void fltCountFlat(const flt_flat* fl, std::vector<fltu32>& tris)
+{
+  tris.assign(fl->node_count,0);
+  for ( fltu32 i=fl->node_count; i-- > 0; )
   {
-    if ( n->ndx_pairs_count )
+    const fltu64* pairs;
+    fltu32 count, start, end;
+    fltFlatPairs(fl,i,&pairs,&count);
+    if ( count )
     {
-      fltu32 start,end;
-      for (fltu32 i=0;i<n->ndx_pairs_count;++i)
+      tris[i]=0;
+      for (fltu32 p=0;p<count;++p)
       {
-        FLTGET32(n->ndx_pairs[i],start,end);
-        *tris += (end-start+1)/3;
+        FLTGET32(pairs[p],start,end);
+        tris[i] += (end-start+1)/3;
       }
     }
-    else
-    {
-      fltCountNode(n->child_head,tris,true);
-    }
-    n = siblings ? n->next : nullptr;
+    if ( fl->parent[i] != FLT_FLAT_NONE )
+      tris[fl->parent[i]] += tris[i];
   }
 }
 
-void fltCountOf(flt* of, fltu32* tris)
-{
-  if ( !of || !of->hie ) return;
-
-  fltCountNode(of->hie->node_root,tris,true);  
-}
-
 void fltXmlIndent(int d){ for ( int i = 0; i < d; ++i ) printf( "  " ); }
-void fltXmlNodePrint(flt_node* n, fltThreadPool* tp, int d, bool allInfo)
+void fltXmlFlatPrint(const flt_flat* fl, const std::vector<fltu32>& tris, fltThreadPool* tp, int d, bool allInfo)
 {
   static const char* names[FLT_NODE_MAX]={"none", "root", "xref", "group", "object", "mesh", "lod", "face", "vlist", "switch"};
   static char tmp[512];
-  if ( !n ) return;
+  std::vector<fltu32> open; // nodes with children, closing tag pending
 
-  // my siblings and children
-  do
+  // preorder: the subtree of node j is j..j+size[j]-1
+  for ( fltu32 i=0; i<=fl->node_count; ++i )
   {
+    while ( !open.empty() && i >= open.back()+fl->size[open.back()] )
+    {
+      fltXmlIndent(d+(int)open.size()-1); printf( "</%s>\n", names[fl->type[open.back()]]);
+      open.pop_back();
+    }
+    if ( i==fl->node_count ) break;
+
+    const int nd=d+(int)open.size();
     *tmp = 0;
-    if ( n->name && *n->name ) 
-      sprintf_s(tmp," name=\"%s\"",n->name);
+    if ( fl->name[i] && *fl->name[i] ) 
+      sprintf_s(tmp," name=\"%s\"",fl->name[i]);
     
     bool hasAttrChildren=false;
-    switch(n->type)
+    switch(fl->type[i])
     {
     case FLT_NODE_LOD:
       {
-      flt_node_lod* lod = (flt_node_lod*)n;
+      const flt_node_lod* lod = fl->lods+fl->data[i];
       sprintf_s(tmp, "%s s_in_out=\"%g %g\" center=\"%g %g %g\" trange=\"%g\" ssize=\"%g\" flags=\"0x%08x\"", tmp, lod->switch_in, lod->switch_out,
         lod->cnt_coords[0],lod->cnt_coords[1],lod->cnt_coords[2], lod->trans_range, lod->sig_size, lod->flags );
       }break;
     case FLT_NODE_SWITCH:
       {
-        flt_node_switch* swi=(flt_node_switch*)n;
+        const flt_node_switch* swi=fl->switches+fl->data[i];
         sprintf_s(tmp, "%s curmask=\"%d\" maskcount=\"%d\" wpm=\"%d\"", tmp, swi->cur_mask, swi->mask_count, swi->wpm);
         hasAttrChildren=true;
       }break;
+    case FLT_NODE_MESH:
+      {
+        const flt_node_mesh* mesh=fl->meshes+fl->data[i];
+        sprintf_s(tmp, "%s vertices=\"%d\" prims=\"%d\"", tmp, mesh->vb ? mesh->vb->count : 0, mesh->prim_count);
+        hasAttrChildren=mesh->prim_count!=0;
+      }break;
     }
     
-    fltu32 tris=0;
-    fltCountNode(n,&tris,false);
-    if ( tris ) 
+    if ( tris[i] ) 
     {
-      sprintf_s( tmp, "%s tris=\"%d\"", tmp, tris);
+      sprintf_s( tmp, "%s tris=\"%d\"", tmp, tris[i]);
       hasAttrChildren = true;      
     }
 
     // if no specific attributes or not children, just print tag and close
-    if ( !hasAttrChildren && !n->child_count )
+    if ( !hasAttrChildren && fl->size[i]==1 )
     {
-      fltXmlIndent(d); printf( "<%s%s/>\n", names[n->type], tmp);
+      fltXmlIndent(nd); printf( "<%s%s/>\n", names[fl->type[i]], tmp);
+      continue;
     }
-    else
+
+    fltXmlIndent(nd); printf( "<%s%s>\n", names[fl->type[i]], tmp);
+    // specific attributes
+    const fltu64* pairs;
+    fltu32 count, start, end;
+    fltFlatPairs(fl,i,&pairs,&count);
+    for (fltu32 p=0;p<count;++p)
+    {
+      FLTGET32(pairs[p],start,end);
+      fltXmlIndent(nd+1); printf( "<batch ndx_start=\"%d\" ndx_end=\"%d\" />\n", start,end );
+    }
+
+    if ( fl->type[i] == FLT_NODE_SWITCH )
     {
-      fltXmlIndent(d); printf( "<%s%s>\n", names[n->type], tmp);
-      // specific attributes
-      if ( n->ndx_pairs_count )
+      const flt_node_switch* swi=fl->switches+fl->data[i];
+      if ( swi->mask_count && swi->maskwords )
       {
-        fltu32 start,end;     
-        for (fltu32 i=0;i<n->ndx_pairs_count;++i)
-        {
-          FLTGET32(n->ndx_pairs[i],start,end);
-          fltXmlIndent(d+1); printf( "<batch ndx_start=\"%d\" ndx_end=\"%d\" />\n", start,end );
-        }
+        fltXmlIndent(nd+1); printf( "<wordmasks>" );           
+        int end = swi->mask_count*swi->wpm;
+        for ( int w = 0; w < end; ++w ) printf( "0x%08x ", swi->maskwords[w]);
+        printf( "</wordmasks>\n" );
       }
+    }
 
-      if ( n->type == FLT_NODE_SWITCH )
+    if ( fl->type[i] == FLT_NODE_MESH )
+    {
+      const flt_node_mesh* mesh=fl->meshes+fl->data[i];
+      for ( fltu32 p=0; p<mesh->prim_count; ++p )
       {
-        flt_node_switch* swi=(flt_node_switch*)n;
-        if ( swi->mask_count && swi->maskwords )
-        {
-          fltXmlIndent(d+1); printf( "<wordmasks>" );           
-          int end = swi->mask_count*swi->wpm;
-          for ( int i = 0; i < end; ++i ) printf( "0x%08x ", swi->maskwords[i]);
-          printf( "</wordmasks>\n" );
-        }
+        fltXmlIndent(nd+1); printf( "<prim type=\"%d\" ndx_start=\"%d\" count=\"%d\" />\n", mesh->prims[p].type, mesh->prims[p].start, mesh->prims[p].count );
       }
-      
-      // children nodes
-      if ( n->child_count)
-        fltXmlNodePrint(n->child_head, tp, d+1, allInfo);
-
-      // closing node tag
-      fltXmlIndent(d); printf( "</%s>\n", names[n->type]);
     }
-    n = n->next;
-  }while(n);
+    
+    // children nodes follow, closing tag after them
+    if ( fl->size[i] > 1 )
+      open.push_back(i);
+    else
+    {
+      fltXmlIndent(nd); printf( "</%s>\n", names[fl->type[i]]);
+    }
+  }
 }
 
-void fltXmlPrintFace(int d, fltu32 facehash, flt_face* face)
+void fltXmlPrintFace(int d, fltu32 faceid, fltu64 facehash, flt_face* face)
 {
-  fltXmlIndent(d); printf( "<face hash=\"0x%08x\">\n", facehash );
+  fltXmlIndent(d); printf( "<face id=\"%u\" hash=\"0x%016llx\">\n", faceid, facehash );
   {
     fltXmlIndent(d+1); printf( "<tex_base>%d</tex_base>\n", face->texbase_pat);
     fltXmlIndent(d+1); printf( "<tex_detail>%d</tex_detail>\n", face->texdetail_pat);
@@ -367,6 +392,11 @@ void fltXmlOfPrint(flt* of, int d, std::set<uint64_t>& done, int* tot_nodes, flt
   
   fltXmlIndent(d); printf( "<file name=\"%s\">\n", of->filename);
 
+  // flat hierarchy, the nodes are scanned in preorder
+  const flt_flat* flat = of->hie && of->hie->node_count && flt_flat_build(of)==FLT_OK ? of->flat : FLT_NULL;
+  std::vector<fltu32> fltris;
+  if ( flat ) fltCountFlat(flat,fltris);
+
   // counters
   fltXmlIndent(d+1); printf( "<counters>\n");
   {
@@ -379,8 +409,7 @@ void fltXmlOfPrint(flt* of, int d, std::set<uint64_t>& done, int* tot_nodes, flt
 
     if ( of->pal )
     {
-      fltu32 tris=0;
-      fltCountOf(of,&tris);
+      fltu32 tris=flat ? fltris[0] : 0;
       if (of->pal->vtx_count) { fltXmlIndent(d + 2); printf("<vertices>%d</vertices>\n", of->pal->vtx_count); }
       if ( tris ){ fltXmlIndent(d+2); printf( "<triangles>%d</triangles>\n", tris); }
       if ( of->pal->tex_count ){ fltXmlIndent(d+2); printf( "<textures>%d</textures>\n", of->pal->tex_count); }      
@@ -424,7 +453,7 @@ void fltXmlOfPrint(flt* of, int d, std::set<uint64_t>& done, int* tot_nodes, flt
   if ( of->hie )
   {
     // hierarchy
-    fltXmlNodePrint(of->hie->node_root, tp, d+1,allInfo);
+    if ( flat ) fltXmlFlatPrint(flat, fltris, tp, d+1, allInfo);
 
     // flat list of extrefs
     if ( of->hie->extref_count)
@@ -539,58 +568,46 @@ void fltXmlOfPrint(flt* of, int d, std::set<uint64_t>& done, int* tot_nodes, flt
       }
 
       // indices
-      if ( of->indices && of->indices->size )
+      const fltu32 nindices=flt_index_count(of);
+      if ( nindices )
       {
-        fltXmlIndent(d+1); printf( "<indices count=\"%d\">\n", of->indices->size);
+        fltXmlIndent(d+1); printf( "<indices count=\"%d\">\n", nindices);
         fltXmlIndent(d+2); printf( "<values>\n");
-        fltu32 hashe,indexvalue;
-        for ( fltu32 i=0;i<of->indices->size;++i)
-        {
-          FLTGET32(of->indices->data[i],hashe,indexvalue);
-          printf( "%d ",indexvalue);
-        }
+        fltu32 faceid;
+        for ( fltu32 i=0;i<nindices;++i)
+          printf( "%d ",flt_index_vertex(of,i));
         printf("\n");
         fltXmlIndent(d+2); printf( "</values>\n");
 
-        fltXmlIndent(d+2); printf( "<facehashes>\n");
+        fltXmlIndent(d+2); printf( "<faceids>\n");
 
-        FLTGET32(of->indices->data[0],hashe,indexvalue);
-        fltu32 lasthashe=hashe;
+        fltu32 lastfaceid=flt_index_face(of,0);
         fltu32 i=1,lasti=0;
-        do
+        while (i<nindices)
         {
-          FLTGET32(of->indices->data[i],hashe,indexvalue);
-          if ( hashe != lasthashe )
+          faceid=flt_index_face(of,i);
+          if ( faceid != lastfaceid )
           {
-            flt_dict_gethe(of->ctx->dictfaces,hashe,&indexvalue);
-            fltXmlIndent(d+3); printf( "<facehash count=\"%d\" hash=\"0x%08x\" />\n", i-lasti, indexvalue);
-            lasthashe=hashe;
+            fltXmlIndent(d+3); printf( "<faceid count=\"%d\" id=\"%u\" />\n", i-lasti, lastfaceid);
+            lastfaceid=faceid;
             lasti=i;
           }
           ++i;
-        }while (i<of->indices->size);
+        }
 
         // last element (or unique)
-        flt_dict_gethe(of->ctx->dictfaces,hashe,&indexvalue);
-        fltXmlIndent(d+3); printf( "<facehash count=\"%d\" hash=\"0x%08x\" />\n", i-lasti, indexvalue);
+        fltXmlIndent(d+3); printf( "<faceid count=\"%d\" id=\"%u\" />\n", i-lasti, lastfaceid);
 
-        fltXmlIndent(d+2); printf( "</facehashes>\n");
+        fltXmlIndent(d+2); printf( "</faceids>\n");
         fltXmlIndent(d+1); printf( "</indices>\n");
       }
 
       // faces
-      if ( of->ctx->dictfaces )
+      if ( of->faces )
       {
-        fltXmlIndent(d+1); printf( "<faces>\n" );
-        for ( int i = 0; i < of->ctx->dictfaces->capacity; ++i )
-        {
-          flt_dict_node* dn = of->ctx->dictfaces->hasht[i];          
-          while (dn)
-          {
-            fltXmlPrintFace(d+2, dn->keyhash, (flt_face*)dn->value);
-            dn = dn->next;
-          }
-        }
+        fltXmlIndent(d+1); printf( "<faces count=\"%u\">\n", of->faces->count );
+        for ( fltu32 i = 0; i < of->faces->count; ++i )
+          fltXmlPrintFace(d+2, i, of->faces->hashes[i], of->faces->faces+i);
         fltXmlIndent(d+1); printf( "</faces>\n" );
       }
     }
@@ -609,21 +626,24 @@ void fltXmlPrint(flt* of, flt_opts* opts, int nfiles, double tim, fltThreadPool*
   fltXmlIndent(1); printf("<stats>\n");
   fltXmlIndent(2); printf("<loadtime>%.4g</loadtime>\n",tim);
   fltXmlIndent(2); printf("<files>%d</files>\n", nfiles);
-  fltXmlIndent(2); printf("<faces>%d</faces>\n", TOTALNFACES);
-  fltXmlIndent(2); printf("<unique_faces>%d</unique_faces>\n", TOTALUNIQUEFACES);
-  fltXmlIndent(2); printf("<indices>%d</indices>\n", TOTALINDICES);
-  if ( opts->countable )
+  flt_stats* stats=(flt_stats*)flt_calloc(1,sizeof(flt_stats));
+  flt_stats_total(of, stats);
+  fltXmlIndent(2); printf("<faces>%u</faces>\n", stats->faces);
+  fltXmlIndent(2); printf("<unique_faces>%u</unique_faces>\n", stats->unique_faces);
+  fltXmlIndent(2); printf("<indices>%I64u</indices>\n", stats->indices);
+  fltXmlIndent(2); printf("<vertices>%I64u</vertices>\n", stats->vertices);
+  fltXmlIndent(2); printf("<parsetime>%.4g</parsetime>\n", stats->load_time);
+  fltXmlIndent(2); printf("<opcodes>\n");
+  for ( int i = 0; i < FLT_OP_MAX; ++i )
   {
-    fltXmlIndent(2); printf("<opcodes>\n");
-    for ( int i = 0; i < FLT_OP_MAX; ++i )
+    if ( stats->rec_count[i] )
     {
-      if ( opts->countable[i] )
-      {
-        fltXmlIndent(3); printf( "<op_%03d name=\"%s\" count=\"%d\" />\n", i, flt_get_op_name((fltu16)i), opts->countable[i], i);
-      }
+      fltXmlIndent(3); printf( "<op_%03d name=\"%s\" count=\"%u\" bytes=\"%I64u\" time=\"%.4g\" />\n", i, flt_get_op_name((fltu16)i), 
+        stats->rec_count[i], stats->rec_bytes[i], stats->rec_time[i]);
     }
-    fltXmlIndent(2); printf("</opcodes>\n");
   }
+  fltXmlIndent(2); printf("</opcodes>\n");
+  flt_free(stats);
   fltXmlIndent(1); printf("</stats>\n");
 
   fltXmlOfPrint(of,1,done,&counterctx, tp, allInfo);
@@ -688,7 +708,7 @@ void read_with_callbacks_mt(const std::vector<std::string>& files, bool inspectT
   opts->cb_texture = fltCallbackTexture;
   opts->cb_extref = recurse ? fltCallbackExtRef : FLT_NULL;
   opts->cb_user_data = &tp;
-  opts->countable = (fltatom32*)flt_calloc(1, sizeof(fltatom32)*FLT_OP_MAX);
+  opts->lflags = FLT_OPT_LOAD_STATS; // counters of every file, summed when printed
 
   // master file task
   tp.nfiles=1;
@@ -708,7 +728,6 @@ void read_with_callbacks_mt(const std::vector<std::string>& files, bool inspectT
   // releasing memory
   flt_release(of);
   flt_safefree(of);
-  flt_safefree(opts->countable);
   flt_safefree(opts);
 
   tp.deinit();
@@ -180,23 +180,12 @@ void fltThreadTask::runTask(fltThreadPool* tp)
   {
   case TASK_FLT    : 
     flt_load_from_filename(filename.c_str(), of, opts); 
-    if ( of->pal && of->pal->vtx_array && of->pal->vtx_count)
+    if ( of->pal && of->pal->vtx_array && of->pal->vtx_count && of->hie && of->hie->node_root && of->hie->node_root->bounds )
     {
-      // we assume 3 doubles consecutive (see opts)
-      double* xyz=(double*)of->pal->vtx_array;
-      double exmin[3]={DBL_MAX, DBL_MAX, DBL_MAX};
-      double exmax[3]={-DBL_MAX, -DBL_MAX, -DBL_MAX};
-      int j;
-      for ( size_t i = 0; i < of->pal->vtx_count; ++i, xyz+=3 )
-      {
-        for (j=0;j<3;++j)
-        {
-          if ( xyz[j]<exmin[j] ) exmin[j] = xyz[j];
-          if ( xyz[j]>exmax[j] ) exmax[j] = xyz[j];
-        }
-      }
+      // bounds of the root, the geometry of the whole file
+      flt_bounds* b=of->hie->node_root->bounds;
       char* basefile = flt_path_basefile(filename.c_str());
-      tp->incExtent(basefile, exmin,exmax, of->pal->vtx_count);
+      tp->incExtent(basefile, b->min, b->max, of->pal->vtx_count);
       flt_safefree(basefile);
       //flt_release(of); // releasing a node ref not working yet
       flt_safefree(of->pal->vtx_array);      
@@ -254,6 +243,7 @@ void read_with_callbacks_mt(const std::vector<std::string>& files, bool recurse,
   flt* of=(flt*)flt_calloc(1,sizeof(flt));
   opts->pflags = FLT_OPT_PAL_TEXTURE | FLT_OPT_PAL_VERTEX | FLT_OPT_PAL_VTX_POSITION;
   opts->hflags = FLT_OPT_HIE_ALL_NODES | FLT_OPT_HIE_HEADER;
+  opts->lflags = FLT_OPT_LOAD_BOUNDS; // extent computed while loading
   opts->dfaces_size = 3079;//1543;
   opts->cb_extref = recurse ? fltCallbackExtRef : FLT_NULL;
   opts->cb_user_data = &tp;
@@ -325,7 +315,6 @@ void read_with_callbacks_mt(const std::vector<std::string>& files, bool recurse,
   // releasing memory
   flt_release(of);
   flt_safefree(of);
-  flt_safefree(opts->countable);
   flt_safefree(opts);
   tp.deinit();
 }
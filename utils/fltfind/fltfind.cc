@@ -39,12 +39,10 @@ struct fltThreadTask
 
   std::string filename;
   std::string basename;
-  flt* of;
-  flt_opts* opts;
 
-  fltThreadTask():type(TASK_NONE), of(NULL), opts(NULL){}
-  fltThreadTask(fltTaskType tt, const std::string& f, flt* of=0, flt_opts* opts=0)
-    :type(tt), filename(f), of(of), opts(opts){}
+  fltThreadTask():type(TASK_NONE){}
+  fltThreadTask(fltTaskType tt, const std::string& f)
+    :type(tt), filename(f){}
 
   void runTask(fltThreadPool* tp);
 };
@@ -135,6 +133,30 @@ void fltThreadPool::deinit()
   tasks.clear();
 }
 
+// opcodes seen in a file while streaming its records
+struct fltFindRecords
+{
+  fltThreadPool* tp;
+  size_t found;
+  fltu32 countable[FLT_OP_MAX];
+};
+
+int fltFindRecord(const flt_record* rec, void* user_data)
+{
+  fltFindRecords* fr=(fltFindRecords*)user_data;
+  const std::vector<int>& opcodes=fr->tp->opcodes;
+  if ( rec->op >= FLT_OP_MAX || fr->countable[rec->op]++ ) 
+    return FLT_SAX_CONTINUE;
+
+  // first time this opcode is seen, stop if all we look for are found
+  for ( size_t i = 0; i < opcodes.size(); ++i )
+  {
+    if ( opcodes[i] == rec->op && ++fr->found == opcodes.size() )
+      return FLT_SAX_STOP;
+  }
+  return FLT_SAX_CONTINUE;
+}
+
 void fltThreadTask::runTask(fltThreadPool* tp)
 {
   tp=tp;
@@ -142,7 +164,12 @@ void fltThreadTask::runTask(fltThreadPool* tp)
   {
     case TASK_FLT: 
     {
-      flt_load_from_filename(filename.c_str(), of, opts); 
+      // only the records are streamed, no hierarchy built
+      fltFindRecords fr;
+      memset(&fr,0,sizeof(fr));
+      fr.tp = tp;
+      if ( flt_parse_from_filename(filename.c_str(), NULL, fltFindRecord, &fr) != FLT_OK )
+        break;
 
       // check the opcodes
       if ( tp->oper == O_AND )
@@ -150,7 +177,7 @@ void fltThreadTask::runTask(fltThreadPool* tp)
         bool allok=true;
         for ( size_t i = 0; i < tp->opcodes.size(); ++i )
         {
-          if ( opts->countable[tp->opcodes[i]] == 0 )
+          if ( fr.countable[tp->opcodes[i]] == 0 )
           {
             allok = false;
             break;
@@ -165,7 +192,7 @@ void fltThreadTask::runTask(fltThreadPool* tp)
         bool any=false;
         for ( size_t i = 0; i < tp->opcodes.size(); ++i )
         {
-          if ( opts->countable[tp->opcodes[i]] != 0 )
+          if ( fr.countable[tp->opcodes[i]] != 0 )
           {
             any=true;
             ops[i]=(fltu16)tp->opcodes[i];
@@ -184,14 +211,6 @@ void fltThreadTask::runTask(fltThreadPool* tp)
 
         flt_free(ops);
       }
-      // releasing memory
-      flt_release(of);
-      flt_safefree(of);
-      flt_safefree(opts->countable);
-      flt_safefree(opts);
-
-      
-
     }break;
   }
 }
@@ -253,7 +272,7 @@ int print_usage(const char* p)
 void addop(std::vector<int>& v, const char* ops)
 {
   int op = atoi(ops);
-  if ( op >= FLT_OP_HEADER && op <= FLT_OP_MAX)
+  if ( op >= FLT_OP_HEADER && op < FLT_OP_MAX)
     v.push_back(op);
 }
 
@@ -345,18 +364,10 @@ void fltExtractTasksFromRecursiveWildcard(fltThreadPool* tp, const std::string&
       {
         if ( fltExtensionIs(ffdata.cFileName, ".flt") )
         {
-          // configuring read options
-          flt_opts* opts=(flt_opts*)flt_calloc(1,sizeof(flt_opts));
-          flt* of=(flt*)flt_calloc(1,sizeof(flt));
-          opts->pflags = FLT_OPT_PAL_ALL;
-          opts->hflags = FLT_OPT_HIE_ALL_NODES | FLT_OPT_HIE_HEADER | FLT_OPT_HIE_GO_THROUGH;
-          opts->cb_user_data = &tp;
-          opts->countable = (fltatom32*)flt_calloc(1, sizeof(fltatom32)*FLT_OP_MAX);
-
           // add task for this file
           ++tp->nfiles;          
           sprintf_s( filterTxt, fltEndsWithSlash(path) ? "%s%s" : "%s\\%s", path.c_str(), ffdata.cFileName );
-          fltThreadTask task(fltThreadTask::TASK_FLT, filterTxt, of, opts);
+          fltThreadTask task(fltThreadTask::TASK_FLT, filterTxt);
           tp->addNewTask(task);  
         }
       }
@@ -252,7 +252,6 @@ void read_with_callbacks_mt(const std::vector<std::string>& files, bool recurse)
   // releasing memory
   flt_release(of);
   flt_safefree(of);
-  flt_safefree(opts->countable);
   flt_safefree(opts);
   tp.deinit();
 }
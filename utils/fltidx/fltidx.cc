@@ -0,0 +1,135 @@
+
+#pragma warning(disable:4100 4005)
+
+#if defined(_DEBUG) && !defined(_WIN64)
+#include <vld.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+//#define FLT_NO_OPNAMES
+//#define FLT_LEAN_FACES
+//#define FLT_ALIGNED
+//#define FLT_UNIQUE_FACES
+#define FLT_IMPLEMENTATION
+#include <flt.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+double fltGetTime();
+
+double fltGetTime()
+{
+#ifdef _MSC_VER
+  double f;
+  LARGE_INTEGER t, freq;
+  QueryPerformanceFrequency(&freq);
+  f=1000.0/(double)(freq.QuadPart);
+  QueryPerformanceCounter(&t);
+  return (double)(t.QuadPart)*f;
+#else
+  return 0.0;
+#endif
+}
+
+void print_index(const std::string& filename, const flt_recidx* idx)
+{
+  printf( "\n%s: %u entries, hierarchy at %I64u\n", filename.c_str(), idx->count, idx->hie );
+  for ( fltu32 i = 0; i < idx->count; ++i )
+  {
+    const flt_recidx_entry* e = idx->entries+i;
+    printf( "%*s%-16s %-24s offset:%I64u size:%I64u parent:%d\n", e->depth*2, "", flt_get_op_name(e->op), 
+      e->name!=FLT_RECIDX_NONE ? idx->names+e->name : "", e->offset, e->end-e->offset, (int)e->parent );
+  }
+}
+
+void load_subtree(const std::string& filename, const std::string& nodename)
+{
+  flt_opts* opts=(flt_opts*)flt_calloc(1,sizeof(flt_opts));
+  flt* of=(flt*)flt_calloc(1,sizeof(flt));
+  double t0=fltGetTime();
+  opts->pflags = FLT_OPT_PAL_ALL;
+  opts->hflags = FLT_OPT_HIE_ALL_NODES | FLT_OPT_HIE_HEADER;
+
+  int err = flt_load_subtree(filename.c_str(), nodename.c_str(), of, opts);
+  if ( err == FLT_OK )
+    printf( "%s: node %s loaded, %u nodes in %g secs\n", filename.c_str(), nodename.c_str(), of->hie ? of->hie->node_count : 0, (fltGetTime()-t0)/1000.0 );
+  else
+    printf( "%s: node %s not loaded (%s)\n", filename.c_str(), nodename.c_str(), flt_get_err_reason(err) );
+
+  flt_release(of);
+  flt_safefree(of);
+  flt_safefree(opts);
+}
+
+void build_indices(const std::vector<std::string>& files, bool print, const std::string& nodename)
+{
+  for ( size_t i = 0; i < files.size(); ++i )
+  {
+    const std::string indexfile = files[i]+FLT_RECIDX_EXT;
+    double t0=fltGetTime();
+    int err = flt_recidx_build(files[i].c_str(), indexfile.c_str(), NULL);
+    if ( err != FLT_OK )
+    {
+      printf( "%s: %s\n", files[i].c_str(), flt_get_err_reason(err) );
+      continue;
+    }
+    printf( "%s: %s written in %g secs\n", files[i].c_str(), indexfile.c_str(), (fltGetTime()-t0)/1000.0 );
+
+    if ( print )
+    {
+      flt_recidx* idx=FLT_NULL;
+      if ( flt_recidx_load(indexfile.c_str(), files[i].c_str(), &idx) == FLT_OK )
+        print_index(files[i], idx);
+      flt_recidx_free(&idx);
+    }
+
+    if ( !nodename.empty() )
+      load_subtree(files[i], nodename);
+  }
+}
+
+int main(int argc, const char** argv)
+{
+  bool print = false;
+  std::string nodename;
+  std::vector<std::string> files;
+  for ( int i = 1; i < argc; ++i )
+  {
+    if ( argv[i][0]=='-' )
+    {
+      switch ( argv[i][1] )
+      {
+        case 'p': print = true; break;
+        case 'n': if ( i+1<argc ) nodename = argv[++i]; break;
+        default : printf ( "Unknown option -%c\n", argv[i][1]); 
+      }
+    }
+    else
+      files.push_back( argv[i] );
+  }
+
+  if ( !files.empty() )
+  {
+    build_indices(files, print, nodename);
+  }
+  else
+  {
+    char* program=flt_path_basefile(argv[0]);
+    printf("%s: Builds the sidecar record index (%s) of FLT files for random access\n\n", program, FLT_RECIDX_EXT );    
+    printf("Usage: $ %s <options> <flt_files> \nOptions:\n", program );    
+    printf("\t -p        : Prints the entries of the index\n");
+    printf("\t -n name   : Loads the header, palettes and the subtree of the node with that name using the index\n");
+    printf("\nExamples:\n" );
+    printf("\tIndex of some tiles:\n" );
+    printf("\t  $ %s tile_0_0.flt tile_0_1.flt\n\n", program);    
+    printf("\tIndex of the master printed and loading only a LOD of it:\n" );
+    printf("\t  $ %s -p -n lod_far master.flt\n\n", program );
+    flt_free(program);
+  }
+  
+  return 0;
+}
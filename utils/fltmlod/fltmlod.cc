@@ -432,6 +432,7 @@ void fltThreadTask::compExtent(fltThreadPool* tp)
   flt_opts opts = {0};
   opts.pflags = FLT_OPT_PAL_VERTEX | FLT_OPT_PAL_VTX_POSITION;
   opts.hflags = FLT_OPT_HIE_ALL_NODES | FLT_OPT_HIE_HEADER;
+  opts.lflags = FLT_OPT_LOAD_BOUNDS; // extent computed while loading
   opts.dfaces_size = 1543;
   flt of = {0};
   
@@ -439,20 +440,15 @@ void fltThreadTask::compExtent(fltThreadPool* tp)
   std::string finalpath = tp->indir + fileForExtent;
   flt_load_from_filename(finalpath.c_str(), &of, &opts);
 
-  // compute extent
-  if ( of.pal && of.pal->vtx_array && of.pal->vtx_count)
+  // extent of the root
+  if ( of.hie && of.hie->node_root && of.hie->node_root->bounds )
   {
-    // we assume 3 doubles consecutive (see opts)
-    double* xyz=(double*)of.pal->vtx_array;
-    fltExtent xtent; xtent.invalidate();
-    int j;
-    for ( size_t i = 0; i < of.pal->vtx_count; ++i, xyz+=3 )
+    flt_bounds* b=of.hie->node_root->bounds;
+    fltExtent xtent;
+    for ( int j=0;j<3;++j )
     {
-      for (j=0;j<3;++j)
-      {
-        if ( xyz[j]<xtent.extent_min[j] ) xtent.extent_min[j] = xyz[j];
-        if ( xyz[j]>xtent.extent_max[j] ) xtent.extent_max[j] = xyz[j];
-      }
+      xtent.extent_min[j] = b->min[j];
+      xtent.extent_max[j] = b->max[j];
     }
 
     // add extent
@@ -29,122 +29,10 @@
 #include <thread>
 #include <vector>
 
-struct fltThreadPool;
-struct fltThreadPoolContext;
-struct fltThreadTask;
-
-// types
-struct fltThreadTask
-{
-  enum f2dTaskType { TASK_NONE=-1, TASK_FLT=0};
-  f2dTaskType type;
-
-  std::string filename;
-  flt* of;
-  flt_opts* opts;
-
-  fltThreadTask():type(TASK_NONE), of(NULL), opts(NULL){}
-  fltThreadTask(f2dTaskType tt, const std::string& f, flt* of, flt_opts* opts)
-    :type(tt), filename(f), of(of), opts(opts){}
-  
-  void runTask(fltThreadPool* tp);
-};
-
-
-struct fltThreadPool
-{
-  void init();
-  void runcode();
-  bool getNextTask(fltThreadTask* t);
-  void addNewTask(const fltThreadTask& task);
-  void deinit();
-  bool isWorking(){ return !tasks.empty() || workingTasks>0; }
-
-  std::vector<std::string> searchpaths;
-  std::vector<std::thread*> threads;
-  std::deque<fltThreadTask> tasks;
-  std::mutex mtxTasks;
-  std::mutex mtxFiles;
-  std::atomic_int workingTasks;
-  std::atomic_int nfiles;
-  int numThreads;
-  bool finish;
-};
-
 double fltGetTime();
 bool fltExtensionIsImg(const char* filename);
 bool fltExtensionIs(const char* filename, const char* ext);
 
-void fltThreadPool::init()
-{
-  deinit();
-  finish=false;
-  threads.reserve(numThreads);
-  workingTasks=0;
-  nfiles=0;
-  for(int i = 0; i < numThreads; ++i)
-    threads.push_back(new std::thread(&fltThreadPool::runcode,this));
-}
-
-void fltThreadPool::runcode()
-{
-  fltThreadTask task;
-  while (!finish)
-  {
-    if ( getNextTask(&task) )
-    {
-      ++workingTasks;
-      try
-      {
-        task.runTask(this);
-      }catch(...)
-      {
-        OutputDebugStringA("Exception\n");
-      }
-      --workingTasks;
-    }
-    else
-      std::this_thread::sleep_for(std::chrono::milliseconds(2));
-  }
-}
-
-bool fltThreadPool::getNextTask(fltThreadTask* t)
-{
-  std::lock_guard<std::mutex> lock(mtxTasks);
-  if ( tasks.empty() ) return false;
-  *t = tasks.back();
-  tasks.pop_back();
-  return true;
-}
-
-void fltThreadPool::addNewTask(const fltThreadTask& task)
-{
-  // not done yet, process
-  std::lock_guard<std::mutex> lock(mtxTasks);
-  tasks.push_front( task );
-}
-
-void fltThreadPool::deinit()
-{
-  finish = true;
-  for each (std::thread* t in threads)
-  {
-    t->join();
-    delete t;
-  }
-  threads.clear();
-  tasks.clear();
-}
-
-void fltThreadTask::runTask(fltThreadPool* tp)
-{
-  tp=tp;
-  switch( type )
-  {
-  case TASK_FLT: flt_load_from_filename(filename.c_str(), of, opts); break;
-  }
-}
-
 bool fltExtensionIs(const char* filename, const char* ext)
 {
   const size_t len1=strlen(filename);
@@ -180,22 +68,51 @@ double fltGetTime()
 
 
 //////////////////////////////////////////////////////////////////////////
-// This callback is a good place to build a full path to the external reference
-// It can be done by building a dictionary with a recursive listing of *.flt
-// under the original filename (master) directory, and here build the finalname
+// Counts the different files in the xref graph (shared ones only once)
 //////////////////////////////////////////////////////////////////////////
-int fltCallbackExtRef(flt_node_extref* extref, flt* of, void* userdata)
+int fltCountFiles(flt* of, std::set<flt*>& visited)
+{
+  int n=0;
+  if ( !of || !visited.insert(of).second ) 
+    return 0;
+  n = 1;
+  if ( of->hie )
+  {
+    for ( flt_node_extref* e=of->hie->extref_head; e; e=e->next_extref )
+      n += fltCountFiles(e->of, visited);
+  }
+  return n;
+}
+
+void fltPrintStats(flt* of, double t0)
 {
-  char* finalname = flt_extref_prepare(extref,of);
-  if ( finalname )
+  std::set<flt*> visited;
+  char tmp[256]; 
+  sprintf_s(tmp, "Time: %.4g secs", (fltGetTime()-t0)/1000.0);
+  printf( "\n%s\n",tmp);
+  if ( of->errcode != FLT_OK )
+  {
+    printf("Error: %s\n", flt_get_err_reason(of->errcode));
+    return;
+  }
+  flt_stats stats;
+  memset(&stats,0,sizeof(stats));
+  flt_stats_total(of, &stats);
+  printf("nfiles total: %d\n", fltCountFiles(of,visited));
+  printf("nfaces total : %u\n", stats.faces);
+#ifdef FLT_UNIQUE_FACES
+  printf("nfaces unique: %u\n", stats.unique_faces);
+#endif
+  printf("nindices total: %I64u\n", stats.indices);
+#ifdef FLT_UNIQUE_FACES
+  if ( of->batches )
   {
-    fltThreadPool* tp=reinterpret_cast<fltThreadPool*>(userdata);
-    fltThreadTask task(fltThreadTask::TASK_FLT, finalname, extref->of, of->ctx->opts); //  read ref in parallel
-    tp->addNewTask(task);
-    flt_safefree(finalname);
-    ++tp->nfiles;
+    float acmr[2];
+    printf("draw batches: %d (%d bits indices)\n", of->batches->batch_count, of->batches->index_size*8);
+    if ( flt_batches_optimize(of, 0, acmr, acmr+1) == FLT_OK )
+      printf("acmr: %.3f -> %.3f\n", acmr[0], acmr[1]);
   }
-  return 1;
+#endif
 }
 
 void read_with_callbacks_mt(const char* filename)
@@ -204,37 +121,20 @@ void read_with_callbacks_mt(const char* filename)
   flt_opts* opts=(flt_opts*)flt_calloc(1,sizeof(flt_opts));
   flt* of=(flt*)flt_calloc(1,sizeof(flt));
 
-  fltThreadPool tp;
-  tp.numThreads = std::thread::hardware_concurrency();
-  tp.init();
-
-  // configuring read options 
+  // configuring read options (xrefs loaded in parallel, done when all loaded)
   opts->pflags = FLT_OPT_PAL_ALL;
-  opts->hflags = FLT_OPT_HIE_ALL_NODES;
+  opts->hflags = FLT_OPT_HIE_ALL_NODES | FLT_OPT_HIE_EXTREF_RESOLVE;
+  opts->lflags = FLT_OPT_LOAD_BATCHES | FLT_OPT_LOAD_STATS | FLT_OPT_LOAD_NAMES; // one draw per face state, names once
   opts->dfaces_size = 1543;
-  opts->cb_extref = fltCallbackExtRef;
-  opts->cb_user_data = &tp;
+  opts->xref_threads = (fltu16)std::thread::hardware_concurrency();
 
-  // master file task
-  tp.nfiles=1;
-  fltThreadTask task(fltThreadTask::TASK_FLT, filename, of, opts);
-  tp.addNewTask(task);  
-
-  // wait until cores finished
-  do
+  // loading in its own thread while rendering
+  flt_async* job=flt_load_async(filename, of, opts);
+  if ( !job ) // no thread, loading here
   {
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));    
-  } while ( tp.isWorking() );
-
-  char tmp[256]; 
-  sprintf_s(tmp, "Time: %.4g secs", (fltGetTime()-t0)/1000.0);
-  printf( "\n%s\n",tmp);
-  printf("nfiles total: %d\n", (int)tp.nfiles);
-  printf("nfaces total : %d\n", TOTALNFACES);
-#ifdef FLT_UNIQUE_FACES
-  printf("nfaces unique: %d\n", TOTALUNIQUEFACES);
-#endif
-  printf("nindices total: %d\n", TOTALINDICES);
+    flt_load_from_filename(filename, of, opts);
+    fltPrintStats(of,t0);
+  }
 
   // RENDERING
   {
@@ -246,8 +146,23 @@ void read_with_callbacks_mt(const char* filename)
     vopts.debug_layer = 1;
     if ( vis_init(&v,&vopts) == VIS_OK )
     {
+      int percent=-1;
       while( vis_begin_frame(v) == VIS_OK )
       {
+        if ( job )
+        {
+          const float progress=flt_async_progress(job);
+          if ( progress >= 1.0f ) // loaded
+          {
+            flt_async_join(&job);
+            fltPrintStats(of,t0);
+          }
+          else if ( int(progress*100.0f) != percent )
+          {
+            percent = int(progress*100.0f);
+            printf("\rLoading %d%%", percent);
+          }
+        }
         vis_render_frame(v);
         vis_end_frame(v);
       }
@@ -255,11 +170,17 @@ void read_with_callbacks_mt(const char* filename)
     }
   }
 
+  // window closed while loading, not needed anymore
+  if ( job )
+  {
+    flt_async_cancel(job);
+    if ( flt_async_join(&job) != FLT_ERR_CANCELED )
+      fltPrintStats(of,t0);
+  }
+
   flt_release(of);
   flt_safefree(of);
   flt_safefree(opts);
-
-  tp.deinit();
 }
 
 int main(int argc, const char** argv)